@@ -38,6 +38,8 @@
 
 gint current_attach_ID;
 
+#define SAVE_BLOCK 65536
+
 #ifdef ATTACH_LIMIT
 #define ATT_SIZE_MAX 2057152
 static guint total_size = 0;
@@ -253,7 +255,8 @@ grg_save_attachment (gchar * path, GtkWidget * parent)
 	GRG_TMPFILE tmpf;
 	guchar *mem;
 	gint fd;
-	glong memDim;
+	glong got;
+	gint64 pos = 0;
 
 	while (tmp
 	       && ((struct grg_attachment *) tmp->data)->ID !=
@@ -267,14 +270,6 @@ grg_save_attachment (gchar * path, GtkWidget * parent)
 
 	wait = grg_wait_msg (_("saving"), parent);
 
-	if (grg_tmpfile_read (gctx, tmpf, &mem, &memDim) < 0)
-	{
-		gtk_widget_destroy (wait);
-		grg_msg (_("Cannot decode tempfile."), GTK_MESSAGE_ERROR,
-			 parent);
-		return FALSE;
-	}
-
 	fd = open (path, O_WRONLY | O_CREAT | O_EXCL,
 		   S_IRUSR | S_IRGRP | S_IROTH | S_IWUSR);
 
@@ -283,15 +278,33 @@ grg_save_attachment (gchar * path, GtkWidget * parent)
 		gtk_widget_destroy (wait);
 		grg_msg (_("Cannot create file, or file already existent."),
 			 GTK_MESSAGE_ERROR, parent);
-		GRGFREE (mem, memDim);
 		close (fd);
 		return FALSE;
 	}
 
-	write (fd, mem, memDim);
-	GRGFREE (mem, memDim);
+	/* a block at a time, never the whole attachment in memory */
+	mem = grg_malloc (SAVE_BLOCK);
+	while ((got = grg_tmpfile_pread (gctx, tmpf, mem, SAVE_BLOCK, pos)) > 0)
+	{
+		if (write (fd, mem, got) != got)
+		{
+			got = -1;
+			break;
+		}
+		pos += got;
+	}
+	GRGFREE (mem, SAVE_BLOCK);
 	close (fd);
 	gtk_widget_destroy (wait);
+
+	if (got < 0)
+	{
+		unlink (path);
+		grg_msg (_("Cannot decode tempfile."), GTK_MESSAGE_ERROR,
+			 parent);
+		return FALSE;
+	}
+
 	return TRUE;
 }
 
@@ -72,6 +72,9 @@
 /*time for the splash screen display*/
 #define GRG_SPLASH_TIMEOUT 1750	/*ms*/
 
+/*locked memory for the keys, when the whole process can't be locked*/
+#define GRG_SECURE_ARENA_DIM	(64 * 1024)
+
 /*errors in grg_safe_open*/
 #define GRG_OPEN_FILE_NOT_FOUND	-171
 #define GRG_OPEN_FILE_IRREGULAR	-172
@@ -36,7 +36,8 @@
 
 static GList *entries = NULL;
 GList *current = NULL;
-static gchar *serialized;
+static GArray *serialized;	/* the pieces of the file, as struct iovec */
+static GPtrArray *pieces;	/* the ones to free */
 static gint pos_to_restore;
 static gboolean newer_data = FALSE;
 static gchar *afname, *afcomment;
@@ -414,18 +415,54 @@ grg_entries_print (gint ennum, gchar * enpage)
 		GRGFREE (utfenpage, ulen);
 }
 
+/**
+ * add_piece:
+ * @str: a piece of the serialized data
+ * @own: TRUE if @str has to be freed once saved
+ *
+ * Appends a piece to the data to save. Used only by meta_save() and
+ * grg_entries_save()
+ */
+static void
+add_piece (gchar * str, gboolean own)
+{
+	struct iovec piece;
+
+	piece.iov_base = str;
+	piece.iov_len = strlen (str);
+	g_array_append_val (serialized, piece);
+
+	if (own)
+		g_ptr_array_add (pieces, str);
+}
+
+/**
+ * piece_free:
+ * @data: the callback's data
+ * @user_data: the callback's user-defined data
+ *
+ * Wipes and frees a piece of the serialized data. Used only by
+ * grg_entries_save()
+ */
+static void
+piece_free (gpointer data, gpointer user_data)
+{
+	GRGAFREE (data);
+}
+
 /**
  * meta_save:
  * @data: the callback's data
  * @user_data: the callback's user-defined data
  *
- * "serializes" a single node. Used only by grg_entries_save()
+ * "serializes" a single node, as a few pieces: attachments are not
+ * copied around once encoded. Used only by grg_entries_save()
  */
 static void
 meta_save (gpointer data, gpointer user_data)
 {
 	struct grg_entry *entry = (struct grg_entry *) data;
-	gchar *eBody, *eID, *res, *attachments;
+	gchar *eBody, *eID;
 	gint dim;
 	GList *attlist;
 
@@ -435,43 +472,35 @@ meta_save (gpointer data, gpointer user_data)
 	dim = strlen (entry->entryID);
 	eID = g_markup_escape_text (entry->entryID, dim);
 
+#define XML_ENTRY_FORMAT	"\n<entry>\n<title>%s</title>\n<body>%s</body>"
+	add_piece (g_strdup_printf (XML_ENTRY_FORMAT, eID, eBody), TRUE);
+
+	GRGAFREE (eBody);
+	eBody = NULL;
+	GRGAFREE (eID);
+	eID = NULL;
+
 	attlist = entry->attach;
-	attachments = g_strdup ("");
-#define XML_ATT_FORMAT	"%s\n<attachment name=\"%s\" comment=\"%s\">%s</attachment>"
+#define XML_ATT_FORMAT	"\n<attachment name=\"%s\" comment=\"%s\">"
 	while (attlist)
 	{
 		struct grg_attachment *att =
 			(struct grg_attachment *) attlist->data;
         void * void_origfile;
-		gchar *origfile, *b64file, *append;
+		gchar *origfile, *b64file;
 
 		grg_get_content (att, &void_origfile, NULL);
         origfile = (gchar*)void_origfile;
 		b64file = (gchar*)grg_encode64 ((guchar*)origfile, att->filedim, NULL);
 		GRGFREE (void_origfile, att->filedim);
-		append = g_strdup_printf (XML_ATT_FORMAT, attachments,
-					  att->filename, att->comment,
-					  b64file);
-		GRGAFREE (b64file);
-		GRGAFREE (attachments);
-		attachments = append;
+		add_piece (g_strdup_printf (XML_ATT_FORMAT, att->filename,
+					    att->comment), TRUE);
+		add_piece (b64file, TRUE);
+		add_piece ("</attachment>", FALSE);
 		attlist = attlist->next;
 	}
 
-#define XML_ENTRY_FORMAT	"%s\n<entry>\n<title>%s</title>\n<body>%s</body>%s\n</entry>"
-	res = g_strdup_printf (XML_ENTRY_FORMAT, serialized, eID, eBody,
-			       attachments);
-
-	GRGAFREE (eBody);
-	eBody = NULL;
-	GRGAFREE (eID);
-	eID = NULL;
-
-	GRGAFREE (serialized);
-	serialized = g_strdup (res);
-
-	GRGAFREE (res);
-	res = NULL;
+	add_piece ("\n</entry>", FALSE);
 }
 
 /**
@@ -494,21 +523,30 @@ grg_entries_save (gchar * file, GRG_KEY key, GtkWidget * parent)
 
 	wait = grg_wait_msg (_("assembling data"), parent);
 
-	serialized = g_strdup_printf
-		("<save_file_fmt_version>" GRG_FILE_SUBVERSION
-		 "</save_file_fmt_version>" "\n<position>%d</position>"
-		 "\n<regen_pwd_time>%ld</regen_pwd_time>", pos, pwdbirth);
+	serialized = g_array_new (FALSE, FALSE, sizeof (struct iovec));
+	pieces = g_ptr_array_new ();
+
+	add_piece (g_strdup_printf
+		   ("<save_file_fmt_version>" GRG_FILE_SUBVERSION
+		    "</save_file_fmt_version>" "\n<position>%d</position>"
+		    "\n<regen_pwd_time>%ld</regen_pwd_time>", pos, pwdbirth),
+		   TRUE);
 
 	g_list_foreach (entries, meta_save, NULL);
 
 	grg_wait_message_change_reason (wait, _("saving"));
 
-	err = grg_encrypt_file (gctx, key, (guchar*)file, (guchar*)serialized,
-				strlen (serialized));
+	/* the pieces are encrypted as they are, without joining them */
+	err = grg_encrypt_file_iov (gctx, key, file,
+				    (struct iovec *) serialized->data,
+				    serialized->len);
 
 	grg_wait_message_change_reason (wait, _("cleaning up"));
 
-	GRGAFREE (serialized);
+	g_ptr_array_foreach (pieces, piece_free, NULL);
+	g_ptr_array_free (pieces, TRUE);
+	pieces = NULL;
+	g_array_free (serialized, TRUE);
 	serialized = NULL;
 
 	gtk_widget_destroy (wait);
@@ -250,6 +250,9 @@ grg_menu_create (GtkWidget * window)
 	NEW_MENU_ITEM (babo, _("_Security monitor"), grg_security_monitor,
 		       NULL, help, GTK_STOCK_HELP, GDK_KEY_S,
 		       GDK_SHIFT_MASK | GDK_CONTROL_MASK);
+	NEW_MENU_ITEM (babo, _("_Diagnostics"), grg_diagnostics,
+		       NULL, help, GTK_STOCK_INFO, GDK_KEY_G,
+		       GDK_SHIFT_MASK | GDK_CONTROL_MASK);
 	NEW_MENU_SEPARATOR (help);
 	NEW_MENU_ITEM (babo, "_README", readme, NULL, help, GTK_STOCK_HELP,
 		       GDK_KEY_R, GDK_SHIFT_MASK | GDK_CONTROL_MASK);
@@ -244,7 +244,10 @@ grg_parse_argv (gint argc, gchar * argv[], gchar ** filename,
 	poptFreeContext (optCon);
 
 	if (strongRnd)
+	{
 		grg_ctx_set_security_lvl (gctx, GRG_SEC_PARANOIA);
+		grg_ctx_set_wipe_mode (gctx, GRG_WIPE_RANDOM);
+	}
 
 /*quite cerebrotic, I know. The idea is: to ensure that stdin isn't exploitable,
   the best way is to close and reopen it, so that any "abnormal" setting is
@@ -58,7 +58,8 @@ static gboolean active_flag = FALSE;
 /*radio buttons & other things to update */
 static GtkWidget *rij1_but, *ser_but, *twof_but, *cast_but, *safer_but;
 static GtkWidget *rij2_but, *tdes_but, *loki_but, *sha_but, *ripe_but;
-static GtkWidget *zlib_but, *bz_but, *r0_but, *r3_but, *r6_but, *r9_but;
+static GtkWidget *zlib_but, *bz_but, *zstd_but, *lz4_but;
+static GtkWidget *r0_but, *r3_but, *r6_but, *r9_but;
 static GtkWidget *crypto_key_lbl, *crypto_block_lbl;
 static GtkWidget *bak_check, *over_check, *splash_check, *tray_check, *xpire_check;
 static GtkWidget *xpire_spin, *passes_spin, *but_font;
@@ -524,6 +525,19 @@ grg_pref_dialog (GtkWidget * parent)
 			  gtk_radio_button_get_group (GTK_RADIO_BUTTON
 						      (zlib_but)),
 			  modify_comp, GRG_BZIP, "BZip2", comp_box);
+	NEW_RADIO_BUTTON (zstd_but,
+			  gtk_radio_button_get_group (GTK_RADIO_BUTTON
+						      (zlib_but)),
+			  modify_comp, GRG_ZSTD, "Zstd", comp_box);
+	NEW_RADIO_BUTTON (lz4_but,
+			  gtk_radio_button_get_group (GTK_RADIO_BUTTON
+						      (zlib_but)),
+			  modify_comp, GRG_LZ4, "LZ4", comp_box);
+
+	/*libgringotts may be built without them */
+	gtk_widget_set_sensitive (zstd_but,
+				  grg_comp_algo_supported (GRG_ZSTD));
+	gtk_widget_set_sensitive (lz4_but, grg_comp_algo_supported (GRG_LZ4));
 
 	NEW_ROW_SEPARATOR (comp_box);
 
@@ -803,6 +817,14 @@ update_buttons (void)
 		gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (bz_but),
 					      TRUE);
 		break;
+	case GRG_ZSTD:
+		gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (zstd_but),
+					      TRUE);
+		break;
+	case GRG_LZ4:
+		gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (lz4_but),
+					      TRUE);
+		break;
 	default:
 		gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (zlib_but),
 					      TRUE);
@@ -36,6 +36,7 @@
 #include "grg_safe.h"
 
 #define PREFS_TAG_ALGO						"algo_code"
+#define PREFS_TAG_COMP_ALGO					"comp_algo"
 #define PREFS_TAG_STARTUP_FILE				"startup_file"
 #define PREFS_TAG_OVERWRITE_WARN			"overwrite_warn"
 #define PREFS_TAG_BACKUP_FILES				"bak_files"
@@ -48,6 +49,23 @@
 #define PREFS_TAG_MAINWIN_WIDTH 			"Width_of_main_window"
 #define PREFS_TAG_MAINWIN_HEIGHT 			"Height_of_main_window"
 
+/*the compression algorithms, by their name in the preferences file */
+static const grg_comp_algo comp_algos[] =
+	{ GRG_ZLIB, GRG_BZIP, GRG_ZSTD, GRG_LZ4 };
+static const gchar *comp_names[] = { "zlib", "bzip2", "zstd", "lz4" };
+
+static gint
+comp_index (grg_comp_algo algo)
+{
+	gint i;
+
+	for (i = 0; i < G_N_ELEMENTS (comp_algos); i++)
+		if (comp_algos[i] == algo)
+			return i;
+
+	return 0;
+}
+
 gint
 grg_save_prefs (void)
 {
@@ -66,9 +84,10 @@ grg_save_prefs (void)
 		return GRG_PREFS_IO_ERROR;
 	}
 
+	/*zstd and lz4 don't fit in it: they're saved on their own below */
 	algo = (guchar) (grg_ctx_get_crypt_algo (gctx) |
 			 grg_ctx_get_hash_algo (gctx) |
-			 grg_ctx_get_comp_algo (gctx) |
+			 (grg_ctx_get_comp_algo (gctx) & GRG_COMP_TYPE_MASK) |
 			 grg_ctx_get_comp_ratio (gctx));
 
 	/*saves the algorithm */
@@ -82,6 +101,16 @@ grg_save_prefs (void)
 	write (fd, row, strlen (row));
 	g_free (row);
 
+	/*saves the compression algorithm */
+	row = g_strdup_printf
+		("<!-- zlib, bzip2, zstd or lz4 -->\n"
+		 "<" PREFS_TAG_COMP_ALGO ">\n"
+		 "%s\n"
+		 "</" PREFS_TAG_COMP_ALGO ">\n\n",
+		 comp_names[comp_index (grg_ctx_get_comp_algo (gctx))]);
+	write (fd, row, strlen (row));
+	g_free (row);
+
 	/*saves the startup file */
 	grg_pref_file_local = get_pref_file ();
 	if (grg_pref_file_local)
@@ -273,18 +302,28 @@ collect_pref (GMarkupParseContext * context,
 			algo |= (guchar) ((algo1 << 4) & 0xf0);
 			algo |= (guchar) (algo2 & 0x0f);
 
-			grg_ctx_set_crypt_algo (gctx, (grg_crypt_algo) (algo & 0x70	/* 01110000 */
-						));
-			grg_ctx_set_hash_algo (gctx,
-				    	   (grg_hash_algo) (algo & 0x08
-								/* 00001000 */ ));
-			grg_ctx_set_comp_algo (gctx,
-				    	   (grg_comp_algo) (algo & 0x04
-								/* 00000100 */ ));
-			grg_ctx_set_comp_ratio (gctx, (grg_comp_ratio) (algo & 0x03	/* 00000011 */
-						));
+			grg_ctx_set_crypt_algo (gctx, (grg_crypt_algo)
+						(algo & GRG_ENCRYPT_MASK));
+			grg_ctx_set_hash_algo (gctx, (grg_hash_algo)
+					       (algo & GRG_HASH_MASK));
+			grg_ctx_set_comp_algo (gctx, (grg_comp_algo)
+					       (algo & GRG_COMP_TYPE_MASK));
+			grg_ctx_set_comp_ratio (gctx, (grg_comp_ratio)
+						(algo & GRG_COMP_LVL_MASK));
 		}
 	} else
+	if (strcmp(*(gchar **) user_data, PREFS_TAG_COMP_ALGO)==0)
+	{
+		/*after PREFS_TAG_ALGO, that holds just zlib or bzip2 */
+		gchar *name = g_strstrip (g_strndup (text, text_len));
+		gint i;
+
+		for (i = 0; i < G_N_ELEMENTS (comp_algos); i++)
+			if (!strcmp (name, comp_names[i]) &&
+			    grg_comp_algo_supported (comp_algos[i]))
+				grg_ctx_set_comp_algo (gctx, comp_algos[i]);
+		g_free (name);
+	} else
 	if (strcmp(*(gchar **) user_data, PREFS_TAG_STARTUP_FILE)==0)
 	{
 		if (text_len == 0)
@@ -56,6 +56,7 @@
 #define GRG_UNSAFE			2
 
 static gboolean mem_safe = FALSE,
+                keys_safe = FALSE,
                 ptrace_safe = FALSE;
 static gint     safety_level = GRG_SAFE;
 
@@ -103,11 +104,16 @@ grg_mlockall_and_drop_root_privileges(void)
     setfsgid(getgid());
 #endif
 
+    /* the keys go in memory of their own, locked even if the rest of */
+    /* the process can't be; as root, it's not bound to RLIMIT_MEMLOCK */
+    keys_safe = (grg_secure_arena_init (GRG_SECURE_ARENA_DIM) == GRG_OK);
+
     if (!geteuid())
 	/* the process is (ev. SUID) root. I can mlockall() the memory in */
 	/* order to avoid swapping. */
     {
 #ifdef HAVE_MLOCKALL
+	gboolean low_limit = FALSE;
 #ifdef linux
         if (grg_kver_ge(2, 6, 9)) {
             /* since Linux 2.6.9, the memlock amount of unprivileged processes */
@@ -124,7 +130,8 @@ grg_mlockall_and_drop_root_privileges(void)
                            strerror(errno));
                 return FALSE;
             }
-            if (rl.rlim_cur < minbytes) {
+            low_limit = (rl.rlim_cur < minbytes);
+            if (low_limit && !keys_safe) {
                 g_critical(_("Increase the memory locking limit to at least "
                              "%d bytes. Current limit: %d bytes.\n"
                              "See /usr/share/doc/gringotts/README for \n"
@@ -135,9 +142,13 @@ grg_mlockall_and_drop_root_privileges(void)
             }
         }
 #endif
-	gint res = mlockall(MCL_CURRENT | MCL_FUTURE);
+	/* with a low limit, only the keys are locked */
+	gint res = low_limit ? -1 : mlockall(MCL_CURRENT | MCL_FUTURE);
 
-	if (res) {
+	if (res && keys_safe) {
+	    g_warning("%s",
+		      _("Cannot lock all the memory; only the keys are locked"));
+	} else if (res) {
 	    g_critical("%s",
 		       _
 		       ("The process is setuid root, but I can't lock memory paging"));
@@ -449,6 +460,13 @@ grg_security_monitor(void)
     }
     g_free(rl);
 
+    if (keys_safe) {
+	ADD_INDICATOR(gtk_dialog_get_content_area(GTK_DIALOG(dialog)),
+		      _("Keys locked in memory"), green);
+    } else {
+	ADD_INDICATOR(gtk_dialog_get_content_area(GTK_DIALOG(dialog)),
+		      _("Keys locked in memory"), yellow);
+    }
 #ifdef HAVE_MLOCKALL
     /* the pwd isn't stored in cleartext anyway */
     if (mem_safe) {
@@ -495,6 +513,79 @@ grg_security_monitor(void)
     gtk_widget_destroy(dialog);
 }
 
+/*
+ * Adds a row to the diagnostics table, freeing the value
+ */
+static void
+add_stat(GtkWidget * table, gint row, const gchar * text, gchar * value)
+{
+    GtkWidget      *lbl;
+
+    lbl = gtk_label_new(text);
+    gtk_misc_set_alignment(GTK_MISC(lbl), 0, 0.5);
+    gtk_table_attach_defaults(GTK_TABLE(table), lbl, 0, 1, row, row + 1);
+
+    lbl = gtk_label_new(value);
+    gtk_misc_set_alignment(GTK_MISC(lbl), 1, 0.5);
+    gtk_table_attach_defaults(GTK_TABLE(table), lbl, 1, 2, row, row + 1);
+
+    g_free(value);
+}
+
+#define STAT_BYTES(n)	g_format_size((guint64) (n))
+#define STAT_COUNT(n)	g_strdup_printf("%lld", (n))
+
+/*
+ * Shows what libgringotts has done so far in this session
+ */
+void
+grg_diagnostics(void)
+{
+    GtkWidget      *dialog =
+	gtk_dialog_new_with_buttons(_("Diagnostics"),
+				    NULL,
+				    GTK_DIALOG_MODAL |
+				    GTK_DIALOG_DESTROY_WITH_PARENT,
+				    GTK_STOCK_OK,
+				    GTK_RESPONSE_OK,
+				    NULL);
+    GtkWidget      *table = gtk_table_new(11, 2, FALSE);
+    struct grg_stats stats;
+
+    if (grg_get_stats(gctx, &stats) != GRG_OK)
+	memset(&stats, 0, sizeof(struct grg_stats));
+
+    gtk_table_set_row_spacings(GTK_TABLE(table), GRG_PAD);
+    gtk_table_set_col_spacings(GTK_TABLE(table), 4 * GRG_PAD);
+    gtk_container_set_border_width(GTK_CONTAINER(table), GRG_PAD);
+
+    add_stat(table, 0, _("Data compressed"),
+	     STAT_BYTES(stats.bytes_compressed));
+    add_stat(table, 1, _("Data uncompressed"),
+	     STAT_BYTES(stats.bytes_uncompressed));
+    add_stat(table, 2, _("Data encrypted"),
+	     STAT_BYTES(stats.bytes_encrypted));
+    add_stat(table, 3, _("Data decrypted"),
+	     STAT_BYTES(stats.bytes_decrypted));
+    add_stat(table, 4, _("Data checksummed"), STAT_BYTES(stats.bytes_crc));
+    add_stat(table, 5, _("Random data drawn"),
+	     STAT_BYTES(stats.bytes_random));
+    add_stat(table, 6, _("Memory wiped"), STAT_BYTES(stats.bytes_wiped));
+    add_stat(table, 7, _("Buffers allocated"), STAT_COUNT(stats.allocs));
+    add_stat(table, 8, _("Memory allocated"),
+	     STAT_BYTES(stats.alloc_bytes));
+    add_stat(table, 9, _("Largest buffer"), STAT_BYTES(stats.alloc_max));
+    add_stat(table, 10, _("System calls"), STAT_COUNT(stats.syscalls));
+
+    gtk_box_pack_start(GTK_BOX
+		       (gtk_dialog_get_content_area(GTK_DIALOG(dialog))),
+		       table, FALSE, FALSE, GRG_PAD);
+
+    gtk_widget_show_all(dialog);
+    gtk_dialog_run(GTK_DIALOG(dialog));
+    gtk_widget_destroy(dialog);
+}
+
 /*
  * Opens a file, only if it is regular and existent
  */
@@ -26,6 +26,7 @@ gboolean grg_mlockall_and_drop_root_privileges (void);
 gboolean grg_security_filter (gboolean rootCheck);
 
 void grg_security_monitor (void);
+void grg_diagnostics (void);
 
 GtkWidget *grg_get_security_button (void);
 gchar *grg_get_security_text (gchar * pattern);
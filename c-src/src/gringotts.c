@@ -1436,12 +1436,35 @@ save_attached_file (void)
 	GRGAFREE (selection);
 }
 
+static gboolean wipe_cancelled;
+
+static void
+wipe_cancel (GtkDialog * dlg GCC_UNUSED, gint response GCC_UNUSED,
+	     gpointer data GCC_UNUSED)
+{
+	wipe_cancelled = TRUE;
+}
+
+/* called by grg_files_shred (), from this thread, to show how it goes */
+static gint
+wipe_progress (void *bar, const long long done, const long long total)
+{
+	gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (bar),
+				       total ? (gdouble) done / total : 1.0);
+
+	while (gtk_events_pending ())
+		gtk_main_iteration ();
+
+	return wipe_cancelled;
+}
+
 void
 wipe_file (void)
 {
-    GtkWidget *file_chooser, *wait;
-	gint response;
-    gchar *selection = NULL;
+    GtkWidget *file_chooser, *dlg, *bar;
+	gint response, n;
+    GSList *selection = NULL, *cur;
+	const gchar **paths;
 
     file_chooser = gtk_file_chooser_dialog_new (_("File to wipe"),
             GTK_WINDOW(win1),
@@ -1449,28 +1472,32 @@ wipe_file (void)
             "_Cancel", GTK_RESPONSE_CANCEL,
             "_Open", GTK_RESPONSE_ACCEPT,
             NULL);
+	gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (file_chooser),
+					      TRUE);
 
 	response = gtk_dialog_run (GTK_DIALOG (file_chooser));
     if (response == GTK_RESPONSE_ACCEPT)
     {
-		selection = gtk_file_chooser_get_filename (
+		selection = gtk_file_chooser_get_filenames (
                 GTK_FILE_CHOOSER (file_chooser)
                 );
     }
 
     gtk_widget_destroy (file_chooser);
 
-	if (response != GTK_RESPONSE_ACCEPT)
+	if (response != GTK_RESPONSE_ACCEPT || !selection)
     {
 		return;
     }
 
-	if (!g_file_test (selection, G_FILE_TEST_IS_REGULAR))
-	{
-		g_free (selection);
-		grg_msg (_("The file does not exist"), GTK_MESSAGE_ERROR,
-			 win1);
-	}
+	for (cur = selection; cur; cur = cur->next)
+		if (!g_file_test (cur->data, G_FILE_TEST_IS_REGULAR))
+		{
+			g_slist_free_full (selection, g_free);
+			grg_msg (_("The file does not exist"), GTK_MESSAGE_ERROR,
+				 win1);
+			return;
+		}
 
 	if (grg_ask_dialog
 	    (_("Confirm..."),
@@ -1478,19 +1505,40 @@ wipe_file (void)
 	       "Its content will be securely erased, so no\n"
 	       "recover is possible."), FALSE, win1) != GRG_YES)
 	{
-		g_free (selection);
+		g_slist_free_full (selection, g_free);
 		return;
 	}
 
-	wait = grg_wait_msg (_("wiping file"), win1);
-
-	response = grg_file_shred (selection, grg_prefs_wipe_passes);
-
-	gtk_widget_destroy (wait);
-
-	g_free (selection);
-
-	if (response < 0)
+	n = g_slist_length (selection);
+	paths = g_new (const gchar *, n);
+	for (cur = selection, n = 0; cur; cur = cur->next)
+		paths[n++] = cur->data;
+
+	dlg = gtk_dialog_new_with_buttons (_("Please wait"), GTK_WINDOW (win1),
+					   GTK_DIALOG_MODAL |
+					   GTK_DIALOG_DESTROY_WITH_PARENT,
+					   "_Cancel", GTK_RESPONSE_CANCEL, NULL);
+	gtk_container_set_border_width (GTK_CONTAINER (dlg), GRG_PAD);
+	bar = gtk_progress_bar_new ();
+	gtk_progress_bar_set_text (GTK_PROGRESS_BAR (bar), _("wiping file"));
+	gtk_progress_bar_set_show_text (GTK_PROGRESS_BAR (bar), TRUE);
+	gtk_box_pack_start (GTK_BOX
+			    (gtk_dialog_get_content_area (GTK_DIALOG (dlg))),
+			    bar, FALSE, FALSE, GRG_PAD);
+	g_signal_connect (dlg, "response", G_CALLBACK (wipe_cancel), NULL);
+	gtk_widget_show_all (dlg);
+
+	/* the files are wiped all at once */
+	wipe_cancelled = FALSE;
+	response = grg_files_shred (gctx, paths, n, grg_prefs_wipe_passes,
+				    wipe_progress, bar, NULL);
+
+	gtk_widget_destroy (dlg);
+
+	g_free (paths);
+	g_slist_free_full (selection, g_free);
+
+	if (response < 0 && response != GRG_SHRED_CANCELLED)
 		grg_msg (_("File wiping failed"), GTK_MESSAGE_ERROR, win1);
 }
 
@@ -1920,6 +1968,8 @@ main (gint argc, gchar ** argv)
 		exit (1);
 
 	gctx = grg_context_initialize_defaults ("GRG");
+	/*wipe at memory speed, instead of asking the kernel for randomness */
+	grg_ctx_set_wipe_mode (gctx, GRG_WIPE_PATTERN);
 
 	/*parse cmdline args */
 	grg_parse_argv (argc, argv, &file2loadInArgv, &root);
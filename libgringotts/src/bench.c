@@ -0,0 +1,777 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  bench.c - throughput benchmark for libGringotts
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// grg_bench: the speed of the single components first (cipher backends,
+// CRC32, base64), then some sweeps of the whole encryption and decryption:
+// of the data size, on the three paths (memory, file name, descriptor), and
+// of each cipher, hash and compression algorithm and level. Each case is
+// repeated, and reported with its throughput (on the median time), the
+// percentiles of the time of an operation, the peak RSS of the process and
+// the allocations per operation; as a table, and as JSON if asked. When
+// built by "make bench", malloc () and co. are wrapped to count them.
+//
+// Usage: grg_bench [--max SIZE] [--reps N] [--json FILE] [--no-components]
+// where SIZE (up to 1G) can end with K, M or G, and FILE can be "-".
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "libgringotts.h"
+#include "libgrg_cipher.h"
+#include "libgrg_crc.h"
+
+#include <mhash.h>
+
+#define BENCH_DIM	(4 * 1024 * 1024)	//4 Mb, for the single components
+
+#define SWEEP_MIN	1024L	//the sizes go by 4 times, from 1 Kb...
+#define SWEEP_MAX	(1024L * 1024 * 1024)	//...up to 1 Gb at most
+#define SWEEP_DEF_MAX	(64L * 1024 * 1024)	//by default
+#define SWEEP_DIM	(1024L * 1024)	//for the sweeps of the algorithms
+
+#define CASE_BYTES	(16L * 1024 * 1024)	//processed by a case, at least...
+#define CASE_REPS_MIN	3
+#define CASE_REPS_MAX	1000	//...within these repetitions
+
+static const char *backends[] = { "libmcrypt", "AES-NI", "VAES" };
+
+static const grg_crypt_algo cryptos[] = { GRG_RIJNDAEL_128, GRG_SERPENT,
+	GRG_TWOFISH, GRG_CAST_256, GRG_SAFERPLUS, GRG_LOKI97, GRG_3DES,
+	GRG_RIJNDAEL_256
+};
+static const char *crypt_names[] = { "RIJNDAEL_128", "SERPENT", "TWOFISH",
+	"CAST_256", "SAFERPLUS", "LOKI97", "3DES", "RIJNDAEL_256"
+};
+
+static const grg_hash_algo hashes[] = { GRG_SHA1, GRG_RIPEMD_160 };
+static const char *hash_names[] = { "SHA1", "RIPEMD_160" };
+
+static const grg_comp_algo comps[] = { GRG_ZLIB, GRG_BZIP, GRG_ZSTD, GRG_LZ4 };
+static const char *comp_names[] = { "ZLib", "BZip2", "zstd", "lz4" };
+static const char *ratio_names[] = { "none", "fast", "good", "best" };
+
+//the three ways of getting the data to and from a file
+typedef enum
+{
+	PATH_MEM,
+	PATH_FILE,
+	PATH_FD
+}
+bench_path;
+
+static const char *path_names[] = { "mem", "file", "fd" };
+
+//a line of the report
+typedef struct
+{
+	const char *sweep;
+	char label[32];
+	const char *path;
+	const char *op;
+	long dim;
+	int reps;
+	double mbs;
+	double p50, p90, p99;	//in microseconds
+	long rss_kb;
+	double allocs;		//per operation, -1 if not counted
+	double ratio;		//of the encrypted size to the plain one
+	int ok;
+}
+RESULT;
+
+static RESULT *results = NULL;
+static int nresults = 0;
+
+static char tmp_path[] = "/tmp/grg_bench-XXXXXX";
+static int fixed_reps = 0;
+
+#ifdef GRG_BENCH_WRAP
+static long allocs = 0;
+
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t nmemb, size_t size);
+void *__real_realloc (void *ptr, size_t size);
+
+void *
+__wrap_malloc (size_t size)
+{
+	__atomic_add_fetch (&allocs, 1, __ATOMIC_RELAXED);
+	return __real_malloc (size);
+}
+
+void *
+__wrap_calloc (size_t nmemb, size_t size)
+{
+	__atomic_add_fetch (&allocs, 1, __ATOMIC_RELAXED);
+	return __real_calloc (nmemb, size);
+}
+
+void *
+__wrap_realloc (void *ptr, size_t size)
+{
+	__atomic_add_fetch (&allocs, 1, __ATOMIC_RELAXED);
+	return __real_realloc (ptr, size);
+}
+
+#define ALLOCS()	__atomic_load_n (&allocs, __ATOMIC_RELAXED)
+#else
+#define ALLOCS()	-1L
+#endif
+
+static double
+now (void)
+{
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double
+mb_per_sec (const long dim, const double secs)
+{
+	return secs > 0 ? dim / secs / (1024 * 1024) : 0;
+}
+
+//forgets the peak RSS so far, where the kernel allows it
+static void
+rss_reset (void)
+{
+	FILE *f = fopen ("/proc/self/clear_refs", "w");
+
+	if (f)
+	{
+		fputs ("5", f);
+		fclose (f);
+	}
+}
+
+static long
+rss_peak_kb (void)
+{
+	struct rusage ru;
+	char line[128];
+	long kb = -1;
+	FILE *f = fopen ("/proc/self/status", "r");
+
+	if (f)
+	{
+		while (fgets (line, sizeof (line), f))
+			if (sscanf (line, "VmHWM: %ld", &kb) == 1)
+				break;
+		fclose (f);
+	}
+
+	if (kb < 0 && !getrusage (RUSAGE_SELF, &ru))
+		kb = ru.ru_maxrss;
+
+	return kb;
+}
+
+static const char *
+human (const long dim, char *buf)
+{
+	if (dim >= 1024L * 1024 * 1024)
+		sprintf (buf, "%ld Gb", dim >> 30);
+	else if (dim >= 1024 * 1024)
+		sprintf (buf, "%ld Mb", dim >> 20);
+	else
+		sprintf (buf, "%ld Kb", dim >> 10);
+	return buf;
+}
+
+//encryption and decryption speed of each backend of GRG_RIJNDAEL_128
+static void
+bench_ciphers (GRG_CTX gctx)
+{
+	unsigned char *key, *IV, *plain, *buf;
+	GRG_CIPHER c;
+	double t, enc, dec;
+	int b;
+
+	key = grg_rnd_seq (gctx, 32);
+	IV = grg_rnd_seq (gctx, 16);
+	plain = grg_rnd_seq (gctx, BENCH_DIM);
+	buf = (unsigned char *) malloc (BENCH_DIM);
+
+	printf ("GRG_RIJNDAEL_128, CFB mode, %d Mb:\n", BENCH_DIM >> 20);
+	printf ("  %-10s %12s %12s\n", "backend", "enc (Mb/s)", "dec (Mb/s)");
+
+	for (b = GRG_CIPHER_MCRYPT; b <= GRG_CIPHER_VAES; b++)
+	{
+		c = grg_cipher_open_backend (b, GRG_RIJNDAEL_128, key, 32, IV);
+		if (!c)
+		{
+			printf ("  %-10s %12s %12s\n", backends[b], "n/a", "n/a");
+			continue;
+		}
+
+		memcpy (buf, plain, BENCH_DIM);
+		t = now ();
+		grg_cipher_encrypt (c, buf, BENCH_DIM);
+		enc = mb_per_sec (BENCH_DIM, now () - t);
+		grg_cipher_close (c);
+
+		c = grg_cipher_open_backend (b, GRG_RIJNDAEL_128, key, 32, IV);
+		t = now ();
+		grg_cipher_decrypt (c, buf, BENCH_DIM);
+		dec = mb_per_sec (BENCH_DIM, now () - t);
+		grg_cipher_close (c);
+
+		printf ("  %-10s %12.1f %12.1f%s\n", backends[b], enc, dec,
+			memcmp (buf, plain, BENCH_DIM) ? "  MISMATCH" : "");
+	}
+
+	free (key);
+	free (IV);
+	free (plain);
+	free (buf);
+}
+
+//the built-in CRC32, against the one of libmhash it replaces
+static void
+bench_crc (GRG_CTX gctx)
+{
+	unsigned char *data, CRC[4];
+	double t, own, lib;
+	MHASH td;
+
+	data = grg_rnd_seq (gctx, BENCH_DIM);
+
+	t = now ();
+	grg_crc32 (data, BENCH_DIM, CRC);
+	own = mb_per_sec (BENCH_DIM, now () - t);
+
+	t = now ();
+	td = mhash_init (MHASH_CRC32);
+	mhash (td, data, BENCH_DIM);
+	free (mhash_end (td));
+	lib = mb_per_sec (BENCH_DIM, now () - t);
+
+	printf ("CRC32, %d Mb:\n", BENCH_DIM >> 20);
+	printf ("  %-10s %12.1f Mb/s\n", "built-in", own);
+	printf ("  %-10s %12.1f Mb/s\n", "libmhash", lib);
+
+	free (data);
+}
+
+//base64 encoding and decoding, the way attachments are saved
+static void
+bench_b64 (GRG_CTX gctx)
+{
+	unsigned char *data, *enc, *dec;
+	unsigned int encDim, decDim;
+	double t, e, d;
+
+	data = grg_rnd_seq (gctx, BENCH_DIM);
+
+	t = now ();
+	enc = grg_encode64 (data, BENCH_DIM, &encDim);
+	e = mb_per_sec (BENCH_DIM, now () - t);
+
+	t = now ();
+	dec = grg_decode64 (enc, encDim - 1, &decDim);	//no '\0'
+	d = mb_per_sec (BENCH_DIM, now () - t);
+
+	printf ("Base64, %d Mb:\n", BENCH_DIM >> 20);
+	printf ("  %-10s %12.1f Mb/s\n", "encode", e);
+	printf ("  %-10s %12.1f Mb/s%s\n", "decode", d,
+		(!dec || decDim != BENCH_DIM ||
+		 memcmp (dec, data, BENCH_DIM)) ? "  MISMATCH" : "");
+
+	free (data);
+	free (enc);
+	free (dec);
+}
+
+//some text-like data, made of random words
+static unsigned char *
+bench_text (GRG_CTX gctx, const long dim)
+{
+	static const char *words[] = { "the ", "password ", "of ", "entry ",
+		"gringotts ", "a ", "secret ", "notes\n", "to ", "vault ",
+		"and ", "2002 ", "key ", "is ", "in ", "file "
+	};
+	unsigned char *text, *rnd;
+	long pos, i, len;
+
+	text = (unsigned char *) malloc (dim);
+	rnd = grg_rnd_seq (gctx, dim / 2 + 1);
+	if (!text || !rnd)
+	{
+		free (text);
+		free (rnd);
+		return NULL;
+	}
+
+	for (pos = 0, i = 0; pos < dim; i++)
+	{
+		len = strlen (words[rnd[i] & 0x0f]);
+		if (len > dim - pos)
+			len = dim - pos;
+		memcpy (text + pos, words[rnd[i] & 0x0f], len);
+		pos += len;
+	}
+
+	free (rnd);
+	return text;
+}
+
+static int
+cmp_double (const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+//the time under which a fraction @q of the (sorted) repetitions stays
+static double
+percentile (const double *times, const int n, const double q)
+{
+	int i = (int) (q * n + 0.999999) - 1;
+
+	if (i < 0)
+		i = 0;
+	if (i >= n)
+		i = n - 1;
+	return times[i] * 1000000.0;
+}
+
+static void
+report (RESULT * r)
+{
+	char dim[16];
+
+	printf ("  %-5s %-14s %-4s %-3s %7s %5d %9.1f %10.0f %10.0f %10.0f "
+		"%8ld %8.1f%s\n", r->sweep, r->label, r->path, r->op,
+		human (r->dim, dim), r->reps, r->mbs, r->p50, r->p90, r->p99,
+		r->rss_kb, r->allocs, r->ok ? "" : "  MISMATCH");
+	fflush (stdout);
+}
+
+static void
+add_result (const char *sweep, const char *label, const bench_path path,
+	    const char *op, const long dim, double *times, const int reps,
+	    const long rss_kb, const long allocs, const double ratio,
+	    const int ok)
+{
+	RESULT *r;
+
+	results = (RESULT *) realloc (results, (nresults + 1) * sizeof (RESULT));
+	if (!results)
+		exit (1);
+	r = &results[nresults++];
+
+	qsort (times, reps, sizeof (double), cmp_double);
+
+	r->sweep = sweep;
+	snprintf (r->label, sizeof (r->label), "%s", label);
+	r->path = path_names[path];
+	r->op = op;
+	r->dim = dim;
+	r->reps = reps;
+	r->p50 = percentile (times, reps, 0.50);
+	r->p90 = percentile (times, reps, 0.90);
+	r->p99 = percentile (times, reps, 0.99);
+	r->mbs = mb_per_sec (dim, r->p50 / 1000000.0);
+	r->rss_kb = rss_kb;
+	r->allocs = (allocs < 0) ? -1 : (double) allocs / reps;
+	r->ratio = ratio;
+	r->ok = ok;
+
+	report (r);
+}
+
+/**
+ * run_case:
+ * @gctx: the context, set as the case needs
+ * @key: the key
+ * @sweep: the name of the sweep
+ * @label: what the case is, in the sweep
+ * @path: where the encrypted data go
+ * @data: the plain data
+ * @dim: their length
+ *
+ * Encrypts and decrypts @data again and again, and reports both.
+ */
+static void
+run_case (GRG_CTX gctx, GRG_KEY key, const char *sweep, const char *label,
+	  const bench_path path, const unsigned char *data, const long dim)
+{
+	double *times, t;
+	void *mem = NULL;
+	unsigned char *back = NULL;
+	long memDim = 0, backDim = 0, before, rss;
+	int reps, i, fd = -1, err = GRG_OK;
+
+	reps = fixed_reps ? fixed_reps : (int) (CASE_BYTES / dim);
+	if (!fixed_reps && reps < CASE_REPS_MIN)
+		reps = CASE_REPS_MIN;
+	if (!fixed_reps && reps > CASE_REPS_MAX)
+		reps = CASE_REPS_MAX;
+
+	times = (double *) malloc (reps * sizeof (double));
+	if (!times)
+		return;
+
+	if (path == PATH_FD)
+		fd = open (tmp_path, O_RDWR | O_TRUNC);
+
+	rss_reset ();
+	before = ALLOCS ();
+	for (i = 0; i < reps && err == GRG_OK; i++)
+	{
+		if (path == PATH_MEM)
+		{
+			free (mem);
+			mem = NULL;
+		}
+		else if (path == PATH_FD)
+		{
+			if (ftruncate (fd, 0) || lseek (fd, 0, SEEK_SET))
+				err = GRG_WRITE_FILE_ERR;
+		}
+
+		t = now ();
+		if (path == PATH_MEM)
+			err = grg_encrypt_mem (gctx, key, &mem, &memDim, data, dim);
+		else if (path == PATH_FILE)
+			err = grg_encrypt_file (gctx, key, tmp_path, data, dim);
+		else if (err == GRG_OK)
+			err = grg_encrypt_file_direct (gctx, key, fd, data, dim);
+		times[i] = now () - t;
+	}
+	rss = rss_peak_kb ();
+
+	if (err < 0)
+	{
+		printf ("  %-5s %-14s %-4s failed (%d)\n", sweep, label,
+			path_names[path], err);
+		free (mem);
+		free (times);
+		if (fd >= 0)
+			close (fd);
+		return;
+	}
+
+	if (path != PATH_MEM)
+	{
+		struct stat st;
+
+		memDim = stat (tmp_path, &st) ? 0 : st.st_size;
+	}
+
+	add_result (sweep, label, path, "enc", dim, times, reps, rss,
+		    (before < 0) ? -1 : ALLOCS () - before,
+		    (double) memDim / dim, 1);
+
+	rss_reset ();
+	before = ALLOCS ();
+	for (i = 0; i < reps && err == GRG_OK; i++)
+	{
+		free (back);
+		back = NULL;
+
+		if (path == PATH_FD && lseek (fd, 0, SEEK_SET))
+			err = GRG_READ_FILE_ERR;
+
+		t = now ();
+		if (path == PATH_MEM)
+			err = grg_decrypt_mem (gctx, key, mem, memDim, &back,
+					       &backDim);
+		else if (path == PATH_FILE)
+			err = grg_decrypt_file (gctx, key, tmp_path, &back,
+						&backDim);
+		else if (err == GRG_OK)
+			err = grg_decrypt_file_direct (gctx, key, fd, &back,
+						       &backDim);
+		times[i] = now () - t;
+	}
+	rss = rss_peak_kb ();
+
+	if (err < 0)
+		printf ("  %-5s %-14s %-4s failed (%d)\n", sweep, label,
+			path_names[path], err);
+	else
+		add_result (sweep, label, path, "dec", dim, times, reps, rss,
+			    (before < 0) ? -1 : ALLOCS () - before,
+			    (double) memDim / dim, backDim == dim &&
+			    !memcmp (back, data, dim));
+
+	free (mem);
+	free (back);
+	free (times);
+	if (fd >= 0)
+		close (fd);
+}
+
+static void
+table_head (const char *title)
+{
+	printf ("%s:\n", title);
+	printf ("  %-5s %-14s %-4s %-3s %7s %5s %9s %10s %10s %10s %8s %8s\n",
+		"sweep", "case", "path", "op", "size", "reps", "Mb/s",
+		"p50 (us)", "p90 (us)", "p99 (us)", "RSS (Kb)", "allocs");
+}
+
+//the default algorithms, on growing sizes and on each path
+static void
+sweep_sizes (const long max)
+{
+	GRG_CTX gctx = grg_context_initialize_defaults ("BNC");
+	GRG_KEY key = grg_key_gen ("bench", -1);
+	unsigned char *text;
+	char label[16];
+	long dim;
+	int p;
+
+	text = bench_text (gctx, max);
+	if (!text)
+	{
+		printf ("Not enough memory for %s\n", human (max, label));
+		grg_key_free (gctx, key);
+		grg_context_free (gctx);
+		return;
+	}
+
+	for (dim = SWEEP_MIN; dim <= max; dim *= 4)
+		for (p = PATH_MEM; p <= PATH_FD; p++)
+			run_case (gctx, key, "size", human (dim, label), p, text,
+				  dim);
+
+	free (text);
+	grg_key_free (gctx, key);
+	grg_context_free (gctx);
+}
+
+//each cipher, without compression
+static void
+sweep_ciphers (void)
+{
+	GRG_CTX gctx = grg_context_initialize_defaults ("BNC");
+	GRG_KEY key = grg_key_gen ("bench", -1);
+	unsigned char *data = grg_rnd_seq (gctx, SWEEP_DIM);
+	int c;
+
+	grg_ctx_set_comp_ratio (gctx, GRG_LVL_NONE);
+
+	for (c = 0; c < (int) (sizeof (cryptos) / sizeof (grg_crypt_algo)); c++)
+	{
+		grg_ctx_set_crypt_algo (gctx, cryptos[c]);
+		run_case (gctx, key, "algo", crypt_names[c], PATH_MEM, data,
+			  SWEEP_DIM);
+	}
+
+	free (data);
+	grg_key_free (gctx, key);
+	grg_context_free (gctx);
+}
+
+//each hash, that selects the key
+static void
+sweep_hashes (void)
+{
+	GRG_CTX gctx = grg_context_initialize_defaults ("BNC");
+	GRG_KEY key = grg_key_gen ("bench", -1);
+	unsigned char *data = grg_rnd_seq (gctx, SWEEP_DIM);
+	int h;
+
+	grg_ctx_set_comp_ratio (gctx, GRG_LVL_NONE);
+
+	for (h = 0; h < (int) (sizeof (hashes) / sizeof (grg_hash_algo)); h++)
+	{
+		grg_ctx_set_hash_algo (gctx, hashes[h]);
+		run_case (gctx, key, "hash", hash_names[h], PATH_MEM, data,
+			  SWEEP_DIM);
+	}
+
+	free (data);
+	grg_key_free (gctx, key);
+	grg_context_free (gctx);
+}
+
+//each compression algorithm and level, on text, with the fastest cipher
+static void
+sweep_comp (void)
+{
+	GRG_CTX gctx = grg_context_initialize_defaults ("BNC");
+	GRG_KEY key = grg_key_gen ("bench", -1);
+	unsigned char *text = bench_text (gctx, SWEEP_DIM);
+	char label[32];
+	int c, r;
+
+	grg_ctx_set_crypt_algo (gctx, GRG_RIJNDAEL_128);
+
+	for (c = 0; c < (int) (sizeof (comps) / sizeof (grg_comp_algo)); c++)
+	{
+		if (!grg_comp_algo_supported (comps[c]))
+			continue;
+
+		grg_ctx_set_comp_algo (gctx, comps[c]);
+
+		for (r = GRG_LVL_NONE; r <= GRG_LVL_BEST; r++)
+		{
+			//no compression is the same for all
+			if (r == GRG_LVL_NONE && c > 0)
+				continue;
+
+			grg_ctx_set_comp_ratio (gctx, r);
+			snprintf (label, sizeof (label), "%s %s",
+				  (r == GRG_LVL_NONE) ? "-" : comp_names[c],
+				  ratio_names[r]);
+			run_case (gctx, key, "comp", label, PATH_MEM, text,
+				  SWEEP_DIM);
+		}
+	}
+
+	free (text);
+	grg_key_free (gctx, key);
+	grg_context_free (gctx);
+}
+
+static void
+write_json (FILE * f)
+{
+	int i;
+	RESULT *r;
+
+	fprintf (f, "{\n  \"unit\": {\"mbs\": \"Mb/s\", \"latency\": \"us\", "
+		 "\"rss\": \"Kb\"},\n  \"results\": [\n");
+
+	for (i = 0; i < nresults; i++)
+	{
+		r = &results[i];
+		fprintf (f, "    {\"sweep\": \"%s\", \"case\": \"%s\", "
+			 "\"path\": \"%s\", \"op\": \"%s\", \"size\": %ld, "
+			 "\"reps\": %d, \"mbs\": %.2f, \"p50\": %.1f, "
+			 "\"p90\": %.1f, \"p99\": %.1f, \"peak_rss\": %ld, "
+			 "\"allocs\": %.2f, \"ratio\": %.4f, \"ok\": %s}%s\n",
+			 r->sweep, r->label, r->path, r->op, r->dim, r->reps,
+			 r->mbs, r->p50, r->p90, r->p99, r->rss_kb, r->allocs,
+			 r->ratio, r->ok ? "true" : "false",
+			 (i < nresults - 1) ? "," : "");
+	}
+
+	fprintf (f, "  ]\n}\n");
+}
+
+static long
+parse_size (const char *arg)
+{
+	char *end;
+	long ret = strtol (arg, &end, 10);
+
+	switch (*end)
+	{
+	case 'g':
+	case 'G':
+		ret <<= 10;
+	case 'm':
+	case 'M':
+		ret <<= 10;
+	case 'k':
+	case 'K':
+		ret <<= 10;
+	}
+
+	return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+	GRG_CTX gctx;
+	const char *json = NULL;
+	long max = SWEEP_DEF_MAX;
+	int components = 1, fd, i;
+	FILE *f;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp (argv[i], "--max") && i + 1 < argc)
+			max = parse_size (argv[++i]);
+		else if (!strcmp (argv[i], "--reps") && i + 1 < argc)
+			fixed_reps = atoi (argv[++i]);
+		else if (!strcmp (argv[i], "--json") && i + 1 < argc)
+			json = argv[++i];
+		else if (!strcmp (argv[i], "--no-components"))
+			components = 0;
+		else
+		{
+			fprintf (stderr, "Usage: %s [--max SIZE] [--reps N] "
+				 "[--json FILE] [--no-components]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (max < SWEEP_MIN || max > SWEEP_MAX || fixed_reps < 0)
+	{
+		fprintf (stderr, "%s: the size goes from 1K to 1G\n", argv[0]);
+		return 1;
+	}
+
+	fd = mkstemp (tmp_path);
+	if (fd < 0)
+		return 1;
+	close (fd);
+
+	if (components)
+	{
+		gctx = grg_context_initialize_defaults ("BNC");
+		if (!gctx)
+			return 1;
+
+		bench_ciphers (gctx);
+		bench_crc (gctx);
+		bench_b64 (gctx);
+		printf ("\n");
+
+		grg_context_free (gctx);
+	}
+
+	table_head ("Encryption and decryption");
+	sweep_sizes (max);
+	sweep_ciphers ();
+	sweep_hashes ();
+	sweep_comp ();
+
+	unlink (tmp_path);
+
+	if (json)
+	{
+		f = strcmp (json, "-") ? fopen (json, "w") : stdout;
+		if (!f)
+			return 1;
+		write_json (f);
+		if (f != stdout)
+			fclose (f);
+	}
+
+	free (results);
+	return 0;
+}
@@ -0,0 +1,706 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_aio.c - asynchronous writes, with io_uring or with a thread
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "libgrg_crypt.h"
+#include "libgrg_utils.h"
+#include "libgrg_structs.h"
+#include "libgrg_probes.h"
+#include "libgrg_aio.h"
+#include "libgringotts.h"
+
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define LIBGRG_IO_URING
+#endif
+#endif
+
+//writes in flight at most, with io_uring
+#define RING_ENTRIES	64
+
+//a piece of data to write
+typedef struct _grg_write
+{
+	struct iovec iov;	//what's still to write
+	off_t offset;		//and where, or -1 to append
+	struct _grg_write *next;
+}
+GRG_WRITE;
+
+#ifdef LIBGRG_IO_URING
+//the rings shared with the kernel
+typedef struct
+{
+	int fd;
+	unsigned int entries;
+
+	void *sq, *cq;
+	size_t sqDim, cqDim, sqesDim;
+	struct io_uring_sqe *sqes;
+	unsigned int *sqTail, *sqMask, *sqArray;
+	unsigned int *cqHead, *cqTail, *cqMask;
+	struct io_uring_cqe *cqes;
+}
+GRG_RING;
+#endif
+
+struct _grg_aio
+{
+	int fd;
+	off_t base;		//where the data start in the file; -1 if it can't seek
+	off_t end;		//where they end, from base
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+
+	GRG_WRITE *head, *tail;	//the writes the thread still has to do
+	long pending;		//the ones submitted and not done yet
+	int closed;		//no more will come
+	int cancelled;
+	int done;
+	int ret;		//GRG_OK, or the first error met
+
+	void *buf;		//the data written, to free when done
+	int pipe[2];		//the read end becomes readable when done
+	GRG_AIO_CALLBACK callback;
+	void *user_data;
+	GRG_TRACE_CALLBACK trace;	//of the context, as GRG_TRACE () wants
+	void *trace_data;
+	struct _grg_counters *counters;	//of the context, as GRG_COUNT () wants
+
+#ifdef LIBGRG_IO_URING
+	GRG_RING *ring;		//NULL if the thread does the writes
+#endif
+};
+
+/**
+ * write_at:
+ * @aio: the asynchronous write
+ * @w: what to write, and where
+ *
+ * Writes a piece of data, going on after short writes and interruptions.
+ *
+ * Returns: GRG_OK or GRG_WRITE_FILE_ERR
+ */
+static int
+write_at (const GRG_AIO aio, const GRG_WRITE * w)
+{
+	const unsigned char *data = (const unsigned char *) w->iov.iov_base;
+	long done = 0, dim = (long) w->iov.iov_len;
+	ssize_t wrote;
+
+	if (w->offset < 0)
+		return grg_write_full (&aio->counters->stats, aio->fd, data,
+				       dim);
+
+	while (done < dim)
+	{
+		wrote = pwrite (aio->fd, data + done, dim - done,
+				w->offset + done);
+		GRG_COUNT (aio, syscalls, 1);
+		if (wrote < 0 && errno == EINTR)
+			continue;
+		if (wrote <= 0)
+			return GRG_WRITE_FILE_ERR;
+		done += wrote;
+	}
+
+	return GRG_OK;
+}
+
+/**
+ * finish:
+ * @aio: the asynchronous write
+ *
+ * Called by its thread once all the writes are done: syncs the file and
+ * leaves its offset after the data, as a plain write () would, then
+ * tells the caller.
+ */
+static void
+finish (GRG_AIO aio)
+{
+	char c = 0;
+	int notify;
+
+	pthread_mutex_lock (&aio->lock);
+	notify = !aio->cancelled;
+	pthread_mutex_unlock (&aio->lock);
+
+	if (notify)
+	{
+		if (aio->ret == GRG_OK && aio->base >= 0)
+			lseek (aio->fd, aio->base + aio->end, SEEK_SET);
+		GRG_TRACE (aio, GRG_STAGE_SYNC, GRG_TRACE_BEGIN, aio->end);
+		GRG_PROBE1 (sync__begin, (long long) aio->end);
+		fsync (aio->fd);
+		GRG_COUNT (aio, syscalls, 1);
+		GRG_TRACE (aio, GRG_STAGE_SYNC, GRG_TRACE_END, aio->end);
+		GRG_PROBE1 (sync__end, (long long) aio->end);
+	}
+
+	grg_unsafe_free (aio->buf);
+	aio->buf = NULL;
+
+	if (notify && aio->callback)
+		aio->callback (aio->user_data, aio->ret);
+
+	while (write (aio->pipe[1], &c, 1) < 0 && errno == EINTR);
+
+	pthread_mutex_lock (&aio->lock);
+	aio->done = TRUE;
+	pthread_cond_broadcast (&aio->cond);
+	pthread_mutex_unlock (&aio->lock);
+}
+
+//the thread doing the writes itself, one at a time
+static void *
+writer (void *data)
+{
+	GRG_AIO aio = (GRG_AIO) data;
+	GRG_WRITE *w;
+	int err, skip;
+
+	pthread_mutex_lock (&aio->lock);
+	while (TRUE)
+	{
+		while (!aio->head && !aio->closed)
+			pthread_cond_wait (&aio->cond, &aio->lock);
+
+		w = aio->head;
+		if (!w)
+			break;
+		aio->head = w->next;
+		if (!aio->head)
+			aio->tail = NULL;
+		skip = aio->ret < 0 || aio->cancelled;
+		pthread_mutex_unlock (&aio->lock);
+
+		err = skip ? GRG_OK : write_at (aio, w);
+		free (w);
+
+		pthread_mutex_lock (&aio->lock);
+		if (err < 0 && aio->ret == GRG_OK)
+			aio->ret = err;
+		aio->pending--;
+		pthread_cond_broadcast (&aio->cond);
+	}
+	pthread_mutex_unlock (&aio->lock);
+
+	finish (aio);
+	return NULL;
+}
+
+#ifdef LIBGRG_IO_URING
+
+static int
+ring_enter (const int fd, const unsigned int submit, const unsigned int wait)
+{
+	int ret;
+
+	do
+		ret = (int) syscall (__NR_io_uring_enter, fd, submit, wait,
+				     wait ? IORING_ENTER_GETEVENTS : 0, NULL,
+				     0);
+	while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+static void
+ring_close (GRG_RING * r)
+{
+	if (r->sqes && r->sqes != MAP_FAILED)
+		munmap (r->sqes, r->sqesDim);
+	if (r->cq && r->cq != MAP_FAILED)
+		munmap (r->cq, r->cqDim);
+	if (r->sq && r->sq != MAP_FAILED)
+		munmap (r->sq, r->sqDim);
+	close (r->fd);
+	free (r);
+}
+
+/**
+ * ring_open:
+ *
+ * Sets up an io_uring instance, with raw system calls so that liburing
+ * isn't needed.
+ *
+ * Returns: the rings, or NULL if the kernel doesn't let us have them
+ */
+static GRG_RING *
+ring_open (void)
+{
+	struct io_uring_params p;
+	GRG_RING *r;
+
+	r = (GRG_RING *) calloc (1, sizeof (GRG_RING));
+	if (!r)
+		return NULL;
+
+	memset (&p, 0, sizeof (p));
+	r->fd = (int) syscall (__NR_io_uring_setup, RING_ENTRIES, &p);
+	if (r->fd < 0)
+	{
+		free (r);
+		return NULL;
+	}
+
+	r->sqDim = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+	r->cqDim = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+	r->sqesDim = p.sq_entries * sizeof (struct io_uring_sqe);
+
+	r->sq = mmap (NULL, r->sqDim, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->cq = mmap (NULL, r->cqDim, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes = (struct io_uring_sqe *) mmap (NULL, r->sqesDim,
+						PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE,
+						r->fd, IORING_OFF_SQES);
+
+	if (r->sq == MAP_FAILED || r->cq == MAP_FAILED ||
+	    r->sqes == MAP_FAILED)
+	{
+		ring_close (r);
+		return NULL;
+	}
+
+	r->entries = p.sq_entries;
+	r->sqTail = (unsigned int *) ((char *) r->sq + p.sq_off.tail);
+	r->sqMask = (unsigned int *) ((char *) r->sq + p.sq_off.ring_mask);
+	r->sqArray = (unsigned int *) ((char *) r->sq + p.sq_off.array);
+	r->cqHead = (unsigned int *) ((char *) r->cq + p.cq_off.head);
+	r->cqTail = (unsigned int *) ((char *) r->cq + p.cq_off.tail);
+	r->cqMask = (unsigned int *) ((char *) r->cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *) ((char *) r->cq + p.cq_off.cqes);
+
+	return r;
+}
+
+/**
+ * ring_push:
+ * @aio: the asynchronous write, locked
+ * @w: the write to submit
+ *
+ * Hands a write to the kernel. If it refuses, the write is done here and
+ * now, and freed.
+ *
+ * Returns: GRG_OK, or an error code if the write was done and failed
+ */
+static int
+ring_push (GRG_AIO aio, GRG_WRITE * w)
+{
+	GRG_RING *r = aio->ring;
+	struct io_uring_sqe *sqe;
+	unsigned int tail, idx;
+	int err;
+
+	tail = *r->sqTail;
+	idx = tail & *r->sqMask;
+	sqe = r->sqes + idx;
+
+	memset (sqe, 0, sizeof (struct io_uring_sqe));
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = aio->fd;
+	sqe->addr = (unsigned long) &w->iov;
+	sqe->len = 1;
+	sqe->off = (unsigned long long) w->offset;
+	sqe->user_data = (unsigned long long) (unsigned long) w;
+	r->sqArray[idx] = idx;
+
+	__atomic_store_n (r->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+	GRG_COUNT (aio, syscalls, 1);
+	if (ring_enter (r->fd, 1, 0) == 1)
+		return GRG_OK;
+
+	//the kernel reads the ring only when entered, so it can be undone
+	__atomic_store_n (r->sqTail, tail, __ATOMIC_RELEASE);
+
+	err = write_at (aio, w);
+	free (w);
+	aio->pending--;
+	pthread_cond_broadcast (&aio->cond);
+
+	return err;
+}
+
+/**
+ * ring_reap:
+ * @aio: the asynchronous write, locked
+ *
+ * Collects the completed writes, submitting again what's left of the
+ * short ones.
+ */
+static void
+ring_reap (GRG_AIO aio)
+{
+	GRG_RING *r = aio->ring;
+	struct io_uring_cqe *cqe;
+	GRG_WRITE *w;
+	unsigned int head, tail;
+	int err;
+
+	head = *r->cqHead;
+	tail = __atomic_load_n (r->cqTail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++)
+	{
+		cqe = r->cqes + (head & *r->cqMask);
+		w = (GRG_WRITE *) (unsigned long) cqe->user_data;
+
+		if (cqe->res == -EINTR || cqe->res == -EAGAIN ||
+		    (cqe->res > 0 && (size_t) cqe->res < w->iov.iov_len))
+		{
+			if (cqe->res > 0)
+			{
+				w->iov.iov_base = (char *) w->iov.iov_base +
+					cqe->res;
+				w->iov.iov_len -= cqe->res;
+				w->offset += cqe->res;
+			}
+			err = ring_push (aio, w);
+		}
+		else
+		{
+			err = (cqe->res < 0 || (size_t) cqe->res < w->iov.iov_len) ?
+				GRG_WRITE_FILE_ERR : GRG_OK;
+			free (w);
+			aio->pending--;
+		}
+
+		if (err < 0 && aio->ret == GRG_OK)
+			aio->ret = err;
+	}
+
+	__atomic_store_n (r->cqHead, head, __ATOMIC_RELEASE);
+	pthread_cond_broadcast (&aio->cond);
+}
+
+//the thread collecting the writes done by the kernel
+static void *
+reaper (void *data)
+{
+	GRG_AIO aio = (GRG_AIO) data;
+
+	pthread_mutex_lock (&aio->lock);
+	while (TRUE)
+	{
+		while (!aio->pending && !aio->closed)
+			pthread_cond_wait (&aio->cond, &aio->lock);
+
+		if (!aio->pending)
+			break;
+
+		//something is in flight, so a completion will come
+		pthread_mutex_unlock (&aio->lock);
+		ring_enter (aio->ring->fd, 0, 1);
+		GRG_COUNT (aio, syscalls, 1);
+		pthread_mutex_lock (&aio->lock);
+
+		ring_reap (aio);
+	}
+	pthread_mutex_unlock (&aio->lock);
+
+	finish (aio);
+	return NULL;
+}
+
+#endif
+
+/**
+ * grg_aio_open:
+ * @gctx: the context, whose trace callback is told of the sync, and whose
+ *        statistics count the system calls
+ * @fd: the file descriptor to write to
+ * @callback: what to call when done, or NULL
+ * @user_data: passed to @callback
+ * @aio: where to store the new asynchronous write
+ *
+ * Starts an asynchronous write to @fd, with io_uring where the kernel
+ * allows it, else with a thread doing the writes. The data are placed
+ * from the current offset of @fd on.
+ *
+ * Returns: GRG_OK or an error code
+ */
+int
+grg_aio_open (const GRG_CTX gctx, const int fd, GRG_AIO_CALLBACK callback,
+	      void *user_data, GRG_AIO * aio)
+{
+	GRG_AIO a;
+	void *(*thread) (void *) = writer;
+
+	a = (GRG_AIO) calloc (1, sizeof (struct _grg_aio));
+	if (!a)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	if (pipe (a->pipe) < 0)
+	{
+		free (a);
+		return GRG_WRITE_FILE_ERR;
+	}
+
+	a->fd = fd;
+	a->callback = callback;
+	a->user_data = user_data;
+	a->trace = gctx->trace;
+	a->trace_data = gctx->trace_data;
+	a->counters = grg_counters_ref (gctx->counters);
+
+	//with O_APPEND, Linux ignores the offsets of pwrite ()
+	a->base = (fcntl (fd, F_GETFL) & O_APPEND) ? -1 :
+		lseek (fd, 0, SEEK_CUR);
+
+#ifdef LIBGRG_IO_URING
+	if (a->base >= 0)
+		a->ring = ring_open ();
+	if (a->ring)
+		thread = reaper;
+#endif
+
+	pthread_mutex_init (&a->lock, NULL);
+	pthread_cond_init (&a->cond, NULL);
+
+	if (pthread_create (&a->thread, NULL, thread, a))
+	{
+#ifdef LIBGRG_IO_URING
+		if (a->ring)
+			ring_close (a->ring);
+#endif
+		pthread_cond_destroy (&a->cond);
+		pthread_mutex_destroy (&a->lock);
+		close (a->pipe[0]);
+		close (a->pipe[1]);
+		grg_counters_unref (a->counters);
+		free (a);
+		return GRG_MEM_ALLOCATION_ERR;
+	}
+
+	*aio = a;
+	return GRG_OK;
+}
+
+/**
+ * grg_aio_seekable:
+ * @aio: the asynchronous write
+ *
+ * Tells if the data can be written out of order; if not, they are
+ * appended in the order they are submitted, and the offsets are ignored.
+ *
+ * Returns: TRUE or FALSE
+ */
+int
+grg_aio_seekable (const GRG_AIO aio)
+{
+	return aio->base >= 0;
+}
+
+/**
+ * grg_aio_submit:
+ * @aio: the asynchronous write
+ * @data: the data to write; they must stay there until the end
+ * @dim: their length
+ * @offset: where they go, from where the data start
+ *
+ * Queues a write. It can be called by many threads at once.
+ *
+ * Returns: GRG_OK, or an error code if something already failed
+ */
+int
+grg_aio_submit (GRG_AIO aio, const unsigned char *data, const long dim,
+		const long long offset)
+{
+	GRG_WRITE *w;
+	int err;
+
+	w = (GRG_WRITE *) malloc (sizeof (GRG_WRITE));
+	if (!w)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	w->iov.iov_base = (void *) data;
+	w->iov.iov_len = dim;
+	w->offset = (aio->base < 0) ? -1 : aio->base + offset;
+	w->next = NULL;
+
+	pthread_mutex_lock (&aio->lock);
+
+	err = aio->ret;
+	if (err < 0)
+	{
+		pthread_mutex_unlock (&aio->lock);
+		free (w);
+		return err;
+	}
+
+	if (offset + dim > aio->end)
+		aio->end = offset + dim;
+
+#ifdef LIBGRG_IO_URING
+	if (aio->ring)
+	{
+		//the completions must fit in their ring
+		while (aio->pending >= aio->ring->entries)
+			pthread_cond_wait (&aio->cond, &aio->lock);
+
+		aio->pending++;
+		err = ring_push (aio, w);
+		if (err < 0 && aio->ret == GRG_OK)
+			aio->ret = err;
+		pthread_cond_broadcast (&aio->cond);
+		pthread_mutex_unlock (&aio->lock);
+		return err;
+	}
+#endif
+
+	if (aio->tail)
+		aio->tail->next = w;
+	else
+		aio->head = w;
+	aio->tail = w;
+	aio->pending++;
+
+	pthread_cond_broadcast (&aio->cond);
+	pthread_mutex_unlock (&aio->lock);
+
+	return GRG_OK;
+}
+
+/**
+ * grg_aio_drain:
+ * @aio: the asynchronous write
+ *
+ * Waits until all the writes submitted so far are done, so that their
+ * data can be freed.
+ */
+void
+grg_aio_drain (GRG_AIO aio)
+{
+	pthread_mutex_lock (&aio->lock);
+	while (aio->pending)
+		pthread_cond_wait (&aio->cond, &aio->lock);
+	pthread_mutex_unlock (&aio->lock);
+}
+
+/**
+ * grg_aio_close:
+ * @aio: the asynchronous write
+ * @buf: the memory holding the data written, to free when done, or NULL
+ *
+ * Tells that no more writes will come: once the submitted ones are done,
+ * the file is synced and the caller notified.
+ */
+void
+grg_aio_close (GRG_AIO aio, void *buf)
+{
+	pthread_mutex_lock (&aio->lock);
+	aio->buf = buf;
+	aio->closed = TRUE;
+	pthread_cond_broadcast (&aio->cond);
+	pthread_mutex_unlock (&aio->lock);
+}
+
+/**
+ * grg_aio_cancel:
+ * @aio: the asynchronous write
+ *
+ * Gives up an asynchronous write before closing it: the writes not yet
+ * started are dropped, the others waited for, and nobody is notified.
+ */
+void
+grg_aio_cancel (GRG_AIO aio)
+{
+	pthread_mutex_lock (&aio->lock);
+	aio->cancelled = TRUE;
+	aio->closed = TRUE;
+	pthread_cond_broadcast (&aio->cond);
+	pthread_mutex_unlock (&aio->lock);
+
+	grg_aio_wait (aio);
+}
+
+/**
+ * grg_aio_fd:
+ * @aio: an asynchronous write, from grg_encrypt_file_async ()
+ *
+ * Gives a file descriptor that becomes readable when the write is done,
+ * to use with poll () or select (); it's closed by grg_aio_wait ().
+ *
+ * Returns: the file descriptor, or -1
+ */
+int
+grg_aio_fd (const GRG_AIO aio)
+{
+	if (!aio)
+		return -1;
+
+	return aio->pipe[0];
+}
+
+/**
+ * grg_aio_wait:
+ * @aio: an asynchronous write, from grg_encrypt_file_async ()
+ *
+ * Waits for an asynchronous write to end, and frees it. It must be
+ * called once for each of them, but not from their callback.
+ *
+ * Returns: GRG_OK, or the error met while writing
+ */
+int
+grg_aio_wait (GRG_AIO aio)
+{
+	int ret;
+
+	if (!aio)
+		return GRG_ARGUMENT_ERR;
+
+	pthread_mutex_lock (&aio->lock);
+	while (!aio->done)
+		pthread_cond_wait (&aio->cond, &aio->lock);
+	pthread_mutex_unlock (&aio->lock);
+
+	pthread_join (aio->thread, NULL);
+	ret = aio->ret;
+
+#ifdef LIBGRG_IO_URING
+	if (aio->ring)
+		ring_close (aio->ring);
+#endif
+	pthread_cond_destroy (&aio->cond);
+	pthread_mutex_destroy (&aio->lock);
+	close (aio->pipe[0]);
+	close (aio->pipe[1]);
+	grg_counters_unref (aio->counters);
+	free (aio);
+
+	return ret;
+}
@@ -0,0 +1,36 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_aio.h - header file for libgrg_aio.c
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef LIBGRG_AIO_H
+#define LIBGRG_AIO_H
+
+#include "libgringotts.h"
+
+int grg_aio_open (const GRG_CTX gctx, const int fd, GRG_AIO_CALLBACK callback,
+		  void *user_data, GRG_AIO * aio);
+int grg_aio_seekable (const GRG_AIO aio);
+int grg_aio_submit (GRG_AIO aio, const unsigned char *data, const long dim,
+		    const long long offset);
+void grg_aio_drain (GRG_AIO aio);
+void grg_aio_close (GRG_AIO aio, void *buf);
+void grg_aio_cancel (GRG_AIO aio);
+
+#endif
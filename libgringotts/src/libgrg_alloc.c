@@ -0,0 +1,335 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_alloc.c - allocation of sensitive memory, and the secure arena
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "libgrg_crypt.h"
+#include "libgringotts.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+
+//the arena hands out blocks of 32 << class bytes, header included
+#define ARENA_CLASSES	9	//up to 8 Kb
+#define ARENA_HEAD		16	//keeps the blocks aligned as malloc () does
+#define ARENA_BLOCK(c)	(32L << (c))
+
+static void *
+default_alloc (void *user_data, const long dim)
+{
+	return malloc (dim);
+}
+
+static void
+default_free (void *user_data, void *data, const long dim)
+{
+	free (data);
+}
+
+static struct grg_allocator allocator = { default_alloc, default_free, NULL };
+
+//a free block keeps the next one of its class where the data were
+typedef struct _grg_block
+{
+	struct _grg_block *next;
+}
+GRG_BLOCK;
+
+static struct
+{
+	pthread_mutex_t lock;
+	unsigned char *map;	//the whole mapping, guard pages included
+	size_t mapDim;
+	unsigned char *start, *end;	//the locked pages between them
+	unsigned char *next;	//where the next new block is cut
+	GRG_BLOCK *free[ARENA_CLASSES];
+}
+arena = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, NULL, NULL, NULL, { NULL } };
+
+/**
+ * grg_set_allocator:
+ * @alloc: the functions to use, or NULL to get back to malloc () and free ()
+ *
+ * Sets the functions libGringotts uses for its sensitive memory, such as
+ * keys and key schedules. It must be called before anything is allocated
+ * with the previous ones, usually at startup.
+ */
+void
+grg_set_allocator (const struct grg_allocator *alloc)
+{
+	if (alloc && alloc->alloc && alloc->free)
+		memcpy (&allocator, alloc, sizeof (struct grg_allocator));
+	else
+	{
+		allocator.alloc = default_alloc;
+		allocator.free = default_free;
+		allocator.user_data = NULL;
+	}
+}
+
+/**
+ * grg_secure_alloc:
+ * @dim: the number of bytes
+ *
+ * Allocates some sensitive memory, with the allocator in use.
+ *
+ * Returns: the memory, to free with grg_secure_free (), or NULL
+ */
+void *
+grg_secure_alloc (const long dim)
+{
+	if (dim < 1)
+		return NULL;
+
+	return allocator.alloc (allocator.user_data, dim);
+}
+
+/**
+ * grg_secure_free:
+ * @gctx: the context, telling how to wipe; if NULL, it's wiped with zeroes
+ * @data: the memory to free, from grg_secure_alloc ()
+ * @dim: its length; if -1 it must be NULL-terminated
+ *
+ * Wipes and frees some sensitive memory.
+ */
+void
+grg_secure_free (const GRG_CTX gctx, void *data, const long dim)
+{
+	long len;
+
+	if (!data)
+		return;
+
+	len = (dim >= 0) ? dim : (long) strlen ((char *) data);
+
+	if (gctx)
+		grg_wipe (gctx, data, len);
+	else
+	{
+		memset (data, 0, len);
+#ifdef __GNUC__
+		__asm__ __volatile__ ("" : : "r" (data) : "memory");
+#endif
+	}
+
+	allocator.free (allocator.user_data, data, len);
+}
+
+static void *
+arena_alloc (void *user_data, const long dim)
+{
+	GRG_BLOCK *b;
+	unsigned char *block = NULL;
+	int c;
+
+	for (c = 0; c < ARENA_CLASSES && ARENA_BLOCK (c) - ARENA_HEAD < dim;
+	     c++);
+
+	//too big for the arena, it can only be left unlocked
+	if (c == ARENA_CLASSES)
+		return malloc (dim);
+
+	pthread_mutex_lock (&arena.lock);
+
+	if (arena.free[c])
+	{
+		b = arena.free[c];
+		arena.free[c] = b->next;
+		b->next = NULL;
+		block = (unsigned char *) b - ARENA_HEAD;
+	}
+	else if (arena.end - arena.next >= ARENA_BLOCK (c))
+	{
+		block = arena.next;
+		arena.next += ARENA_BLOCK (c);
+	}
+
+	pthread_mutex_unlock (&arena.lock);
+
+	//the arena is full
+	if (!block)
+		return malloc (dim);
+
+	block[0] = (unsigned char) c;
+	return block + ARENA_HEAD;
+}
+
+static void
+arena_free (void *user_data, void *data, const long dim)
+{
+	unsigned char *block = (unsigned char *) data - ARENA_HEAD;
+	GRG_BLOCK *b = (GRG_BLOCK *) data;
+	int c;
+
+	//not ours: it was too big, or the arena was full
+	if ((unsigned char *) data < arena.start ||
+	    (unsigned char *) data >= arena.end)
+	{
+		free (data);
+		return;
+	}
+
+	c = block[0];
+	memset (data, 0, ARENA_BLOCK (c) - ARENA_HEAD);
+
+	pthread_mutex_lock (&arena.lock);
+	b->next = arena.free[c];
+	arena.free[c] = b;
+	pthread_mutex_unlock (&arena.lock);
+}
+
+/**
+ * grg_secure_arena_init:
+ * @dim: the bytes the arena can hold; they'll be locked in memory
+ *
+ * Sets up an arena of memory locked against swapping, kept out of core
+ * dumps and fenced by two guard pages, and makes it the allocator of the
+ * sensitive memory. Its blocks are allocated and freed in constant time,
+ * and wiped when freed; what doesn't fit is left to malloc ().
+ *
+ * Returns: GRG_OK, GRG_MEM_ALLOCATION_ERR, or GRG_MEM_LOCK_ERR if the
+ *          memory can't be locked (see RLIMIT_MEMLOCK)
+ */
+int
+grg_secure_arena_init (const long dim)
+{
+	static const struct grg_allocator arena_allocator =
+		{ arena_alloc, arena_free, NULL };
+	long page = sysconf (_SC_PAGESIZE);
+	size_t slab;
+	void *map;
+
+	if (dim < 1)
+		return GRG_ARGUMENT_ERR;
+
+	if (arena.map)
+		return GRG_OK;
+
+	slab = ((dim + page - 1) / page) * page;
+
+	map = mmap (NULL, slab + 2 * page, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	if (mprotect (map, page, PROT_NONE) ||
+	    mprotect ((unsigned char *) map + page + slab, page, PROT_NONE))
+	{
+		munmap (map, slab + 2 * page);
+		return GRG_MEM_ALLOCATION_ERR;
+	}
+
+	if (mlock ((unsigned char *) map + page, slab))
+	{
+		munmap (map, slab + 2 * page);
+		return GRG_MEM_LOCK_ERR;
+	}
+
+#ifdef MADV_DONTDUMP
+	madvise ((unsigned char *) map + page, slab, MADV_DONTDUMP);
+#endif
+
+	pthread_mutex_lock (&arena.lock);
+	arena.map = (unsigned char *) map;
+	arena.mapDim = slab + 2 * page;
+	arena.start = arena.map + page;
+	arena.end = arena.start + slab;
+	arena.next = arena.start;
+	memset (arena.free, 0, sizeof (arena.free));
+	pthread_mutex_unlock (&arena.lock);
+
+	grg_set_allocator (&arena_allocator);
+
+	return GRG_OK;
+}
+
+/**
+ * grg_secure_arena_reset:
+ *
+ * Wipes the whole arena at once, and makes all of it free again. Every
+ * block allocated in it is lost, so nothing must be in use: keys, keyholders,
+ * ciphers, temporary files...
+ */
+void
+grg_secure_arena_reset (void)
+{
+	pthread_mutex_lock (&arena.lock);
+
+	if (arena.map)
+	{
+		memset (arena.start, 0, arena.next - arena.start);
+#ifdef __GNUC__
+		__asm__ __volatile__ ("" : : "r" (arena.start) : "memory");
+#endif
+		arena.next = arena.start;
+		memset (arena.free, 0, sizeof (arena.free));
+	}
+
+	pthread_mutex_unlock (&arena.lock);
+}
+
+/**
+ * grg_secure_arena_free:
+ *
+ * Wipes and releases the arena, getting back to malloc () and free (). As
+ * for grg_secure_arena_reset (), nothing must be in use.
+ */
+void
+grg_secure_arena_free (void)
+{
+	if (!arena.map)
+		return;
+
+	grg_secure_arena_reset ();
+	grg_set_allocator (NULL);
+
+	pthread_mutex_lock (&arena.lock);
+	munlock (arena.start, arena.end - arena.start);
+	munmap (arena.map, arena.mapDim);
+	arena.map = arena.start = arena.end = arena.next = NULL;
+	arena.mapDim = 0;
+	pthread_mutex_unlock (&arena.lock);
+}
+
+/**
+ * grg_secure_arena_used:
+ *
+ * Tells how much of the arena has been cut into blocks so far.
+ *
+ * Returns: the bytes, blocks free for reuse included
+ */
+long
+grg_secure_arena_used (void)
+{
+	long ret;
+
+	pthread_mutex_lock (&arena.lock);
+	ret = arena.next - arena.start;
+	pthread_mutex_unlock (&arena.lock);
+
+	return ret;
+}
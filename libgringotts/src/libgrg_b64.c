@@ -0,0 +1,835 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_b64.c - base64 encoding and decoding
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// The bulk of the data goes through vector kernels where the CPU has
+// them: 12 bytes (16 characters) at a time with SSSE3, 24 with AVX2 and
+// 48 with NEON, as in W. Muła and D. Lemire, "Faster Base64 Encoding and
+// Decoding Using AVX2 Instructions". What's left, the padding and any
+// invalid character go through the scalar code, that has the last word.
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libgringotts.h"
+
+static const unsigned char basis_64[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+//the value of every byte, -1 if it's not in the alphabet
+static const signed char index_64[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+	-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+#define CHAR64(c)	(index_64[(unsigned char) (c)])
+
+#if (defined (__x86_64__) || defined (__i386__)) && \
+	(defined (__clang__) || (defined (__GNUC__) && __GNUC__ >= 5))
+#define GRG_B64_X86
+#include <immintrin.h>
+
+#define SSSE3_FN __attribute__ ((target ("ssse3")))
+#define AVX2_FN __attribute__ ((target ("avx2")))
+
+static int b64_level;		//0, or 1 for SSSE3, or 2 for AVX2
+static pthread_once_t b64_once = PTHREAD_ONCE_INIT;
+
+static void
+detect_b64 (void)
+{
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2"))
+		b64_level = 2;
+	else if (__builtin_cpu_supports ("ssse3"))
+		b64_level = 1;
+}
+
+//spreads 12 bytes in four groups of 3, as 16 values of 6 bits
+SSSE3_FN static inline __m128i
+enc_reshuffle (__m128i in)
+{
+	__m128i t0, t1, t2, t3;
+
+	in = _mm_shuffle_epi8 (in, _mm_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7,
+						 4, 5, 3, 4, 1, 2, 0, 1));
+
+	t0 = _mm_and_si128 (in, _mm_set1_epi32 (0x0fc0fc00));
+	t1 = _mm_mulhi_epu16 (t0, _mm_set1_epi32 (0x04000040));
+	t2 = _mm_and_si128 (in, _mm_set1_epi32 (0x003f03f0));
+	t3 = _mm_mullo_epi16 (t2, _mm_set1_epi32 (0x01000010));
+
+	return _mm_or_si128 (t1, t3);
+}
+
+//turns 16 values of 6 bits into characters, adding the offset of their
+//range: A-Z, a-z, 0-9, '+' or '/'
+SSSE3_FN static inline __m128i
+enc_translate (const __m128i in)
+{
+	const __m128i lut = _mm_setr_epi8 (65, 71, -4, -4, -4, -4, -4, -4,
+					   -4, -4, -4, -4, -19, -16, 0, 0);
+	__m128i idx;
+
+	idx = _mm_subs_epu8 (in, _mm_set1_epi8 (51));
+	idx = _mm_sub_epi8 (idx, _mm_cmpgt_epi8 (in, _mm_set1_epi8 (25)));
+
+	return _mm_add_epi8 (in, _mm_shuffle_epi8 (lut, idx));
+}
+
+//the value of 16 characters, if they're all in the alphabet
+SSSE3_FN static inline int
+dec_translate (__m128i * str)
+{
+	const __m128i lut_lo = _mm_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11,
+					      0x11, 0x11, 0x11, 0x11, 0x11,
+					      0x13, 0x1a, 0x1b, 0x1b, 0x1b,
+					      0x1a);
+	const __m128i lut_hi = _mm_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04,
+					      0x08, 0x04, 0x08, 0x10, 0x10,
+					      0x10, 0x10, 0x10, 0x10, 0x10,
+					      0x10);
+	const __m128i lut_roll = _mm_setr_epi8 (0, 16, 19, 4, -65, -65, -71,
+						-71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask_2f = _mm_set1_epi8 (0x2f);
+	__m128i hi_nibbles, lo_nibbles, hi, lo, roll;
+
+	hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (*str, 4), mask_2f);
+	lo_nibbles = _mm_and_si128 (*str, mask_2f);
+	hi = _mm_shuffle_epi8 (lut_hi, hi_nibbles);
+	lo = _mm_shuffle_epi8 (lut_lo, lo_nibbles);
+
+	//a character is out of the alphabet if its nibbles share a bit
+	if (_mm_movemask_epi8 (_mm_cmpgt_epi8 (_mm_and_si128 (lo, hi),
+					       _mm_setzero_si128 ())))
+		return 0;
+
+	roll = _mm_shuffle_epi8 (lut_roll,
+				 _mm_add_epi8 (_mm_cmpeq_epi8 (*str, mask_2f),
+					       hi_nibbles));
+	*str = _mm_add_epi8 (*str, roll);
+
+	return 1;
+}
+
+//packs 16 values of 6 bits in the first 12 bytes
+SSSE3_FN static inline __m128i
+dec_reshuffle (const __m128i in)
+{
+	__m128i out;
+
+	out = _mm_maddubs_epi16 (in, _mm_set1_epi32 (0x01400140));
+	out = _mm_madd_epi16 (out, _mm_set1_epi32 (0x00011000));
+
+	return _mm_shuffle_epi8 (out, _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9,
+						     8, 14, 13, 12, -1, -1,
+						     -1, -1));
+}
+
+//each step reads 16 bytes and uses 12
+SSSE3_FN static long
+encode_ssse3 (const unsigned char *in, long len, unsigned char *out)
+{
+	const unsigned char *start = in;
+	__m128i str;
+
+	for (; len >= 16; in += 12, out += 16, len -= 12)
+	{
+		str = _mm_loadu_si128 ((const __m128i *) in);
+		str = enc_translate (enc_reshuffle (str));
+		_mm_storeu_si128 ((__m128i *) out, str);
+	}
+
+	return in - start;
+}
+
+//each step writes 16 bytes and fills 12; 24 characters make sure that
+//the rest is in the output anyway
+SSSE3_FN static long
+decode_ssse3 (const unsigned char *in, long len, unsigned char *out)
+{
+	const unsigned char *start = in;
+	__m128i str;
+
+	for (; len >= 24; in += 16, out += 12, len -= 16)
+	{
+		str = _mm_loadu_si128 ((const __m128i *) in);
+		if (!dec_translate (&str))
+			break;
+		_mm_storeu_si128 ((__m128i *) out, dec_reshuffle (str));
+	}
+
+	return in - start;
+}
+
+//as encode_ssse3 (), on two lanes of 12 bytes
+AVX2_FN static long
+encode_avx2 (const unsigned char *in, long len, unsigned char *out)
+{
+	const unsigned char *start = in;
+	const __m256i lut = _mm256_setr_epi8 (65, 71, -4, -4, -4, -4, -4, -4,
+					      -4, -4, -4, -4, -19, -16, 0, 0,
+					      65, 71, -4, -4, -4, -4, -4, -4,
+					      -4, -4, -4, -4, -19, -16, 0, 0);
+	const __m256i shuf = _mm256_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7,
+					      4, 5, 3, 4, 1, 2, 0, 1,
+					      10, 11, 9, 10, 7, 8, 6, 7,
+					      4, 5, 3, 4, 1, 2, 0, 1);
+	__m256i str, t0, t1, t2, t3, idx;
+
+	for (; len >= 28; in += 24, out += 32, len -= 24)
+	{
+		str = _mm256_inserti128_si256 (_mm256_castsi128_si256
+					       (_mm_loadu_si128
+						((const __m128i *) in)),
+					       _mm_loadu_si128 ((const __m128i *)
+								(in + 12)), 1);
+		str = _mm256_shuffle_epi8 (str, shuf);
+
+		t0 = _mm256_and_si256 (str, _mm256_set1_epi32 (0x0fc0fc00));
+		t1 = _mm256_mulhi_epu16 (t0, _mm256_set1_epi32 (0x04000040));
+		t2 = _mm256_and_si256 (str, _mm256_set1_epi32 (0x003f03f0));
+		t3 = _mm256_mullo_epi16 (t2, _mm256_set1_epi32 (0x01000010));
+		str = _mm256_or_si256 (t1, t3);
+
+		idx = _mm256_subs_epu8 (str, _mm256_set1_epi8 (51));
+		idx = _mm256_sub_epi8 (idx, _mm256_cmpgt_epi8
+				       (str, _mm256_set1_epi8 (25)));
+		str = _mm256_add_epi8 (str, _mm256_shuffle_epi8 (lut, idx));
+
+		_mm256_storeu_si256 ((__m256i *) out, str);
+	}
+
+	return in - start;
+}
+
+//as decode_ssse3 (), 32 characters at a time
+AVX2_FN static long
+decode_avx2 (const unsigned char *in, long len, unsigned char *out)
+{
+	const unsigned char *start = in;
+	const __m256i lut_lo = _mm256_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11,
+						 0x11, 0x11, 0x11, 0x11, 0x11,
+						 0x13, 0x1a, 0x1b, 0x1b, 0x1b,
+						 0x1a, 0x15, 0x11, 0x11, 0x11,
+						 0x11, 0x11, 0x11, 0x11, 0x11,
+						 0x11, 0x13, 0x1a, 0x1b, 0x1b,
+						 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04,
+						 0x08, 0x04, 0x08, 0x10, 0x10,
+						 0x10, 0x10, 0x10, 0x10, 0x10,
+						 0x10, 0x10, 0x10, 0x01, 0x02,
+						 0x04, 0x08, 0x04, 0x08, 0x10,
+						 0x10, 0x10, 0x10, 0x10, 0x10,
+						 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8 (0, 16, 19, 4, -65, -65,
+						   -71, -71, 0, 0, 0, 0, 0, 0,
+						   0, 0, 0, 16, 19, 4, -65, -65,
+						   -71, -71, 0, 0, 0, 0, 0, 0,
+						   0, 0);
+	const __m256i mask_2f = _mm256_set1_epi8 (0x2f);
+	__m256i str, hi_nibbles, lo_nibbles, hi, lo, roll;
+
+	for (; len >= 48; in += 32, out += 24, len -= 32)
+	{
+		str = _mm256_loadu_si256 ((const __m256i *) in);
+
+		hi_nibbles = _mm256_and_si256 (_mm256_srli_epi32 (str, 4),
+					       mask_2f);
+		lo_nibbles = _mm256_and_si256 (str, mask_2f);
+		hi = _mm256_shuffle_epi8 (lut_hi, hi_nibbles);
+		lo = _mm256_shuffle_epi8 (lut_lo, lo_nibbles);
+
+		if (!_mm256_testz_si256 (lo, hi))
+			break;
+
+		roll = _mm256_shuffle_epi8 (lut_roll, _mm256_add_epi8
+					    (_mm256_cmpeq_epi8 (str, mask_2f),
+					     hi_nibbles));
+		str = _mm256_add_epi8 (str, roll);
+
+		str = _mm256_maddubs_epi16 (str,
+					    _mm256_set1_epi32 (0x01400140));
+		str = _mm256_madd_epi16 (str, _mm256_set1_epi32 (0x00011000));
+		str = _mm256_shuffle_epi8 (str, _mm256_setr_epi8
+					   (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13,
+					    12, -1, -1, -1, -1, 2, 1, 0, 6, 5,
+					    4, 10, 9, 8, 14, 13, 12, -1, -1,
+					    -1, -1));
+		str = _mm256_permutevar8x32_epi32 (str, _mm256_setr_epi32
+						   (0, 1, 2, 4, 5, 6, 3, 7));
+
+		_mm256_storeu_si256 ((__m256i *) out, str);
+	}
+
+	return in - start;
+}
+
+#endif //GRG_B64_X86
+
+#if defined (__aarch64__) && defined (__ARM_NEON)
+#define GRG_B64_NEON
+#include <arm_neon.h>
+
+//NEON is always there on AArch64: no need to ask the CPU
+static long
+encode_neon (const unsigned char *in, long len, unsigned char *out)
+{
+	const unsigned char *start = in;
+	const uint8x16_t mask = vdupq_n_u8 (0x3f);
+	uint8x16x4_t lut, res;
+	uint8x16x3_t str;
+
+	lut.val[0] = vld1q_u8 (basis_64);
+	lut.val[1] = vld1q_u8 (basis_64 + 16);
+	lut.val[2] = vld1q_u8 (basis_64 + 32);
+	lut.val[3] = vld1q_u8 (basis_64 + 48);
+
+	for (; len >= 48; in += 48, out += 64, len -= 48)
+	{
+		str = vld3q_u8 (in);
+
+		res.val[0] = vshrq_n_u8 (str.val[0], 2);
+		res.val[1] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (str.val[0], 4),
+						 vshrq_n_u8 (str.val[1], 4)),
+				       mask);
+		res.val[2] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (str.val[1], 2),
+						 vshrq_n_u8 (str.val[2], 6)),
+				       mask);
+		res.val[3] = vandq_u8 (str.val[2], mask);
+
+		res.val[0] = vqtbl4q_u8 (lut, res.val[0]);
+		res.val[1] = vqtbl4q_u8 (lut, res.val[1]);
+		res.val[2] = vqtbl4q_u8 (lut, res.val[2]);
+		res.val[3] = vqtbl4q_u8 (lut, res.val[3]);
+
+		vst4q_u8 (out, res);
+	}
+
+	return in - start;
+}
+
+static long
+decode_neon (const unsigned char *in, long len, unsigned char *out)
+{
+	const unsigned char *start = in;
+	const uint8x16_t off = vdupq_n_u8 (64);
+	uint8x16x4_t lut_lo, lut_hi, str, val;
+	uint8x16x3_t res;
+	uint8x16_t bad;
+	int i;
+
+	//the values of the bytes from 0 to 63, and from 64 to 127
+	for (i = 0; i < 4; i++)
+	{
+		lut_lo.val[i] = vld1q_u8 ((const unsigned char *) index_64 +
+					  16 * i);
+		lut_hi.val[i] = vld1q_u8 ((const unsigned char *) index_64 +
+					  64 + 16 * i);
+	}
+
+	for (; len >= 64; in += 64, out += 48, len -= 64)
+	{
+		str = vld4q_u8 (in);
+
+		//an index out of the table gives 0, so each byte is
+		//found in one table only; bytes over 127 in none
+		for (i = 0; i < 4; i++)
+			val.val[i] = vorrq_u8 (vqtbl4q_u8 (lut_lo, str.val[i]),
+					       vqtbl4q_u8 (lut_hi,
+							   vsubq_u8 (str.val[i],
+								     off)));
+
+		//out of the alphabet, the value or the byte has bit 7 set
+		bad = vorrq_u8 (vorrq_u8 (val.val[0], val.val[1]),
+				vorrq_u8 (val.val[2], val.val[3]));
+		bad = vorrq_u8 (bad, vorrq_u8 (vorrq_u8 (str.val[0],
+							 str.val[1]),
+					       vorrq_u8 (str.val[2],
+							 str.val[3])));
+		if (vmaxvq_u8 (bad) & 0x80)
+			break;
+
+		res.val[0] = vorrq_u8 (vshlq_n_u8 (val.val[0], 2),
+				       vshrq_n_u8 (val.val[1], 4));
+		res.val[1] = vorrq_u8 (vshlq_n_u8 (val.val[1], 4),
+				       vshrq_n_u8 (val.val[2], 2));
+		res.val[2] = vorrq_u8 (vshlq_n_u8 (val.val[2], 6), val.val[3]);
+
+		vst3q_u8 (out, res);
+	}
+
+	return in - start;
+}
+
+#endif //GRG_B64_NEON
+
+/**
+ * encode_groups:
+ * @in: the data
+ * @len: their length
+ * @out: where to put the characters, 4 for every 3 bytes
+ *
+ * Encodes all the whole groups of 3 bytes, with no padding.
+ *
+ * Returns: how many bytes were encoded
+ */
+static long
+encode_groups (const unsigned char *in, const long len, unsigned char *out)
+{
+	long done = 0;
+
+#ifdef GRG_B64_X86
+	pthread_once (&b64_once, detect_b64);
+	if (b64_level == 2)
+		done = encode_avx2 (in, len, out);
+	else if (b64_level == 1)
+		done = encode_ssse3 (in, len, out);
+#endif
+#ifdef GRG_B64_NEON
+	done = encode_neon (in, len, out);
+#endif
+
+	in += done;
+	out += done / 3 * 4;
+
+	for (; len - done >= 3; in += 3, done += 3)
+	{
+		*out++ = basis_64[in[0] >> 2];
+		*out++ = basis_64[((in[0] << 4) & 0x30) | (in[1] >> 4)];
+		*out++ = basis_64[((in[1] << 2) & 0x3c) | (in[2] >> 6)];
+		*out++ = basis_64[in[2] & 0x3f];
+	}
+
+	return done;
+}
+
+/**
+ * encode_tail:
+ * @in: the last one or two bytes
+ * @len: how many they are
+ * @out: where to put the four characters
+ *
+ * Encodes the last group, padding it with '='.
+ */
+static void
+encode_tail (const unsigned char *in, const long len, unsigned char *out)
+{
+	unsigned char oval;
+
+	out[0] = basis_64[in[0] >> 2];
+	oval = (in[0] << 4) & 0x30;
+	if (len > 1)
+		oval |= in[1] >> 4;
+	out[1] = basis_64[oval];
+	out[2] = (len < 2) ? '=' : basis_64[(in[1] << 2) & 0x3c];
+	out[3] = '=';
+}
+
+/**
+ * decode_groups:
+ * @in: the characters
+ * @len: how many they are
+ * @out: where to put the data, 3 bytes for every 4 characters
+ *
+ * Decodes the groups of 4 characters, as long as they're all in the
+ * alphabet: the ones with padding, or anything wrong, are left to the
+ * caller.
+ *
+ * Returns: how many characters were decoded
+ */
+static long
+decode_groups (const unsigned char *in, const long len, unsigned char *out)
+{
+	long done = 0;
+	int c1, c2, c3, c4;
+
+#ifdef GRG_B64_X86
+	pthread_once (&b64_once, detect_b64);
+	if (b64_level == 2)
+		done = decode_avx2 (in, len, out);
+	if (b64_level >= 1)
+		done += decode_ssse3 (in + done, len - done,
+				      out + done / 4 * 3);
+#endif
+#ifdef GRG_B64_NEON
+	done = decode_neon (in, len, out);
+#endif
+
+	in += done;
+	out += done / 4 * 3;
+
+	for (; len - done >= 4; in += 4, done += 4)
+	{
+		c1 = CHAR64 (in[0]);
+		c2 = CHAR64 (in[1]);
+		c3 = CHAR64 (in[2]);
+		c4 = CHAR64 (in[3]);
+
+		//just one test: -1 is the only negative value
+		if ((c1 | c2 | c3 | c4) < 0)
+			break;
+
+		*out++ = (c1 << 2) | (c2 >> 4);
+		*out++ = (c2 << 4) | (c3 >> 2);
+		*out++ = (c3 << 6) | c4;
+	}
+
+	return done;
+}
+
+unsigned char *
+grg_encode64 (const unsigned char *in, const int inlen,
+	      unsigned int *outlen)
+{
+	unsigned char *out;
+	unsigned int olen, origlen, done;
+
+	if (!in)
+		return NULL;
+
+	origlen = (inlen >= 0) ? inlen : strlen ((char *)in);
+	olen = (origlen + 2) / 3 * 4 + 1;
+	out = (unsigned char *) malloc (olen);
+	if (!out)
+		return NULL;
+
+	if (outlen)
+		*outlen = olen;
+
+	done = encode_groups (in, origlen, out);
+	if (done < origlen)
+		encode_tail (in + done, origlen - done, out + done / 3 * 4);
+
+	out[olen - 1] = '\0';
+
+	return out;
+}
+
+unsigned char *
+grg_decode64 (const unsigned char *in, const int inlen,
+	      unsigned int *outlen)
+{
+	unsigned olen, lup, tmpinlen;
+	int c1, c2, c3, c4;
+	unsigned char *out, *ret;
+
+	if (!in)
+		return NULL;
+
+	tmpinlen = (inlen >= 0) ? inlen : strlen ((char *)in);
+
+	if (tmpinlen >= 2 && in[0] == '+' && in[1] == ' ')
+	{
+		in += 2;
+		tmpinlen -= 2;
+	}
+
+	if (!tmpinlen || *in == '\0')
+		return NULL;
+
+	olen = tmpinlen / 4 * 3;
+	if (olen && in[tmpinlen - 1] == '=')
+	{
+		olen--;
+		if (in[tmpinlen - 2] == '=')
+			olen--;
+	}
+
+	out = (unsigned char *) malloc (olen + 1);
+	if (!out)
+		return NULL;
+
+	ret = out;
+
+	//the bulk; then the groups with padding, or anything wrong
+	lup = decode_groups (in, tmpinlen / 4 * 4, out);
+	in += lup;
+	out += lup / 4 * 3;
+
+	for (lup /= 4; lup < tmpinlen / 4; lup++)
+	{
+		c1 = CHAR64 (in[0]);
+		c2 = CHAR64 (in[1]);
+		c3 = (in[2] == '=') ? 0 : CHAR64 (in[2]);
+		c4 = (in[3] == '=') ? 0 : CHAR64 (in[3]);
+		if ((c1 | c2 | c3 | c4) < 0)
+		{
+			free (ret);
+			return NULL;
+		}
+		*out++ = (c1 << 2) | (c2 >> 4);
+		if (in[2] != '=')
+		{
+			*out++ = (c2 << 4) | (c3 >> 2);
+			if (in[3] != '=')
+				*out++ = (c3 << 6) | c4;
+		}
+		in += 4;
+	}
+
+	if (outlen)
+		*outlen = olen;
+
+	ret[olen] = '\0';
+
+	return ret;
+}
+
+/**
+ * grg_encode64_init:
+ * @state: the state of the conversion
+ *
+ * Starts an incremental base64 encoding.
+ */
+void
+grg_encode64_init (struct grg_b64_state *state)
+{
+	memset (state, 0, sizeof (struct grg_b64_state));
+}
+
+/**
+ * grg_encode64_update:
+ * @state: the state of the conversion
+ * @in: some more data
+ * @inlen: their length
+ * @out: where to put the characters; it must have room for
+ *       (@inlen + 2) / 3 * 4 of them
+ *
+ * Encodes some more data; up to two bytes are kept for the next call.
+ *
+ * Returns: how many characters were written
+ */
+long
+grg_encode64_update (struct grg_b64_state *state, const unsigned char *in,
+		     const long inlen, unsigned char *out)
+{
+	long len = inlen, done, written = 0;
+
+	if (len <= 0)
+		return 0;
+
+	if (state->carried)
+	{
+		while (state->carried < 3 && len > 0)
+		{
+			state->carry[state->carried++] = *in++;
+			len--;
+		}
+
+		if (state->carried < 3)
+			return 0;
+
+		encode_groups (state->carry, 3, out);
+		state->carried = 0;
+		written = 4;
+	}
+
+	done = encode_groups (in, len, out + written);
+	written += done / 3 * 4;
+
+	memcpy (state->carry, in + done, len - done);
+	state->carried = len - done;
+
+	return written;
+}
+
+/**
+ * grg_encode64_final:
+ * @state: the state of the conversion
+ * @out: where to put the last characters, up to 4; no '\0' is added
+ *
+ * Ends an incremental base64 encoding, padding the last group.
+ *
+ * Returns: how many characters were written
+ */
+long
+grg_encode64_final (struct grg_b64_state *state, unsigned char *out)
+{
+	long carried = state->carried;
+
+	if (!carried)
+		return 0;
+
+	encode_tail (state->carry, carried, out);
+	memset (state, 0, sizeof (struct grg_b64_state));
+
+	return 4;
+}
+
+/**
+ * decode_one:
+ * @state: the state of the conversion
+ * @group: four characters
+ * @out: where to put the bytes
+ *
+ * Decodes a single group, that can be the padded one.
+ *
+ * Returns: how many bytes were written, or GRG_ARGUMENT_ERR
+ */
+static long
+decode_one (struct grg_b64_state *state, const unsigned char *group,
+	    unsigned char *out)
+{
+	int c1, c2, c3, c4;
+
+	if (state->over)
+		return GRG_ARGUMENT_ERR;
+
+	c1 = CHAR64 (group[0]);
+	c2 = CHAR64 (group[1]);
+	c3 = (group[2] == '=') ? 0 : CHAR64 (group[2]);
+	c4 = (group[3] == '=') ? 0 : CHAR64 (group[3]);
+
+	if ((c1 | c2 | c3 | c4) < 0 ||
+	    (group[2] == '=' && group[3] != '='))
+		return GRG_ARGUMENT_ERR;
+
+	out[0] = (c1 << 2) | (c2 >> 4);
+	if (group[2] == '=')
+	{
+		state->over = 1;
+		return 1;
+	}
+
+	out[1] = (c2 << 4) | (c3 >> 2);
+	if (group[3] == '=')
+	{
+		state->over = 1;
+		return 2;
+	}
+
+	out[2] = (c3 << 6) | c4;
+	return 3;
+}
+
+/**
+ * grg_decode64_init:
+ * @state: the state of the conversion
+ *
+ * Starts an incremental base64 decoding.
+ */
+void
+grg_decode64_init (struct grg_b64_state *state)
+{
+	memset (state, 0, sizeof (struct grg_b64_state));
+}
+
+/**
+ * grg_decode64_update:
+ * @state: the state of the conversion
+ * @in: some more characters
+ * @inlen: how many they are
+ * @out: where to put the data; it must have room for (@inlen + 3) / 4 * 3
+ *       bytes
+ *
+ * Decodes some more characters; up to three are kept for the next call.
+ * Nothing but the alphabet is accepted, and the padding only at the end.
+ *
+ * Returns: how many bytes were written, or GRG_ARGUMENT_ERR
+ */
+long
+grg_decode64_update (struct grg_b64_state *state, const unsigned char *in,
+		     const long inlen, unsigned char *out)
+{
+	long len = inlen, done, ret, written = 0;
+
+	if (len <= 0)
+		return 0;
+
+	if (state->carried)
+	{
+		while (state->carried < 4 && len > 0)
+		{
+			state->carry[state->carried++] = *in++;
+			len--;
+		}
+
+		if (state->carried < 4)
+			return 0;
+
+		state->carried = 0;
+		ret = decode_one (state, state->carry, out);
+		if (ret < 0)
+			return ret;
+		written = ret;
+	}
+
+	while (len >= 4)
+	{
+		if (state->over)
+			return GRG_ARGUMENT_ERR;
+
+		done = decode_groups (in, len / 4 * 4, out + written);
+		in += done;
+		len -= done;
+		written += done / 4 * 3;
+
+		//a group the fast way can't take: the last, or a wrong one
+		if (len >= 4)
+		{
+			ret = decode_one (state, in, out + written);
+			if (ret < 0)
+				return ret;
+			in += 4;
+			len -= 4;
+			written += ret;
+		}
+	}
+
+	memcpy (state->carry, in, len);
+	state->carried = len;
+
+	return written;
+}
+
+/**
+ * grg_decode64_final:
+ * @state: the state of the conversion
+ *
+ * Ends an incremental base64 decoding.
+ *
+ * Returns: GRG_OK, or GRG_ARGUMENT_ERR if the characters didn't end with
+ *          a whole group
+ */
+int
+grg_decode64_final (struct grg_b64_state *state)
+{
+	int carried = state->carried;
+
+	memset (state, 0, sizeof (struct grg_b64_state));
+
+	return carried ? GRG_ARGUMENT_ERR : GRG_OK;
+}
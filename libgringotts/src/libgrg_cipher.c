@@ -0,0 +1,512 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_cipher.c - the ciphers, natively or through libmcrypt
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// libGringotts has always used the MCRYPT_CFB mode of libmcrypt, that is
+// CFB with an 8 bit feedback: every byte of data costs a whole block
+// encryption, of the last block-size bytes of ciphertext. When the CPU
+// has the AES instructions, GRG_RIJNDAEL_128 (always with a 256 bit key
+// here, so it's AES-256) is done natively, with the very same output.
+// The encryption has to go one byte after the other, since each one is
+// fed back in the next block; the decryption already knows all of the
+// ciphertext, so it works on 8 bytes at a time with AES-NI, and on 16
+// with the 512 bit VAES instructions. Everything else goes to libmcrypt.
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <mcrypt.h>
+
+#include "libgrg_crypt.h"
+#include "libgrg_cipher.h"
+
+#if (defined (__x86_64__) || defined (__i386__)) && \
+	(defined (__clang__) || (defined (__GNUC__) && __GNUC__ >= 5))
+#define GRG_CIPHER_X86
+#include <immintrin.h>
+#if defined (__clang__) || __GNUC__ >= 8
+#define GRG_CIPHER_X86_VAES
+#endif
+#endif
+
+#define AES_BLOCK	16
+#define AES256_KEY	32
+#define AES256_ROUNDS	14
+
+struct _grg_cipher
+{
+	grg_cipher_backend backend;
+	MCRYPT mod;		//only for GRG_CIPHER_MCRYPT
+	unsigned char rk[(AES256_ROUNDS + 1) * AES_BLOCK];
+	unsigned char reg[AES_BLOCK];	//the last AES_BLOCK bytes of ciphertext
+};
+
+static void
+wipe (void *data, size_t len)
+{
+	volatile unsigned char *tmp = (volatile unsigned char *) data;
+
+	while (len--)
+		*tmp++ = 0;
+}
+
+#ifdef GRG_CIPHER_X86
+
+#define AESNI_FN __attribute__ ((target ("aes,sse2")))
+
+#define AESNI_BATCH	8
+
+AESNI_FN static inline __m128i
+expand_shift (__m128i k)
+{
+	k = _mm_xor_si128 (k, _mm_slli_si128 (k, 4));
+	k = _mm_xor_si128 (k, _mm_slli_si128 (k, 4));
+	return _mm_xor_si128 (k, _mm_slli_si128 (k, 4));
+}
+
+//the round keys of AES-256, as in the Intel AES-NI white paper
+#define EXPAND_EVEN(i, rcon) \
+	rk[i] = _mm_xor_si128 (expand_shift (rk[(i) - 2]), _mm_shuffle_epi32 \
+		(_mm_aeskeygenassist_si128 (rk[(i) - 1], rcon), 0xff))
+#define EXPAND_ODD(i) \
+	rk[i] = _mm_xor_si128 (expand_shift (rk[(i) - 2]), _mm_shuffle_epi32 \
+		(_mm_aeskeygenassist_si128 (rk[(i) - 1], 0), 0xaa))
+
+AESNI_FN static void
+aesni_expand (struct _grg_cipher *c, const unsigned char *key)
+{
+	__m128i rk[AES256_ROUNDS + 1];
+	int i;
+
+	rk[0] = _mm_loadu_si128 ((const __m128i *) key);
+	rk[1] = _mm_loadu_si128 ((const __m128i *) (key + AES_BLOCK));
+	EXPAND_EVEN (2, 0x01);
+	EXPAND_ODD (3);
+	EXPAND_EVEN (4, 0x02);
+	EXPAND_ODD (5);
+	EXPAND_EVEN (6, 0x04);
+	EXPAND_ODD (7);
+	EXPAND_EVEN (8, 0x08);
+	EXPAND_ODD (9);
+	EXPAND_EVEN (10, 0x10);
+	EXPAND_ODD (11);
+	EXPAND_EVEN (12, 0x20);
+	EXPAND_ODD (13);
+	EXPAND_EVEN (14, 0x40);
+
+	for (i = 0; i <= AES256_ROUNDS; i++)
+		_mm_storeu_si128 ((__m128i *) (c->rk + i * AES_BLOCK), rk[i]);
+
+	wipe (rk, sizeof (rk));
+}
+
+AESNI_FN static inline void
+aesni_load (const struct _grg_cipher *c, __m128i * rk)
+{
+	int i;
+
+	for (i = 0; i <= AES256_ROUNDS; i++)
+		rk[i] = _mm_loadu_si128 ((const __m128i *) (c->rk +
+							    i * AES_BLOCK));
+}
+
+AESNI_FN static inline __m128i
+aesni_block (const __m128i * rk, __m128i b)
+{
+	int i;
+
+	b = _mm_xor_si128 (b, rk[0]);
+	for (i = 1; i < AES256_ROUNDS; i++)
+		b = _mm_aesenc_si128 (b, rk[i]);
+	return _mm_aesenclast_si128 (b, rk[AES256_ROUNDS]);
+}
+
+//shifts a byte of ciphertext in the register
+AESNI_FN static inline __m128i
+aesni_feed (__m128i reg, const unsigned char ct)
+{
+	return _mm_or_si128 (_mm_srli_si128 (reg, 1),
+			     _mm_slli_si128 (_mm_cvtsi32_si128 (ct), 15));
+}
+
+AESNI_FN static void
+aesni_encrypt (struct _grg_cipher *c, unsigned char *data, const long len)
+{
+	__m128i rk[AES256_ROUNDS + 1], reg;
+	long i;
+
+	aesni_load (c, rk);
+	reg = _mm_loadu_si128 ((const __m128i *) c->reg);
+
+	for (i = 0; i < len; i++)
+	{
+		data[i] ^= (unsigned char) _mm_cvtsi128_si32 (aesni_block
+							       (rk, reg));
+		reg = aesni_feed (reg, data[i]);
+	}
+
+	_mm_storeu_si128 ((__m128i *) c->reg, reg);
+	wipe (rk, sizeof (rk));
+}
+
+//decrypts a few bytes one at a time, after the batches
+AESNI_FN static void
+aesni_decrypt_tail (struct _grg_cipher *c, const __m128i * rk,
+		    unsigned char *data, const long len)
+{
+	__m128i reg;
+	unsigned char ct;
+	long i;
+
+	reg = _mm_loadu_si128 ((const __m128i *) c->reg);
+
+	for (i = 0; i < len; i++)
+	{
+		ct = data[i];
+		data[i] ^= (unsigned char) _mm_cvtsi128_si32 (aesni_block
+							       (rk, reg));
+		reg = aesni_feed (reg, ct);
+	}
+
+	_mm_storeu_si128 ((__m128i *) c->reg, reg);
+}
+
+AESNI_FN static void
+aesni_decrypt (struct _grg_cipher *c, unsigned char *data, const long len)
+{
+	__m128i rk[AES256_ROUNDS + 1], b[AESNI_BATCH];
+	//the register of the byte k of a batch starts at win + k
+	unsigned char win[AES_BLOCK + AESNI_BATCH];
+	long i;
+	int k, r;
+
+	aesni_load (c, rk);
+	memcpy (win, c->reg, AES_BLOCK);
+
+	for (i = 0; i + AESNI_BATCH <= len; i += AESNI_BATCH)
+	{
+		memcpy (win + AES_BLOCK, data + i, AESNI_BATCH);
+
+		for (k = 0; k < AESNI_BATCH; k++)
+			b[k] = _mm_xor_si128 (_mm_loadu_si128
+					      ((const __m128i *) (win + k)),
+					      rk[0]);
+		for (r = 1; r < AES256_ROUNDS; r++)
+			for (k = 0; k < AESNI_BATCH; k++)
+				b[k] = _mm_aesenc_si128 (b[k], rk[r]);
+		for (k = 0; k < AESNI_BATCH; k++)
+			data[i + k] ^= (unsigned char)
+				_mm_cvtsi128_si32 (_mm_aesenclast_si128
+						   (b[k],
+						    rk[AES256_ROUNDS]));
+
+		memmove (win, win + AESNI_BATCH, AES_BLOCK);
+	}
+
+	memcpy (c->reg, win, AES_BLOCK);
+	aesni_decrypt_tail (c, rk, data + i, len - i);
+
+	wipe (rk, sizeof (rk));
+	wipe (b, sizeof (b));
+}
+
+#ifdef GRG_CIPHER_X86_VAES
+
+#define VAES_FN __attribute__ ((target ("aes,avx512f,vaes")))
+
+#define VAES_BATCH	16
+
+VAES_FN static void
+vaes_decrypt (struct _grg_cipher *c, unsigned char *data, const long len)
+{
+	__m512i rk[AES256_ROUNDS + 1], b[VAES_BATCH / 4];
+	__m128i rk128[AES256_ROUNDS + 1];
+	unsigned char win[AES_BLOCK + VAES_BATCH], out[4 * AES_BLOCK];
+	long i;
+	int j, r;
+
+	aesni_load (c, rk128);
+	for (r = 0; r <= AES256_ROUNDS; r++)
+		rk[r] = _mm512_broadcast_i32x4 (rk128[r]);
+	memcpy (win, c->reg, AES_BLOCK);
+
+	for (i = 0; i + VAES_BATCH <= len; i += VAES_BATCH)
+	{
+		memcpy (win + AES_BLOCK, data + i, VAES_BATCH);
+
+		//each 512 bit register holds four consecutive shift registers
+		for (j = 0; j < VAES_BATCH / 4; j++)
+		{
+			b[j] = _mm512_castsi128_si512 (_mm_loadu_si128
+						       ((const __m128i *)
+							(win + 4 * j)));
+			b[j] = _mm512_inserti32x4 (b[j], _mm_loadu_si128
+						   ((const __m128i *)
+						    (win + 4 * j + 1)), 1);
+			b[j] = _mm512_inserti32x4 (b[j], _mm_loadu_si128
+						   ((const __m128i *)
+						    (win + 4 * j + 2)), 2);
+			b[j] = _mm512_inserti32x4 (b[j], _mm_loadu_si128
+						   ((const __m128i *)
+						    (win + 4 * j + 3)), 3);
+			b[j] = _mm512_xor_si512 (b[j], rk[0]);
+		}
+		for (r = 1; r < AES256_ROUNDS; r++)
+			for (j = 0; j < VAES_BATCH / 4; j++)
+				b[j] = _mm512_aesenc_epi128 (b[j], rk[r]);
+		for (j = 0; j < VAES_BATCH / 4; j++)
+		{
+			_mm512_storeu_si512 (out, _mm512_aesenclast_epi128
+					     (b[j], rk[AES256_ROUNDS]));
+			data[i + 4 * j] ^= out[0];
+			data[i + 4 * j + 1] ^= out[AES_BLOCK];
+			data[i + 4 * j + 2] ^= out[2 * AES_BLOCK];
+			data[i + 4 * j + 3] ^= out[3 * AES_BLOCK];
+		}
+
+		memmove (win, win + VAES_BATCH, AES_BLOCK);
+	}
+
+	memcpy (c->reg, win, AES_BLOCK);
+	aesni_decrypt_tail (c, rk128, data + i, len - i);
+
+	wipe (rk, sizeof (rk));
+	wipe (rk128, sizeof (rk128));
+	wipe (b, sizeof (b));
+	wipe (out, sizeof (out));
+}
+
+#endif //GRG_CIPHER_X86_VAES
+
+#endif //GRG_CIPHER_X86
+
+/**
+ * grg_cipher_best_backend:
+ * @algo: the algorithm
+ *
+ * Tells the fastest implementation of an algorithm on this CPU.
+ *
+ * Returns: the backend grg_cipher_open() uses for @algo
+ */
+grg_cipher_backend
+grg_cipher_best_backend (const grg_crypt_algo algo)
+{
+	if (algo != GRG_RIJNDAEL_128)
+		return GRG_CIPHER_MCRYPT;
+
+#ifdef GRG_CIPHER_X86
+	__builtin_cpu_init ();
+#ifdef GRG_CIPHER_X86_VAES
+	if (__builtin_cpu_supports ("vaes")
+	    && __builtin_cpu_supports ("avx512f"))
+		return GRG_CIPHER_VAES;
+#endif
+	if (__builtin_cpu_supports ("aes"))
+		return GRG_CIPHER_AESNI;
+#endif
+
+	return GRG_CIPHER_MCRYPT;
+}
+
+/**
+ * grg_cipher_open_backend:
+ * @backend: the implementation to use
+ * @algo: the algorithm
+ * @key: the key
+ * @keylen: its length
+ * @IV: the initialization vector, as long as a block of @algo
+ *
+ * Prepares a cipher for a sequence of grg_cipher_encrypt() or
+ * grg_cipher_decrypt() calls, that continue each other.
+ *
+ * Returns: the cipher, to close with grg_cipher_close(), or NULL if
+ * @backend can't do @algo (on this CPU), or on errors
+ */
+GRG_CIPHER
+grg_cipher_open_backend (const grg_cipher_backend backend,
+			 const grg_crypt_algo algo,
+			 const unsigned char *key, const int keylen,
+			 const unsigned char *IV)
+{
+	struct _grg_cipher *c;
+
+	if (backend != GRG_CIPHER_MCRYPT)
+	{
+		if (algo != GRG_RIJNDAEL_128 || keylen != AES256_KEY)
+			return NULL;
+		//a faster backend can do all that the slower ones do
+		if (backend > grg_cipher_best_backend (algo))
+			return NULL;
+	}
+
+	//it will hold the key schedule
+	c = (struct _grg_cipher *) grg_secure_alloc (sizeof (struct _grg_cipher));
+	if (!c)
+		return NULL;
+	memset (c, 0, sizeof (struct _grg_cipher));
+
+	c->backend = backend;
+	c->mod = MCRYPT_FAILED;
+
+	if (backend == GRG_CIPHER_MCRYPT)
+	{
+		c->mod = mcrypt_module_open (grg2mcrypt (algo), NULL,
+					     MCRYPT_CFB, NULL);
+		if (c->mod == MCRYPT_FAILED)
+		{
+			grg_secure_free (NULL, c, sizeof (struct _grg_cipher));
+			return NULL;
+		}
+
+		if (mcrypt_generic_init (c->mod, (void *) key, keylen,
+					 (void *) IV) < 0)
+		{
+			mcrypt_module_close (c->mod);
+			grg_secure_free (NULL, c, sizeof (struct _grg_cipher));
+			return NULL;
+		}
+
+		return c;
+	}
+
+#ifdef GRG_CIPHER_X86
+	aesni_expand (c, key);
+#endif
+	memcpy (c->reg, IV, AES_BLOCK);
+
+	return c;
+}
+
+/**
+ * grg_cipher_open:
+ * @algo: the algorithm
+ * @key: the key
+ * @keylen: its length
+ * @IV: the initialization vector, as long as a block of @algo
+ *
+ * As grg_cipher_open_backend(), with the fastest backend for @algo.
+ *
+ * Returns: the cipher, to close with grg_cipher_close(), or NULL on errors
+ */
+GRG_CIPHER
+grg_cipher_open (const grg_crypt_algo algo, const unsigned char *key,
+		 const int keylen, const unsigned char *IV)
+{
+	GRG_CIPHER c;
+
+	c = grg_cipher_open_backend (grg_cipher_best_backend (algo), algo,
+				     key, keylen, IV);
+	if (!c)
+		c = grg_cipher_open_backend (GRG_CIPHER_MCRYPT, algo, key,
+					     keylen, IV);
+
+	return c;
+}
+
+//libmcrypt takes an int as the length; CFB mode goes on across the calls
+#define MCRYPT_STEP	(1L << 30)
+
+static void
+mcrypt_run (MCRYPT mod, unsigned char *data, long len, const int decrypt)
+{
+	long step;
+
+	for (; len > 0; data += step, len -= step)
+	{
+		step = (len > MCRYPT_STEP) ? MCRYPT_STEP : len;
+		if (decrypt)
+			mdecrypt_generic (mod, data, step);
+		else
+			mcrypt_generic (mod, data, step);
+	}
+}
+
+/**
+ * grg_cipher_encrypt:
+ * @cipher: the cipher
+ * @data: the data to encrypt, in place
+ * @len: their length
+ *
+ * Encrypts some data, continuing from the previous call.
+ */
+void
+grg_cipher_encrypt (GRG_CIPHER cipher, unsigned char *data, const long len)
+{
+	switch (cipher->backend)
+	{
+#ifdef GRG_CIPHER_X86
+	case GRG_CIPHER_AESNI:
+	case GRG_CIPHER_VAES:
+		aesni_encrypt (cipher, data, len);
+		break;
+#endif
+	default:
+		mcrypt_run (cipher->mod, data, len, FALSE);
+	}
+}
+
+/**
+ * grg_cipher_decrypt:
+ * @cipher: the cipher
+ * @data: the data to decrypt, in place
+ * @len: their length
+ *
+ * Decrypts some data, continuing from the previous call.
+ */
+void
+grg_cipher_decrypt (GRG_CIPHER cipher, unsigned char *data, const long len)
+{
+	switch (cipher->backend)
+	{
+#ifdef GRG_CIPHER_X86
+#ifdef GRG_CIPHER_X86_VAES
+	case GRG_CIPHER_VAES:
+		vaes_decrypt (cipher, data, len);
+		break;
+#endif
+	case GRG_CIPHER_AESNI:
+		aesni_decrypt (cipher, data, len);
+		break;
+#endif
+	default:
+		mcrypt_run (cipher->mod, data, len, TRUE);
+	}
+}
+
+/**
+ * grg_cipher_close:
+ * @cipher: the cipher
+ *
+ * Frees a cipher, wiping its key.
+ */
+void
+grg_cipher_close (GRG_CIPHER cipher)
+{
+	if (!cipher)
+		return;
+
+	if (cipher->mod != MCRYPT_FAILED)
+	{
+		mcrypt_generic_deinit (cipher->mod);
+		mcrypt_module_close (cipher->mod);
+	}
+
+	grg_secure_free (NULL, cipher, sizeof (struct _grg_cipher));
+}
@@ -0,0 +1,54 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_cipher.h - header file for libgrg_cipher.c
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef LIBGRG_CIPHER_H
+#define LIBGRG_CIPHER_H
+
+#include "libgringotts.h"
+
+//a cipher in (8 bit) CFB mode, keyed and ready to use
+typedef struct _grg_cipher *GRG_CIPHER;
+
+//the implementations a GRG_CIPHER can use
+typedef enum
+{
+	GRG_CIPHER_MCRYPT,
+	GRG_CIPHER_AESNI,
+	GRG_CIPHER_VAES
+}
+grg_cipher_backend;
+
+grg_cipher_backend grg_cipher_best_backend (const grg_crypt_algo algo);
+GRG_CIPHER grg_cipher_open (const grg_crypt_algo algo,
+			    const unsigned char *key, const int keylen,
+			    const unsigned char *IV);
+GRG_CIPHER grg_cipher_open_backend (const grg_cipher_backend backend,
+				    const grg_crypt_algo algo,
+				    const unsigned char *key,
+				    const int keylen,
+				    const unsigned char *IV);
+void grg_cipher_encrypt (GRG_CIPHER cipher, unsigned char *data,
+			 const long len);
+void grg_cipher_decrypt (GRG_CIPHER cipher, unsigned char *data,
+			 const long len);
+void grg_cipher_close (GRG_CIPHER cipher);
+
+#endif
@@ -0,0 +1,224 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_crc.c - the CRC32 of the data formats
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// The checksum is the one of MHASH_CRC32 in libmhash, that the formats
+// have always used: polynomial 0x04C11DB7, most significant bit first,
+// starting from 0xFFFFFFFF and complemented at the end, and stored
+// least significant byte first. It's computed eight bytes at a time with
+// the "slicing-by-8" tables, or, when the CPU has the carry-less
+// multiplication, by folding 64 bytes at a time with PCLMULQDQ, as in
+// the Intel paper "Fast CRC Computation for Generic Polynomials Using
+// PCLMULQDQ Instruction".
+
+#include <pthread.h>
+
+#include "libgrg_crc.h"
+
+#define CRC32_POLY	0x04C11DB7U
+
+//T[k][b] is the CRC of the byte b followed by k zeroes
+static uint32_t T[8][256];
+static pthread_once_t T_once = PTHREAD_ONCE_INIT;
+
+static void
+make_tables (void)
+{
+	uint32_t c;
+	int i, k;
+
+	for (i = 0; i < 256; i++)
+	{
+		c = (uint32_t) i << 24;
+		for (k = 0; k < 8; k++)
+			c = (c & 0x80000000U) ? (c << 1) ^ CRC32_POLY : c << 1;
+		T[0][i] = c;
+	}
+
+	for (k = 1; k < 8; k++)
+		for (i = 0; i < 256; i++)
+			T[k][i] = (T[k - 1][i] << 8) ^ T[0][T[k - 1][i] >> 24];
+}
+
+static uint32_t
+crc32_slice8 (uint32_t crc, const unsigned char *p, long len)
+{
+	for (; len >= 8; p += 8, len -= 8)
+	{
+		crc ^= ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+			((uint32_t) p[2] << 8) | p[3];
+		crc = T[7][crc >> 24] ^ T[6][(crc >> 16) & 0xff] ^
+			T[5][(crc >> 8) & 0xff] ^ T[4][crc & 0xff] ^
+			T[3][p[4]] ^ T[2][p[5]] ^ T[1][p[6]] ^ T[0][p[7]];
+	}
+
+	for (; len > 0; p++, len--)
+		crc = (crc << 8) ^ T[0][(crc >> 24) ^ *p];
+
+	return crc;
+}
+
+#if (defined (__x86_64__) || defined (__i386__)) && \
+	(defined (__clang__) || (defined (__GNUC__) && __GNUC__ >= 5))
+#define GRG_CRC_CLMUL
+#include <immintrin.h>
+
+#define CLMUL_FN __attribute__ ((target ("pclmul,ssse3")))
+
+//below this, the tables are just as fast
+#define CLMUL_MIN	256
+
+static int clmul_ok;
+static pthread_once_t clmul_once = PTHREAD_ONCE_INIT;
+
+static void
+detect_clmul (void)
+{
+	__builtin_cpu_init ();
+	clmul_ok = __builtin_cpu_supports ("pclmul")
+		&& __builtin_cpu_supports ("ssse3");
+}
+
+//loads 16 bytes as a polynomial, the first byte giving the highest terms
+CLMUL_FN static inline __m128i
+load_be (const unsigned char *p)
+{
+	const __m128i rev = _mm_set_epi8 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+					  11, 12, 13, 14, 15);
+
+	return _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) p), rev);
+}
+
+//x * x^N, reduced to 96 bits; k holds x^N and x^(N+64) modulo the polynomial
+CLMUL_FN static inline __m128i
+fold (const __m128i x, const __m128i k)
+{
+	return _mm_xor_si128 (_mm_clmulepi64_si128 (x, k, 0x00),
+			      _mm_clmulepi64_si128 (x, k, 0x11));
+}
+
+//processes the data 16 bytes at a time, leaving the rest to the caller
+CLMUL_FN static uint32_t
+crc32_clmul (uint32_t crc, const unsigned char *p, long *len)
+{
+	const __m128i k512 = _mm_set_epi32 (0, 0x8833794c, 0, 0xe6228b11);
+	const __m128i k128 = _mm_set_epi32 (0, 0xc5b9cd4c, 0, 0xe8a45605);
+	const __m128i rev = _mm_set_epi8 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+					  11, 12, 13, 14, 15);
+	__m128i x0, x1, x2, x3;
+	unsigned char last[16];
+	long rem = *len;
+
+	//the register is added to the first 32 bits of data
+	x0 = _mm_xor_si128 (load_be (p), _mm_slli_si128 (_mm_cvtsi32_si128
+							 ((int) crc), 12));
+	x1 = load_be (p + 16);
+	x2 = load_be (p + 32);
+	x3 = load_be (p + 48);
+	p += 64;
+	rem -= 64;
+
+	for (; rem >= 64; p += 64, rem -= 64)
+	{
+		x0 = _mm_xor_si128 (fold (x0, k512), load_be (p));
+		x1 = _mm_xor_si128 (fold (x1, k512), load_be (p + 16));
+		x2 = _mm_xor_si128 (fold (x2, k512), load_be (p + 32));
+		x3 = _mm_xor_si128 (fold (x3, k512), load_be (p + 48));
+	}
+
+	x1 = _mm_xor_si128 (fold (x0, k128), x1);
+	x2 = _mm_xor_si128 (fold (x1, k128), x2);
+	x3 = _mm_xor_si128 (fold (x2, k128), x3);
+
+	for (; rem >= 16; p += 16, rem -= 16)
+		x3 = _mm_xor_si128 (fold (x3, k128), load_be (p));
+
+	//the last 128 bits left go through the tables, from a zero register
+	_mm_storeu_si128 ((__m128i *) last, _mm_shuffle_epi8 (x3, rev));
+	*len = rem;
+
+	return crc32_slice8 (0, last, 16);
+}
+
+#endif //GRG_CRC_CLMUL
+
+/**
+ * grg_crc32_update:
+ * @crc: the register, GRG_CRC32_INIT at first
+ * @data: some more data
+ * @len: their length
+ *
+ * Adds data to a CRC32 computation.
+ *
+ * Returns: the new register
+ */
+uint32_t
+grg_crc32_update (uint32_t crc, const unsigned char *data, const long len)
+{
+	long rem = len;
+
+	pthread_once (&T_once, make_tables);
+
+#ifdef GRG_CRC_CLMUL
+	if (rem >= CLMUL_MIN)
+	{
+		pthread_once (&clmul_once, detect_clmul);
+		if (clmul_ok)
+		{
+			crc = crc32_clmul (crc, data, &rem);
+			data += len - rem;
+		}
+	}
+#endif
+
+	return crc32_slice8 (crc, data, rem);
+}
+
+/**
+ * grg_crc32_final:
+ * @crc: the register, after all the data
+ * @CRC: where to store the LIBGRG_CRC_LEN bytes of the checksum
+ *
+ * Ends a CRC32 computation.
+ */
+void
+grg_crc32_final (const uint32_t crc, unsigned char *CRC)
+{
+	uint32_t c = ~crc;
+
+	CRC[0] = c & 0xff;
+	CRC[1] = (c >> 8) & 0xff;
+	CRC[2] = (c >> 16) & 0xff;
+	CRC[3] = c >> 24;
+}
+
+/**
+ * grg_crc32:
+ * @data: a byte sequence
+ * @len: its length
+ * @CRC: where to store the LIBGRG_CRC_LEN bytes of the checksum
+ *
+ * Computes the CRC32 of a byte sequence, in one go.
+ */
+void
+grg_crc32 (const unsigned char *data, const long len, unsigned char *CRC)
+{
+	grg_crc32_final (grg_crc32_update (GRG_CRC32_INIT, data, len), CRC);
+}
@@ -0,0 +1,36 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_crc.h - header file for libgrg_crc.c
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef LIBGRG_CRC_H
+#define LIBGRG_CRC_H
+
+#include <stdint.h>
+
+//the register of a CRC32 computation, before any data
+#define GRG_CRC32_INIT	0xffffffffU
+
+uint32_t grg_crc32_update (uint32_t crc, const unsigned char *data,
+			   const long len);
+void grg_crc32_final (const uint32_t crc, unsigned char *CRC);
+void grg_crc32 (const unsigned char *data, const long len,
+		unsigned char *CRC);
+
+#endif
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stddef.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -31,11 +32,26 @@
 #include "libgrg_crypt.h"
 #include "libgrg_utils.h"
 #include "libgrg_structs.h"
+#include "libgrg_probes.h"
+#include "libgrg_threads.h"
+#include "libgrg_cipher.h"
+#include "libgrg_crc.h"
+#include "libgrg_aio.h"
 #include "libgringotts.h"
 
-#include <mhash.h>
 #include <zlib.h>
 #include <bzlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+//the compression algorithms, by their value of COMP in version 5
+static const grg_comp_algo comp_ids[LIBGRG_COMP_IDS] =
+	{ GRG_ZLIB, GRG_BZIP, GRG_ZSTD, GRG_LZ4 };
 
 unsigned int
 grg_get_key_size_static (const grg_crypt_algo crypt_algo)
@@ -49,7 +65,7 @@ grg_get_key_size_static (const grg_crypt_algo crypt_algo)
 unsigned int
 grg_get_key_size (const GRG_CTX gctx)
 {
-	return grg_get_key_size_static (gctx->crypt_algo);
+	return grg_get_key_size_static (grg_ctx_get_crypt_algo (gctx));
 }
 
 unsigned int
@@ -69,38 +85,48 @@ grg_get_block_size_static (const grg_crypt_algo crypt_algo)
 unsigned int
 grg_get_block_size (const GRG_CTX gctx)
 {
-	return grg_get_block_size_static (gctx->crypt_algo);
+	return grg_get_block_size_static (grg_ctx_get_crypt_algo (gctx));
+}
+
+int
+grg_comp_algo_supported (const grg_comp_algo comp_algo)
+{
+	switch (comp_algo)
+	{
+	case GRG_ZLIB:
+	case GRG_BZIP:
+		return TRUE;
+#ifdef HAVE_ZSTD
+	case GRG_ZSTD:
+		return TRUE;
+#endif
+#ifdef HAVE_LZ4
+	case GRG_LZ4:
+		return TRUE;
+#endif
+	default:
+		return FALSE;
+	}
 }
 
 /**
- * get_CRC32:
- * @string: a byte sequence
- * @strlen: the length of the string
+ * needs_comp_byte:
+ * @gctx: the context
  *
- * Computes the CRC32 checksum of a byte sequence.
+ * Tells if the compression algorithm doesn't fit in ALGO, so that the
+ * data must be in a chunked format.
  *
- * Returns: the checksum
+ * Returns: TRUE or FALSE
  */
-static unsigned char *
-get_CRC32 (const unsigned char *string, const long strlen)
+static int
+needs_comp_byte (const GRG_CTX gctx)
 {
-	MHASH td;
-	unsigned char *ret;
-
-	td = mhash_init (MHASH_CRC32);
-
-	if (td == MHASH_FAILED)
-		exit (1);
-
-	mhash (td, string, strlen);
-
-	ret = mhash_end (td);
-
-	return ret;
+	return gctx->comp_algo != GRG_ZLIB && gctx->comp_algo != GRG_BZIP;
 }
 
 /**
  * compare_CRC32:
+ * @gctx: the context, to count the bytes checked with
  * @CRC: the CRC to compare to
  * @toCheck: the byte sequence to compare the CRC to
  * @len: the byte sequence length
@@ -111,11 +137,10 @@ get_CRC32 (const unsigned char *string, const long strlen)
  * Returns: TRUE or FALSE
  */
 static int
-compare_CRC32 (const unsigned char *CRC, const unsigned char *toCheck,
-	       const long len)
+compare_CRC32 (const GRG_CTX gctx, const unsigned char *CRC,
+	       const unsigned char *toCheck, const long len)
 {
-	unsigned char *CRC2;
-	int ret;
+	unsigned char CRC2[LIBGRG_CRC_LEN];
 
 	if (!CRC || !toCheck)
 		return 0;
@@ -123,13 +148,10 @@ compare_CRC32 (const unsigned char *CRC, const unsigned char *toCheck,
 	if (!len)
 		return 1;
 
-	CRC2 = get_CRC32 (toCheck, len);
-
-	ret = !memcmp (CRC, CRC2, LIBGRG_CRC_LEN);
+	grg_crc32 (toCheck, len, CRC2);
+	GRG_COUNT (gctx, bytes_crc, len);
 
-	free (CRC2);
-
-	return ret;
+	return !memcmp (CRC, CRC2, LIBGRG_CRC_LEN);
 }
 
 char *
@@ -166,18 +188,86 @@ grg2mcrypt (const grg_crypt_algo algo)
 	}
 }
 
+/**
+ * validate_chunks:
+ * @gctx: the context, to count the bytes checked with
+ * @mem: a version 5 data sequence
+ * @memDim: its length
+ *
+ * Checks the CRC32 of the header and of the chunk table, and then the
+ * position and CRC32 of every chunk.
+ *
+ * Returns: GRG_OK or an error code
+ */
 static int
-validate_mem (const GRG_CTX gctx, const void *mem, const long memDim)
+validate_chunks (const GRG_CTX gctx, const unsigned char *mem,
+		 const long memDim)
+{
+	const unsigned char *entry;
+	long count, chunkSize, dataPos, i;
+	long long offset, len;
+	int dIV;
+
+	if (memDim < LIBGRG_TABLE_POS)
+		return GRG_READ_CRC_ERR;
+
+	chunkSize = grg_char2long (mem + LIBGRG_CHUNK_SIZE_POS);
+	count = grg_char2long (mem + LIBGRG_CHUNK_COUNT_POS);
+
+	if (chunkSize < 1 || chunkSize > LIBGRG_CHUNK_SIZE_MAX || count < 1 ||
+	    count > (memDim - LIBGRG_TABLE_POS) / LIBGRG_CHUNK_ENTRY_LEN)
+		return GRG_READ_CRC_ERR;
+
+	dataPos = LIBGRG_TABLE_POS + count * LIBGRG_CHUNK_ENTRY_LEN;
+
+	if (!compare_CRC32 (gctx, mem + HEADER_LEN + LIBGRG_FILE_VERSION_LEN,
+			    mem + LIBGRG_ALGO_POS, dataPos - LIBGRG_ALGO_POS))
+		return GRG_READ_CRC_ERR;
+
+	if (mem[LIBGRG_COMP_ID_POS] >= LIBGRG_COMP_IDS)
+		return GRG_READ_UNSUPPORTED_VERSION;
+
+	dIV = grg_get_block_size_static (mem[LIBGRG_ALGO_POS] &
+					 GRG_ENCRYPT_MASK);
+
+	for (i = 0; i < count; i++)
+	{
+		entry = mem + LIBGRG_TABLE_POS + i * LIBGRG_CHUNK_ENTRY_LEN;
+		offset = grg_char2llong (entry);
+		len = grg_char2llong (entry + LIBGRG_OFFSET_LEN);
+
+		if (offset < dataPos || offset > memDim ||
+		    len < dIV + LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN ||
+		    len > memDim - offset)
+			return GRG_READ_CRC_ERR;
+
+		if (!compare_CRC32 (gctx, entry + 2 * LIBGRG_OFFSET_LEN,
+				    mem + offset, len))
+			return GRG_READ_CRC_ERR;
+	}
+
+	return GRG_OK;
+}
+
+/**
+ * check_mem:
+ * @gctx: the context, giving the header to expect
+ * @mem: a data sequence
+ * @memDim: its length
+ *
+ * Checks the header, the version and the outer CRC32s of some data.
+ *
+ * Returns: the version of the data, or an error code
+ */
+static int
+check_mem (const GRG_CTX gctx, const void *mem, const long memDim)
 {
 	unsigned char vers;
 	unsigned char *tmp;
 	long rem;
 
-	if (!gctx || !mem)
-		return GRG_ARGUMENT_ERR;
-
 	tmp = (unsigned char *) mem;
-	rem = (memDim >= 0) ? memDim : strlen (mem);
+	rem = memDim;
 
 	//checks the ID header
 	if (memcmp (gctx->header, mem, HEADER_LEN))
@@ -191,27 +281,110 @@ validate_mem (const GRG_CTX gctx, const void *mem, const long memDim)
 	tmp++;
 	rem--;
 
-	if (vers != 3)		//add here all the supported versions
+	if (LIBGRG_IS_CHUNKED (vers))
+	{
+		int err = validate_chunks (gctx, mem, memDim);
+
+		return (err < 0) ? err : vers;
+	}
+
+	if (!LIBGRG_IS_SINGLE (vers))	//add here all the supported versions
 		return GRG_READ_UNSUPPORTED_VERSION;
 
 	//checks the 1st CRC
-	if (!compare_CRC32 (tmp, tmp + LIBGRG_CRC_LEN, rem - LIBGRG_CRC_LEN))
+	if (!compare_CRC32 (gctx, tmp, tmp + LIBGRG_CRC_LEN,
+			    rem - LIBGRG_CRC_LEN))
 		return GRG_READ_CRC_ERR;
 
 	return vers;
 }
 
+static int
+validate_mem (const GRG_CTX gctx, const void *mem, const long memDim)
+{
+	long len;
+	int ret;
+
+	if (!gctx || !mem)
+		return GRG_ARGUMENT_ERR;
+
+	len = (memDim >= 0) ? memDim : (long) strlen (mem);
+
+	GRG_TRACE (gctx, GRG_STAGE_VALIDATE, GRG_TRACE_BEGIN, len);
+	GRG_PROBE1 (validate__begin, len);
+	ret = check_mem (gctx, mem, len);
+	GRG_TRACE (gctx, GRG_STAGE_VALIDATE, GRG_TRACE_END,
+		   (ret < 0) ? ret : len);
+	GRG_PROBE1 (validate__end, (ret < 0) ? ret : len);
+
+	return ret;
+}
+
+/**
+ * grg_params_from_mem:
+ * @params: where to store the parameters
+ * @mem: validated data; only the head is read, up to LIBGRG_DATA_POS or,
+ *       for the chunked format, to LIBGRG_TABLE_POS
+ *
+ * Reads the parameters some data were written with.
+ */
+void
+grg_params_from_mem (struct grg_params *params, const void *mem)
+{
+	const unsigned char *tmp = (const unsigned char *) mem;
+	unsigned char algo = tmp[LIBGRG_ALGO_POS];
+	int vers = tmp[HEADER_LEN] - '0';
+
+	params->version = vers;
+	params->crypt_algo = (unsigned char) (algo & GRG_ENCRYPT_MASK);
+	params->hash_algo = (unsigned char) (algo & GRG_HASH_MASK);
+	params->comp_algo = (unsigned char) (algo & GRG_COMP_TYPE_MASK);
+	params->comp_lvl = (unsigned char) (algo & GRG_COMP_LVL_MASK);
+	params->comp_level = 0;
+
+	params->chunk_size = 0;
+
+	if (!LIBGRG_IS_CHUNKED (vers))
+		return;
+
+	if (tmp[LIBGRG_COMP_ID_POS] < LIBGRG_COMP_IDS)
+	{
+		params->comp_algo = comp_ids[tmp[LIBGRG_COMP_ID_POS]];
+		params->comp_level = (signed char) tmp[LIBGRG_COMP_LEVEL_POS];
+	}
+
+	//so that the data are saved back in the same format; the chunks of
+	//an unchunked context are as long as they can be
+	params->chunk_size = grg_char2long (tmp + LIBGRG_CHUNK_SIZE_POS);
+	if (params->chunk_size == LIBGRG_CHUNK_SIZE_MAX)
+		params->chunk_size = 0;
+}
+
+/**
+ * snapshot_for_mem:
+ * @gctx: the context
+ * @mem: validated data
+ * @op: where to put a snapshot of the context, set up to read the data
+ * @params: where to store the parameters of the data, or NULL
+ *
+ * Prepares the decryption of some data, leaving @gctx alone.
+ */
 static void
-update_gctx_from_mem (GRG_CTX gctx, const char algo)
+snapshot_for_mem (const GRG_CTX gctx, const void *mem,
+		  struct _grg_context *op, struct grg_params *params)
 {
-	gctx->crypt_algo = (unsigned char) (algo & GRG_ENCRYPT_MASK);
-	gctx->hash_algo = (unsigned char) (algo & GRG_HASH_MASK);
-	gctx->comp_algo = (unsigned char) (algo & GRG_COMP_TYPE_MASK);
-	gctx->comp_lvl = (unsigned char) (algo & GRG_COMP_LVL_MASK);
+	struct grg_params found;
+
+	grg_params_from_mem (&found, mem);
+	grg_ctx_snapshot (gctx, op);
+	grg_ctx_set_params (op, &found);
+
+	if (params)
+		memcpy (params, &found, sizeof (struct grg_params));
 }
 
-static unsigned char *
-select_key (const GRG_CTX gctx, const GRG_KEY keystruct, int *dim)
+unsigned char *
+grg_select_key (const GRG_CTX gctx, const GRG_KEY keystruct, int *dim)
 {
 	unsigned char *key;
 
@@ -220,604 +393,3118 @@ select_key (const GRG_CTX gctx, const GRG_KEY keystruct, int *dim)
 	else
 		*dim = 32;
 
+	key = (unsigned char *) grg_secure_alloc (*dim);
+	if (!key)
+		return NULL;
+
 	if (gctx->hash_algo == GRG_SHA1)
-		key = grg_memdup (((*dim ==
-				     24) ? (unsigned char *)keystruct->
-				    key_192_sha : (unsigned char *)keystruct->key_256_sha),
-				   *dim);
+		memcpy (key, (*dim == 24) ? keystruct->key_192_sha :
+			keystruct->key_256_sha, *dim);
 	else
-		key = grg_memdup (((*dim ==
-				     24) ? (unsigned char *)keystruct->
-				    key_192_ripe : (unsigned char *)keystruct->key_256_ripe),
-				   *dim);
+		memcpy (key, (*dim == 24) ? keystruct->key_192_ripe :
+			keystruct->key_256_ripe, *dim);
 
 	return key;
 }
 
-static int
-decrypt_mem (const GRG_CTX gctx, const GRG_KEY keystruct, const void *mem,
-	     long memDim, unsigned char **origData, long *origDim)
+/**
+ * grg_key_check_value:
+ * @algo: the encryption algorithm
+ * @key: the key of a block, already XOR'ed with its IV
+ * @dKey: its length
+ * @IV: the IV of the block
+ * @dIV: its length
+ * @kcv: where to store the LIBGRG_KCV_LEN bytes of the value
+ *
+ * Computes the key check value of a version 4 block, or of the first
+ * chunk of a version 5 one.
+ *
+ * Returns: TRUE, or FALSE if the cipher can't be set up
+ */
+int
+grg_key_check_value (const grg_crypt_algo algo, const unsigned char *key,
+		     const int dKey, const unsigned char *IV, const int dIV,
+		     unsigned char *kcv)
 {
-	unsigned char *IV, *ecdata, *curdata, *dimdata, *key, *CRC32b;
-	int dIV, len, curlen, keylen, err;
-	char *tmp;
-	unsigned long oDim;
-	MCRYPT mod;
-
-	len = memDim - LIBGRG_DATA_POS;
-	tmp = ((char *) mem) + LIBGRG_DATA_POS;
+	unsigned char notIV[LIBGRG_IV_SIZE_MAX];
+	GRG_CIPHER cipher;
+	int i;
 
-	dIV = grg_get_block_size_static (gctx->crypt_algo);
-	IV = grg_memdup ((unsigned char *)tmp, dIV);
-	if (!IV){
-		return GRG_MEM_ALLOCATION_ERR;
-	}
+	for (i = 0; i < dIV; i++)
+		notIV[i] = (unsigned char) ~IV[i];
 
-	tmp += dIV;
-	len -= dIV;
+	cipher = grg_cipher_open (algo, key, dKey, notIV);
+	if (!cipher)
+		return FALSE;
 
-	ecdata = grg_memdup ((unsigned char *)tmp, len);
-	if (!ecdata)
-	{
-		grg_unsafe_free (IV);
-		return GRG_MEM_ALLOCATION_ERR;
-	}
+	memset (kcv, 0, LIBGRG_KCV_LEN);
+	grg_cipher_encrypt (cipher, kcv, LIBGRG_KCV_LEN);
+	grg_cipher_close (cipher);
 
-	curdata = ecdata;
-	curlen = len;
+	return TRUE;
+}
 
-	//decrypts the encrypted data
-	mod = mcrypt_module_open (grg2mcrypt (gctx->crypt_algo), NULL,
-				  MCRYPT_CFB, NULL);
+/**
+ * block_kcv:
+ * @gctx: the context, giving the algorithms
+ * @keystruct: the key
+ * @IV: the IV of a block
+ * @kcv: where to store the key check value of the block
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+block_kcv (const GRG_CTX gctx, const GRG_KEY keystruct,
+	   const unsigned char *IV, unsigned char *kcv)
+{
+	unsigned char *key;
+	int dIV, dKey, ok;
 
-	if (mod == MCRYPT_FAILED)
-	{
-		grg_unsafe_free (ecdata);
-		grg_unsafe_free (IV);
-		return GRG_READ_ENC_INIT_ERR;
-	}
+	dIV = grg_get_block_size_static (gctx->crypt_algo);
 
-	key = select_key (gctx, keystruct, &keylen);
+	key = grg_select_key (gctx, keystruct, &dKey);
 	if (!key)
-	{
-		grg_unsafe_free (ecdata);
-		grg_unsafe_free (IV);
 		return GRG_MEM_ALLOCATION_ERR;
-	}
 
-	grg_XOR_mem (key, keylen, IV, dIV);
+	grg_XOR_mem (key, dKey, (unsigned char *) IV, dIV);
 
-	mcrypt_generic_init (mod, key, keylen, IV);
-	grg_free (gctx, key, keylen);
+	ok = grg_key_check_value (gctx->crypt_algo, key, dKey, IV, dIV, kcv);
+	grg_secure_free (gctx, key, dKey);
 	key = NULL;
-	grg_unsafe_free (IV);
 
-	mdecrypt_generic (mod, ecdata, len);
+	if (!ok)
+		return GRG_READ_ENC_INIT_ERR;
 
-	mcrypt_generic_deinit (mod);
-	mcrypt_module_close (mod);
+	GRG_COUNT (gctx, bytes_encrypted, LIBGRG_KCV_LEN);
 
-	//checks the 2nd CRC32
+	return GRG_OK;
+}
 
-	CRC32b = grg_memdup (ecdata, LIBGRG_CRC_LEN);
-	if (!CRC32b)
-	{
-		grg_unsafe_free (ecdata);
-		return GRG_MEM_ALLOCATION_ERR;
-	}
+/**
+ * check_key:
+ * @gctx: the context, already updated with the algorithms used
+ * @keystruct: the key
+ * @mem: a data sequence
+ * @memDim: its length
+ *
+ * Verifies the password against the key check value of a version 4 or 5
+ * data sequence, before anything is decrypted; the other versions pass.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+check_key (const GRG_CTX gctx, const GRG_KEY keystruct,
+	   const unsigned char *mem, const long memDim)
+{
+	unsigned char kcv[LIBGRG_KCV_LEN];
+	const unsigned char *IV, *stored;
+	long long offset;
+	int dIV, vers, err;
 
-	curdata += LIBGRG_CRC_LEN;
-	curlen -= LIBGRG_CRC_LEN;
+	vers = mem[HEADER_LEN] - '0';
+	dIV = grg_get_block_size_static (gctx->crypt_algo);
 
-	if (!compare_CRC32 (CRC32b, curdata, curlen))
+	if (vers == LIBGRG_KCV_FILE_VERSION)
 	{
-		grg_unsafe_free (ecdata);
-		grg_unsafe_free (CRC32b);
-		return GRG_READ_PWD_ERR;
-	}
+		if (memDim < LIBGRG_KCV_DATA_POS + dIV)
+			return GRG_READ_CRC_ERR;
 
-	grg_unsafe_free (CRC32b);
-
-	//reads the uncompressed data length
-
-	dimdata = grg_memdup (curdata, LIBGRG_DATA_DIM_LEN);
-	if (!dimdata)
-	{
-		grg_unsafe_free (ecdata);
-		return GRG_MEM_ALLOCATION_ERR;
+		stored = mem + LIBGRG_KCV_POS;
+		IV = mem + LIBGRG_KCV_DATA_POS;
 	}
-
-	curdata += LIBGRG_DATA_DIM_LEN;
-	curlen -= LIBGRG_DATA_DIM_LEN;
-
-	oDim = grg_char2long (dimdata);
-
-	grg_free (gctx, dimdata, LIBGRG_DATA_DIM_LEN);
-	dimdata = NULL;
-
-	//uncompress the final data
-	if (gctx->comp_lvl)
+	else if (LIBGRG_IS_CHUNKED (vers))
 	{
-		unsigned char *tmpData = (unsigned char *) malloc (oDim);
-
-		if (!tmpData)
-		{
-			grg_unsafe_free (ecdata);
-			return GRG_MEM_ALLOCATION_ERR;
-		}
-
-		if (gctx->comp_algo)	//bz2
-		{
-			unsigned int uint_oDim = oDim;
-			err = BZ2_bzBuffToBuffDecompress ((char *)tmpData, &uint_oDim,
-							  (char *) curdata, curlen,
-							  USE_BZ2_SMALL_MEM, 0);
-			oDim = uint_oDim;
-		}
-		else		//zlib
-			err = uncompress (tmpData, &oDim, curdata, curlen);
+		//the IV of the first chunk
+		if (memDim < LIBGRG_TABLE_POS + LIBGRG_CHUNK_ENTRY_LEN)
+			return GRG_READ_CRC_ERR;
 
-		if (err < 0)
-		{
-			grg_free (gctx, tmpData, oDim);
-			tmpData = NULL;
-			grg_unsafe_free (ecdata);
-			return GRG_READ_COMP_ERR;
-		}
+		offset = grg_char2llong (mem + LIBGRG_TABLE_POS);
+		if (offset < LIBGRG_TABLE_POS || offset > memDim - dIV)
+			return GRG_READ_CRC_ERR;
 
-		*origData = grg_memconcat (2, tmpData, oDim, "", 1);
-
-		grg_free (gctx, tmpData, oDim);
-		tmpData = NULL;
+		stored = mem + LIBGRG_KCV_CHUNKED_POS;
+		IV = mem + offset;
 	}
 	else
-		*origData = grg_memconcat (2, curdata, oDim, "", 1);
-
-	grg_unsafe_free (ecdata);
+		return GRG_OK;
 
-	if (!*origData){
-		return GRG_MEM_ALLOCATION_ERR;
-	}
+	err = block_kcv (gctx, keystruct, IV, kcv);
+	if (err < 0)
+		return err;
 
-	if (origDim != NULL)
-		*origDim = oDim;
+	if (memcmp (kcv, stored, LIBGRG_KCV_LEN))
+		return GRG_READ_PWD_ERR;
 
 	return GRG_OK;
 }
 
-int
-grg_encrypt_mem (const GRG_CTX gctx, const GRG_KEY keystruct, void **mem,
-		 long *memDim, const unsigned char *origData,
-		 const long origDim)
+/**
+ * decrypt_payload:
+ * @gctx: the context, already updated with the algorithms used
+ * @keystruct: the key
+ * @block: an encrypted block (IV|CRC32|DATA_LEN|DATA) of a validated data
+ *         sequence; it's decrypted in place
+ * @blockDim: its length
+ * @payload: where to store the pointer to the (still compressed) data
+ * @payloadDim: where to store their length
+ * @oDim: where to store the uncompressed data length
+ *
+ * Decrypts a block in place, and verifies the password.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+decrypt_payload (const GRG_CTX gctx, const GRG_KEY keystruct,
+		 unsigned char *block, const long blockDim,
+		 unsigned char **payload, long *payloadDim,
+		 unsigned long *oDim)
 {
-	char *compData;
-	unsigned char *chunk, *toCRC1, *CRC1, *toEnc, *key, *IV,
-		*toCRC2, *CRC2, algo;
-	unsigned int dIV, dKey;
-    int err;
-	long compDim, uncDim;
-	MCRYPT mod;
-
-	if (!gctx || !keystruct || !origData)
-			return GRG_ARGUMENT_ERR;
+	unsigned char *IV, *curdata, *key;
+	int dIV, keylen, valid;
+	long curlen;
+	GRG_CIPHER cipher;
 
-	uncDim = (origDim < 0) ? strlen ((char *)origData) : origDim;
-
-	if (gctx->comp_lvl)
-	{
-		if (gctx->comp_algo)	//bz2
-			compDim = (long) ((((float) uncDim) * 1.01) + 600);
-		else		//libz
-			compDim = (long) ((((float) uncDim) + 12) * 1.01);
+	dIV = grg_get_block_size_static (gctx->crypt_algo);
+	IV = block;
+	curdata = IV + dIV;
+	curlen = blockDim - dIV;
 
-		compData = (char *) malloc (compDim);
-		if (!compData)
-			return GRG_MEM_ALLOCATION_ERR;
+	if (curlen < LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN)
+		return GRG_READ_CRC_ERR;
 
-		//compress the data
-		if (gctx->comp_algo)	//bz2
-		{
-			unsigned int uint_compDim = compDim;
-			err = BZ2_bzBuffToBuffCompress (compData,
-							&uint_compDim,
-							(char *)
-							origData, uncDim,
-							gctx->comp_lvl * 3, 0,
-							0);
-			compDim = uint_compDim;
-		}
-		else
-			err = compress2 ((Bytef *)compData, (uLongf *)&compDim, origData, uncDim,
-					 gctx->comp_lvl * 3);
+	//decrypts the encrypted data
+	key = grg_select_key (gctx, keystruct, &keylen);
+	if (!key)
+		return GRG_MEM_ALLOCATION_ERR;
 
-		if (err < 0)
-		{
-			grg_free (gctx, compData, compDim);
-			compData = NULL;
-			compDim = 0;
-			return GRG_WRITE_COMP_ERR;
-		}
-	}
-	else
-	{
-		compDim = uncDim;
-		compData = (char *)grg_memdup (origData, uncDim);
-		if (!compData)
-			return GRG_MEM_ALLOCATION_ERR;
-	}
+	grg_XOR_mem (key, keylen, IV, dIV);
 
-	chunk = grg_long2char (uncDim);
+	cipher = grg_cipher_open (gctx->crypt_algo, key, keylen, IV);
+	grg_secure_free (gctx, key, keylen);
+	key = NULL;
 
-	//adds the CRC32 and DATA_LEN field
-	toCRC1 = grg_memconcat (2, chunk, LIBGRG_DATA_DIM_LEN, compData,
-				compDim);
+	if (!cipher)
+		return GRG_READ_ENC_INIT_ERR;
 
-	grg_free (gctx, chunk, LIBGRG_DATA_DIM_LEN);
-	chunk = NULL;
-	grg_free (gctx, compData, compDim);
-	compData = NULL;
+	GRG_TRACE (gctx, GRG_STAGE_CIPHER, GRG_TRACE_BEGIN, curlen);
+	GRG_PROBE2 (decipher__begin, curlen, gctx->crypt_algo);
+	grg_cipher_decrypt (cipher, curdata, curlen);
+	grg_cipher_close (cipher);
+	GRG_COUNT (gctx, bytes_decrypted, curlen);
+	GRG_TRACE (gctx, GRG_STAGE_CIPHER, GRG_TRACE_END, curlen);
+	GRG_PROBE1 (decipher__end, curlen);
 
-	if (!toCRC1)
-		return GRG_MEM_ALLOCATION_ERR;
+	//checks the 2nd CRC32
+	GRG_TRACE (gctx, GRG_STAGE_CRC, GRG_TRACE_BEGIN,
+		   curlen - LIBGRG_CRC_LEN);
+	GRG_PROBE1 (crc__begin, curlen - LIBGRG_CRC_LEN);
+	valid = compare_CRC32 (gctx, curdata, curdata + LIBGRG_CRC_LEN,
+			       curlen - LIBGRG_CRC_LEN);
+	GRG_TRACE (gctx, GRG_STAGE_CRC, GRG_TRACE_END,
+		   valid ? curlen - LIBGRG_CRC_LEN : GRG_READ_PWD_ERR);
+	GRG_PROBE1 (crc__end,
+		    valid ? curlen - LIBGRG_CRC_LEN : GRG_READ_PWD_ERR);
+
+	if (!valid)
+		return GRG_READ_PWD_ERR;
 
-	compDim += LIBGRG_DATA_DIM_LEN;
+	curdata += LIBGRG_CRC_LEN;
+	curlen -= LIBGRG_CRC_LEN;
 
-	CRC1 = get_CRC32 (toCRC1, compDim);
+	//reads the uncompressed data length
+	*oDim = grg_char2long (curdata);
 
-	toEnc = grg_memconcat (2, CRC1, LIBGRG_CRC_LEN, toCRC1, compDim);
+	*payload = curdata + LIBGRG_DATA_DIM_LEN;
+	*payloadDim = curlen - LIBGRG_DATA_DIM_LEN;
 
-	grg_free (gctx, CRC1, LIBGRG_CRC_LEN);
-	CRC1 = NULL;
-	grg_free (gctx, toCRC1, compDim);
-	toCRC1 = NULL;
+	return GRG_OK;
+}
 
-	if (!toEnc)
-		return GRG_MEM_ALLOCATION_ERR;
+//a cursor over plain data in as many pieces as the caller likes, to read
+//or write them in order without ever joining them
+typedef struct
+{
+	const struct iovec *iov;
+	int iovcnt;
+	int seg;		//the piece we're in
+	long pos;		//and how far in it
+}
+GRG_PIECES;
 
-	compDim += LIBGRG_CRC_LEN;
+/**
+ * pieces_dim:
+ * @iov: the pieces
+ * @iovcnt: how many they are
+ *
+ * Tells the length of the data in @iov, checking the pieces.
+ *
+ * Returns: the length, or -1 if a piece is wrong or the whole is too long
+ */
+static long
+pieces_dim (const struct iovec *iov, const int iovcnt)
+{
+	long dim = 0;
+	int i;
 
-	//encrypts the data
-	mod = mcrypt_module_open (grg2mcrypt (gctx->crypt_algo), NULL,
-				  MCRYPT_CFB, NULL);
+	if (iovcnt < 0 || (iovcnt && !iov))
+		return -1;
 
-	if (mod == MCRYPT_FAILED)
+	for (i = 0; i < iovcnt; i++)
 	{
-		grg_free (gctx, toEnc, compDim);
-		toEnc = NULL;
-		return GRG_WRITE_ENC_INIT_ERR;
+		if ((iov[i].iov_len && !iov[i].iov_base) ||
+		    iov[i].iov_len > (size_t) (LONG_MAX - dim))
+			return -1;
+		dim += iov[i].iov_len;
 	}
 
-	dIV = mcrypt_enc_get_iv_size (mod);
-	IV = grg_rnd_seq (gctx, dIV);
-	if (!IV)
-	{
-		grg_free (gctx, toEnc, compDim);
-		toEnc = NULL;
-		return GRG_MEM_ALLOCATION_ERR;
-	}
+	return dim;
+}
 
-	key = select_key (gctx, keystruct, (int *)&dKey);
-	if (!key)
-	{
-		grg_unsafe_free (IV);
-		grg_free (gctx, toEnc, compDim);
-		toEnc = NULL;
-		return GRG_MEM_ALLOCATION_ERR;
-	}
+/**
+ * pieces_init:
+ * @p: the cursor to set up
+ * @iov: the pieces
+ * @iovcnt: how many they are
+ * @offset: where to start, counting from the beginning of the first piece
+ */
+static void
+pieces_init (GRG_PIECES * p, const struct iovec *iov, const int iovcnt,
+	     long offset)
+{
+	p->iov = iov;
+	p->iovcnt = iovcnt;
 
-	grg_XOR_mem (key, dKey, IV, dIV);
+	for (p->seg = 0;
+	     p->seg < iovcnt && offset >= (long) iov[p->seg].iov_len;
+	     p->seg++)
+		offset -= iov[p->seg].iov_len;
 
-	err = mcrypt_generic_init (mod, key, dKey, IV);
+	p->pos = offset;
+}
 
-	grg_free (gctx, key, dKey);
-	key = NULL;
+/**
+ * pieces_next:
+ * @p: the cursor
+ * @data: where to store the pointer to the next contiguous stretch
+ * @max: the longest it can be
+ *
+ * Moves the cursor past the next contiguous stretch of the data.
+ *
+ * Returns: its length, or 0 at the end of the data
+ */
+static long
+pieces_next (GRG_PIECES * p, unsigned char **data, const long max)
+{
+	long len;
 
-	if (err < 0)
+	while (p->seg < p->iovcnt &&
+	       p->pos == (long) p->iov[p->seg].iov_len)
 	{
-		grg_unsafe_free (IV);
-		grg_free (gctx, toEnc, compDim);
-		toEnc = NULL;
-		return GRG_WRITE_ENC_INIT_ERR;
+		p->seg++;
+		p->pos = 0;
 	}
 
-	mcrypt_generic (mod, toEnc, compDim);
-
-	mcrypt_generic_deinit (mod);
-	mcrypt_module_close (mod);
-
-	//adds algorithm and salt
+	if (p->seg == p->iovcnt)
+		return 0;
 
-	algo = (unsigned char) (gctx->crypt_algo | gctx->hash_algo | gctx->
-				comp_algo | gctx->comp_lvl);
+	len = p->iov[p->seg].iov_len - p->pos;
+	if (len > max)
+		len = max;
 
-	toCRC2 = grg_memconcat (3, &algo, LIBGRG_ALGO_LEN, IV, dIV, toEnc,
-				compDim);
+	*data = (unsigned char *) p->iov[p->seg].iov_base + p->pos;
+	p->pos += len;
 
-	grg_unsafe_free (IV);
-	grg_free (gctx, toEnc, compDim);
-	toEnc = NULL;
+	return len;
+}
 
-	if (!toCRC2)
+/**
+ * pieces_scatter:
+ * @p: the cursor
+ * @data: the bytes to put in the pieces
+ * @dim: their length
+ *
+ * Copies some bytes into the pieces, from the cursor on.
+ */
+static void
+pieces_scatter (GRG_PIECES * p, const unsigned char *data, const long dim)
+{
+	unsigned char *piece;
+	long done, len;
+
+	for (done = 0; done < dim; done += len)
+	{
+		len = pieces_next (p, &piece, dim - done);
+		if (!len)
+			return;
+		memcpy (piece, data + done, len);
+	}
+}
+
+#ifdef HAVE_ZSTD
+/**
+ * compress_zstd:
+ * @gctx: the context, giving the level to use
+ * @in, @inDim, @out, @outDim, @crc: as in compress_data()
+ *
+ * Compresses the data with zstd, LIBGRG_PIPE_BLOCK bytes of output at a
+ * time, adding each piece to the CRC32. Long distance matching is on, so
+ * that repetitions farther than the window of the level are found too;
+ * zstd is told the data length, to fit the window to it.
+ *
+ * Returns: GRG_OK or GRG_WRITE_COMP_ERR
+ */
+static int
+compress_zstd (const GRG_CTX gctx, GRG_PIECES * in, const long inDim,
+	       unsigned char *out, long *outDim, uint32_t * crc)
+{
+	//zlib's ratios, several times faster
+	static const int levels[] = { 0, 1, 6, 12 };
+	ZSTD_CCtx *zc;
+	ZSTD_inBuffer zin;
+	ZSTD_outBuffer zout;
+	ZSTD_EndDirective mode;
+	unsigned char *piece;
+	size_t left;
+	long done, step, fed;
+	int level;
+
+	level = gctx->comp_level ? gctx->comp_level :
+		levels[gctx->comp_lvl & GRG_COMP_LVL_MASK];
+	if (level < ZSTD_minCLevel ())
+		level = ZSTD_minCLevel ();
+	if (level > ZSTD_maxCLevel ())
+		level = ZSTD_maxCLevel ();
+
+	zc = ZSTD_createCCtx ();
+	if (!zc)
+		return GRG_WRITE_COMP_ERR;
+
+	ZSTD_CCtx_setParameter (zc, ZSTD_c_compressionLevel, level);
+	ZSTD_CCtx_setParameter (zc, ZSTD_c_enableLongDistanceMatching, 1);
+	ZSTD_CCtx_setPledgedSrcSize (zc, inDim);
+
+	zin.src = NULL;
+	zin.size = 0;
+	zin.pos = 0;
+	zout.dst = out;
+	zout.pos = 0;
+	done = 0;
+	fed = 0;
+	mode = ZSTD_e_continue;
+
+	//the pieces are handed over one at a time; the frame is closed
+	//with the last one
+	do
+	{
+		if (zin.pos == zin.size && fed < inDim)
+		{
+			step = pieces_next (in, &piece, inDim - fed);
+			if (!step)
+				break;
+			zin.src = piece;
+			zin.size = step;
+			zin.pos = 0;
+			fed += step;
+		}
+		mode = (fed == inDim) ? ZSTD_e_end : ZSTD_e_continue;
+
+		step = (*outDim - done < LIBGRG_PIPE_BLOCK) ?
+			*outDim - done : LIBGRG_PIPE_BLOCK;
+		zout.size = done + step;
+
+		left = ZSTD_compressStream2 (zc, &zout, &zin, mode);
+
+		*crc = grg_crc32_update (*crc, out + done, zout.pos - done);
+		done = zout.pos;
+	}
+	while (!ZSTD_isError (left) && (mode != ZSTD_e_end || left) &&
+	       done < *outDim);
+
+	ZSTD_freeCCtx (zc);
+
+	if (mode != ZSTD_e_end || ZSTD_isError (left) || left)
+		return GRG_WRITE_COMP_ERR;
+
+	*outDim = done;
+
+	return GRG_OK;
+}
+
+static int
+uncompress_zstd (const unsigned char *payload, const long payloadDim,
+		 unsigned char *out, unsigned long *oDim)
+{
+	ZSTD_DCtx *zd;
+	size_t ret;
+
+	zd = ZSTD_createDCtx ();
+	if (!zd)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	ret = ZSTD_decompressDCtx (zd, out, *oDim, payload, payloadDim);
+	ZSTD_freeDCtx (zd);
+
+	if (ZSTD_isError (ret))
+		return GRG_READ_COMP_ERR;
+
+	*oDim = ret;
+
+	return GRG_OK;
+}
+#endif //HAVE_ZSTD
+
+#ifdef HAVE_LZ4
+/**
+ * pieces_gather:
+ * @p: the cursor
+ * @dim: how many bytes are wanted
+ * @copy: where to store a newly allocated copy, if one is needed
+ *
+ * Gets the next @dim bytes in one stretch, for the algorithms that can't
+ * take them a piece at a time: straight from their piece if they're all
+ * in it, else copied together. Only what is needed at once is copied,
+ * that is at most a chunk.
+ *
+ * Returns: the bytes, or NULL if the copy can't be allocated
+ */
+static unsigned char *
+pieces_gather (GRG_PIECES * p, const long dim, unsigned char **copy)
+{
+	unsigned char *data = NULL;
+	long len, done;
+
+	*copy = NULL;
+
+	len = pieces_next (p, &data, dim);
+	if (len == dim)
+		return data;
+
+	*copy = (unsigned char *) malloc (dim);
+	if (!*copy)
+		return NULL;
+
+	for (done = 0; len > 0; len = pieces_next (p, &data, dim - done))
+	{
+		memcpy (*copy + done, data, len);
+		done += len;
+	}
+
+	return *copy;
+}
+
+/**
+ * compress_lz4:
+ * @gctx: the context, giving the level to use
+ * @in, @inDim, @out, @outDim, @crc: as in compress_data()
+ *
+ * Compresses the data with lz4: the fast compressor below
+ * LZ4HC_CLEVEL_MIN, the high compression one from there on. The block
+ * is made in one go, so its CRC32 is computed afterwards, and the data
+ * must be in one piece: if they aren't, they're copied together.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+compress_lz4 (const GRG_CTX gctx, GRG_PIECES * in, const long inDim,
+	      unsigned char *out, long *outDim, uint32_t * crc)
+{
+	static const int levels[] = { 0, 1, LZ4HC_CLEVEL_MIN,
+		LZ4HC_CLEVEL_DEFAULT
+	};
+	unsigned char *data, *copy;
+	long done, step;
+	int level, len;
+
+	level = gctx->comp_level ? gctx->comp_level :
+		levels[gctx->comp_lvl & GRG_COMP_LVL_MASK];
+	if (level > LZ4HC_CLEVEL_MAX)
+		level = LZ4HC_CLEVEL_MAX;
+
+	if (inDim > LZ4_MAX_INPUT_SIZE)
+		return GRG_WRITE_COMP_ERR;
+
+	data = pieces_gather (in, inDim, &copy);
+	if (!data && inDim)
 		return GRG_MEM_ALLOCATION_ERR;
 
-	compDim += LIBGRG_ALGO_LEN + dIV;
+	if (level < LZ4HC_CLEVEL_MIN)
+		len = LZ4_compress_default ((const char *) data, (char *) out,
+					    inDim, *outDim);
+	else
+		len = LZ4_compress_HC ((const char *) data, (char *) out,
+				       inDim, *outDim, level);
+
+	if (copy)
+		grg_free (gctx, copy, inDim);
 
-	//calculates the CRC32
+	if (len <= 0)
+		return GRG_WRITE_COMP_ERR;
 
-	CRC2 = get_CRC32 (toCRC2, compDim);
+	for (done = 0; done < len; done += step)
+	{
+		step = (len - done < LIBGRG_PIPE_BLOCK) ?
+			len - done : LIBGRG_PIPE_BLOCK;
+		*crc = grg_crc32_update (*crc, out + done, step);
+	}
+
+	*outDim = len;
+
+	return GRG_OK;
+}
+
+static int
+uncompress_lz4 (const unsigned char *payload, const long payloadDim,
+		unsigned char *out, unsigned long *oDim)
+{
+	int len;
+
+	if (payloadDim > INT_MAX || *oDim > INT_MAX)
+		return GRG_READ_COMP_ERR;
+
+	len = LZ4_decompress_safe ((const char *) payload, (char *) out,
+				   payloadDim, *oDim);
+
+	if (len < 0)
+		return GRG_READ_COMP_ERR;
+
+	*oDim = len;
+
+	return GRG_OK;
+}
+#endif //HAVE_LZ4
+
+/**
+ * uncompress_data:
+ * @gctx: the context, already updated with the algorithms used
+ * @payload: the decrypted data, as returned by decrypt_payload ()
+ * @payloadDim: their length
+ * @out: the buffer to uncompress them into; it must be long @oDim
+ * @oDim: the uncompressed data length; it's updated with the real one
+ *
+ * Uncompresses the data right into their final place.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+uncompress_data (const GRG_CTX gctx, const unsigned char *payload,
+		 const long payloadDim, unsigned char *out,
+		 unsigned long *oDim)
+{
+	int err;
+
+	if (!grg_comp_algo_supported (gctx->comp_algo))
+		return GRG_READ_COMP_ERR;
+
+	if (gctx->comp_lvl)
+	{
+#ifdef HAVE_ZSTD
+		if (gctx->comp_algo == GRG_ZSTD)
+			return uncompress_zstd (payload, payloadDim, out, oDim);
+#endif
+#ifdef HAVE_LZ4
+		if (gctx->comp_algo == GRG_LZ4)
+			return uncompress_lz4 (payload, payloadDim, out, oDim);
+#endif
+
+		if (gctx->comp_algo)	//bz2
+		{
+			unsigned int uint_oDim = *oDim;
+
+			if (payloadDim > UINT_MAX || *oDim > UINT_MAX)
+				return GRG_READ_COMP_ERR;
+			err = BZ2_bzBuffToBuffDecompress ((char *)out, &uint_oDim,
+							  (char *) payload,
+							  payloadDim,
+							  USE_BZ2_SMALL_MEM, 0);
+			*oDim = uint_oDim;
+		}
+		else		//zlib
+			err = uncompress (out, oDim, payload, payloadDim);
+
+		if (err < 0)
+			return GRG_READ_COMP_ERR;
+	}
+	else
+	{
+		if ((long) *oDim > payloadDim)
+			return GRG_READ_COMP_ERR;
+
+		memcpy (out, payload, *oDim);
+	}
+
+	return GRG_OK;
+}
+
+/**
+ * uncompress_payload:
+ * @gctx: the context, already updated with the algorithms used
+ * @payload: the decrypted data, as returned by decrypt_payload ()
+ * @payloadDim: their length
+ * @out: the buffer to uncompress them into; it must be long @oDim + 1
+ * @oDim: the uncompressed data length; it's updated with the real one
+ *
+ * Uncompresses the data right into their final place, and appends
+ * a '\0' to them.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+uncompress_payload (const GRG_CTX gctx, const unsigned char *payload,
+		    const long payloadDim, unsigned char *out,
+		    unsigned long *oDim)
+{
+	int err;
+
+	GRG_TRACE (gctx, GRG_STAGE_UNCOMPRESS, GRG_TRACE_BEGIN, payloadDim);
+	GRG_PROBE3 (uncompress__begin,
+		    payloadDim, gctx->comp_algo, gctx->comp_lvl);
+	err = uncompress_data (gctx, payload, payloadDim, out, oDim);
+	GRG_TRACE (gctx, GRG_STAGE_UNCOMPRESS, GRG_TRACE_END,
+		   (err < 0) ? err : (long) *oDim);
+	GRG_PROBE1 (uncompress__end, (err < 0) ? err : (long) *oDim);
+
+	if (err < 0)
+		return err;
 
-	//writes it all
+	GRG_COUNT (gctx, bytes_uncompressed, *oDim);
 
-	*memDim = LIBGRG_ALGO_POS + compDim;
-	*mem = malloc (*memDim);
-	if (!*mem){
-		grg_free (gctx, CRC2, LIBGRG_CRC_LEN);
-		CRC2 = NULL;
-		grg_free (gctx, toCRC2, compDim);
-		toCRC2 = NULL;
+	out[*oDim] = '\0';
+
+	return GRG_OK;
+}
+
+#ifdef HAVE_ZSTD
+/**
+ * uncompress_zstd_pieces:
+ * @payload, @payloadDim, @out, @oDim: as in uncompress_pieces()
+ *
+ * Uncompresses zstd data a piece of the output at a time.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+uncompress_zstd_pieces (const unsigned char *payload, const long payloadDim,
+			GRG_PIECES * out, unsigned long *oDim)
+{
+	ZSTD_DCtx *zd;
+	ZSTD_inBuffer zin;
+	ZSTD_outBuffer zout;
+	unsigned char *piece;
+	unsigned long done = 0;
+	size_t left = 1;
+	long len;
+
+	zd = ZSTD_createDCtx ();
+	if (!zd)
 		return GRG_MEM_ALLOCATION_ERR;
+
+	zin.src = payload;
+	zin.size = payloadDim;
+	zin.pos = 0;
+
+	//every call fills the piece, unless the input is over
+	while (left && !ZSTD_isError (left) &&
+	       (len = pieces_next (out, &piece, *oDim - done)) > 0)
+	{
+		zout.dst = piece;
+		zout.size = len;
+		zout.pos = 0;
+
+		left = ZSTD_decompressStream (zd, &zout, &zin);
+		done += zout.pos;
+
+		if (left && zout.pos < zout.size)
+			break;
+	}
+
+	//the end of the frame can be left, with all the data out
+	if (left && !ZSTD_isError (left) && done == *oDim)
+	{
+		zout.dst = NULL;
+		zout.size = 0;
+		zout.pos = 0;
+		left = ZSTD_decompressStream (zd, &zout, &zin);
+	}
+
+	ZSTD_freeDCtx (zd);
+
+	if (left)
+		return GRG_READ_COMP_ERR;
+
+	*oDim = done;
+
+	return GRG_OK;
+}
+#endif //HAVE_ZSTD
+
+/**
+ * uncompress_scattered:
+ * @gctx: the context, already updated with the algorithms used
+ * @payload, @payloadDim, @out, @oDim: as in uncompress_pieces()
+ *
+ * Uncompresses the data across many pieces, a piece at a time; lz4 can
+ * only work on a whole block, so it's uncompressed aside and copied.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+uncompress_scattered (const GRG_CTX gctx, const unsigned char *payload,
+		      const long payloadDim, GRG_PIECES * out,
+		      unsigned long *oDim)
+{
+	unsigned char *piece;
+	unsigned long done = 0;
+	long len;
+	int err;
+
+	if (!gctx->comp_lvl)
+	{
+		if ((long) *oDim > payloadDim)
+			return GRG_READ_COMP_ERR;
+
+		pieces_scatter (out, payload, *oDim);
+		return GRG_OK;
+	}
+
+#ifdef HAVE_ZSTD
+	if (gctx->comp_algo == GRG_ZSTD)
+		return uncompress_zstd_pieces (payload, payloadDim, out, oDim);
+#endif
+#ifdef HAVE_LZ4
+	if (gctx->comp_algo == GRG_LZ4)
+	{
+		unsigned char *tmp;
+		unsigned long tmpDim = *oDim;
+
+		tmp = (unsigned char *) malloc (tmpDim);
+		if (!tmp)
+			return GRG_MEM_ALLOCATION_ERR;
+		grg_count_alloc (gctx, tmpDim);
+
+		err = uncompress_lz4 (payload, payloadDim, tmp, oDim);
+		if (err == GRG_OK)
+			pieces_scatter (out, tmp, *oDim);
+
+		grg_free (gctx, tmp, tmpDim);
+		return err;
+	}
+#endif
+
+	if (payloadDim > UINT_MAX)
+		return GRG_READ_COMP_ERR;
+
+	//in both, a call with room left in the piece means the input is over
+	if (gctx->comp_algo)	//bz2
+	{
+		bz_stream bzs;
+
+		memset (&bzs, 0, sizeof (bz_stream));
+		if (BZ2_bzDecompressInit (&bzs, 0, USE_BZ2_SMALL_MEM) != BZ_OK)
+			return GRG_READ_COMP_ERR;
+
+		bzs.next_in = (char *) payload;
+		bzs.avail_in = payloadDim;
+		err = BZ_OK;
+
+		while (err == BZ_OK &&
+		       (len = pieces_next (out, &piece,
+					   (*oDim - done > UINT_MAX) ?
+					   UINT_MAX : *oDim - done)) > 0)
+		{
+			bzs.next_out = (char *) piece;
+			bzs.avail_out = len;
+
+			err = BZ2_bzDecompress (&bzs);
+
+			done += len - bzs.avail_out;
+			if (err == BZ_OK && bzs.avail_out)
+				err = BZ_UNEXPECTED_EOF;
+		}
+
+		BZ2_bzDecompressEnd (&bzs);
+		err = (err == BZ_STREAM_END) ? 0 : -1;
+	}
+	else
+	{
+		z_stream zs;
+
+		memset (&zs, 0, sizeof (z_stream));
+		if (inflateInit (&zs) != Z_OK)
+			return GRG_READ_COMP_ERR;
+
+		zs.next_in = (Bytef *) payload;
+		zs.avail_in = payloadDim;
+		err = Z_OK;
+
+		while (err == Z_OK &&
+		       (len = pieces_next (out, &piece,
+					   (*oDim - done > UINT_MAX) ?
+					   UINT_MAX : *oDim - done)) > 0)
+		{
+			zs.next_out = piece;
+			zs.avail_out = len;
+
+			err = inflate (&zs, Z_NO_FLUSH);
+
+			done += len - zs.avail_out;
+			if (err == Z_OK && zs.avail_out)
+				err = Z_DATA_ERROR;
+		}
+
+		inflateEnd (&zs);
+		err = (err == Z_STREAM_END) ? 0 : -1;
+	}
+
+	if (err < 0)
+		return GRG_READ_COMP_ERR;
+
+	*oDim = done;
+
+	return GRG_OK;
+}
+
+/**
+ * uncompress_pieces:
+ * @gctx: the context, already updated with the algorithms used
+ * @payload: the decrypted data, as returned by decrypt_payload ()
+ * @payloadDim: their length
+ * @out: a cursor on the pieces to uncompress them into, moved past them
+ * @oDim: the room in the pieces from the cursor on; it's updated with
+ *        the uncompressed data length
+ *
+ * Uncompresses the data right into the pieces: the usual way if they
+ * fall in just one, else a piece at a time.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+uncompress_pieces (const GRG_CTX gctx, const unsigned char *payload,
+		   const long payloadDim, GRG_PIECES * out,
+		   unsigned long *oDim)
+{
+	GRG_PIECES start = *out;
+	unsigned char none, *flat = &none;
+	int err;
+
+	if (!grg_comp_algo_supported (gctx->comp_algo))
+		return GRG_READ_COMP_ERR;
+
+	GRG_TRACE (gctx, GRG_STAGE_UNCOMPRESS, GRG_TRACE_BEGIN, payloadDim);
+	GRG_PROBE3 (uncompress__begin,
+		    payloadDim, gctx->comp_algo, gctx->comp_lvl);
+
+	if (pieces_next (out, &flat, *oDim) == (long) *oDim)
+		err = uncompress_data (gctx, payload, payloadDim, flat, oDim);
+	else
+	{
+		*out = start;
+		err = uncompress_scattered (gctx, payload, payloadDim, out,
+					    oDim);
 	}
 
-	memcpy (((char *) *mem), gctx->header, HEADER_LEN);
-	((char *) *mem)[HEADER_LEN] = LIBGRG_FILE_VERSION + '0';
-	memcpy (((char *) *mem) + HEADER_LEN + LIBGRG_FILE_VERSION_LEN, CRC2,
-		LIBGRG_CRC_LEN);
-	grg_free (gctx, CRC2, LIBGRG_CRC_LEN);
-	CRC2 = NULL;
-	memcpy (((char *) *mem) + LIBGRG_ALGO_POS, toCRC2, compDim);
-	grg_free (gctx, toCRC2, compDim);
-	toCRC2 = NULL;
+	if (err == GRG_OK)
+		GRG_COUNT (gctx, bytes_uncompressed, *oDim);
+
+	GRG_TRACE (gctx, GRG_STAGE_UNCOMPRESS, GRG_TRACE_END,
+		   (err < 0) ? err : (long) *oDim);
+	GRG_PROBE1 (uncompress__end, (err < 0) ? err : (long) *oDim);
+
+	return err;
+}
+
+//what the jobs working on the chunks of a chunked data sequence need
+typedef struct
+{
+	GRG_CTX gctx;
+	GRG_KEY keystruct;
+	long count;
+	long chunkSize;
+	long blockHead;		//the length of IV|CRC32|DATA_LEN
+
+	unsigned char *mem;	//the encoded data sequence
+	long dataPos;		//where the first chunk starts in it
+	long slotDim;		//the room for a full chunk, when encrypting
+
+	const struct iovec *plain;	//the plain data, in pieces
+	int pieces;
+	long plainDim;
+
+	GRG_AIO aio;		//if set, where each chunk goes once encrypted
+	pthread_mutex_t lock;	//then, for the fields below
+	unsigned char *ready;	//the chunks encrypted so far
+	long next;		//the first one not yet written
+	long pos;		//and where it goes
+}
+CHUNK_JOB;
+
+/**
+ * decrypt_chunk:
+ * @arg: a CHUNK_JOB
+ * @index: the chunk to decrypt
+ *
+ * Decrypts a chunk in place, verifying the password.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+decrypt_chunk (void *arg, const long index)
+{
+	CHUNK_JOB *cj = (CHUNK_JOB *) arg;
+	unsigned char *entry, *payload;
+	long payloadDim;
+	unsigned long chunkDim;
+	int err;
+
+	entry = cj->mem + LIBGRG_TABLE_POS + index * LIBGRG_CHUNK_ENTRY_LEN;
+
+	err = decrypt_payload (cj->gctx, cj->keystruct,
+			       cj->mem + grg_char2llong (entry),
+			       grg_char2llong (entry + LIBGRG_OFFSET_LEN),
+			       &payload, &payloadDim, &chunkDim);
+
+	if (err < 0)
+		return err;
+
+	//all the chunks but the last one are full
+	if (chunkDim > (unsigned long) cj->chunkSize ||
+	    (index < cj->count - 1 &&
+	     chunkDim != (unsigned long) cj->chunkSize))
+		return GRG_READ_COMP_ERR;
+
+	return GRG_OK;
+}
+
+/**
+ * uncompress_chunk:
+ * @arg: a CHUNK_JOB
+ * @index: the chunk to uncompress, after decrypt_chunk ()
+ *
+ * Uncompresses a chunk right at its place in the plain data; as all
+ * the chunks but the last are full, it's known in advance.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+uncompress_chunk (void *arg, const long index)
+{
+	CHUNK_JOB *cj = (CHUNK_JOB *) arg;
+	unsigned char *entry, *block;
+	unsigned long chunkDim;
+	GRG_PIECES out;
+	long pos;
+	int err;
+
+	entry = cj->mem + LIBGRG_TABLE_POS + index * LIBGRG_CHUNK_ENTRY_LEN;
+	block = cj->mem + grg_char2llong (entry);
+
+	chunkDim = grg_char2long (block + cj->blockHead - LIBGRG_DATA_DIM_LEN);
+	pos = index * cj->chunkSize;
+
+	if (pos + (long) chunkDim > cj->plainDim)
+		return GRG_READ_COMP_ERR;
+
+	pieces_init (&out, cj->plain, cj->pieces, pos);
+
+	err = uncompress_pieces (cj->gctx, block + cj->blockHead,
+				 grg_char2llong (entry + LIBGRG_OFFSET_LEN) -
+				 cj->blockHead, &out, &chunkDim);
+
+	if (err < 0)
+		return err;
+
+	if (index < cj->count - 1 &&
+	    chunkDim != (unsigned long) cj->chunkSize)
+		return GRG_READ_COMP_ERR;
+
+	return GRG_OK;
+}
+
+/**
+ * chunk_job_init:
+ * @cj: the CHUNK_JOB to fill in
+ * @gctx: the context, already updated with the algorithms used
+ * @keystruct: the key
+ * @mem: a validated version 5 data sequence
+ *
+ * Prepares the decryption of the chunks of @mem.
+ */
+static void
+chunk_job_init (CHUNK_JOB * cj, const GRG_CTX gctx, const GRG_KEY keystruct,
+		unsigned char *mem)
+{
+	cj->gctx = gctx;
+	cj->keystruct = keystruct;
+	cj->mem = mem;
+	cj->count = grg_char2long (mem + LIBGRG_CHUNK_COUNT_POS);
+	cj->chunkSize = grg_char2long (mem + LIBGRG_CHUNK_SIZE_POS);
+	cj->blockHead = grg_get_block_size_static (gctx->crypt_algo) +
+		LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN;
+	cj->dataPos = LIBGRG_TABLE_POS + cj->count * LIBGRG_CHUNK_ENTRY_LEN;
+	cj->slotDim = 0;
+	cj->plain = NULL;
+	cj->pieces = 0;
+	cj->plainDim = 0;
+	cj->aio = NULL;
+}
+
+/**
+ * decrypt_chunks:
+ * @gctx: the context, already updated with the algorithms used
+ * @keystruct: the key
+ * @mem: a validated version 5 data sequence; its chunks are
+ *       decrypted in place
+ * @memDim: its length
+ * @oDim: where to store the uncompressed data length
+ *
+ * Decrypts all the chunks in place, as many at a time as the context
+ * allows, verifying the password on each of them, so that nothing is
+ * allocated for a wrong one; with a key check value, before starting.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+decrypt_chunks (const GRG_CTX gctx, const GRG_KEY keystruct,
+		unsigned char *mem, const long memDim, unsigned long *oDim)
+{
+	CHUNK_JOB cj;
+	unsigned char *last;
+	int err;
+
+	err = check_key (gctx, keystruct, mem, memDim);
+	if (err < 0)
+		return err;
+
+	chunk_job_init (&cj, gctx, keystruct, mem);
+
+	err = grg_parallel_for (gctx->threads, cj.count, decrypt_chunk, &cj);
+
+	if (err < 0)
+		return err;
+
+	last = mem + grg_char2llong (mem + LIBGRG_TABLE_POS +
+				     (cj.count - 1) * LIBGRG_CHUNK_ENTRY_LEN);
+
+	*oDim = (cj.count - 1) * cj.chunkSize +
+		grg_char2long (last + cj.blockHead - LIBGRG_DATA_DIM_LEN);
+
+	return GRG_OK;
+}
+
+/**
+ * uncompress_chunks:
+ * @gctx: the context, already updated with the algorithms used
+ * @mem: a data sequence, as decrypted by decrypt_chunks ()
+ * @iov: the pieces to uncompress the chunks into; they must hold @oDim
+ *       bytes
+ * @iovcnt: how many they are
+ * @oDim: the uncompressed data length, as told by decrypt_chunks ()
+ *
+ * Uncompresses every chunk at its place, as many at a time as the
+ * context allows.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+uncompress_chunks (const GRG_CTX gctx, unsigned char *mem,
+		   const struct iovec *iov, const int iovcnt,
+		   const unsigned long oDim)
+{
+	CHUNK_JOB cj;
+
+	chunk_job_init (&cj, gctx, NULL, mem);
+	cj.plain = iov;
+	cj.pieces = iovcnt;
+	cj.plainDim = oDim;
+
+	return grg_parallel_for (gctx->threads, cj.count, uncompress_chunk,
+				 &cj);
+}
+
+/**
+ * decrypt_chunked:
+ * @gctx: the context, already updated with the algorithms used
+ * @keystruct: the key
+ * @mem: a validated version 5 data sequence; it's decrypted in place
+ * @memDim: its length
+ * @origData: where to store the newly allocated plain data
+ * @origDim: where to store their length
+ *
+ * Decrypts a chunked data sequence, allocating only the plain data.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+decrypt_chunked (const GRG_CTX gctx, const GRG_KEY keystruct,
+		 unsigned char *mem, const long memDim,
+		 unsigned char **origData, long *origDim)
+{
+	unsigned char *tmpData;
+	unsigned long oDim;
+	struct iovec whole;
+	int err;
+
+	err = decrypt_chunks (gctx, keystruct, mem, memDim, &oDim);
+
+	if (err < 0)
+		return err;
+
+	tmpData = (unsigned char *) malloc (oDim + 1);
+
+	if (!tmpData)
+		return GRG_MEM_ALLOCATION_ERR;
+	grg_count_alloc (gctx, oDim + 1);
+
+	whole.iov_base = tmpData;
+	whole.iov_len = oDim;
+	err = uncompress_chunks (gctx, mem, &whole, 1, oDim);
+
+	if (err < 0)
+	{
+		grg_free (gctx, tmpData, oDim);
+		return err;
+	}
+
+	tmpData[oDim] = '\0';
+	*origData = tmpData;
+
+	if (origDim != NULL)
+		*origDim = oDim;
+
+	return GRG_OK;
+}
+
+static int
+decrypt_mem (const GRG_CTX gctx, const GRG_KEY keystruct, const void *mem,
+	     long memDim, unsigned char **origData, long *origDim)
+{
+	unsigned char *ecdata, *payload, *tmpData;
+	long payloadDim, pos;
+	unsigned long oDim;
+	int err;
+
+	//a wrong password is told before copying the data around
+	err = check_key (gctx, keystruct, mem, memDim);
+	if (err < 0)
+		return err;
+
+	ecdata = grg_memdup (gctx, (unsigned char *) mem, memDim);
+	if (!ecdata)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	if (LIBGRG_IS_CHUNKED (ecdata[HEADER_LEN] - '0'))
+	{
+		err = decrypt_chunked (gctx, keystruct, ecdata, memDim,
+				       origData, origDim);
+		grg_free (gctx, ecdata, memDim);
+		return err;
+	}
+
+	pos = LIBGRG_BLOCK_POS (ecdata[HEADER_LEN] - '0');
+	err = decrypt_payload (gctx, keystruct, ecdata + pos, memDim - pos,
+			       &payload, &payloadDim, &oDim);
+
+	if (err < 0)
+	{
+		grg_free (gctx, ecdata, memDim);
+		return err;
+	}
+
+	tmpData = (unsigned char *) malloc (oDim + 1);
+
+	if (!tmpData)
+	{
+		grg_free (gctx, ecdata, memDim);
+		return GRG_MEM_ALLOCATION_ERR;
+	}
+	grg_count_alloc (gctx, oDim + 1);
+
+	err = uncompress_payload (gctx, payload, payloadDim, tmpData, &oDim);
+
+	grg_free (gctx, ecdata, memDim);
+	ecdata = NULL;
+
+	if (err < 0)
+	{
+		grg_free (gctx, tmpData, oDim);
+		return err;
+	}
+
+	*origData = tmpData;
+
+	if (origDim != NULL)
+		*origDim = oDim;
+
+	return GRG_OK;
+}
+
+/**
+ * start_data_CRC:
+ * @inner: the CRC32|DATA_LEN|DATA part of a block
+ * @uncDim: the length of the data before compression
+ *
+ * Writes the DATA_LEN field, and starts the CRC32 that covers it and the
+ * data; compress_data() goes on with it.
+ *
+ * Returns: the CRC32 register
+ */
+static uint32_t
+start_data_CRC (unsigned char *inner, const long uncDim)
+{
+	grg_long2char_direct (uncDim, inner + LIBGRG_CRC_LEN);
+
+	return grg_crc32_update (GRG_CRC32_INIT, inner + LIBGRG_CRC_LEN,
+				 LIBGRG_DATA_DIM_LEN);
+}
+
+/**
+ * encode_block:
+ * @gctx: the context, giving the algorithms to use
+ * @keystruct: the key
+ * @block: a buffer laid out as IV|CRC32|DATA_LEN|DATA, where DATA_LEN and
+ *         the compressed data are already in place
+ * @blockDim: the length of the whole block
+ * @dataCRC: the CRC32 register over DATA_LEN and the data
+ * @outerCRC: a CRC32 register, to go on with the IV and the encrypted
+ *            block, or NULL
+ * @kcv: where to store the key check value, that comes right before the
+ *       IV, or NULL
+ *
+ * Fills in the IV and the CRC32 of the block, and encrypts it in place,
+ * checksumming each piece of it right after encrypting it.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+encode_block (const GRG_CTX gctx, const GRG_KEY keystruct,
+	      unsigned char *block, const long blockDim,
+	      const uint32_t dataCRC, uint32_t * outerCRC,
+	      unsigned char *kcv)
+{
+	unsigned char *inner, *key, *IV;
+	long innerDim, done, step;
+	int dIV, dKey;
+	GRG_CIPHER cipher;
+
+	dIV = grg_get_block_size_static (gctx->crypt_algo);
+
+	inner = block + dIV;
+	innerDim = blockDim - dIV;
+
+	grg_crc32_final (dataCRC, inner);
+
+	//encrypts the data
+	IV = block;
+	grg_rnd_seq_direct (gctx, IV, dIV);
+
+	key = grg_select_key (gctx, keystruct, &dKey);
+	if (!key)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	grg_XOR_mem (key, dKey, IV, dIV);
+
+	if (kcv && !grg_key_check_value (gctx->crypt_algo, key, dKey, IV, dIV,
+					 kcv))
+	{
+		grg_secure_free (gctx, key, dKey);
+		return GRG_WRITE_ENC_INIT_ERR;
+	}
+
+	cipher = grg_cipher_open (gctx->crypt_algo, key, dKey, IV);
+
+	grg_secure_free (gctx, key, dKey);
+	key = NULL;
+
+	if (!cipher)
+		return GRG_WRITE_ENC_INIT_ERR;
+
+	if (kcv)
+	{
+		GRG_COUNT (gctx, bytes_encrypted, LIBGRG_KCV_LEN);
+		if (outerCRC)
+			*outerCRC = grg_crc32_update (*outerCRC, kcv,
+						      LIBGRG_KCV_LEN);
+	}
+
+	if (outerCRC)
+		*outerCRC = grg_crc32_update (*outerCRC, IV, dIV);
+
+	GRG_TRACE (gctx, GRG_STAGE_CIPHER, GRG_TRACE_BEGIN, innerDim);
+	GRG_PROBE2 (encipher__begin, innerDim, gctx->crypt_algo);
+
+	for (done = 0; done < innerDim; done += step)
+	{
+		step = (innerDim - done < LIBGRG_PIPE_BLOCK) ?
+			innerDim - done : LIBGRG_PIPE_BLOCK;
+
+		grg_cipher_encrypt (cipher, inner + done, step);
+		if (outerCRC)
+			*outerCRC = grg_crc32_update (*outerCRC, inner + done,
+						      step);
+	}
+
+	grg_cipher_close (cipher);
+
+	//the inner CRC32 covers what follows it, the outer one everything
+	GRG_COUNT (gctx, bytes_encrypted, innerDim);
+	GRG_COUNT (gctx, bytes_crc, innerDim - LIBGRG_CRC_LEN +
+		   (outerCRC ? (kcv ? LIBGRG_KCV_LEN : 0) + dIV +
+		    innerDim : 0));
+
+	GRG_TRACE (gctx, GRG_STAGE_CIPHER, GRG_TRACE_END, innerDim);
+	GRG_PROBE1 (encipher__end, innerDim);
+
+	return GRG_OK;
+}
+
+/**
+ * encode_mem:
+ * @gctx: the context, giving the algorithms to use
+ * @keystruct: the key
+ * @mem: as in grg_encode_in_place(), with DATA_LEN already in place too
+ * @memDim: the length of the whole buffer
+ * @dataCRC: the CRC32 register over DATA_LEN and the data
+ *
+ * Completes a version 4 data sequence.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+encode_mem (const GRG_CTX gctx, const GRG_KEY keystruct,
+	    unsigned char *mem, const long memDim, const uint32_t dataCRC)
+{
+	uint32_t outerCRC;
+	int err;
+
+	//the CRC32 of the algorithm, the KCV, the IV and the encrypted data
+	mem[LIBGRG_ALGO_POS] =
+		(unsigned char) (gctx->crypt_algo | gctx->hash_algo | gctx->
+				 comp_algo | gctx->comp_lvl);
+	outerCRC = grg_crc32_update (GRG_CRC32_INIT, mem + LIBGRG_ALGO_POS,
+				     LIBGRG_ALGO_LEN);
+	GRG_COUNT (gctx, bytes_crc, LIBGRG_ALGO_LEN);
+
+	err = encode_block (gctx, keystruct, mem + LIBGRG_KCV_DATA_POS,
+			    memDim - LIBGRG_KCV_DATA_POS, dataCRC, &outerCRC,
+			    mem + LIBGRG_KCV_POS);
+
+	if (err < 0)
+		return err;
+
+	grg_crc32_final (outerCRC, mem + HEADER_LEN + LIBGRG_FILE_VERSION_LEN);
+
+	memcpy (mem, gctx->header, HEADER_LEN);
+	mem[HEADER_LEN] = LIBGRG_KCV_FILE_VERSION + '0';
+
+	return GRG_OK;
+}
+
+/**
+ * grg_encode_in_place:
+ * @gctx: the context, giving the algorithms to use
+ * @keystruct: the key
+ * @mem: a buffer laid out as the final data, where the compressed data are
+ *       already in place, after room for HEADER ... IV, CRC32 and DATA_LEN
+ * @memDim: the length of the whole buffer
+ * @uncDim: the length of the data before compression
+ *
+ * Fills in all the fields around the compressed data, and encrypts them
+ * in place, so that @mem becomes a complete libgringotts data sequence
+ * without copying the payload around.
+ *
+ * Returns: GRG_OK or an error code
+ */
+int
+grg_encode_in_place (const GRG_CTX gctx, const GRG_KEY keystruct,
+		     unsigned char *mem, const long memDim, const long uncDim)
+{
+	unsigned char *inner;
+	uint32_t dataCRC;
+
+	inner = mem + LIBGRG_KCV_DATA_POS + grg_get_block_size (gctx);
+
+	dataCRC = start_data_CRC (inner, uncDim);
+	dataCRC = grg_crc32_update (dataCRC, inner + LIBGRG_CRC_LEN +
+				    LIBGRG_DATA_DIM_LEN,
+				    mem + memDim - inner - LIBGRG_CRC_LEN -
+				    LIBGRG_DATA_DIM_LEN);
+
+	return encode_mem (gctx, keystruct, mem, memDim, dataCRC);
+}
+
+/**
+ * compress_bound:
+ * @gctx: the context, giving the algorithms to use
+ * @uncDim: the length of the data to compress
+ *
+ * Tells how long the compressed data can be, at worst.
+ *
+ * Returns: the length
+ */
+static long
+compress_bound (const GRG_CTX gctx, const long uncDim)
+{
+	if (!gctx->comp_lvl)
+		return uncDim;
+
+#ifdef HAVE_ZSTD
+	if (gctx->comp_algo == GRG_ZSTD)
+		return ZSTD_compressBound (uncDim);
+#endif
+#ifdef HAVE_LZ4
+	if (gctx->comp_algo == GRG_LZ4)
+		return LZ4_compressBound (uncDim);
+#endif
+
+	if (gctx->comp_algo)	//bz2
+		return (long) ((((float) uncDim) * 1.01) + 600);
+
+	//libz
+	return (long) ((((float) uncDim) + 12) * 1.01);
+}
+
+/**
+ * compress_data:
+ * @gctx: the context, giving the algorithms to use
+ * @in: a cursor on the data to compress, moved past them
+ * @inDim: their length
+ * @out: where to put the compressed data
+ * @outDim: the room available at @out; it's updated with the length
+ *          of the compressed data
+ * @crc: a CRC32 register, to go on with the compressed data
+ *
+ * Compresses (or just copies, if so requested) the data right where
+ * they are wanted, LIBGRG_PIPE_BLOCK bytes of output at a time, adding
+ * each piece to the CRC32 while it's still in the cache. With zlib and
+ * bzip2, the output is the same as compress2() or
+ * BZ2_bzBuffToBuffCompress() would give. The input is read a piece at a
+ * time, as the pieces come.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+compress_data (const GRG_CTX gctx, GRG_PIECES * in, const long inDim,
+	       unsigned char *out, long *outDim, uint32_t * crc)
+{
+	unsigned char *piece;
+	long done, step, fed;
+	int err, finish;
+
+	if (!gctx->comp_lvl)
+	{
+		for (done = 0; done < inDim; done += step)
+		{
+			step = pieces_next (in, &piece,
+					    (inDim - done < LIBGRG_PIPE_BLOCK) ?
+					    inDim - done : LIBGRG_PIPE_BLOCK);
+			if (!step)
+				return GRG_WRITE_COMP_ERR;
+			memcpy (out + done, piece, step);
+			*crc = grg_crc32_update (*crc, out + done, step);
+		}
+		*outDim = inDim;
+		return GRG_OK;
+	}
+
+#ifdef HAVE_ZSTD
+	if (gctx->comp_algo == GRG_ZSTD)
+		return compress_zstd (gctx, in, inDim, out, outDim, crc);
+#endif
+#ifdef HAVE_LZ4
+	if (gctx->comp_algo == GRG_LZ4)
+		return compress_lz4 (gctx, in, inDim, out, outDim, crc);
+#endif
+
+	//the input is handed over a piece at a time, and pieces beyond
+	//4 Gb in steps
+	fed = 0;
+	done = 0;
+
+	if (gctx->comp_algo)	//bz2
+	{
+		bz_stream bzs;
+
+		memset (&bzs, 0, sizeof (bz_stream));
+		if (BZ2_bzCompressInit (&bzs, gctx->comp_lvl * 3, 0, 0) != BZ_OK)
+			return GRG_WRITE_COMP_ERR;
+
+		do
+		{
+			if (!bzs.avail_in && fed < inDim)
+			{
+				step = pieces_next (in, &piece,
+						    (inDim - fed > UINT_MAX) ?
+						    UINT_MAX : inDim - fed);
+				bzs.next_in = (char *) piece;
+				bzs.avail_in = step;
+				fed += step;
+			}
+			finish = (fed == inDim);
+
+			step = (*outDim - done < LIBGRG_PIPE_BLOCK) ?
+				*outDim - done : LIBGRG_PIPE_BLOCK;
+			bzs.next_out = (char *) out + done;
+			bzs.avail_out = step;
+
+			err = BZ2_bzCompress (&bzs, finish ? BZ_FINISH : BZ_RUN);
+
+			step -= bzs.avail_out;
+			*crc = grg_crc32_update (*crc, out + done, step);
+			done += step;
+		}
+		while ((err == BZ_RUN_OK || err == BZ_FINISH_OK)
+		       && done < *outDim);
+
+		BZ2_bzCompressEnd (&bzs);
+		err = (err == BZ_STREAM_END) ? 0 : -1;
+	}
+	else
+	{
+		z_stream zs;
+
+		memset (&zs, 0, sizeof (z_stream));
+		if (deflateInit (&zs, gctx->comp_lvl * 3) != Z_OK)
+			return GRG_WRITE_COMP_ERR;
+
+		do
+		{
+			if (!zs.avail_in && fed < inDim)
+			{
+				step = pieces_next (in, &piece,
+						    (inDim - fed > UINT_MAX) ?
+						    UINT_MAX : inDim - fed);
+				zs.next_in = piece;
+				zs.avail_in = step;
+				fed += step;
+			}
+			finish = (fed == inDim);
+
+			step = (*outDim - done < LIBGRG_PIPE_BLOCK) ?
+				*outDim - done : LIBGRG_PIPE_BLOCK;
+			zs.next_out = out + done;
+			zs.avail_out = step;
+
+			err = deflate (&zs, finish ? Z_FINISH : Z_NO_FLUSH);
+
+			step -= zs.avail_out;
+			*crc = grg_crc32_update (*crc, out + done, step);
+			done += step;
+		}
+		while (err == Z_OK && done < *outDim);
+
+		deflateEnd (&zs);
+		err = (err == Z_STREAM_END) ? 0 : -1;
+	}
+
+	if (err < 0)
+		return GRG_WRITE_COMP_ERR;
+
+	*outDim = done;
+
+	return GRG_OK;
+}
+
+/**
+ * write_ready:
+ * @cj: a CHUNK_JOB writing to a GRG_AIO
+ * @index: the chunk just encrypted
+ *
+ * Submits the chunks whose place in the file is now known, that is the
+ * ones encrypted from the first not yet written on, setting their offset
+ * in the table. They are written straight from their slots.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+write_ready (CHUNK_JOB * cj, const long index)
+{
+	unsigned char *entry;
+	long len;
+	int err = GRG_OK;
+
+	pthread_mutex_lock (&cj->lock);
+	cj->ready[index] = TRUE;
+
+	while (err == GRG_OK && cj->next < cj->count && cj->ready[cj->next])
+	{
+		entry = cj->mem + LIBGRG_TABLE_POS +
+			cj->next * LIBGRG_CHUNK_ENTRY_LEN;
+		len = grg_char2llong (entry + LIBGRG_OFFSET_LEN);
+		grg_llong2char (cj->pos, entry);
+
+		err = grg_aio_submit (cj->aio, cj->mem + cj->dataPos +
+				      cj->next * cj->slotDim, len, cj->pos);
+
+		cj->pos += len;
+		cj->next++;
+	}
+
+	pthread_mutex_unlock (&cj->lock);
+	return err;
+}
+
+/**
+ * write_whole:
+ * @aio: where to write
+ * @out: an encoded data sequence, that @aio will free
+ * @outDim: its length
+ *
+ * Writes a data sequence all at once, when it can't go a chunk at a time.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+write_whole (GRG_AIO aio, unsigned char *out, const long outDim)
+{
+	int err = grg_aio_submit (aio, out, outDim, 0);
+
+	if (err < 0)
+	{
+		grg_unsafe_free (out);
+		return err;
+	}
+
+	grg_aio_close (aio, out);
+	return GRG_OK;
+}
+
+/**
+ * encrypt_chunk:
+ * @arg: a CHUNK_JOB
+ * @index: the chunk to encode
+ *
+ * Compresses and encrypts a chunk in its own slot of the output, and
+ * puts its length and CRC32 in the table; the offset will be set when
+ * the chunks are packed together.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+encrypt_chunk (void *arg, const long index)
+{
+	CHUNK_JOB *cj = (CHUNK_JOB *) arg;
+	unsigned char *slot, *entry;
+	long chunkDim, compDim;
+	uint32_t dataCRC, chunkCRC;
+	GRG_PIECES in;
+	int err;
+
+	chunkDim = (index < cj->count - 1) ? cj->chunkSize :
+		cj->plainDim - index * cj->chunkSize;
+	slot = cj->mem + cj->dataPos + index * cj->slotDim;
+	compDim = compress_bound (cj->gctx, chunkDim);
+
+	pieces_init (&in, cj->plain, cj->pieces, index * cj->chunkSize);
+
+	dataCRC = start_data_CRC (slot + cj->blockHead - LIBGRG_CRC_LEN -
+				  LIBGRG_DATA_DIM_LEN, chunkDim);
+	GRG_TRACE (cj->gctx, GRG_STAGE_COMPRESS, GRG_TRACE_BEGIN, chunkDim);
+	GRG_PROBE3 (compress__begin,
+		    chunkDim, cj->gctx->comp_algo, cj->gctx->comp_lvl);
+	err = compress_data (cj->gctx, &in, chunkDim, slot + cj->blockHead,
+			     &compDim, &dataCRC);
+	GRG_TRACE (cj->gctx, GRG_STAGE_COMPRESS, GRG_TRACE_END,
+		   (err < 0) ? err : compDim);
+	GRG_PROBE1 (compress__end, (err < 0) ? err : compDim);
+
+	if (err < 0)
+		return err;
+
+	GRG_COUNT (cj->gctx, bytes_compressed, chunkDim);
+
+	chunkCRC = GRG_CRC32_INIT;
+	err = encode_block (cj->gctx, cj->keystruct, slot,
+			    cj->blockHead + compDim, dataCRC, &chunkCRC, NULL);
+
+	if (err < 0)
+		return err;
+
+	//the first chunk gives the key check value, in the head
+	if (!index)
+	{
+		err = block_kcv (cj->gctx, cj->keystruct, slot,
+				 cj->mem + LIBGRG_KCV_CHUNKED_POS);
+		if (err < 0)
+			return (err == GRG_MEM_ALLOCATION_ERR) ? err :
+				GRG_WRITE_ENC_INIT_ERR;
+	}
+
+	entry = cj->mem + LIBGRG_TABLE_POS + index * LIBGRG_CHUNK_ENTRY_LEN;
+	grg_llong2char (cj->blockHead + compDim, entry + LIBGRG_OFFSET_LEN);
+	grg_crc32_final (chunkCRC, entry + 2 * LIBGRG_OFFSET_LEN);
+
+	if (cj->aio)
+		return write_ready (cj, index);
+
+	return GRG_OK;
+}
+
+/**
+ * encrypt_mem_chunked:
+ * @gctx: the context, giving the algorithms, the chunk size and the
+ *        number of threads to use
+ * @keystruct: the key
+ * @mem: where to store the newly allocated data sequence
+ * @memDim: where to store its length
+ * @iov: the data to encode, in pieces
+ * @iovcnt: how many they are
+ * @uncDim: their length
+ * @aio: if not NULL, where to write the data sequence instead
+ *
+ * Encodes the data in the version 5 format: every chunk is compressed and
+ * encrypted on its own, as many at a time as the context allows, in a
+ * slot of the output big enough for the worst case; then the chunks are
+ * packed together, and listed in the table with their offset, length
+ * and CRC32. If @aio can seek, each chunk is written as soon as its
+ * offset is known, and the head goes last; @aio then owns the output,
+ * and *@mem is set to NULL.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+encrypt_mem_chunked (const GRG_CTX gctx, const GRG_KEY keystruct,
+		     void **mem, long *memDim, const struct iovec *iov,
+		     const int iovcnt, const long uncDim, GRG_AIO aio)
+{
+	CHUNK_JOB cj;
+	unsigned char *out, *tmp, *entry, *chunk;
+	long lastDim, maxDim, pos, len, i;
+	int err, id;
+
+	cj.gctx = gctx;
+	cj.keystruct = keystruct;
+	cj.chunkSize = gctx->chunk_size ? gctx->chunk_size :
+		LIBGRG_CHUNK_SIZE_MAX;
+	cj.count = (uncDim + cj.chunkSize - 1) / cj.chunkSize;
+	if (!cj.count)
+		cj.count = 1;
+	lastDim = uncDim - (cj.count - 1) * cj.chunkSize;
+
+	cj.blockHead = grg_get_block_size (gctx) + LIBGRG_CRC_LEN +
+		LIBGRG_DATA_DIM_LEN;
+	cj.dataPos = LIBGRG_TABLE_POS + cj.count * LIBGRG_CHUNK_ENTRY_LEN;
+	cj.slotDim = cj.blockHead + compress_bound (gctx, cj.chunkSize);
+	maxDim = cj.dataPos + (cj.count - 1) * cj.slotDim + cj.blockHead +
+		compress_bound (gctx, lastDim);
+
+	cj.plain = iov;
+	cj.pieces = iovcnt;
+	cj.plainDim = uncDim;
+
+	out = (unsigned char *) malloc (maxDim);
+	if (!out)
+		return GRG_MEM_ALLOCATION_ERR;
+	grg_count_alloc (gctx, maxDim);
+	cj.mem = out;
+
+	//chunk size and count; they must be there before the first chunk
+	//can be written
+	chunk = grg_long2char (cj.chunkSize);
+	if (!chunk)
+	{
+		grg_free (gctx, out, maxDim);
+		return GRG_MEM_ALLOCATION_ERR;
+	}
+	memcpy (out + LIBGRG_CHUNK_SIZE_POS, chunk, LIBGRG_CHUNK_SIZE_LEN);
+	grg_free (gctx, chunk, LIBGRG_CHUNK_SIZE_LEN);
+
+	chunk = grg_long2char (cj.count);
+	if (!chunk)
+	{
+		grg_free (gctx, out, maxDim);
+		return GRG_MEM_ALLOCATION_ERR;
+	}
+	memcpy (out + LIBGRG_CHUNK_COUNT_POS, chunk, LIBGRG_CHUNK_COUNT_LEN);
+	grg_free (gctx, chunk, LIBGRG_CHUNK_COUNT_LEN);
+	chunk = NULL;
+
+	cj.aio = (aio && grg_aio_seekable (aio)) ? aio : NULL;
+	if (cj.aio)
+	{
+		cj.ready = (unsigned char *) calloc (cj.count, 1);
+		if (!cj.ready)
+		{
+			grg_free (gctx, out, maxDim);
+			return GRG_MEM_ALLOCATION_ERR;
+		}
+		pthread_mutex_init (&cj.lock, NULL);
+		cj.next = 0;
+		cj.pos = cj.dataPos;
+	}
+
+	err = grg_parallel_for (gctx->threads, cj.count, encrypt_chunk, &cj);
+
+	if (cj.aio)
+	{
+		pthread_mutex_destroy (&cj.lock);
+		free (cj.ready);
+	}
+
+	if (err < 0)
+	{
+		//the chunks already submitted are still being written
+		if (cj.aio)
+			grg_aio_drain (aio);
+		grg_free (gctx, out, maxDim);
+		out = NULL;
+		return err;
+	}
+
+	if (cj.aio)
+		//they are already in place, with their offsets in the table
+		pos = cj.pos;
+	else
+	{
+		//packs the chunks, and adds their offsets to the table
+		pos = cj.dataPos;
+		for (i = 0; i < cj.count; i++)
+		{
+			entry = out + LIBGRG_TABLE_POS +
+				i * LIBGRG_CHUNK_ENTRY_LEN;
+			len = grg_char2llong (entry + LIBGRG_OFFSET_LEN);
+
+			memmove (out + pos, out + cj.dataPos + i * cj.slotDim,
+				 len);
+			grg_llong2char (pos, entry);
+
+			pos += len;
+		}
+	}
+
+	//adds the algorithm, and the CRC32 of it, of chunk size and count,
+	//of the key check value and of the table
+	for (id = 0; comp_ids[id] != gctx->comp_algo; id++);
+
+	out[LIBGRG_ALGO_POS] =
+		(unsigned char) (gctx->crypt_algo | gctx->hash_algo |
+				 gctx->comp_lvl);
+	out[LIBGRG_COMP_ID_POS] = (unsigned char) id;
+	out[LIBGRG_COMP_LEVEL_POS] = (unsigned char) gctx->comp_level;
+
+	grg_crc32 (out + LIBGRG_ALGO_POS, cj.dataPos - LIBGRG_ALGO_POS,
+		   out + HEADER_LEN + LIBGRG_FILE_VERSION_LEN);
+	GRG_COUNT (gctx, bytes_crc, cj.dataPos - LIBGRG_ALGO_POS);
+
+	memcpy (out, gctx->header, HEADER_LEN);
+	out[HEADER_LEN] = LIBGRG_CHUNKED_FILE_VERSION + '0';
+
+	if (cj.aio)
+	{
+		//the head goes last, once the table is complete
+		err = grg_aio_submit (aio, out, cj.dataPos, 0);
+		if (err < 0)
+		{
+			grg_aio_drain (aio);
+			grg_free (gctx, out, maxDim);
+			return err;
+		}
+
+		grg_aio_close (aio, out);
+		*memDim = pos;
+		*mem = NULL;
+		return GRG_OK;
+	}
+
+	//gives back the unused room; it holds no plain data
+	tmp = (unsigned char *) realloc (out, pos);
+	if (tmp)
+		out = tmp;
+
+	*memDim = pos;
+	*mem = out;
+
+	if (aio)
+	{
+		*mem = NULL;
+		return write_whole (aio, out, pos);
+	}
+
+	return GRG_OK;
+}
+
+/**
+ * encrypt_pieces:
+ * @gctx: the context, a snapshot
+ * @keystruct: the key
+ * @mem: where to store the newly allocated data sequence
+ * @memDim: where to store its length
+ * @iov: the data to encode, in pieces
+ * @iovcnt: how many they are
+ * @uncDim: their length
+ * @aio: if not NULL, where to write the data sequence instead; it then
+ *       owns it, and *@mem is set to NULL
+ *
+ * Encodes the data, in the format the context asks for.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+encrypt_pieces (const GRG_CTX gctx, const GRG_KEY keystruct, void **mem,
+		long *memDim, const struct iovec *iov, const int iovcnt,
+		const long uncDim, GRG_AIO aio)
+{
+	unsigned char *out;
+	long compDim, dataPos;
+	uint32_t dataCRC;
+	GRG_PIECES in;
+	int err;
+
+	if (!grg_comp_algo_supported (gctx->comp_algo))
+		return GRG_WRITE_COMP_ERR;
+
+	if (gctx->chunk_size || needs_comp_byte (gctx) ||
+	    uncDim > LIBGRG_CHUNK_SIZE_MAX)
+		return encrypt_mem_chunked (gctx, keystruct, mem, memDim,
+					    iov, iovcnt, uncDim, aio);
+
+	//the data are compressed right at their final place, after
+	//HEADER ... IV, CRC32 and DATA_LEN
+	dataPos = LIBGRG_KCV_DATA_POS + grg_get_block_size (gctx) +
+		LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN;
+
+	compDim = compress_bound (gctx, uncDim);
+
+	out = (unsigned char *) malloc (dataPos + compDim);
+	if (!out)
+		return GRG_MEM_ALLOCATION_ERR;
+	grg_count_alloc (gctx, dataPos + compDim);
+
+	//two passes, each over a piece at a time: compression and the
+	//inner CRC32, then encryption and the outer one. The inner CRC32
+	//is the first thing encrypted, and in CFB mode every byte depends
+	//on the ones before, so that the second pass can't start earlier.
+	dataCRC = start_data_CRC (out + dataPos - LIBGRG_CRC_LEN -
+				  LIBGRG_DATA_DIM_LEN, uncDim);
+	pieces_init (&in, iov, iovcnt, 0);
+	GRG_TRACE (gctx, GRG_STAGE_COMPRESS, GRG_TRACE_BEGIN, uncDim);
+	GRG_PROBE3 (compress__begin, uncDim, gctx->comp_algo, gctx->comp_lvl);
+	err = compress_data (gctx, &in, uncDim, out + dataPos, &compDim,
+			     &dataCRC);
+	GRG_TRACE (gctx, GRG_STAGE_COMPRESS, GRG_TRACE_END,
+		   (err < 0) ? err : compDim);
+	GRG_PROBE1 (compress__end, (err < 0) ? err : compDim);
+
+	if (err < 0)
+	{
+		grg_free (gctx, out, dataPos + compDim);
+		out = NULL;
+		return err;
+	}
+
+	GRG_COUNT (gctx, bytes_compressed, uncDim);
+
+	err = encode_mem (gctx, keystruct, out, dataPos + compDim, dataCRC);
+
+	if (err < 0)
+	{
+		grg_free (gctx, out, dataPos + compDim);
+		out = NULL;
+		return err;
+	}
+
+	*memDim = dataPos + compDim;
+	*mem = out;
+
+	if (aio)
+	{
+		*mem = NULL;
+		return write_whole (aio, out, dataPos + compDim);
+	}
+
+	return GRG_OK;
+}
+
+/**
+ * encrypt_mem:
+ * @gctx, @keystruct, @mem, @memDim, @iov, @iovcnt, @uncDim, @aio: as in
+ *        encrypt_pieces()
+ *
+ * Encodes the data, reporting it to the trace callback.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+encrypt_mem (const GRG_CTX gctx, const GRG_KEY keystruct, void **mem,
+	     long *memDim, const struct iovec *iov, const int iovcnt,
+	     const long uncDim, GRG_AIO aio)
+{
+	int err;
+
+	GRG_TRACE (gctx, GRG_STAGE_ENCRYPT, GRG_TRACE_BEGIN, uncDim);
+	GRG_PROBE4 (encrypt__begin,
+		    uncDim, gctx->crypt_algo, gctx->hash_algo, gctx->comp_algo);
+	err = encrypt_pieces (gctx, keystruct, mem, memDim, iov, iovcnt,
+			      uncDim, aio);
+	GRG_TRACE (gctx, GRG_STAGE_ENCRYPT, GRG_TRACE_END,
+		   (err < 0) ? err : *memDim);
+	GRG_PROBE1 (encrypt__end, (err < 0) ? err : *memDim);
+
+	return err;
+}
+
+int
+grg_encrypt_mem (const GRG_CTX gctx, const GRG_KEY keystruct, void **mem,
+		 long *memDim, const unsigned char *origData,
+		 const long origDim)
+{
+	struct _grg_context op;
+	struct iovec whole;
+
+	if (!gctx || !keystruct || !origData)
+			return GRG_ARGUMENT_ERR;
+
+	whole.iov_base = (void *) origData;
+	whole.iov_len = (origDim < 0) ? strlen ((char *)origData) : origDim;
+
+	//the settings can't change under our feet
+	grg_ctx_snapshot (gctx, &op);
+
+	return encrypt_mem (&op, keystruct, mem, memDim, &whole, 1,
+			    whole.iov_len, NULL);
+}
+
+int
+grg_encrypt_iov (const GRG_CTX gctx, const GRG_KEY keystruct, void **mem,
+		 long *memDim, const struct iovec *iov, const int iovcnt)
+{
+	struct _grg_context op;
+	long uncDim;
+
+	uncDim = pieces_dim (iov, iovcnt);
+
+	if (!gctx || !keystruct || uncDim < 0)
+		return GRG_ARGUMENT_ERR;
+
+	grg_ctx_snapshot (gctx, &op);
+
+	return encrypt_mem (&op, keystruct, mem, memDim, iov, iovcnt, uncDim,
+			    NULL);
+}
+
+int
+grg_validate_file_direct (const GRG_CTX gctx, const int fd)
+{
+	off_t len;
+	int ret;
+	void *mem;
+
+	if (fd < 0)
+		return GRG_READ_FILE_ERR;
+
+	if (!gctx)
+		return GRG_ARGUMENT_ERR;
+
+	len = lseek (fd, 0, SEEK_END);
+	if (len < 0 || len > LONG_MAX)
+		return GRG_READ_FILE_ERR;
+	mem = mmap (NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (mem == MAP_FAILED)
+		return GRG_READ_MMAP_ERR;
+
+	ret = validate_mem (gctx, mem, len);
+
+	munmap (mem, len);
+
+	if (ret > 0)
+		return GRG_OK;
+	return ret;
+}
+
+int
+grg_validate_file (const GRG_CTX gctx, const char *path)
+{
+	int fd, res;
+
+	if (!gctx || !path)
+		return GRG_ARGUMENT_ERR;
+
+	fd = open (path, O_RDONLY);
+	res = grg_validate_file_direct (gctx, fd);
+	close (fd);
+
+	return res;
+}
+
+int
+grg_update_gctx_from_file_direct (GRG_CTX gctx, const int fd)
+{
+	struct grg_params params;
+	off_t len;
+	int ret;
+	void *mem;
+
+	if (fd < 0)
+		return GRG_READ_FILE_ERR;
+
+	if (!gctx)
+		return GRG_ARGUMENT_ERR;
+
+	len = lseek (fd, 0, SEEK_END);
+	if (len < 0 || len > LONG_MAX)
+		return GRG_READ_FILE_ERR;
+	mem = mmap (NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (mem == MAP_FAILED)
+		return GRG_READ_MMAP_ERR;
+
+	ret = validate_mem (gctx, mem, len);
+
+	if (ret < 0)
+	{
+		munmap (mem, len);
+		return ret;
+	}
+
+	grg_params_from_mem (&params, mem);
+	grg_ctx_set_params (gctx, &params);
+
+	munmap (mem, len);
+
+	return GRG_OK;
+}
+
+int
+grg_update_gctx_from_file (GRG_CTX gctx, const char *path)
+{
+	int fd, res;
+
+	if (!gctx || !path)
+		return GRG_ARGUMENT_ERR;
+
+	fd = open (path, O_RDONLY);
+	res = grg_update_gctx_from_file_direct (gctx, fd);
+	close (fd);
+
+	return res;
+}
+
+int
+grg_decrypt_file_direct_r (const GRG_CTX gctx, const GRG_KEY keystruct,
+			   const int fd, unsigned char **origData,
+			   long *origDim, struct grg_params *params)
+{
+	struct _grg_context op;
+	off_t len;
+	int ret;
+	void *mem;
+	unsigned char *payload, *tmpData;
+	long payloadDim, chunkedDim = 0, pos;
+	unsigned long oDim;
+
+	if (fd < 0)
+		return GRG_READ_FILE_ERR;
+
+	if (!gctx || !keystruct)
+		return GRG_ARGUMENT_ERR;
+
+	//the file is read into a buffer of our own and decrypted in place
+	//there: at most it takes the encrypted data plus the plain ones
+	len = lseek (fd, 0, SEEK_END);
+	if (len < 0 || len > LONG_MAX || lseek (fd, 0, SEEK_SET) < 0)
+		return GRG_READ_FILE_ERR;
+
+	mem = malloc (len ? len : 1);
+	if (!mem)
+		return GRG_MEM_ALLOCATION_ERR;
+	grg_count_alloc (gctx, len);
+
+	ret = grg_read_full (&gctx->counters->stats, fd, mem, len);
+	if (ret < 0)
+	{
+		free (mem);
+		return ret;
+	}
+
+	GRG_TRACE (gctx, GRG_STAGE_DECRYPT, GRG_TRACE_BEGIN, len);
+	GRG_PROBE1 (decrypt__begin, len);
+
+	ret = validate_mem (gctx, mem, len);
+
+	if (ret < 0)
+	{
+		free (mem);
+		GRG_TRACE (gctx, GRG_STAGE_DECRYPT, GRG_TRACE_END, ret);
+		GRG_PROBE1 (decrypt__end, ret);
+		return ret;
+	}
+
+	snapshot_for_mem (gctx, mem, &op, params);
+
+	if (LIBGRG_IS_CHUNKED (ret))
+	{
+		ret = decrypt_chunked (&op, keystruct, mem, len, origData,
+				       &chunkedDim);
+		oDim = chunkedDim;
+		if (ret == GRG_OK && origDim != NULL)
+			*origDim = chunkedDim;
+	}
+	else
+	{
+		pos = LIBGRG_BLOCK_POS (ret);
+		ret = check_key (&op, keystruct, mem, len);
+
+		if (ret == GRG_OK)
+			ret = decrypt_payload (&op, keystruct,
+					       (unsigned char *) mem + pos,
+					       len - pos, &payload,
+					       &payloadDim, &oDim);
+
+		if (ret == GRG_OK)
+		{
+			tmpData = (unsigned char *) malloc (oDim + 1);
+
+			if (!tmpData)
+				ret = GRG_MEM_ALLOCATION_ERR;
+			else
+			{
+				grg_count_alloc (&op, oDim + 1);
+				ret = uncompress_payload (&op, payload,
+							  payloadDim, tmpData,
+							  &oDim);
+
+				if (ret < 0)
+					grg_free (&op, tmpData, oDim);
+				else
+				{
+					*origData = tmpData;
+					if (origDim != NULL)
+						*origDim = oDim;
+				}
+			}
+		}
+	}
+
+	//the buffer now holds decrypted data
+	grg_free (&op, mem, len);
+
+	GRG_TRACE (gctx, GRG_STAGE_DECRYPT, GRG_TRACE_END,
+		   (ret < 0) ? ret : (long) oDim);
+	GRG_PROBE1 (decrypt__end, (ret < 0) ? ret : (long) oDim);
+
+	return ret;
+}
+
+int
+grg_decrypt_file_direct (const GRG_CTX gctx, const GRG_KEY keystruct,
+			 const int fd, unsigned char **origData, long *origDim)
+{
+	struct grg_params params;
+	int ret;
+
+	params.version = 0;
+	ret = grg_decrypt_file_direct_r (gctx, keystruct, fd, origData,
+					 origDim, &params);
+
+	//as it always did, once the data are found valid
+	if (params.version)
+		grg_ctx_set_params (gctx, &params);
+
+	return ret;
+}
+
+int
+grg_decrypt_file_r (const GRG_CTX gctx, const GRG_KEY keystruct,
+		    const char *path, unsigned char **origData,
+		    long *origDim, struct grg_params *params)
+{
+	int fd, res;
+
+	if (!gctx || !keystruct || !path)
+		return GRG_ARGUMENT_ERR;
+
+	fd = open (path, O_RDONLY);
+	res = grg_decrypt_file_direct_r (gctx, keystruct, fd, origData,
+					 origDim, params);
+	close (fd);
+
+	return res;
+}
+
+int
+grg_decrypt_file (const GRG_CTX gctx, const GRG_KEY keystruct,
+		  const char *path, unsigned char **origData,
+		  long *origDim)
+{
+	int fd, res;
+
+	if (!gctx || !keystruct || !path)
+		return GRG_ARGUMENT_ERR;
+
+	fd = open (path, O_RDONLY);
+	res = grg_decrypt_file_direct (gctx, keystruct, fd, origData,
+				       origDim);
+	close (fd);
+
+	return res;
+}
+
+/**
+ * encrypt_file_async:
+ * @gctx: the context
+ * @keystruct: the key
+ * @fd: the file to write
+ * @iov: the data to encode, in pieces
+ * @iovcnt: how many they are
+ * @uncDim: their length
+ * @callback: if not NULL, what to call once the file is written
+ * @user_data: what to pass it
+ * @aio: where to store the handle of the writes
+ *
+ * Encodes the data to a file, writing it while still encrypting.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+encrypt_file_async (const GRG_CTX gctx, const GRG_KEY keystruct,
+		    const int fd, const struct iovec *iov, const int iovcnt,
+		    const long uncDim, GRG_AIO_CALLBACK callback,
+		    void *user_data, GRG_AIO * aio)
+{
+	struct _grg_context op;
+	GRG_AIO a;
+	void *mem;
+	long memDim;
+	int ret;
+
+	if (fd < 3)
+		return GRG_WRITE_FILE_ERR;
+
+	grg_ctx_snapshot (gctx, &op);
+
+	ret = grg_aio_open (&op, fd, callback, user_data, &a);
+	if (ret < 0)
+		return ret;
+
+	//chunked data are written a chunk at a time, while the others
+	//are still being encrypted
+	ret = encrypt_mem (&op, keystruct, &mem, &memDim, iov, iovcnt,
+			   uncDim, a);
+
+	if (ret < 0)
+	{
+		grg_aio_cancel (a);
+		return ret;
+	}
+
+	*aio = a;
+	return GRG_OK;
+}
+
+int
+grg_encrypt_file_async (const GRG_CTX gctx, const GRG_KEY keystruct,
+			const int fd, const unsigned char *origData,
+			const long origDim, GRG_AIO_CALLBACK callback,
+			void *user_data, GRG_AIO * aio)
+{
+	struct iovec whole;
+
+	if (!gctx || !keystruct || !origData || !aio)
+		return GRG_ARGUMENT_ERR;
+
+	whole.iov_base = (void *) origData;
+	whole.iov_len = (origDim < 0) ? strlen ((char *) origData) : origDim;
+
+	return encrypt_file_async (gctx, keystruct, fd, &whole, 1,
+				   whole.iov_len, callback, user_data, aio);
+}
+
+int
+grg_encrypt_file_direct (const GRG_CTX gctx, const GRG_KEY keystruct,
+			 const int fd, const unsigned char *origData,
+			 const long origDim)
+{
+	GRG_AIO aio;
+	int ret;
+
+	//the same, waiting for the writes; they still overlap encryption
+	ret = grg_encrypt_file_async (gctx, keystruct, fd, origData, origDim,
+				      NULL, NULL, &aio);
+
+	if (ret < 0)
+		return ret;
+
+	return grg_aio_wait (aio);
+}
+
+int
+grg_encrypt_file (const GRG_CTX gctx, const GRG_KEY keystruct,
+		  const char *path, const unsigned char *origData,
+		  const long origDim)
+{
+	int fd, res;
+
+	if (!gctx || !keystruct || !path || !origData)
+		return GRG_ARGUMENT_ERR;
+
+	fd = open (path, O_WRONLY | O_CREAT | O_TRUNC,
+		   S_IRUSR | S_IRGRP | S_IROTH | S_IWUSR);
+
+	res = grg_encrypt_file_direct (gctx, keystruct, fd, origData,
+				       origDim);
+	close (fd);
+
+	if (res < 0)
+		unlink (path);
+
+	return res;
+}
+
+int
+grg_encrypt_file_iov_direct (const GRG_CTX gctx, const GRG_KEY keystruct,
+			     const int fd, const struct iovec *iov,
+			     const int iovcnt)
+{
+	GRG_AIO aio;
+	long uncDim;
+	int ret;
+
+	uncDim = pieces_dim (iov, iovcnt);
+
+	if (!gctx || !keystruct || uncDim < 0)
+		return GRG_ARGUMENT_ERR;
+
+	ret = encrypt_file_async (gctx, keystruct, fd, iov, iovcnt, uncDim,
+				  NULL, NULL, &aio);
+
+	if (ret < 0)
+		return ret;
+
+	return grg_aio_wait (aio);
+}
+
+int
+grg_encrypt_file_iov (const GRG_CTX gctx, const GRG_KEY keystruct,
+		      const char *path, const struct iovec *iov,
+		      const int iovcnt)
+{
+	int fd, res;
+
+	if (!gctx || !keystruct || !path)
+		return GRG_ARGUMENT_ERR;
+
+	fd = open (path, O_WRONLY | O_CREAT | O_TRUNC,
+		   S_IRUSR | S_IRGRP | S_IROTH | S_IWUSR);
+
+	res = grg_encrypt_file_iov_direct (gctx, keystruct, fd, iov, iovcnt);
+	close (fd);
+
+	if (res < 0)
+		unlink (path);
+
+	return res;
+}
+
+//what the jobs working on a batch of files need
+typedef struct
+{
+	struct _grg_context params;	//a snapshot, set up for the batch
+	GRG_KEY keystruct;
+	const char **paths;	//the files, by path...
+	const int *fds;		//...or by file descriptor
+
+	int *rets;		//the results, when validating
+	struct grg_file_result *results;	//when decrypting
+}
+FILE_BATCH;
+
+static int
+validate_one (void *arg, const long index)
+{
+	FILE_BATCH *fb = (FILE_BATCH *) arg;
+
+	if (fb->paths)
+		fb->rets[index] = grg_validate_file (&fb->params,
+						     fb->paths[index]);
+	else
+		fb->rets[index] = grg_validate_file_direct (&fb->params,
+							    fb->fds[index]);
+
+	//a failed file mustn't stop the others
+	return GRG_OK;
+}
+
+static int
+decrypt_one (void *arg, const long index)
+{
+	FILE_BATCH *fb = (FILE_BATCH *) arg;
+	struct grg_file_result *res = fb->results + index;
+
+	res->data = NULL;
+	res->dim = 0;
+	res->params.version = 0;
+
+	if (fb->paths)
+		res->ret = grg_decrypt_file_r (&fb->params, fb->keystruct,
+					       fb->paths[index], &res->data,
+					       &res->dim, &res->params);
+	else
+		res->ret = grg_decrypt_file_direct_r (&fb->params, fb->keystruct,
+						      fb->fds[index],
+						      &res->data, &res->dim,
+						      &res->params);
+
+	return GRG_OK;
+}
+
+/**
+ * run_batch:
+ * @gctx: the context
+ * @fb: the batch, whose snapshot of @gctx is taken here
+ * @count: the number of files
+ * @job: validate_one() or decrypt_one()
+ *
+ * Spreads the files of a batch among the threads of the context, as
+ * the chunks of a file are. Each file is then handled by a single thread,
+ * unless there's just one.
+ */
+static void
+run_batch (const GRG_CTX gctx, FILE_BATCH * fb, const long count,
+	   GRG_JOB job)
+{
+	int threads;
+
+	grg_ctx_snapshot (gctx, &fb->params);
+
+	if (count > 1)
+	{
+		threads = fb->params.threads;
+		fb->params.threads = 1;
+		grg_parallel_for (threads, count, job, fb);
+		return;
+	}
+
+	if (count == 1)
+		job (fb, 0);
+}
+
+static int
+batch_validate (const GRG_CTX gctx, const char **paths, const int *fds,
+		const long count, int *results)
+{
+	FILE_BATCH fb;
+	long i;
+
+	if (!gctx || count < 0 || !results)
+		return GRG_ARGUMENT_ERR;
+
+	fb.keystruct = NULL;
+	fb.paths = paths;
+	fb.fds = fds;
+	fb.rets = results;
+	fb.results = NULL;
+
+	run_batch (gctx, &fb, count, validate_one);
+
+	for (i = 0; i < count; i++)
+		if (results[i] < 0)
+			return results[i];
+
+	return GRG_OK;
+}
+
+static int
+batch_decrypt (const GRG_CTX gctx, const GRG_KEY keystruct,
+	       const char **paths, const int *fds, const long count,
+	       struct grg_file_result *results)
+{
+	FILE_BATCH fb;
+	long i;
+
+	if (!gctx || !keystruct || count < 0 || !results)
+		return GRG_ARGUMENT_ERR;
+
+	fb.keystruct = keystruct;
+	fb.paths = paths;
+	fb.fds = fds;
+	fb.rets = NULL;
+	fb.results = results;
+
+	run_batch (gctx, &fb, count, decrypt_one);
+
+	for (i = 0; i < count; i++)
+		if (results[i].ret < 0)
+			return results[i].ret;
+
+	return GRG_OK;
+}
+
+int
+grg_validate_files (const GRG_CTX gctx, const char **paths,
+		    const long count, int *results)
+{
+	if (!paths)
+		return GRG_ARGUMENT_ERR;
+
+	return batch_validate (gctx, paths, NULL, count, results);
+}
+
+int
+grg_validate_files_direct (const GRG_CTX gctx, const int *fds,
+			   const long count, int *results)
+{
+	if (!fds)
+		return GRG_ARGUMENT_ERR;
 
-	return GRG_OK;
+	return batch_validate (gctx, NULL, fds, count, results);
 }
 
 int
-grg_validate_file_direct (const GRG_CTX gctx, const int fd)
+grg_decrypt_files (const GRG_CTX gctx, const GRG_KEY keystruct,
+		   const char **paths, const long count,
+		   struct grg_file_result *results)
 {
-	int ret, len;
-	void *mem;
+	if (!paths)
+		return GRG_ARGUMENT_ERR;
 
-	if (fd < 0)
-		return GRG_READ_FILE_ERR;
+	return batch_decrypt (gctx, keystruct, paths, NULL, count, results);
+}
 
-	if (!gctx)
+int
+grg_decrypt_files_direct (const GRG_CTX gctx, const GRG_KEY keystruct,
+			  const int *fds, const long count,
+			  struct grg_file_result *results)
+{
+	if (!fds)
 		return GRG_ARGUMENT_ERR;
 
-	len = lseek (fd, 0, SEEK_END);
-	mem = mmap (NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	return batch_decrypt (gctx, keystruct, NULL, fds, count, results);
+}
 
-	if (mem == MAP_FAILED)
-		return GRG_READ_MMAP_ERR;
+int
+grg_validate_mem (const GRG_CTX gctx, const void *mem, const long memDim)
+{
+	int ret;
 
-	ret = validate_mem (gctx, mem, len);
+	if (!mem || !gctx)
+			return GRG_ARGUMENT_ERR;
 
-	munmap (mem, len);
+	ret = validate_mem (gctx, mem, memDim);
 
 	if (ret > 0)
 		return GRG_OK;
+
 	return ret;
 }
 
 int
-grg_validate_file (const GRG_CTX gctx, const char *path)
+grg_update_gctx_from_mem (GRG_CTX gctx, const void *mem, const long memDim)
 {
-	int fd, res;
+	struct grg_params params;
+	int ret = validate_mem (gctx, mem, memDim);
+	if (ret < 0)
+		return ret;
 
-	if (!gctx || !path)
-		return GRG_ARGUMENT_ERR;
+	grg_params_from_mem (&params, mem);
+	grg_ctx_set_params (gctx, &params);
 
-	fd = open (path, O_RDONLY);
-	res = grg_validate_file_direct (gctx, fd);
-	close (fd);
+	return GRG_OK;
+}
 
-	return res;
+int
+grg_decrypt_mem_r (const GRG_CTX gctx, const GRG_KEY keystruct,
+		   const void *mem, const long memDim,
+		   unsigned char **origData, long *origDim,
+		   struct grg_params *params)
+{
+	struct _grg_context op;
+	long oDim = 0;
+	int ret;
+
+	if (!mem || !gctx || !keystruct)
+			return GRG_ARGUMENT_ERR;
+
+	GRG_TRACE (gctx, GRG_STAGE_DECRYPT, GRG_TRACE_BEGIN, memDim);
+	GRG_PROBE1 (decrypt__begin, memDim);
+
+	ret = validate_mem (gctx, mem, memDim);
+
+	if (ret >= 0)
+	{
+		snapshot_for_mem (gctx, mem, &op, params);
+		ret = decrypt_mem (&op, keystruct, mem, memDim, origData,
+				   &oDim);
+		if (ret == GRG_OK && origDim != NULL)
+			*origDim = oDim;
+	}
+
+	GRG_TRACE (gctx, GRG_STAGE_DECRYPT, GRG_TRACE_END,
+		   (ret < 0) ? ret : oDim);
+	GRG_PROBE1 (decrypt__end, (ret < 0) ? ret : oDim);
+
+	return ret;
 }
 
 int
-grg_update_gctx_from_file_direct (GRG_CTX gctx, const int fd)
+grg_decrypt_mem (const GRG_CTX gctx, const GRG_KEY keystruct, const void *mem,
+		 const long memDim, unsigned char **origData, long *origDim)
 {
-	int ret, len;
-	void *mem;
+	struct grg_params params;
+	int ret;
 
-	if (fd < 0)
-		return GRG_READ_FILE_ERR;
+	params.version = 0;
+	ret = grg_decrypt_mem_r (gctx, keystruct, mem, memDim, origData,
+				 origDim, &params);
 
-	if (!gctx)
-		return GRG_ARGUMENT_ERR;
+	if (params.version)
+		grg_ctx_set_params (gctx, &params);
 
-	len = lseek (fd, 0, SEEK_END);
-	mem = mmap (NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	return ret;
+}
 
-	if (mem == MAP_FAILED)
-		return GRG_READ_MMAP_ERR;
+/**
+ * uncompress_bound:
+ * @gctx: the context, updated with the algorithms used
+ * @payloadDim: the length of some compressed data
+ *
+ * Tells how long some compressed data can be once uncompressed, at most:
+ * a longer DATA_LEN can only come from a wrong password.
+ *
+ * Returns: the length
+ */
+static unsigned long long
+uncompress_bound (const GRG_CTX gctx, const long payloadDim)
+{
+	unsigned long long dim = (payloadDim > 0) ? payloadDim : 0;
 
-	ret = validate_mem (gctx, mem, len);
+	if (!gctx->comp_lvl)
+		return dim;
 
-	if (ret < 0)
-	{
-		munmap (mem, len);
-		return ret;
-	}
+	//a zstd block of 4 bytes (RLE) gives 128 Kb at most
+	if (gctx->comp_algo == GRG_ZSTD)
+		return dim * 32768;
 
-	update_gctx_from_mem (gctx, ((char *) mem)[LIBGRG_ALGO_POS]);
+	//each byte of a match length adds 255 bytes, in lz4
+	if (gctx->comp_algo == GRG_LZ4)
+		return dim * 256;
 
-	munmap (mem, len);
+	//bzip2 can reach almost 46 millions to 1, with its run lengths
+	if (gctx->comp_algo)	//bz2
+		return dim * 45899236;
 
-	return GRG_OK;
+	//a deflate stream 1032 to 1
+	return dim * 1032;
 }
 
-int
-grg_update_gctx_from_file (GRG_CTX gctx, const char *path)
+/**
+ * peek_block:
+ * @params: the context, updated with the algorithms used
+ * @keystruct: the key
+ * @block: an encrypted block (IV|CRC32|DATA_LEN|DATA)
+ * @blockDim: its length
+ * @oDim: where to store the uncompressed data length
+ *
+ * Reads the (encrypted) DATA_LEN field of a block, decrypting only a
+ * copy of its first few bytes. A value that the data can't hold tells a
+ * wrong password.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+peek_block (const GRG_CTX params, const GRG_KEY keystruct,
+	    const unsigned char *block, const long blockDim,
+	    unsigned long *oDim)
 {
-	int fd, res;
+	unsigned char *key, IV[LIBGRG_IV_SIZE_MAX],
+		inner[LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN];
+	int dIV, keylen;
+	GRG_CIPHER cipher;
 
-	if (!gctx || !path)
-		return GRG_ARGUMENT_ERR;
+	dIV = grg_get_block_size_static (params->crypt_algo);
+	if (blockDim < dIV + LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN)
+		return GRG_READ_CRC_ERR;
 
-	fd = open (path, O_RDONLY);
-	res = grg_update_gctx_from_file_direct (gctx, fd);
-	close (fd);
+	memcpy (IV, block, dIV);
+	memcpy (inner, block + dIV, LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN);
 
-	return res;
+	key = grg_select_key (params, keystruct, &keylen);
+	if (!key)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	grg_XOR_mem (key, keylen, IV, dIV);
+
+	cipher = grg_cipher_open (params->crypt_algo, key, keylen, IV);
+	grg_secure_free (params, key, keylen);
+	key = NULL;
+
+	if (!cipher)
+		return GRG_READ_ENC_INIT_ERR;
+
+	grg_cipher_decrypt (cipher, inner, LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN);
+	grg_cipher_close (cipher);
+	GRG_COUNT (params, bytes_decrypted, LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN);
+
+	*oDim = grg_char2long (inner + LIBGRG_CRC_LEN);
+
+	if (*oDim > uncompress_bound (params, blockDim - dIV - LIBGRG_CRC_LEN -
+				      LIBGRG_DATA_DIM_LEN))
+		return GRG_READ_PWD_ERR;
+
+	return GRG_OK;
 }
 
-int
-grg_decrypt_file_direct (const GRG_CTX gctx, const GRG_KEY keystruct,
-			 const int fd, unsigned char **origData, long *origDim)
+/**
+ * peek_dim:
+ * @gctx: the context
+ * @keystruct: the key
+ * @mem: a libgringotts data sequence
+ * @memDim: its length
+ * @oDim: where to store the uncompressed data length
+ *
+ * Reads the (encrypted) DATA_LEN field, decrypting only the first few
+ * bytes of a copy of the data; for the chunked formats, only the ones
+ * of the last chunk are needed. Nothing is validated, and @gctx is not
+ * modified.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+peek_dim (const GRG_CTX gctx, const GRG_KEY keystruct, const void *mem,
+	  const long memDim, unsigned long *oDim)
 {
-	int ret, len;
-	void *mem;
+	struct _grg_context params;
+	const unsigned char *tmp = (const unsigned char *) mem, *entry;
+	long count, chunkSize, pos;
+	long long offset, len;
+	unsigned long lastDim;
+	int vers, ret;
+
+	if (memcmp (gctx->header, tmp, HEADER_LEN))
+		return GRG_READ_MAGIC_ERR;
 
-	if (fd < 0)
-		return GRG_READ_FILE_ERR;
+	vers = tmp[HEADER_LEN] - '0';
 
-	if (!gctx || !keystruct)
-		return GRG_ARGUMENT_ERR;
+	if (!LIBGRG_IS_SINGLE (vers) && !LIBGRG_IS_CHUNKED (vers))
+		return GRG_READ_UNSUPPORTED_VERSION;
 
-	len = lseek (fd, 0, SEEK_END);
-	mem = mmap (NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (LIBGRG_IS_SINGLE (vers))
+	{
+		snapshot_for_mem (gctx, tmp, &params, NULL);
 
-	if (mem == MAP_FAILED)
-		return GRG_READ_MMAP_ERR;
+		ret = check_key (&params, keystruct, tmp, memDim);
+		if (ret < 0)
+			return ret;
 
-	ret = validate_mem (gctx, mem, len);
+		pos = LIBGRG_BLOCK_POS (vers);
+
+		return peek_block (&params, keystruct, tmp + pos,
+				   memDim - pos, oDim);
+	}
+
+	if (memDim < LIBGRG_TABLE_POS)
+		return GRG_READ_CRC_ERR;
+
+	snapshot_for_mem (gctx, tmp, &params, NULL);
 
+	ret = check_key (&params, keystruct, tmp, memDim);
 	if (ret < 0)
-	{
-		munmap (mem, len);
 		return ret;
-	}
 
-	update_gctx_from_mem (gctx, ((char *) mem)[LIBGRG_ALGO_POS]);
+	count = grg_char2long (tmp + LIBGRG_CHUNK_COUNT_POS);
+	chunkSize = grg_char2long (tmp + LIBGRG_CHUNK_SIZE_POS);
+	if (count < 1 || chunkSize < 1 || chunkSize > LIBGRG_CHUNK_SIZE_MAX ||
+	    count > (memDim - LIBGRG_TABLE_POS) / LIBGRG_CHUNK_ENTRY_LEN)
+		return GRG_READ_CRC_ERR;
+
+	entry = tmp + LIBGRG_TABLE_POS + (count - 1) * LIBGRG_CHUNK_ENTRY_LEN;
+	offset = grg_char2llong (entry);
+	len = grg_char2llong (entry + LIBGRG_OFFSET_LEN);
 
-	ret = decrypt_mem (gctx, keystruct, mem, len, origData, origDim);
+	if (offset < 0 || offset > memDim || len > memDim - offset)
+		return GRG_READ_CRC_ERR;
 
-	munmap (mem, len);
+	ret = peek_block (&params, keystruct, tmp + offset, len, &lastDim);
 
-	return ret;
+	if (ret < 0)
+		return ret;
+
+	//only the last chunk can be shorter, and empty only if it's alone
+	if (lastDim > (unsigned long) chunkSize || (count > 1 && !lastDim))
+		return GRG_READ_PWD_ERR;
+
+	*oDim = (count - 1) * chunkSize + lastDim;
+
+	return GRG_OK;
 }
 
 int
-grg_decrypt_file (const GRG_CTX gctx, const GRG_KEY keystruct,
-		  const char *path, unsigned char **origData,
-		  long *origDim)
+grg_decrypted_size (const GRG_CTX gctx, const GRG_KEY keystruct,
+		    const void *mem, const long memDim, long *origDim)
 {
-	int fd, res;
+	unsigned long oDim;
+	int ret;
 
-	if (!gctx || !keystruct || !path)
+	if (!mem || !gctx || !keystruct || !origDim)
 		return GRG_ARGUMENT_ERR;
 
-	fd = open (path, O_RDONLY);
-	res = grg_decrypt_file_direct (gctx, keystruct, fd, origData,
-				       origDim);
-	close (fd);
+	if (memDim < LIBGRG_DATA_POS)
+		return GRG_READ_MAGIC_ERR;
 
-	return res;
+	ret = peek_dim (gctx, keystruct, mem, memDim, &oDim);
+
+	if (ret < 0)
+		return ret;
+
+	*origDim = oDim;
+
+	return GRG_OK;
 }
 
-int
-grg_encrypt_file_direct (const GRG_CTX gctx, const GRG_KEY keystruct,
-			 const int fd, const unsigned char *origData,
-			 const long origDim)
+/**
+ * decrypt_into:
+ * @gctx: the context
+ * @keystruct: the key
+ * @mem: a libgringotts data sequence; it's decrypted in place
+ * @memDim: its length
+ * @iov: the pieces to put the plain data into
+ * @iovcnt: how many they are
+ * @room: how many bytes they hold
+ * @oDim: where to store the plain data length
+ * @params: where to store the settings @mem was encoded with
+ *
+ * Decrypts a data sequence in place, and uncompresses it right into the
+ * pieces, checking first that they have room for it.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+decrypt_into (const GRG_CTX gctx, const GRG_KEY keystruct, void *mem,
+	      const long memDim, const struct iovec *iov, const int iovcnt,
+	      const long room, unsigned long *oDim,
+	      struct grg_params *params)
 {
+	struct _grg_context op;
+	unsigned char *payload;
+	long payloadDim, pos;
+	GRG_PIECES out;
 	int ret;
-	void *mem;
-	long memDim;
 
-	if (!gctx || !keystruct || !origData)
-		return GRG_ARGUMENT_ERR;
+	ret = validate_mem (gctx, mem, memDim);
 
-	ret = grg_encrypt_mem (gctx, keystruct, &mem, &memDim, origData,
-			       origDim);
+	if (ret < 0)
+		return ret;
+
+	//checks the room before destroying the encrypted data
+	ret = peek_dim (gctx, keystruct, mem, memDim, oDim);
 
 	if (ret < 0)
 		return ret;
 
-	if (fd < 3)
+	if (room < 0 || *oDim > (unsigned long) room)
+		return GRG_ARGUMENT_ERR;
+
+	snapshot_for_mem (gctx, mem, &op, params);
+
+	if (LIBGRG_IS_CHUNKED (((unsigned char *) mem)[HEADER_LEN] - '0'))
 	{
-		grg_unsafe_free (mem);
-		return GRG_WRITE_FILE_ERR;
+		ret = decrypt_chunks (&op, keystruct, mem, memDim, oDim);
+
+		if (ret < 0)
+			return ret;
+
+		if (*oDim > (unsigned long) room)
+			return GRG_READ_COMP_ERR;
+
+		return uncompress_chunks (&op, mem, iov, iovcnt, *oDim);
 	}
 
-	write (fd, mem, memDim);
+	pos = LIBGRG_BLOCK_POS (((unsigned char *) mem)[HEADER_LEN] - '0');
+	ret = decrypt_payload (&op, keystruct, (unsigned char *) mem + pos,
+			       memDim - pos, &payload, &payloadDim, oDim);
 
-	fsync (fd);
+	if (ret < 0)
+		return ret;
 
-	//closing
-	grg_unsafe_free (mem);
+	pieces_init (&out, iov, iovcnt, 0);
 
-	return GRG_OK;
+	return uncompress_pieces (&op, payload, payloadDim, &out, oDim);
 }
 
 int
-grg_encrypt_file (const GRG_CTX gctx, const GRG_KEY keystruct,
-		  const char *path, const unsigned char *origData,
-		  const long origDim)
+grg_decrypt_mem_into_r (const GRG_CTX gctx, const GRG_KEY keystruct,
+			void *mem, const long memDim,
+			unsigned char *origData, const long origSize,
+			long *origDim, struct grg_params *params)
 {
-	int fd, res;
+	struct iovec whole;
+	unsigned long oDim;
+	int ret;
 
-	if (!gctx || !keystruct || !path || !origData)
+	if (!mem || !gctx || !keystruct || !origData)
 		return GRG_ARGUMENT_ERR;
 
-	fd = open (path, O_WRONLY | O_CREAT | O_TRUNC,
-		   S_IRUSR | S_IRGRP | S_IROTH | S_IWUSR);
+	//leaves room for the '\0'
+	whole.iov_base = origData;
+	whole.iov_len = (origSize > 0) ? origSize - 1 : 0;
 
-	res = grg_encrypt_file_direct (gctx, keystruct, fd, origData,
-				       origDim);
-	close (fd);
+	GRG_TRACE (gctx, GRG_STAGE_DECRYPT, GRG_TRACE_BEGIN, memDim);
+	GRG_PROBE1 (decrypt__begin, memDim);
+	ret = decrypt_into (gctx, keystruct, mem, memDim, &whole, 1,
+			    origSize - 1, &oDim, params);
+	GRG_TRACE (gctx, GRG_STAGE_DECRYPT, GRG_TRACE_END,
+		   (ret < 0) ? ret : (long) oDim);
+	GRG_PROBE1 (decrypt__end, (ret < 0) ? ret : (long) oDim);
 
-	if (res < 0)
-		unlink (path);
+	if (ret < 0)
+		return ret;
 
-	return res;
-}
+	origData[oDim] = '\0';
+
+	if (origDim != NULL)
+		*origDim = oDim;
 
+	return GRG_OK;
+}
 
 int
-grg_validate_mem (const GRG_CTX gctx, const void *mem, const long memDim)
+grg_decrypt_mem_into (const GRG_CTX gctx, const GRG_KEY keystruct,
+		      void *mem, const long memDim, unsigned char *origData,
+		      const long origSize, long *origDim)
 {
+	struct grg_params params;
 	int ret;
 
-	if (!mem || !gctx)
-			return GRG_ARGUMENT_ERR;
-
-	ret = validate_mem (gctx, mem, memDim);
+	params.version = 0;
+	ret = grg_decrypt_mem_into_r (gctx, keystruct, mem, memDim, origData,
+				      origSize, origDim, &params);
 
-	if (ret > 0)
-		return GRG_OK;
+	if (params.version)
+		grg_ctx_set_params (gctx, &params);
 
 	return ret;
 }
 
 int
-grg_update_gctx_from_mem (GRG_CTX gctx, const void *mem, const long memDim)
+grg_decrypt_to_iov (const GRG_CTX gctx, const GRG_KEY keystruct, void *mem,
+		    const long memDim, const struct iovec *iov,
+		    const int iovcnt, long *origDim)
 {
-	int ret = validate_mem (gctx, mem, memDim);
-	if (ret < 0)
-		return ret;
-
-	update_gctx_from_mem (gctx, ((char *) mem)[LIBGRG_ALGO_POS]);
+	struct grg_params params;
+	unsigned long oDim;
+	long room;
+	int ret;
 
-	return GRG_OK;
-}
+	room = pieces_dim (iov, iovcnt);
 
-int
-grg_decrypt_mem (const GRG_CTX gctx, const GRG_KEY keystruct, const void *mem,
-		 const long memDim, unsigned char **origData, long *origDim)
-{
-	int ret;
+	if (!mem || !gctx || !keystruct || room < 0)
+		return GRG_ARGUMENT_ERR;
 
-	if (!mem || !gctx || !keystruct)
-			return GRG_ARGUMENT_ERR;
+	params.version = 0;
+	GRG_TRACE (gctx, GRG_STAGE_DECRYPT, GRG_TRACE_BEGIN, memDim);
+	GRG_PROBE1 (decrypt__begin, memDim);
+	ret = decrypt_into (gctx, keystruct, mem, memDim, iov, iovcnt, room,
+			    &oDim, &params);
+	GRG_TRACE (gctx, GRG_STAGE_DECRYPT, GRG_TRACE_END,
+		   (ret < 0) ? ret : (long) oDim);
+	GRG_PROBE1 (decrypt__end, (ret < 0) ? ret : (long) oDim);
 
-	ret = validate_mem (gctx, mem, memDim);
+	if (params.version)
+		grg_ctx_set_params (gctx, &params);
 
 	if (ret < 0)
 		return ret;
 
-	update_gctx_from_mem (gctx, ((char *) mem)[LIBGRG_ALGO_POS]);
-
-	ret = decrypt_mem (gctx, keystruct, mem, memDim, origData, origDim);
+	if (origDim != NULL)
+		*origDim = oDim;
 
-	return ret;
+	return GRG_OK;
 }
@@ -25,12 +25,6 @@
 #include "libgringotts.h"
 #include "config.h"
 
-//masks
-#define GRG_ENCRYPT_MASK		0x70	//01110000
-#define GRG_HASH_MASK			0x08	//00001000
-#define GRG_COMP_TYPE_MASK		0x04	//00000100
-#define GRG_COMP_LVL_MASK		0x03	//00000011
-
 //use of small memory requirements in BZ2 decompression
 #define USE_BZ2_SMALL_MEM		TRUE
 
@@ -44,6 +38,62 @@
 #define LIBGRG_DATA_POS			9	//LIBGRG_ALGO_POS + LIBGRG_ALGO_LEN
 #define LIBGRG_OVERHEAD			14	//LIBGRG_DATA_POS + LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN
 
+#define LIBGRG_DATA_DIM_MAX		0xffffffffUL	//what DATA_LEN can hold
+
+//version 4 format specs: as version 3, with a key check value (KCV) after
+//ALGO, so that a wrong password is told without decrypting the data: it's
+//the encryption of zeroes with the key of the block, and its IV with all
+//the bits flipped, not to give away the keystream of the data. It's
+//written instead of version 3.
+#define LIBGRG_KCV_FILE_VERSION	4
+#define LIBGRG_KCV_LEN			4
+
+#define LIBGRG_KCV_POS			9	//LIBGRG_ALGO_POS + LIBGRG_ALGO_LEN
+#define LIBGRG_KCV_DATA_POS		13	//LIBGRG_KCV_POS + LIBGRG_KCV_LEN
+
+//version 5 (chunked) format specs: after ALGO come the plain chunk size,
+//the chunk count, the compression algorithm (COMP) and its own level, the
+//key check value of the first chunk and a table with OFFSET, LENGTH and
+//CRC32 of each chunk; each chunk is laid out as IV|CRC32|DATA_LEN|DATA, as
+//in version 3. COMP holds any compression algorithm, so the compression
+//bit of ALGO is 0. It's written when a chunk size is set, for zstd and lz4,
+//and for the data that are too long for a single block; an unchunked
+//context writes chunks of LIBGRG_CHUNK_SIZE_MAX.
+#define LIBGRG_CHUNKED_FILE_VERSION	5
+#define LIBGRG_CHUNK_SIZE_LEN	4
+#define LIBGRG_CHUNK_COUNT_LEN	4
+#define LIBGRG_COMP_ID_LEN		1
+#define LIBGRG_COMP_LEVEL_LEN	1
+#define LIBGRG_OFFSET_LEN		8
+
+#define LIBGRG_CHUNK_SIZE_POS	9	//LIBGRG_ALGO_POS + LIBGRG_ALGO_LEN
+#define LIBGRG_CHUNK_COUNT_POS	13	//LIBGRG_CHUNK_SIZE_POS + LIBGRG_CHUNK_SIZE_LEN
+#define LIBGRG_COMP_ID_POS		17	//LIBGRG_CHUNK_COUNT_POS + LIBGRG_CHUNK_COUNT_LEN
+#define LIBGRG_COMP_LEVEL_POS	18	//LIBGRG_COMP_ID_POS + LIBGRG_COMP_ID_LEN
+#define LIBGRG_KCV_CHUNKED_POS	19	//LIBGRG_COMP_LEVEL_POS + LIBGRG_COMP_LEVEL_LEN
+#define LIBGRG_TABLE_POS		23	//LIBGRG_KCV_CHUNKED_POS + LIBGRG_KCV_LEN
+#define LIBGRG_CHUNK_ENTRY_LEN	20	//2 * LIBGRG_OFFSET_LEN + LIBGRG_CRC_LEN
+
+#define LIBGRG_CHUNK_SIZE_MAX	0x40000000	//1 Gb
+
+//the values of COMP: 0 for zlib, 1 for bzip2, 2 for zstd, 3 for lz4
+#define LIBGRG_COMP_IDS			4
+
+#define LIBGRG_IS_CHUNKED(vers)	((vers) == LIBGRG_CHUNKED_FILE_VERSION)
+#define LIBGRG_IS_SINGLE(vers)	((vers) == 3 || \
+				 (vers) == LIBGRG_KCV_FILE_VERSION)
+//where the IV of a version 3 or 4 data sequence is
+#define LIBGRG_BLOCK_POS(vers)	((vers) == LIBGRG_KCV_FILE_VERSION ? \
+				 LIBGRG_KCV_DATA_POS : LIBGRG_DATA_POS)
+
+//the encoder compresses, checksums and encrypts the data this many bytes
+//at a time, so that each step finds them still in the cache
+#define LIBGRG_PIPE_BLOCK		(64 * 1024)
+
+//a temp file keeps an overwrite generation, the nonce of its keystream,
+//for each block this long; LIBGRG_PIPE_BLOCK must be a multiple of it
+#define LIBGRG_TMP_BLOCK		4096
+
 #define LIBGRG_IV_SIZE_MIN		8	//for 3DES
 #define LIBGRG_IV_SIZE_MAX		32	//for RIJNDAEL_256
 
@@ -51,5 +101,14 @@
 #define TRUE	!FALSE
 
 char *grg2mcrypt (const grg_crypt_algo algo);
+unsigned char *grg_select_key (const GRG_CTX gctx, const GRG_KEY keystruct,
+			       int *dim);
+void grg_params_from_mem (struct grg_params *params, const void *mem);
+int grg_key_check_value (const grg_crypt_algo algo, const unsigned char *key,
+			 const int dKey, const unsigned char *IV,
+			 const int dIV, unsigned char *kcv);
+int grg_encode_in_place (const GRG_CTX gctx, const GRG_KEY keystruct,
+			 unsigned char *mem, const long memDim,
+			 const long uncDim);
 
 #endif
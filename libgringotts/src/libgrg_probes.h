@@ -0,0 +1,47 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_probes.h - static probes for SystemTap, perf and bpftrace
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef LIBGRG_PROBES_H
+#define LIBGRG_PROBES_H
+
+#include "config.h"
+
+// The probes of the "libgringotts" provider. Each one is a nop in the
+// code, and a note in the ELF file telling the tracers where to put their
+// breakpoint and how to find the arguments, so that it costs nothing
+// until somebody listens. Without sys/sdt.h, or with configure
+// --disable-sdt, they aren't there at all.
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define GRG_PROBE1(name, a)		DTRACE_PROBE1 (libgringotts, name, a)
+#define GRG_PROBE2(name, a, b)		DTRACE_PROBE2 (libgringotts, name, a, b)
+#define GRG_PROBE3(name, a, b, c)	DTRACE_PROBE3 (libgringotts, name, a, b, c)
+#define GRG_PROBE4(name, a, b, c, d)	DTRACE_PROBE4 (libgringotts, name, a, b, c, d)
+#else
+#define GRG_PROBE1(name, a)
+#define GRG_PROBE2(name, a, b)
+#define GRG_PROBE3(name, a, b, c)
+#define GRG_PROBE4(name, a, b, c, d)
+#endif
+
+#endif
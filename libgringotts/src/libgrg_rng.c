@@ -0,0 +1,463 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_rng.c - a buffered, ChaCha20-based random generator
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// The generator is seeded with 32 bytes from the kernel (getrandom(), or
+// the context's /dev/urandom if that's missing), and then runs ChaCha20
+// on its own. Every refill of the buffer takes the first 32 bytes of the
+// new keystream as the next key, and the bytes handed out are wiped from
+// the buffer, so that the state never tells anything about the bytes
+// already produced. Fresh kernel entropy is mixed into the key every
+// GRG_RNG_RESEED bytes, and in a child after a fork().
+//
+// Each thread gets a generator of its own on its first request, so that
+// threads never wait for each other; the one of the context is used only
+// if that can't be made.
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "libgrg_crypt.h"
+#include "libgrg_rng.h"
+
+#define GRG_RNG_KEY_LEN		32
+#define GRG_RNG_BLOCK_LEN	64
+#define GRG_RNG_BUF_LEN		(16 * GRG_RNG_BLOCK_LEN)
+#define GRG_RNG_RESEED		(1024 * 1024)
+
+struct _grg_rng
+{
+	pthread_mutex_t lock;
+	uint32_t key[GRG_RNG_KEY_LEN / 4];
+	unsigned char buf[GRG_RNG_BUF_LEN];
+	int used;		//bytes of buf already handed out (or wiped)
+	unsigned long since_reseed;
+	unsigned long fork_gen;
+};
+
+static void
+wipe (void *data, size_t len)
+{
+	volatile unsigned char *tmp = (volatile unsigned char *) data;
+
+	while (len--)
+		*tmp++ = 0;
+}
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static volatile unsigned long fork_gen = 0;
+
+static pthread_key_t thread_key;
+static int thread_key_ok = FALSE;
+
+static void
+on_fork (void)
+{
+	fork_gen++;
+}
+
+static void
+on_thread_exit (void *rng)
+{
+	grg_rng_free ((GRG_RNG) rng);
+}
+
+static void
+init_globals (void)
+{
+	pthread_atfork (NULL, NULL, on_fork);
+	thread_key_ok = !pthread_key_create (&thread_key, on_thread_exit);
+}
+
+#define ROTL32(v, n)	(((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QR(a, b, c, d) \
+	a += b; d ^= a; d = ROTL32 (d, 16); \
+	c += d; b ^= c; b = ROTL32 (b, 12); \
+	a += b; d ^= a; d = ROTL32 (d, 8); \
+	c += d; b ^= c; b = ROTL32 (b, 7)
+
+/**
+ * chacha20_block:
+ * @key: the 256 bits key
+ * @nonce: the nonce, 0 for the generator
+ * @counter: the block counter
+ * @out: where to put the 64 bytes of keystream
+ *
+ * Computes a ChaCha20 block (RFC 8439), with a 64 bits nonce and counter.
+ */
+static void
+chacha20_block (const uint32_t * key, const uint64_t nonce,
+		const uint64_t counter, unsigned char *out)
+{
+	uint32_t in[16], x[16];
+	int i;
+
+	in[0] = 0x61707865;
+	in[1] = 0x3320646e;
+	in[2] = 0x79622d32;
+	in[3] = 0x6b206574;
+	for (i = 0; i < 8; i++)
+		in[4 + i] = key[i];
+	in[12] = (uint32_t) counter;
+	in[13] = (uint32_t) (counter >> 32);
+	in[14] = (uint32_t) nonce;
+	in[15] = (uint32_t) (nonce >> 32);
+
+	memcpy (x, in, sizeof (x));
+
+	for (i = 0; i < 10; i++)
+	{
+		QR (x[0], x[4], x[8], x[12]);
+		QR (x[1], x[5], x[9], x[13]);
+		QR (x[2], x[6], x[10], x[14]);
+		QR (x[3], x[7], x[11], x[15]);
+		QR (x[0], x[5], x[10], x[15]);
+		QR (x[1], x[6], x[11], x[12]);
+		QR (x[2], x[7], x[8], x[13]);
+		QR (x[3], x[4], x[9], x[14]);
+	}
+
+	for (i = 0; i < 16; i++)
+	{
+		x[i] += in[i];
+		out[4 * i] = x[i] & 0xff;
+		out[4 * i + 1] = (x[i] >> 8) & 0xff;
+		out[4 * i + 2] = (x[i] >> 16) & 0xff;
+		out[4 * i + 3] = (x[i] >> 24) & 0xff;
+	}
+
+	wipe (x, sizeof (x));
+	wipe (in, sizeof (in));
+}
+
+/**
+ * chacha20_fill:
+ * @key: the 256 bits key
+ * @out: where to put the keystream
+ * @len: its length
+ *
+ * Writes @len bytes of ChaCha20 keystream, starting from block 0.
+ */
+static void
+chacha20_fill (const uint32_t * key, unsigned char *out, const long len)
+{
+	unsigned char tail[GRG_RNG_BLOCK_LEN];
+	uint64_t counter = 0;
+	long done = 0;
+
+	for (; len - done >= GRG_RNG_BLOCK_LEN; done += GRG_RNG_BLOCK_LEN)
+		chacha20_block (key, 0, counter++, out + done);
+
+	if (done < len)
+	{
+		chacha20_block (key, 0, counter, tail);
+		memcpy (out + done, tail, len - done);
+		wipe (tail, sizeof (tail));
+	}
+}
+
+static void
+load_key (uint32_t * key, const unsigned char *src)
+{
+	int i;
+
+	for (i = 0; i < GRG_RNG_KEY_LEN / 4; i++)
+		key[i] = (uint32_t) src[4 * i] |
+			((uint32_t) src[4 * i + 1] << 8) |
+			((uint32_t) src[4 * i + 2] << 16) |
+			((uint32_t) src[4 * i + 3] << 24);
+}
+
+/**
+ * get_entropy:
+ * @fd: a file descriptor on /dev/urandom, to use if getrandom() is missing
+ * @buf: where to put the random bytes
+ * @len: how many (at most 256)
+ *
+ * Reads some entropy from the kernel.
+ *
+ * Returns: TRUE or FALSE
+ */
+static int
+get_entropy (const int fd, unsigned char *buf, const int len)
+{
+#ifdef SYS_getrandom
+	if (syscall (SYS_getrandom, buf, len, 0) == len)
+		return TRUE;
+#endif
+
+	if (fd >= 0 && read (fd, buf, len) == len)
+		return TRUE;
+
+	return FALSE;
+}
+
+/**
+ * refill:
+ * @rng: the generator
+ *
+ * Fills the buffer with new keystream, and takes its first 32 bytes
+ * as the next key.
+ */
+static void
+refill (GRG_RNG rng)
+{
+	chacha20_fill (rng->key, rng->buf, GRG_RNG_BUF_LEN);
+	load_key (rng->key, rng->buf);
+	wipe (rng->buf, GRG_RNG_KEY_LEN);
+	rng->used = GRG_RNG_KEY_LEN;
+}
+
+/**
+ * reseed:
+ * @rng: the generator
+ * @fd: the fallback entropy source
+ *
+ * Mixes fresh kernel entropy into the key, and throws the buffer away.
+ * If the kernel can't give any, the generator just goes on.
+ */
+static void
+reseed (GRG_RNG rng, const int fd)
+{
+	unsigned char seed[GRG_RNG_KEY_LEN];
+	uint32_t fresh[GRG_RNG_KEY_LEN / 4];
+	int i;
+
+	if (get_entropy (fd, seed, GRG_RNG_KEY_LEN))
+	{
+		load_key (fresh, seed);
+		for (i = 0; i < GRG_RNG_KEY_LEN / 4; i++)
+			rng->key[i] ^= fresh[i];
+		wipe (seed, sizeof (seed));
+		wipe (fresh, sizeof (fresh));
+	}
+
+	rng->since_reseed = 0;
+	rng->fork_gen = fork_gen;
+	refill (rng);
+}
+
+/**
+ * take:
+ * @rng: the generator, locked
+ * @fd: the fallback entropy source
+ * @out: where to put the bytes
+ * @len: how many
+ *
+ * Hands out bytes from the buffer, wiping them, and refilling it as
+ * needed.
+ */
+static void
+take (GRG_RNG rng, const int fd, unsigned char *out, long len)
+{
+	long step;
+
+	if (rng->fork_gen != fork_gen || rng->since_reseed >= GRG_RNG_RESEED)
+		reseed (rng, fd);
+
+	rng->since_reseed += len;
+
+	while (len > 0)
+	{
+		if (rng->used == GRG_RNG_BUF_LEN)
+			refill (rng);
+
+		step = GRG_RNG_BUF_LEN - rng->used;
+		if (step > len)
+			step = len;
+
+		memcpy (out, rng->buf + rng->used, step);
+		wipe (rng->buf + rng->used, step);
+		rng->used += step;
+		out += step;
+		len -= step;
+	}
+}
+
+/**
+ * grg_rng_new:
+ * @fd: a file descriptor on /dev/urandom, to use if getrandom() is missing
+ *
+ * Creates and seeds a new generator.
+ *
+ * Returns: the generator, or NULL if no entropy can be obtained
+ */
+GRG_RNG
+grg_rng_new (const int fd)
+{
+	unsigned char seed[GRG_RNG_KEY_LEN];
+	GRG_RNG rng;
+
+	pthread_once (&init_once, init_globals);
+
+	if (!get_entropy (fd, seed, GRG_RNG_KEY_LEN))
+		return NULL;
+
+	rng = (GRG_RNG) malloc (sizeof (struct _grg_rng));
+	if (!rng)
+	{
+		wipe (seed, sizeof (seed));
+		return NULL;
+	}
+
+	pthread_mutex_init (&rng->lock, NULL);
+	load_key (rng->key, seed);
+	wipe (seed, sizeof (seed));
+
+	rng->since_reseed = 0;
+	rng->fork_gen = fork_gen;
+	refill (rng);
+
+	return rng;
+}
+
+/**
+ * thread_rng:
+ * @fd: the fallback entropy source, for seeding
+ *
+ * Gets the generator of the calling thread, making it the first time.
+ *
+ * Returns: the generator, or NULL if it can't be made
+ */
+static GRG_RNG
+thread_rng (const int fd)
+{
+	GRG_RNG rng;
+
+	pthread_once (&init_once, init_globals);
+	if (!thread_key_ok)
+		return NULL;
+
+	rng = (GRG_RNG) pthread_getspecific (thread_key);
+	if (rng)
+		return rng;
+
+	rng = grg_rng_new (fd);
+	if (rng && pthread_setspecific (thread_key, rng))
+	{
+		grg_rng_free (rng);
+		rng = NULL;
+	}
+
+	return rng;
+}
+
+/**
+ * grg_rng_read:
+ * @rng: the generator of the context, to use if the thread can't have one
+ * @fd: the fallback entropy source, for reseeding
+ * @out: where to put the random bytes
+ * @len: how many
+ *
+ * Produces random bytes; it can be called by many threads at once.
+ * Small requests are served from the buffer; for big ones, a one-time
+ * key is taken from it, and the keystream is written straight into
+ * @out outside of the lock (that, on the generator of the thread, is
+ * never contended anyway).
+ */
+void
+grg_rng_read (GRG_RNG rng, const int fd, unsigned char *out, const long len)
+{
+	unsigned char seed[GRG_RNG_KEY_LEN];
+	uint32_t key[GRG_RNG_KEY_LEN / 4];
+	GRG_RNG own;
+
+	if (len <= 0)
+		return;
+
+	own = thread_rng (fd);
+	if (own)
+		rng = own;
+
+	pthread_mutex_lock (&rng->lock);
+
+	if (len <= GRG_RNG_BUF_LEN - GRG_RNG_KEY_LEN)
+	{
+		take (rng, fd, out, len);
+		pthread_mutex_unlock (&rng->lock);
+		return;
+	}
+
+	take (rng, fd, seed, GRG_RNG_KEY_LEN);
+	rng->since_reseed += len;
+	pthread_mutex_unlock (&rng->lock);
+
+	load_key (key, seed);
+	chacha20_fill (key, out, len);
+
+	wipe (seed, sizeof (seed));
+	wipe (key, sizeof (key));
+}
+
+/**
+ * grg_chacha20_xor:
+ * @key: the 256 bits key, GRG_CHACHA20_KEY_LEN bytes
+ * @nonce: the nonce, telling apart the streams of the same key
+ * @offset: the position of @data in the stream
+ * @data: the data to encrypt or decrypt, in place
+ * @len: their length
+ *
+ * XORs @data with the ChaCha20 keystream of @key and @nonce, from byte
+ * @offset on; any range of the stream can be reached directly, as in CTR
+ * mode.
+ */
+void
+grg_chacha20_xor (const unsigned char *key, const unsigned long long nonce,
+		  const unsigned long long offset, unsigned char *data,
+		  const long len)
+{
+	unsigned char block[GRG_RNG_BLOCK_LEN];
+	uint32_t k[GRG_RNG_KEY_LEN / 4];
+	uint64_t counter = offset / GRG_RNG_BLOCK_LEN;
+	long skip = offset % GRG_RNG_BLOCK_LEN, done = 0, i;
+
+	if (len <= 0)
+		return;
+
+	load_key (k, key);
+
+	while (done < len)
+	{
+		chacha20_block (k, nonce, counter++, block);
+		for (i = skip; i < GRG_RNG_BLOCK_LEN && done < len; i++)
+			data[done++] ^= block[i];
+		skip = 0;
+	}
+
+	wipe (block, sizeof (block));
+	wipe (k, sizeof (k));
+}
+
+void
+grg_rng_free (GRG_RNG rng)
+{
+	if (!rng)
+		return;
+
+	pthread_mutex_destroy (&rng->lock);
+	wipe (rng->key, sizeof (rng->key));
+	wipe (rng->buf, sizeof (rng->buf));
+	free (rng);
+}
@@ -0,0 +1,38 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_rng.h - header file for libgrg_rng.c
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef LIBGRG_RNG_H
+#define LIBGRG_RNG_H
+
+typedef struct _grg_rng *GRG_RNG;
+
+#define GRG_CHACHA20_KEY_LEN	32
+
+GRG_RNG grg_rng_new (const int fd);
+void grg_rng_read (GRG_RNG rng, const int fd, unsigned char *out,
+		   const long len);
+void grg_rng_free (GRG_RNG rng);
+void grg_chacha20_xor (const unsigned char *key,
+		       const unsigned long long nonce,
+		       const unsigned long long offset, unsigned char *data,
+		       const long len);
+
+#endif
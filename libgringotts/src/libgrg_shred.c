@@ -0,0 +1,411 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_shred.c - secure wiping of files
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Every pass overwrites the file in place, a block at a time, with
+// keystream of the generator of the context; the blocks are written with
+// O_DIRECT where the filesystem allows it, so that they don't go through
+// (and flush out) the page cache, and the pass ends with an fsync() of the
+// file alone. Many files are wiped at once, each by a thread; the calling
+// thread just reports the progress, so that the callback is always called
+// from it.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		//O_DIRECT
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "libgrg_crypt.h"
+#include "libgrg_utils.h"
+#include "libgrg_structs.h"
+#include "libgrg_probes.h"
+#include "libgrg_threads.h"
+#include "libgringotts.h"
+
+#ifndef O_DIRECT
+#define O_DIRECT		0
+#endif
+
+#define SHRED_BLOCK		(1024 * 1024)	//written at once
+#define SHRED_ALIGN		4096	//what O_DIRECT asks for, on any filesystem
+#define SHRED_REPORT_MS	100	//how often the progress is reported
+
+typedef struct
+{
+	GRG_CTX gctx;
+	const char **paths;
+	int *results;
+	int npaths;
+	int npasses;
+	int threads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	long long done;
+	long long total;
+	int cancel;
+	int finished;
+
+	GRG_SHRED_PROGRESS progress;
+	void *user_data;
+	int report;		//the jobs call progress themselves, in the calling thread
+}
+GRG_SHRED;
+
+/**
+ * advance:
+ * @s: the shredding
+ * @dim: the bytes just written
+ *
+ * Accounts for a block written, reporting it if there's no reporter.
+ *
+ * Returns: GRG_OK, or GRG_SHRED_CANCELLED if the work must stop
+ */
+static int
+advance (GRG_SHRED * s, const long dim)
+{
+	long long done;
+	int cancel;
+
+	pthread_mutex_lock (&s->lock);
+	s->done += dim;
+	done = s->done;
+	cancel = s->cancel;
+	pthread_mutex_unlock (&s->lock);
+
+	if (!cancel && s->report &&
+	    s->progress (s->user_data, (done < s->total) ? done : s->total,
+			 s->total))
+	{
+		pthread_mutex_lock (&s->lock);
+		cancel = s->cancel = TRUE;
+		pthread_mutex_unlock (&s->lock);
+	}
+
+	return cancel ? GRG_SHRED_CANCELLED : GRG_OK;
+}
+
+/**
+ * shred_one:
+ * @s: the shredding
+ * @path: the file to wipe
+ *
+ * Overwrites a file @s->npasses times, and unlinks it.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+shred_one (GRG_SHRED * s, const char *path)
+{
+	GRG_CTX gctx = s->gctx;
+	struct stat buf;
+	unsigned char *block;
+	void *mem;
+	off_t dim, body, pos;
+	long len;
+	int fd, dfd, pass, ret = GRG_OK;
+
+	fd = open (path, O_WRONLY);
+	if (fd < 0)
+		return GRG_SHRED_CANT_OPEN_FILE;
+
+	if (fstat (fd, &buf) || !S_ISREG (buf.st_mode))
+	{
+		close (fd);
+		return GRG_SHRED_CANT_OPEN_FILE;
+	}
+
+	if (buf.st_nlink > 1)
+	{
+		close (fd);
+		return GRG_SHRED_YET_LINKED;
+	}
+
+	if (posix_memalign (&mem, SHRED_ALIGN, SHRED_BLOCK))
+	{
+		close (fd);
+		return GRG_MEM_ALLOCATION_ERR;
+	}
+	block = (unsigned char *) mem;
+
+	//O_DIRECT takes whole aligned blocks; the tail goes through the cache
+	dim = buf.st_size;
+	GRG_PROBE3 (shred__file__begin, path, (long long) dim, s->npasses);
+	body = dim / SHRED_ALIGN * SHRED_ALIGN;
+	dfd = (O_DIRECT && body) ? open (path, O_WRONLY | O_DIRECT) : -1;
+
+	for (pass = 0; pass < s->npasses && ret == GRG_OK; pass++)
+	{
+		for (pos = 0; pos < dim && ret == GRG_OK; pos += len)
+		{
+			len = (dim - pos < SHRED_BLOCK) ? dim - pos : SHRED_BLOCK;
+			if (dfd >= 0 && pos < body && len > body - pos)
+				len = body - pos;
+
+			if (gctx->rng)
+			{
+				grg_rng_read (gctx->rng, gctx->rnd, block, len);
+				GRG_COUNT (gctx, bytes_random, len);
+			}
+			else
+				grg_rnd_seq_direct (gctx, block, len);
+
+			ret = GRG_WRITE_FILE_ERR;
+			if (dfd >= 0 && pos < body)
+			{
+				ret = grg_pwrite_full (&gctx->counters->stats,
+						       dfd, block, len, pos);
+				//the filesystem doesn't take it after all
+				if (ret != GRG_OK)
+				{
+					close (dfd);
+					dfd = -1;
+				}
+			}
+			if (ret != GRG_OK)
+				ret = grg_pwrite_full (&gctx->counters->stats,
+						       fd, block, len, pos);
+
+			if (ret == GRG_OK)
+				ret = advance (s, len);
+		}
+
+		//flushes what went through the cache, and the device's one
+		if (ret == GRG_OK)
+		{
+			GRG_TRACE (gctx, GRG_STAGE_SYNC, GRG_TRACE_BEGIN, dim);
+			GRG_PROBE1 (sync__begin, (long long) dim);
+			if (fsync (fd))
+				ret = GRG_WRITE_FILE_ERR;
+			GRG_COUNT (gctx, syscalls, 1);
+			GRG_TRACE (gctx, GRG_STAGE_SYNC, GRG_TRACE_END,
+				   (ret < 0) ? ret : dim);
+			GRG_PROBE1 (sync__end, (ret < 0) ? ret : (long long) dim);
+		}
+	}
+
+	free (mem);
+	if (dfd >= 0)
+		close (dfd);
+	close (fd);
+
+	if (ret == GRG_OK)
+		unlink (path);
+
+	GRG_PROBE2 (shred__file__end, path, ret);
+
+	return ret;
+}
+
+static int
+shred_job (void *arg, const long index)
+{
+	GRG_SHRED *s = (GRG_SHRED *) arg;
+
+	s->results[index] = shred_one (s, s->paths[index]);
+
+	//a file that fails doesn't stop the others, a cancellation does
+	return (s->results[index] == GRG_SHRED_CANCELLED) ?
+		GRG_SHRED_CANCELLED : GRG_OK;
+}
+
+static void *
+shred_all (void *arg)
+{
+	GRG_SHRED *s = (GRG_SHRED *) arg;
+
+	grg_parallel_for (s->threads, s->npaths, shred_job, s);
+
+	pthread_mutex_lock (&s->lock);
+	s->finished = TRUE;
+	pthread_cond_signal (&s->cond);
+	pthread_mutex_unlock (&s->lock);
+
+	return NULL;
+}
+
+/**
+ * report:
+ * @s: the shredding, whose work is going on in another thread
+ *
+ * Calls the progress callback every SHRED_REPORT_MS, and once at the end,
+ * until the work is finished; if the callback asks so, it's cancelled.
+ */
+static void
+report (GRG_SHRED * s)
+{
+	struct timeval now;
+	struct timespec until;
+	long long done;
+	int finished = FALSE;
+
+	while (!finished)
+	{
+		gettimeofday (&now, NULL);
+		until.tv_sec = now.tv_sec;
+		until.tv_nsec = now.tv_usec * 1000L + SHRED_REPORT_MS * 1000000L;
+		if (until.tv_nsec >= 1000000000L)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+
+		pthread_mutex_lock (&s->lock);
+		if (!s->finished)
+			pthread_cond_timedwait (&s->cond, &s->lock, &until);
+		done = s->done;
+		finished = s->finished;
+		pthread_mutex_unlock (&s->lock);
+
+		if (s->progress (s->user_data, (done < s->total) ? done : s->total,
+				 s->total))
+		{
+			pthread_mutex_lock (&s->lock);
+			s->cancel = TRUE;
+			pthread_mutex_unlock (&s->lock);
+		}
+	}
+}
+
+/**
+ * grg_files_shred:
+ * @gctx: the context, whose random generator makes the data to write
+ * @paths: the files to wipe
+ * @npaths: how many they are
+ * @npasses: how many times each is overwritten
+ * @progress: called with the bytes written so far, or NULL
+ * @user_data: the first argument of @progress
+ * @results: where to put the result of each file, or NULL
+ *
+ * Securely wipes some files, many at once, and unlinks them. @progress is
+ * called from the calling thread, about every 100 ms; if it returns
+ * non-zero the work stops, and the files not yet wiped are left where
+ * they are, maybe partially overwritten.
+ *
+ * Returns: GRG_OK, GRG_SHRED_CANCELLED, or the error of the first file
+ *          that failed
+ */
+int
+grg_files_shred (const GRG_CTX gctx, const char **paths, const int npaths,
+		 const int npasses, GRG_SHRED_PROGRESS progress,
+		 void *user_data, int *results)
+{
+	GRG_SHRED s;
+	pthread_t tid;
+	struct stat buf;
+	int i, ret = GRG_OK;
+
+	if (!gctx || !paths || npaths < 1)
+		return GRG_ARGUMENT_ERR;
+
+	memset (&s, 0, sizeof (GRG_SHRED));
+	s.gctx = gctx;
+	s.paths = paths;
+	s.npaths = npaths;
+	s.npasses = (npasses > 0) ? npasses : 1;
+	s.threads = grg_online_cpus ();
+	s.progress = progress;
+	s.user_data = user_data;
+
+	s.results = results ? results : (int *) malloc (npaths * sizeof (int));
+	if (!s.results)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	//the files never started are those a cancellation left alone
+	for (i = 0; i < npaths; i++)
+	{
+		s.results[i] = GRG_SHRED_CANCELLED;
+		if (!stat (paths[i], &buf) && S_ISREG (buf.st_mode))
+			s.total += (long long) buf.st_size * s.npasses;
+	}
+
+	pthread_mutex_init (&s.lock, NULL);
+	pthread_cond_init (&s.cond, NULL);
+
+	GRG_TRACE (gctx, GRG_STAGE_SHRED, GRG_TRACE_BEGIN, s.total);
+	GRG_PROBE3 (shred__begin, npaths, s.npasses, s.total);
+
+	if (!progress)
+		shred_all (&s);
+	else if (pthread_create (&tid, NULL, shred_all, &s))
+	{
+		//no reporter, then everything is done in this thread
+		s.threads = 1;
+		s.report = TRUE;
+		shred_all (&s);
+	}
+	else
+	{
+		report (&s);
+		pthread_join (tid, NULL);
+	}
+
+	pthread_cond_destroy (&s.cond);
+	pthread_mutex_destroy (&s.lock);
+
+	for (i = 0; i < npaths && ret == GRG_OK; i++)
+		ret = s.results[i];
+
+	if (s.cancel)
+		ret = GRG_SHRED_CANCELLED;
+
+	GRG_TRACE (gctx, GRG_STAGE_SHRED, GRG_TRACE_END,
+		   (ret < 0) ? ret : s.done);
+	GRG_PROBE1 (shred__end, (ret < 0) ? ret : s.done);
+
+	if (!results)
+		free (s.results);
+
+	return ret;
+}
+
+/**
+ * grg_file_shred:
+ * @path: the file to wipe
+ * @npasses: how many times it's overwritten
+ *
+ * Securely wipes a file, and unlinks it; see grg_files_shred ().
+ *
+ * Returns: GRG_OK or an error code
+ */
+int
+grg_file_shred (const char *path, const int npasses)
+{
+	GRG_CTX gctx;
+	int ret;
+
+	gctx = grg_context_initialize_defaults ("GRG");
+	if (!gctx)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	ret = grg_files_shred (gctx, &path, 1, npasses, NULL, NULL, NULL);
+
+	grg_context_free (gctx);
+
+	return ret;
+}
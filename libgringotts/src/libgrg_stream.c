@@ -0,0 +1,1219 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_stream.c - incremental encoding and decoding of data
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "libgrg_crypt.h"
+#include "libgrg_utils.h"
+#include "libgrg_structs.h"
+#include "libgringotts.h"
+
+// A stream produces exactly the same (version 4) data as grg_encrypt_mem(),
+// and reads them back, as well as the chunked (version 5) data, unless
+// they're compressed with zstd or lz4. When decrypting, only a couple of
+// fixed-size blocks and the chunk table are ever allocated. When
+// encrypting, the format forces us to keep the compressed data until the
+// end, since the CRC32 over them is the first thing to be encrypted;
+// still, the plain data are never stored, and the compressed data are
+// encrypted in place.
+
+#define GRG_STREAM_BLOCK	65536
+
+static GRG_STREAM
+stream_new (const GRG_CTX gctx, const GRG_KEY keystruct,
+	    GRG_STREAM_SINK sink, void *user_data, const int encrypting)
+{
+	GRG_STREAM gs;
+
+	if (!gctx || !keystruct || !sink)
+		return NULL;
+
+	gs = (GRG_STREAM) calloc (1, sizeof (struct _grg_stream));
+	if (!gs)
+		return NULL;
+
+	gs->key = grg_key_clone (keystruct);
+	if (!gs->key)
+	{
+		free (gs);
+		return NULL;
+	}
+
+	gs->gctx = gctx;
+	grg_ctx_snapshot (gctx, &gs->params);
+	gs->encrypting = encrypting;
+	gs->sink = sink;
+	gs->user_data = user_data;
+	gs->crypt = NULL;
+
+	return gs;
+}
+
+/**
+ * stream_reserve:
+ * @gs: the stream
+ * @room: how many free bytes are needed at the end of the buffer
+ *
+ * Grows the stream buffer, if needed, so that it can accept @room bytes
+ * more. The old buffer is wiped, since it holds (compressed) plain data.
+ *
+ * Returns: GRG_OK or GRG_MEM_ALLOCATION_ERR
+ */
+static int
+stream_reserve (GRG_STREAM gs, const long room)
+{
+	unsigned char *newbuf;
+	long newlen;
+
+	if (gs->buf_len - gs->buf_used >= room)
+		return GRG_OK;
+
+	newlen = gs->buf_len ? gs->buf_len : GRG_STREAM_BLOCK;
+	while (newlen - gs->buf_used < room)
+		newlen *= 2;
+
+	newbuf = (unsigned char *) malloc (newlen);
+	if (!newbuf)
+		return GRG_MEM_ALLOCATION_ERR;
+	grg_count_alloc (gs->gctx, newlen);
+
+	if (gs->buf)
+	{
+		memcpy (newbuf, gs->buf, gs->buf_used);
+		grg_free (gs->gctx, gs->buf, gs->buf_used);
+	}
+
+	gs->buf = newbuf;
+	gs->buf_len = newlen;
+
+	return GRG_OK;
+}
+
+static int
+stream_emit (GRG_STREAM gs, const unsigned char *data, const long dim)
+{
+	int err = gs->sink (gs->user_data, data, dim);
+
+	if (err < 0)
+		gs->err = err;
+
+	return err;
+}
+
+GRG_STREAM
+grg_stream_encrypt_init (const GRG_CTX gctx, const GRG_KEY keystruct,
+			 GRG_STREAM_SINK sink, void *user_data)
+{
+	GRG_STREAM gs;
+	int err;
+
+	gs = stream_new (gctx, keystruct, sink, user_data, TRUE);
+	if (!gs)
+		return NULL;
+
+	//a version 4 data sequence has room for zlib and bzip2 only
+	if (gs->params.comp_algo != GRG_ZLIB &&
+	    gs->params.comp_algo != GRG_BZIP)
+	{
+		grg_stream_close (gctx, gs);
+		return NULL;
+	}
+
+	gs->dIV = grg_get_block_size_static (gs->params.crypt_algo);
+
+	//room for everything up to DATA_LEN, filled in at the end
+	if (stream_reserve (gs, LIBGRG_KCV_DATA_POS + gs->dIV +
+			    LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN) < 0)
+	{
+		grg_stream_close (gctx, gs);
+		return NULL;
+	}
+	gs->buf_used = LIBGRG_KCV_DATA_POS + gs->dIV + LIBGRG_CRC_LEN +
+		LIBGRG_DATA_DIM_LEN;
+
+	if (gs->params.comp_lvl)
+	{
+		if (gs->params.comp_algo)	//bz2
+			err = BZ2_bzCompressInit (&gs->bzs,
+						  gs->params.comp_lvl * 3, 0,
+						  0) == BZ_OK ? 0 : -1;
+		else		//zlib
+			err = deflateInit (&gs->zs,
+					   gs->params.comp_lvl * 3) ==
+				Z_OK ? 0 : -1;
+
+		if (err < 0)
+		{
+			grg_stream_close (gctx, gs);
+			return NULL;
+		}
+
+		gs->comp_open = TRUE;
+	}
+
+	return gs;
+}
+
+/**
+ * stream_compress:
+ * @gs: the stream
+ * @data: the plain data to compress
+ * @dim: their length
+ * @finish: TRUE to flush the compressor
+ *
+ * Compresses a chunk of data, appending it to the stream buffer.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+stream_compress (GRG_STREAM gs, const unsigned char *data, const long dim,
+		 const int finish)
+{
+	int err;
+
+	if (!gs->params.comp_lvl)
+	{
+		err = stream_reserve (gs, dim);
+		if (err < 0)
+			return err;
+
+		memcpy (gs->buf + gs->buf_used, data, dim);
+		gs->buf_used += dim;
+		return GRG_OK;
+	}
+
+	if (gs->params.comp_algo)	//bz2
+	{
+		gs->bzs.next_in = (char *) data;
+		gs->bzs.avail_in = dim;
+
+		do
+		{
+			err = stream_reserve (gs, GRG_STREAM_BLOCK);
+			if (err < 0)
+				return err;
+
+			gs->bzs.next_out = (char *) gs->buf + gs->buf_used;
+			gs->bzs.avail_out = gs->buf_len - gs->buf_used;
+
+			err = BZ2_bzCompress (&gs->bzs,
+					      finish ? BZ_FINISH : BZ_RUN);
+
+			gs->buf_used = (unsigned char *) gs->bzs.next_out -
+				gs->buf;
+
+			if (err < 0)
+				return GRG_WRITE_COMP_ERR;
+		}
+		while (finish ? err != BZ_STREAM_END : gs->bzs.avail_in > 0);
+	}
+	else			//zlib
+	{
+		gs->zs.next_in = (Bytef *) data;
+		gs->zs.avail_in = dim;
+
+		do
+		{
+			err = stream_reserve (gs, GRG_STREAM_BLOCK);
+			if (err < 0)
+				return err;
+
+			gs->zs.next_out = gs->buf + gs->buf_used;
+			gs->zs.avail_out = gs->buf_len - gs->buf_used;
+
+			err = deflate (&gs->zs, finish ? Z_FINISH : Z_NO_FLUSH);
+
+			gs->buf_used = gs->zs.next_out - gs->buf;
+
+			if (err < 0 && err != Z_BUF_ERROR)
+				return GRG_WRITE_COMP_ERR;
+		}
+		while (finish ? err != Z_STREAM_END : gs->zs.avail_in > 0);
+	}
+
+	return GRG_OK;
+}
+
+int
+grg_stream_encrypt_update (GRG_STREAM gs, const unsigned char *data,
+			   const long dim)
+{
+	long rem, piece;
+	int err;
+
+	if (!gs || !gs->encrypting || gs->head_done || !data)
+		return GRG_ARGUMENT_ERR;
+
+	if (gs->err < 0)
+		return gs->err;
+
+	rem = (dim >= 0) ? dim : strlen ((char *) data);
+
+	//the version 4 format can't hold more
+	if ((unsigned long) rem > LIBGRG_DATA_DIM_MAX - gs->uncDim)
+		return (gs->err = GRG_ARGUMENT_ERR);
+
+	while (rem > 0)
+	{
+		piece = (rem > GRG_STREAM_BLOCK) ? GRG_STREAM_BLOCK : rem;
+
+		err = stream_compress (gs, data, piece, FALSE);
+		if (err < 0)
+		{
+			gs->err = err;
+			return err;
+		}
+		GRG_COUNT (gs->gctx, bytes_compressed, piece);
+
+		gs->uncDim += piece;
+		data += piece;
+		rem -= piece;
+	}
+
+	return GRG_OK;
+}
+
+int
+grg_stream_encrypt_final (GRG_STREAM gs)
+{
+	long done, piece;
+	int err;
+
+	if (!gs || !gs->encrypting || gs->head_done)
+		return GRG_ARGUMENT_ERR;
+
+	if (gs->err < 0)
+		return gs->err;
+
+	if (gs->comp_open)
+	{
+		err = stream_compress (gs, NULL, 0, TRUE);
+		if (err < 0)
+		{
+			gs->err = err;
+			return err;
+		}
+
+		if (gs->params.comp_algo)
+			BZ2_bzCompressEnd (&gs->bzs);
+		else
+			deflateEnd (&gs->zs);
+		gs->comp_open = FALSE;
+	}
+
+	//fills in everything around the compressed data, and encrypts them
+	gs->params.rnd = gs->gctx->rnd;
+	err = grg_encode_in_place (&gs->params, gs->key, gs->buf, gs->buf_used,
+				   gs->uncDim);
+	if (err < 0)
+		return (gs->err = err);
+
+	gs->head_done = TRUE;
+
+	for (done = 0; done < gs->buf_used; done += piece)
+	{
+		piece = gs->buf_used - done;
+		if (piece > GRG_STREAM_BLOCK)
+			piece = GRG_STREAM_BLOCK;
+
+		err = stream_emit (gs, gs->buf + done, piece);
+		if (err < 0)
+			return err;
+	}
+
+	return GRG_OK;
+}
+
+GRG_STREAM
+grg_stream_decrypt_init (const GRG_CTX gctx, const GRG_KEY keystruct,
+			 GRG_STREAM_SINK sink, void *user_data)
+{
+	GRG_STREAM gs;
+
+	gs = stream_new (gctx, keystruct, sink, user_data, FALSE);
+	if (!gs)
+		return NULL;
+
+	gs->buf = (unsigned char *) malloc (GRG_STREAM_BLOCK);
+	gs->out = (unsigned char *) malloc (GRG_STREAM_BLOCK);
+	if (!gs->buf || !gs->out)
+	{
+		grg_stream_close (gctx, gs);
+		return NULL;
+	}
+	gs->buf_len = GRG_STREAM_BLOCK;
+	grg_count_alloc (gctx, 2 * GRG_STREAM_BLOCK);
+
+	return gs;
+}
+
+/**
+ * stream_set_params:
+ * @gs: the stream, with the head of the data up to the parameters
+ *
+ * Adopts the parameters the data were written with, and updates the
+ * context with them, as grg_decrypt_file () does.
+ */
+static void
+stream_set_params (GRG_STREAM gs)
+{
+	struct grg_params found;
+
+	grg_params_from_mem (&found, gs->head);
+	grg_ctx_set_params (&gs->params, &found);
+	grg_ctx_set_params (gs->gctx, &found);
+
+	gs->dIV = grg_get_block_size_static (gs->params.crypt_algo);
+}
+
+/**
+ * stream_open_block:
+ * @gs: the stream
+ * @IV: the IV of an encrypted block (IV|CRC32|DATA_LEN|DATA)
+ * @stored: the key check value to verify the password with, or NULL
+ *
+ * Sets up the decryption and the decompression of a block, checking the
+ * password first if there's a key check value.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+stream_open_block (GRG_STREAM gs, unsigned char *IV,
+		   const unsigned char *stored)
+{
+	unsigned char *key, kcv[LIBGRG_KCV_LEN];
+	int dKey, err, ok;
+
+	key = grg_select_key (&gs->params, gs->key, &dKey);
+	if (!key)
+		return (gs->err = GRG_MEM_ALLOCATION_ERR);
+
+	grg_XOR_mem (key, dKey, IV, gs->dIV);
+
+	//a wrong password is told before anything is decrypted
+	if (stored)
+	{
+		ok = grg_key_check_value (gs->params.crypt_algo, key, dKey, IV,
+					  gs->dIV, kcv);
+		if (!ok)
+		{
+			grg_secure_free (gs->gctx, key, dKey);
+			return (gs->err = GRG_READ_ENC_INIT_ERR);
+		}
+
+		GRG_COUNT (gs->gctx, bytes_encrypted, LIBGRG_KCV_LEN);
+
+		if (memcmp (kcv, stored, LIBGRG_KCV_LEN))
+		{
+			grg_secure_free (gs->gctx, key, dKey);
+			return (gs->err = GRG_READ_PWD_ERR);
+		}
+	}
+
+	gs->crypt = grg_cipher_open (gs->params.crypt_algo, key, dKey, IV);
+	grg_secure_free (gs->gctx, key, dKey);
+	key = NULL;
+
+	if (!gs->crypt)
+		return (gs->err = GRG_READ_ENC_INIT_ERR);
+
+	if (gs->params.comp_lvl)
+	{
+		if (gs->params.comp_algo)	//bz2
+			err = BZ2_bzDecompressInit (&gs->bzs, 0,
+						    USE_BZ2_SMALL_MEM) ==
+				BZ_OK ? 0 : -1;
+		else		//zlib
+			err = inflateInit (&gs->zs) == Z_OK ? 0 : -1;
+
+		if (err < 0)
+			return (gs->err = GRG_READ_COMP_ERR);
+
+		gs->comp_open = TRUE;
+	}
+
+	gs->comp_done = FALSE;
+	gs->inner_used = 0;
+	gs->dataDim = 0;
+	gs->uncDim = 0;
+	gs->crc_inner = GRG_CRC32_INIT;
+
+	return GRG_OK;
+}
+
+/**
+ * stream_parse_table:
+ * @gs: the stream
+ * @in: the pointer to the data to read; it's moved forward
+ * @rem: the remaining data length; it's decremented
+ *
+ * Collects the table of the chunked format, that must be kept to find
+ * and check the chunks, and checks the CRC32 of the head as soon as it's
+ * complete.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+stream_parse_table (GRG_STREAM gs, const unsigned char **in, long *rem)
+{
+	unsigned char CRC[LIBGRG_CRC_LEN];
+	long used, take;
+
+	used = gs->pos - LIBGRG_TABLE_POS;
+	take = gs->count * LIBGRG_CHUNK_ENTRY_LEN - used;
+	if (take > *rem)
+		take = *rem;
+
+	memcpy (gs->table + used, *in, take);
+	gs->crc_outer = grg_crc32_update (gs->crc_outer, *in, take);
+	GRG_COUNT (gs->gctx, bytes_crc, take);
+	*in += take;
+	*rem -= take;
+	gs->pos += take;
+
+	if (used + take < gs->count * LIBGRG_CHUNK_ENTRY_LEN)
+		return GRG_OK;
+
+	//checks the 1st CRC, as validate_chunks () would do
+	grg_crc32_final (gs->crc_outer, CRC);
+	if (memcmp (CRC, gs->head + HEADER_LEN + LIBGRG_FILE_VERSION_LEN,
+		    LIBGRG_CRC_LEN))
+		return (gs->err = GRG_READ_CRC_ERR);
+
+	gs->head_done = TRUE;
+
+	return GRG_OK;
+}
+
+/**
+ * stream_start_table:
+ * @gs: the stream, with the head of chunked data up to the table
+ * @in, @rem: as in stream_parse_table()
+ *
+ * Checks the head of the chunked format, and allocates its table.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+stream_start_table (GRG_STREAM gs, const unsigned char **in, long *rem)
+{
+	gs->chunkSize = grg_char2long (gs->head + LIBGRG_CHUNK_SIZE_POS);
+	gs->count = grg_char2long (gs->head + LIBGRG_CHUNK_COUNT_POS);
+
+	if (gs->chunkSize < 1 || gs->chunkSize > LIBGRG_CHUNK_SIZE_MAX ||
+	    gs->count < 1 || gs->count > LONG_MAX / LIBGRG_CHUNK_ENTRY_LEN)
+		return (gs->err = GRG_READ_CRC_ERR);
+
+	if (gs->head[LIBGRG_COMP_ID_POS] >= LIBGRG_COMP_IDS)
+		return (gs->err = GRG_READ_UNSUPPORTED_VERSION);
+
+	stream_set_params (gs);
+
+	//zstd and lz4 chunks can't be uncompressed a piece at a time
+	if (gs->params.comp_lvl && gs->params.comp_algo != GRG_ZLIB &&
+	    gs->params.comp_algo != GRG_BZIP)
+		return (gs->err = GRG_READ_COMP_ERR);
+
+	gs->table = (unsigned char *) malloc (gs->count *
+					      LIBGRG_CHUNK_ENTRY_LEN);
+	if (!gs->table)
+		return (gs->err = GRG_MEM_ALLOCATION_ERR);
+	grg_count_alloc (gs->gctx, gs->count * LIBGRG_CHUNK_ENTRY_LEN);
+
+	gs->crc_outer = grg_crc32_update (GRG_CRC32_INIT,
+					  gs->head + LIBGRG_ALGO_POS,
+					  LIBGRG_TABLE_POS - LIBGRG_ALGO_POS);
+
+	return stream_parse_table (gs, in, rem);
+}
+
+/**
+ * stream_parse_head:
+ * @gs: the stream
+ * @in: the pointer to the data to read; it's moved forward
+ * @rem: the remaining data length; it's decremented
+ *
+ * Collects the unencrypted part of the data, up to the IV, and sets
+ * up the decryption as soon as it's complete; with the chunked format,
+ * up to the end of the chunk table instead, and the chunks are set up
+ * one at a time by stream_open_chunk ().
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+stream_parse_head (GRG_STREAM gs, const unsigned char **in, long *rem)
+{
+	long need, take;
+	unsigned char *IV;
+	int vers, err;
+
+	vers = gs->head[HEADER_LEN] - '0';
+	if (gs->head_used < LIBGRG_DATA_POS)
+		need = LIBGRG_DATA_POS;
+	else if (gs->table)
+		return stream_parse_table (gs, in, rem);
+	else if (LIBGRG_IS_CHUNKED (vers))
+		need = LIBGRG_TABLE_POS;
+	else
+		need = LIBGRG_BLOCK_POS (vers) + gs->dIV;
+
+	take = need - gs->head_used;
+	if (take > *rem)
+		take = *rem;
+
+	memcpy (gs->head + gs->head_used, *in, take);
+	gs->head_used += take;
+	*in += take;
+	*rem -= take;
+	gs->pos += take;
+
+	if (gs->head_used < need)
+		return GRG_OK;
+
+	if (need == LIBGRG_DATA_POS)
+	{
+		//checks the ID header and the version
+		if (memcmp (gs->params.header, gs->head, HEADER_LEN))
+			return (gs->err = GRG_READ_MAGIC_ERR);
+
+		vers = gs->head[HEADER_LEN] - '0';
+		if (!LIBGRG_IS_SINGLE (vers) && !LIBGRG_IS_CHUNKED (vers))
+			return (gs->err = GRG_READ_UNSUPPORTED_VERSION);
+
+		//the chunked format has more of them further on
+		if (LIBGRG_IS_SINGLE (vers))
+			stream_set_params (gs);
+
+		return stream_parse_head (gs, in, rem);
+	}
+
+	if (LIBGRG_IS_CHUNKED (vers))
+		return stream_start_table (gs, in, rem);
+
+	IV = gs->head + LIBGRG_BLOCK_POS (vers);
+	err = stream_open_block (gs, IV, (vers == LIBGRG_KCV_FILE_VERSION) ?
+				 gs->head + LIBGRG_KCV_POS : NULL);
+	if (err < 0)
+		return err;
+
+	gs->crc_outer = grg_crc32_update (GRG_CRC32_INIT,
+					  gs->head + LIBGRG_ALGO_POS,
+					  IV + gs->dIV - gs->head -
+					  LIBGRG_ALGO_POS);
+
+	gs->head_done = TRUE;
+
+	return GRG_OK;
+}
+
+/**
+ * stream_open_chunk:
+ * @gs: the stream
+ * @in: the pointer to the data to read; it's moved forward
+ * @rem: the remaining data length; it's decremented
+ *
+ * Skips to the next chunk in the table and collects its IV, then sets
+ * up its decryption, checking the password on the first one. The chunks
+ * must come in the order of the table, as they are always written.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+stream_open_chunk (GRG_STREAM gs, const unsigned char **in, long *rem)
+{
+	unsigned char *entry, *IV;
+	long long offset, len;
+	long take;
+	int err;
+
+	entry = gs->table + gs->chunk * LIBGRG_CHUNK_ENTRY_LEN;
+	offset = grg_char2llong (entry);
+	len = grg_char2llong (entry + LIBGRG_OFFSET_LEN);
+
+	if (gs->head_used == LIBGRG_TABLE_POS)
+	{
+		if (offset < gs->pos ||
+		    len < gs->dIV + LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN)
+			return (gs->err = GRG_READ_CRC_ERR);
+
+		//nothing between the chunks is read, as by grg_decrypt_mem ()
+		take = (offset - gs->pos > *rem) ? *rem : offset - gs->pos;
+		*in += take;
+		*rem -= take;
+		gs->pos += take;
+
+		if (gs->pos < offset)
+			return GRG_OK;
+	}
+
+	take = LIBGRG_TABLE_POS + gs->dIV - gs->head_used;
+	if (take > *rem)
+		take = *rem;
+
+	memcpy (gs->head + gs->head_used, *in, take);
+	gs->head_used += take;
+	*in += take;
+	*rem -= take;
+	gs->pos += take;
+
+	if (gs->head_used < LIBGRG_TABLE_POS + gs->dIV)
+		return GRG_OK;
+
+	//the key check value is computed on the first chunk
+	IV = gs->head + LIBGRG_TABLE_POS;
+	err = stream_open_block (gs, IV, gs->chunk ? NULL :
+				 gs->head + LIBGRG_KCV_CHUNKED_POS);
+	if (err < 0)
+		return err;
+
+	gs->crc_outer = grg_crc32_update (GRG_CRC32_INIT, IV, gs->dIV);
+	gs->chunkRem = len - gs->dIV;
+
+	return GRG_OK;
+}
+
+/**
+ * stream_inflate:
+ * @gs: the stream
+ * @data: a chunk of decrypted, compressed data
+ * @dim: its length
+ *
+ * Decompresses a chunk of data, and passes the result to the sink. A
+ * decompression error is remembered, but it's reported only at the end,
+ * since it may well be caused by a wrong password or a corrupted file.
+ *
+ * Returns: GRG_OK or the error returned by the sink
+ */
+static int
+stream_inflate (GRG_STREAM gs, unsigned char *data, const long dim)
+{
+	long produced;
+	int err, end;
+
+	if (gs->err < 0 || !dim)
+		return GRG_OK;
+
+	if (!gs->params.comp_lvl)
+	{
+		gs->uncDim += dim;
+		GRG_COUNT (gs->gctx, bytes_uncompressed, dim);
+		if (gs->uncDim > gs->dataDim)
+		{
+			gs->err = GRG_READ_COMP_ERR;
+			return GRG_OK;
+		}
+
+		return stream_emit (gs, data, dim);
+	}
+
+	if (gs->comp_done)
+	{
+		//garbage after the end of the compressed data
+		gs->err = GRG_READ_COMP_ERR;
+		return GRG_OK;
+	}
+
+	if (gs->params.comp_algo)	//bz2
+	{
+		gs->bzs.next_in = (char *) data;
+		gs->bzs.avail_in = dim;
+	}
+	else
+	{
+		gs->zs.next_in = data;
+		gs->zs.avail_in = dim;
+	}
+
+	do
+	{
+		if (gs->params.comp_algo)	//bz2
+		{
+			gs->bzs.next_out = (char *) gs->out;
+			gs->bzs.avail_out = GRG_STREAM_BLOCK;
+			err = BZ2_bzDecompress (&gs->bzs);
+			produced = GRG_STREAM_BLOCK - gs->bzs.avail_out;
+			end = (err == BZ_STREAM_END);
+			if (err != BZ_OK && !end)
+				err = -1;
+		}
+		else		//zlib
+		{
+			gs->zs.next_out = gs->out;
+			gs->zs.avail_out = GRG_STREAM_BLOCK;
+			err = inflate (&gs->zs, Z_NO_FLUSH);
+			produced = GRG_STREAM_BLOCK - gs->zs.avail_out;
+			end = (err == Z_STREAM_END);
+			if (err != Z_OK && err != Z_BUF_ERROR && !end)
+				err = -1;
+		}
+
+		if (err < 0)
+		{
+			gs->err = GRG_READ_COMP_ERR;
+			return GRG_OK;
+		}
+
+		gs->uncDim += produced;
+		GRG_COUNT (gs->gctx, bytes_uncompressed, produced);
+		if (gs->uncDim > gs->dataDim)
+		{
+			gs->err = GRG_READ_COMP_ERR;
+			return GRG_OK;
+		}
+
+		if (produced)
+		{
+			err = stream_emit (gs, gs->out, produced);
+			if (err < 0)
+				return err;
+		}
+
+		if (end)
+		{
+			gs->comp_done = TRUE;
+			if ((gs->params.comp_algo ? gs->bzs.avail_in :
+			     gs->zs.avail_in) > 0)
+				gs->err = GRG_READ_COMP_ERR;
+			return GRG_OK;
+		}
+	}
+	while (produced == GRG_STREAM_BLOCK || (gs->params.comp_algo ?
+						gs->bzs.avail_in :
+						gs->zs.avail_in) > 0);
+
+	return GRG_OK;
+}
+
+/**
+ * stream_decrypt:
+ * @gs: the stream, with a block set up
+ * @in: a piece of the encrypted block
+ * @piece: its length
+ *
+ * Decrypts a piece of a block, and passes it on to stream_inflate ().
+ *
+ * Returns: GRG_OK or the error returned by the sink
+ */
+static int
+stream_decrypt (GRG_STREAM gs, const unsigned char *in, long piece)
+{
+	unsigned char *plain;
+	long take;
+
+	gs->crc_outer = grg_crc32_update (gs->crc_outer, in, piece);
+
+	memcpy (gs->buf, in, piece);
+	grg_cipher_decrypt (gs->crypt, gs->buf, piece);
+	GRG_COUNT (gs->gctx, bytes_decrypted, piece);
+	GRG_COUNT (gs->gctx, bytes_crc, piece);
+
+	plain = gs->buf;
+
+	//the (2nd) CRC32 and DATA_LEN fields
+	if (gs->inner_used < LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN)
+	{
+		take = LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN - gs->inner_used;
+		if (take > piece)
+			take = piece;
+
+		memcpy (gs->inner + gs->inner_used, plain, take);
+		gs->inner_used += take;
+		plain += take;
+		piece -= take;
+
+		if (gs->inner_used < LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN)
+			return GRG_OK;
+
+		gs->crc_inner = grg_crc32_update (gs->crc_inner,
+						  gs->inner + LIBGRG_CRC_LEN,
+						  LIBGRG_DATA_DIM_LEN);
+		gs->dataDim = grg_char2long (gs->inner + LIBGRG_CRC_LEN);
+		GRG_COUNT (gs->gctx, bytes_crc, LIBGRG_DATA_DIM_LEN);
+	}
+
+	gs->crc_inner = grg_crc32_update (gs->crc_inner, plain, piece);
+	GRG_COUNT (gs->gctx, bytes_crc, piece);
+
+	return stream_inflate (gs, plain, piece);
+}
+
+/**
+ * stream_check_block:
+ * @gs: the stream, at the end of a block
+ * @stored: the CRC32 of the encrypted block, as found in the data
+ *
+ * Checks a block once it's all been decrypted, as validate_mem () and
+ * decrypt_payload () would do.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+stream_check_block (GRG_STREAM gs, const unsigned char *stored)
+{
+	unsigned char CRC[LIBGRG_CRC_LEN];
+
+	//checks the 1st CRC
+	grg_crc32_final (gs->crc_outer, CRC);
+	if (memcmp (CRC, stored, LIBGRG_CRC_LEN))
+		return GRG_READ_CRC_ERR;
+
+	if (gs->inner_used < LIBGRG_CRC_LEN + LIBGRG_DATA_DIM_LEN)
+		return GRG_READ_CRC_ERR;
+
+	//checks the 2nd CRC, that tells if the password is correct
+	grg_crc32_final (gs->crc_inner, CRC);
+	if (memcmp (CRC, gs->inner, LIBGRG_CRC_LEN))
+		return GRG_READ_PWD_ERR;
+
+	if (gs->err < 0)
+		return gs->err;
+
+	if ((gs->params.comp_lvl && !gs->comp_done) ||
+	    gs->uncDim != gs->dataDim)
+		return GRG_READ_COMP_ERR;
+
+	return GRG_OK;
+}
+
+/**
+ * stream_close_chunk:
+ * @gs: the stream, at the end of a chunk
+ *
+ * Checks a chunk against its entry in the table, and gets ready for
+ * the next one.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+stream_close_chunk (GRG_STREAM gs)
+{
+	int err;
+
+	err = stream_check_block (gs, gs->table + gs->chunk *
+				  LIBGRG_CHUNK_ENTRY_LEN +
+				  2 * LIBGRG_OFFSET_LEN);
+
+	//all the chunks but the last one are full
+	if (err == GRG_OK && (gs->dataDim > gs->chunkSize ||
+			      (gs->chunk < gs->count - 1 &&
+			       gs->dataDim != gs->chunkSize)))
+		err = GRG_READ_COMP_ERR;
+
+	grg_cipher_close (gs->crypt);
+	gs->crypt = NULL;
+
+	if (gs->comp_open)
+	{
+		if (gs->params.comp_algo)
+			BZ2_bzDecompressEnd (&gs->bzs);
+		else
+			inflateEnd (&gs->zs);
+		gs->comp_open = FALSE;
+	}
+
+	gs->head_used = LIBGRG_TABLE_POS;
+	gs->chunk++;
+
+	if (err < 0)
+		return (gs->err = err);
+
+	return GRG_OK;
+}
+
+int
+grg_stream_decrypt_update (GRG_STREAM gs, const void *mem,
+			   const long memDim)
+{
+	const unsigned char *in = (const unsigned char *) mem;
+	long rem, piece;
+	int err;
+
+	if (!gs || gs->encrypting || !mem)
+		return GRG_ARGUMENT_ERR;
+
+	rem = (memDim >= 0) ? memDim : strlen ((char *) mem);
+
+	if (!gs->head_done)
+	{
+		if (gs->err < 0)
+			return gs->err;
+
+		err = stream_parse_head (gs, &in, &rem);
+		if (err < 0)
+			return err;
+	}
+
+	while (rem > 0)
+	{
+		if (gs->table && !gs->crypt)
+		{
+			if (gs->err < 0)
+				return gs->err;
+
+			//nothing after the last chunk is read, either
+			if (gs->chunk == gs->count)
+				break;
+
+			err = stream_open_chunk (gs, &in, &rem);
+			if (err < 0)
+				return err;
+
+			continue;
+		}
+
+		piece = (rem > GRG_STREAM_BLOCK) ? GRG_STREAM_BLOCK : rem;
+		if (gs->table && piece > gs->chunkRem)
+			piece = gs->chunkRem;
+
+		err = stream_decrypt (gs, in, piece);
+		if (err < 0)
+			return err;
+
+		in += piece;
+		rem -= piece;
+
+		if (gs->table)
+		{
+			gs->pos += piece;
+			gs->chunkRem -= piece;
+
+			if (!gs->chunkRem)
+			{
+				err = stream_close_chunk (gs);
+				if (err < 0)
+					return err;
+			}
+		}
+	}
+
+	return GRG_OK;
+}
+
+int
+grg_stream_decrypt_final (GRG_STREAM gs)
+{
+	if (!gs || gs->encrypting)
+		return GRG_ARGUMENT_ERR;
+
+	if (!gs->head_done)
+		return (gs->err < 0) ? gs->err : GRG_READ_CRC_ERR;
+
+	//each chunk is checked as soon as it ends
+	if (gs->table)
+	{
+		if (gs->err < 0)
+			return gs->err;
+
+		return (gs->chunk < gs->count) ? GRG_READ_CRC_ERR : GRG_OK;
+	}
+
+	//the 1st CRC is checked as validate_mem () would do
+	return stream_check_block (gs, gs->head + HEADER_LEN +
+				   LIBGRG_FILE_VERSION_LEN);
+}
+
+void
+grg_stream_close (const GRG_CTX gctx, GRG_STREAM gs)
+{
+	if (!gs)
+		return;
+
+	if (gs->comp_open)
+	{
+		if (gs->encrypting)
+		{
+			if (gs->params.comp_algo)
+				BZ2_bzCompressEnd (&gs->bzs);
+			else
+				deflateEnd (&gs->zs);
+		}
+		else
+		{
+			if (gs->params.comp_algo)
+				BZ2_bzDecompressEnd (&gs->bzs);
+			else
+				inflateEnd (&gs->zs);
+		}
+	}
+
+	grg_cipher_close (gs->crypt);
+
+	grg_free (gctx, gs->table, gs->count * LIBGRG_CHUNK_ENTRY_LEN);
+	grg_free (gctx, gs->buf, gs->encrypting ? gs->buf_used : gs->buf_len);
+	grg_free (gctx, gs->out, GRG_STREAM_BLOCK);
+	grg_key_free (gctx, gs->key);
+	grg_free (gctx, gs, sizeof (struct _grg_stream));
+	gs = NULL;
+}
+
+//where fd_sink () writes
+typedef struct
+{
+	int fd;
+	struct grg_stats *stats;
+}
+FD_SINK;
+
+static int
+fd_sink (void *user_data, const unsigned char *data, const long dim)
+{
+	FD_SINK *out = (FD_SINK *) user_data;
+
+	return grg_write_full (out->stats, out->fd, data, dim);
+}
+
+/**
+ * stream_fd:
+ * @gs: an initialized stream
+ * @in_fd: the file descriptor to read data from
+ *
+ * Feeds a stream with all the content of a file descriptor, then
+ * finalizes it.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+stream_fd (GRG_STREAM gs, const int in_fd)
+{
+	unsigned char *chunk;
+	ssize_t rd;
+	int ret = GRG_OK;
+
+	chunk = (unsigned char *) malloc (GRG_STREAM_BLOCK);
+	if (!chunk)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	while ((rd = read (in_fd, chunk, GRG_STREAM_BLOCK)) != 0)
+	{
+		GRG_COUNT (gs->gctx, syscalls, 1);
+		if (rd < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ret = GRG_READ_FILE_ERR;
+			break;
+		}
+
+		if (gs->encrypting)
+			ret = grg_stream_encrypt_update (gs, chunk, rd);
+		else
+			ret = grg_stream_decrypt_update (gs, chunk, rd);
+
+		if (ret < 0)
+			break;
+	}
+
+	if (ret == GRG_OK)
+	{
+		if (gs->encrypting)
+			ret = grg_stream_encrypt_final (gs);
+		else
+			ret = grg_stream_decrypt_final (gs);
+	}
+
+	grg_free (gs->gctx, chunk, GRG_STREAM_BLOCK);
+
+	return ret;
+}
+
+int
+grg_stream_encrypt_fd (const GRG_CTX gctx, const GRG_KEY keystruct,
+		       const int in_fd, const int out_fd)
+{
+	GRG_STREAM gs;
+	struct stat buf;
+	FD_SINK out;
+	int ret;
+
+	if (in_fd < 0)
+		return GRG_READ_FILE_ERR;
+
+	if (out_fd < 3)
+		return GRG_WRITE_FILE_ERR;
+
+	if (!gctx || !keystruct)
+		return GRG_ARGUMENT_ERR;
+
+	if (gctx->comp_algo != GRG_ZLIB && gctx->comp_algo != GRG_BZIP)
+		return GRG_WRITE_COMP_ERR;
+
+	out.fd = out_fd;
+	out.stats = &gctx->counters->stats;
+	gs = grg_stream_encrypt_init (gctx, keystruct, fd_sink, &out);
+	if (!gs)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	//for regular files, avoids growing the buffer over and over
+	if (!fstat (in_fd, &buf) && S_ISREG (buf.st_mode) &&
+	    stream_reserve (gs, buf.st_size + buf.st_size / 100 + 600) < 0)
+	{
+		grg_stream_close (gctx, gs);
+		return GRG_MEM_ALLOCATION_ERR;
+	}
+
+	ret = stream_fd (gs, in_fd);
+
+	if (ret == GRG_OK)
+	{
+		fsync (out_fd);
+		GRG_COUNT (gctx, syscalls, 1);
+	}
+
+	grg_stream_close (gctx, gs);
+
+	return ret;
+}
+
+int
+grg_stream_decrypt_fd (const GRG_CTX gctx, const GRG_KEY keystruct,
+		       const int in_fd, const int out_fd)
+{
+	GRG_STREAM gs;
+	FD_SINK out;
+	int ret;
+
+	if (in_fd < 0)
+		return GRG_READ_FILE_ERR;
+
+	if (out_fd < 0)
+		return GRG_WRITE_FILE_ERR;
+
+	if (!gctx || !keystruct)
+		return GRG_ARGUMENT_ERR;
+
+	out.fd = out_fd;
+	out.stats = &gctx->counters->stats;
+	gs = grg_stream_decrypt_init (gctx, keystruct, fd_sink, &out);
+	if (!gs)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	ret = stream_fd (gs, in_fd);
+
+	grg_stream_close (gctx, gs);
+
+	return ret;
+}
@@ -29,6 +29,10 @@
 
 #include "config.h"
 #include "libgrg_structs.h"
+#include "libgrg_probes.h"
+#include "libgrg_crypt.h"
+#include "libgrg_threads.h"
+#include "libgrg_rng.h"
 #include "libgrg_utils.h"
 #include "libgringotts.h"
 
@@ -36,21 +40,32 @@ static int
 reinit_random (GRG_CTX gctx)
 {
 #ifdef HAVE__DEV_RANDOM
+	int fd;
+
 	if (!gctx)
 		return 0;
 
-	close (gctx->rnd);
-
 	if (gctx->sec_lvl == GRG_SEC_PARANOIA)
-		gctx->rnd = open ("/dev/random", O_RDONLY);
+		fd = open ("/dev/random", O_RDONLY);
 	else
-		gctx->rnd = open ("/dev/urandom", O_RDONLY);
+		fd = open ("/dev/urandom", O_RDONLY);
 
-	if (gctx->rnd < 3)
+	if (fd < 3)
 	{
-		close (gctx->rnd);
+		close (fd);
 		return 0;
 	}
+
+	//dup2() swaps the file behind the descriptor in one step, so that
+	//the operations running on a snapshot of the context never see it
+	//closed
+	if (gctx->rnd < 0)
+		gctx->rnd = fd;
+	else
+	{
+		dup2 (fd, gctx->rnd);
+		close (fd);
+	}
 #else
 #warning compiling without /dev/random
 	srandom ((unsigned int) time (NULL));
@@ -95,7 +110,30 @@ grg_context_initialize (const char *header,
 	ret->hash_algo = hash_algo;
 	ret->comp_algo = comp_algo;
 	ret->comp_lvl = comp_lvl;
+	ret->comp_level = 0;
 	ret->sec_lvl = sec_lvl;
+	ret->chunk_size = 0;
+	ret->threads = 1;
+
+	ret->wipe_mode = GRG_WIPE_RANDOM;
+	ret->wipe_pattern = NULL;
+	ret->trace = NULL;
+	ret->trace_data = NULL;
+	ret->counters = (struct _grg_counters *)
+		calloc (1, sizeof (struct _grg_counters));
+	if (!ret->counters)
+	{
+#ifdef HAVE__DEV_RANDOM
+		close (ret->rnd);
+#endif
+		free (ret);
+		return NULL;
+	}
+	pthread_mutex_init (&ret->counters->lock, NULL);
+	ret->counters->refs = 1;
+
+	//if it fails, random data are read straight from the kernel
+	ret->rng = grg_rng_new (ret->rnd);
 
 	return ret;
 }
@@ -115,37 +153,150 @@ grg_context_free (GRG_CTX gctx)
 	close (gctx->rnd);
 #endif
 
+	if (gctx->wipe_pattern)
+	{
+		memset (gctx->wipe_pattern, 0, GRG_WIPE_PATTERN_LEN);
+		free (gctx->wipe_pattern);
+	}
+	grg_counters_unref (gctx->counters);
+	grg_rng_free (gctx->rng);
 	free (gctx);
 }
 
 grg_crypt_algo
 grg_ctx_get_crypt_algo (const GRG_CTX gctx)
 {
-	return gctx->crypt_algo;
+	grg_crypt_algo ret;
+
+	grg_ctx_lock (gctx);
+	ret = gctx->crypt_algo;
+	grg_ctx_unlock (gctx);
+
+	return ret;
 }
 
 grg_hash_algo
 grg_ctx_get_hash_algo (const GRG_CTX gctx)
 {
-	return gctx->hash_algo;
+	grg_hash_algo ret;
+
+	grg_ctx_lock (gctx);
+	ret = gctx->hash_algo;
+	grg_ctx_unlock (gctx);
+
+	return ret;
 }
 
 grg_comp_algo
 grg_ctx_get_comp_algo (const GRG_CTX gctx)
 {
-	return gctx->comp_algo;
+	grg_comp_algo ret;
+
+	grg_ctx_lock (gctx);
+	ret = gctx->comp_algo;
+	grg_ctx_unlock (gctx);
+
+	return ret;
 }
 
 grg_comp_ratio
 grg_ctx_get_comp_ratio (const GRG_CTX gctx)
 {
-	return gctx->comp_lvl;
+	grg_comp_ratio ret;
+
+	grg_ctx_lock (gctx);
+	ret = gctx->comp_lvl;
+	grg_ctx_unlock (gctx);
+
+	return ret;
+}
+
+int
+grg_ctx_get_comp_level (const GRG_CTX gctx)
+{
+	int ret;
+
+	grg_ctx_lock (gctx);
+	ret = gctx->comp_level;
+	grg_ctx_unlock (gctx);
+
+	return ret;
 }
 
 grg_security_lvl
 grg_ctx_get_security_lvl (const GRG_CTX gctx)
 {
-	return gctx->sec_lvl;
+	grg_security_lvl ret;
+
+	grg_ctx_lock (gctx);
+	ret = gctx->sec_lvl;
+	grg_ctx_unlock (gctx);
+
+	return ret;
+}
+
+long
+grg_ctx_get_chunk_size (const GRG_CTX gctx)
+{
+	long ret;
+
+	grg_ctx_lock (gctx);
+	ret = gctx->chunk_size;
+	grg_ctx_unlock (gctx);
+
+	return ret;
+}
+
+int
+grg_ctx_get_threads (const GRG_CTX gctx)
+{
+	int ret;
+
+	grg_ctx_lock (gctx);
+	ret = gctx->threads;
+	grg_ctx_unlock (gctx);
+
+	return ret;
+}
+
+grg_wipe_mode
+grg_ctx_get_wipe_mode (const GRG_CTX gctx)
+{
+	grg_wipe_mode ret;
+
+	grg_ctx_lock (gctx);
+	ret = gctx->wipe_mode;
+	grg_ctx_unlock (gctx);
+
+	return ret;
+}
+
+long long
+grg_ctx_get_wiped_bytes (const GRG_CTX gctx)
+{
+	return gctx->counters->stats.bytes_wiped;
+}
+
+/**
+ * grg_get_stats:
+ * @gctx: the context
+ * @stats: where to copy its statistics
+ *
+ * Gets the counters of what has been done so far with a context and its
+ * snapshots. They're updated while the work goes on, so that they can be
+ * a little behind each other if some of it is going on right now.
+ *
+ * Returns: GRG_OK or GRG_ARGUMENT_ERR
+ */
+int
+grg_get_stats (const GRG_CTX gctx, struct grg_stats *stats)
+{
+	if (!gctx || !stats)
+		return GRG_ARGUMENT_ERR;
+
+	memcpy (stats, &gctx->counters->stats, sizeof (struct grg_stats));
+
+	return GRG_OK;
 }
 
 void
@@ -154,7 +305,9 @@ grg_ctx_set_crypt_algo (GRG_CTX gctx, const grg_crypt_algo crypt_algo)
 	if (!gctx)
 		return;
 
+	grg_ctx_lock (gctx);
 	gctx->crypt_algo = crypt_algo;
+	grg_ctx_unlock (gctx);
 }
 
 void
@@ -163,7 +316,9 @@ grg_ctx_set_hash_algo (GRG_CTX gctx, const grg_hash_algo hash_algo)
 	if (!gctx)
 		return;
 
+	grg_ctx_lock (gctx);
 	gctx->hash_algo = hash_algo;
+	grg_ctx_unlock (gctx);
 }
 
 void
@@ -172,7 +327,9 @@ grg_ctx_set_comp_algo (GRG_CTX gctx, const grg_comp_algo comp_algo)
 	if (!gctx)
 		return;
 
+	grg_ctx_lock (gctx);
 	gctx->comp_algo = comp_algo;
+	grg_ctx_unlock (gctx);
 }
 
 void
@@ -181,7 +338,21 @@ grg_ctx_set_comp_ratio (GRG_CTX gctx, const grg_comp_ratio comp_ratio)
 	if (!gctx)
 		return;
 
+	grg_ctx_lock (gctx);
 	gctx->comp_lvl = comp_ratio;
+	grg_ctx_unlock (gctx);
+}
+
+void
+grg_ctx_set_comp_level (GRG_CTX gctx, const int comp_level)
+{
+	//it's stored in a (signed) byte of the data
+	if (!gctx || comp_level < -128 || comp_level > 127)
+		return;
+
+	grg_ctx_lock (gctx);
+	gctx->comp_level = comp_level;
+	grg_ctx_unlock (gctx);
 }
 
 void
@@ -190,8 +361,187 @@ grg_ctx_set_security_lvl (GRG_CTX gctx, const grg_security_lvl sec_level)
 	if (!gctx)
 		return;
 
+	grg_ctx_lock (gctx);
 	gctx->sec_lvl = sec_level;
 	reinit_random (gctx);
+	grg_ctx_unlock (gctx);
+}
+
+void
+grg_ctx_set_chunk_size (GRG_CTX gctx, const long chunk_size)
+{
+	if (!gctx || chunk_size < 0 || chunk_size > LIBGRG_CHUNK_SIZE_MAX)
+		return;
+
+	grg_ctx_lock (gctx);
+	gctx->chunk_size = chunk_size;
+	grg_ctx_unlock (gctx);
+}
+
+void
+grg_ctx_set_threads (GRG_CTX gctx, const int threads)
+{
+	if (!gctx)
+		return;
+
+	grg_ctx_lock (gctx);
+	if (threads < 1)
+		gctx->threads = grg_online_cpus ();
+	else
+		gctx->threads = threads;
+	grg_ctx_unlock (gctx);
+}
+
+void
+grg_ctx_set_wipe_mode (GRG_CTX gctx, const grg_wipe_mode wipe_mode)
+{
+	if (!gctx)
+		return;
+
+	grg_ctx_lock (gctx);
+	//the pattern is made once, and kept until the context is freed
+	//(so that the snapshots can go on using it)
+	if (wipe_mode == GRG_WIPE_PATTERN && !gctx->wipe_pattern)
+		gctx->wipe_pattern = grg_rnd_seq (gctx, GRG_WIPE_PATTERN_LEN);
+
+	if (wipe_mode != GRG_WIPE_PATTERN || gctx->wipe_pattern)
+		gctx->wipe_mode = wipe_mode;
+	grg_ctx_unlock (gctx);
+}
+
+/**
+ * grg_set_trace_callback:
+ * @gctx: the context
+ * @callback: the function to call at the begin and at the end of each
+ *            stage, or NULL to stop tracing
+ * @user_data: its first argument
+ *
+ * Traces the work done with a context: the operations started after this
+ * call report their stages to @callback, each from the thread that runs
+ * it, so that it can be called by many threads at once.
+ */
+void
+grg_set_trace_callback (GRG_CTX gctx, GRG_TRACE_CALLBACK callback,
+			void *user_data)
+{
+	if (!gctx)
+		return;
+
+	grg_ctx_lock (gctx);
+	gctx->trace = callback;
+	gctx->trace_data = user_data;
+	grg_ctx_unlock (gctx);
+}
+
+/**
+ * grg_ctx_set_params:
+ * @gctx: the context
+ * @params: the parameters of some data, as given by a _r function
+ *
+ * Sets all the algorithms and the chunk size of the context at once, so
+ * that it saves data as the ones the parameters come from.
+ */
+void
+grg_ctx_set_params (GRG_CTX gctx, const struct grg_params *params)
+{
+	if (!gctx || !params)
+		return;
+
+	grg_ctx_lock (gctx);
+	gctx->crypt_algo = params->crypt_algo;
+	gctx->hash_algo = params->hash_algo;
+	gctx->comp_algo = params->comp_algo;
+	gctx->comp_lvl = params->comp_lvl;
+	gctx->comp_level = params->comp_level;
+	gctx->chunk_size = params->chunk_size;
+	grg_ctx_unlock (gctx);
+}
+
+//the settings are read and changed under a lock, so that a context can be
+//shared by many threads; the operations work on a snapshot of them
+void
+grg_ctx_lock (const GRG_CTX gctx)
+{
+	pthread_mutex_lock (&gctx->counters->lock);
+}
+
+void
+grg_ctx_unlock (const GRG_CTX gctx)
+{
+	pthread_mutex_unlock (&gctx->counters->lock);
+}
+
+/**
+ * grg_ctx_snapshot:
+ * @gctx: the context
+ * @snap: where to copy it
+ *
+ * Takes a consistent copy of the settings of a context, to work with
+ * during an operation; it shares the random source, the wipe pattern and
+ * the counters with the context, so it mustn't outlive it, nor be freed.
+ */
+void
+grg_ctx_snapshot (const GRG_CTX gctx, struct _grg_context *snap)
+{
+	grg_ctx_lock (gctx);
+	memcpy (snap, gctx, sizeof (struct _grg_context));
+	grg_ctx_unlock (gctx);
+}
+
+/**
+ * grg_counters_ref:
+ * @counters: the counters of a context
+ *
+ * Keeps the counters of a context alive for something that can outlive
+ * it, such as an asynchronous write.
+ *
+ * Returns: @counters
+ */
+struct _grg_counters *
+grg_counters_ref (struct _grg_counters *counters)
+{
+	__sync_fetch_and_add (&counters->refs, 1);
+
+	return counters;
+}
+
+/**
+ * grg_counters_unref:
+ * @counters: the counters of a context
+ *
+ * Releases the counters of a context, freeing them with the last user.
+ */
+void
+grg_counters_unref (struct _grg_counters *counters)
+{
+	if (__sync_sub_and_fetch (&counters->refs, 1))
+		return;
+
+	pthread_mutex_destroy (&counters->lock);
+	free (counters);
+}
+
+/**
+ * grg_count_alloc:
+ * @gctx: the context
+ * @dim: the length of a buffer just allocated for the data
+ *
+ * Counts an allocation in the statistics of a context.
+ */
+void
+grg_count_alloc (const GRG_CTX gctx, const long dim)
+{
+	struct grg_stats *stats = &gctx->counters->stats;
+	long long max;
+
+	GRG_COUNT (gctx, allocs, 1);
+	GRG_COUNT (gctx, alloc_bytes, dim);
+
+	do
+		max = stats->alloc_max;
+	while (dim > max &&
+	       !__sync_bool_compare_and_swap (&stats->alloc_max, max,
+					      (long long) dim));
 }
 
 GRG_KEY
@@ -208,11 +558,13 @@ grg_key_gen (const char *pwd, const int pwd_len)
 	else
 		real_pwd_len = pwd_len;
 
-	key = (GRG_KEY) malloc (sizeof (struct _grg_key));
+	key = (GRG_KEY) grg_secure_alloc (sizeof (struct _grg_key));
 
 	if (!key)
 		return NULL;
 
+	GRG_PROBE1 (key__gen__begin, real_pwd_len);
+
 	mhash_keygen (KEYGEN_S2K_SIMPLE, MHASH_RIPEMD160, 0,
 		      key->key_192_ripe, 24, NULL, 0, (unsigned char *) pwd,
 		      real_pwd_len);
@@ -224,13 +576,15 @@ grg_key_gen (const char *pwd, const int pwd_len)
 	mhash_keygen (KEYGEN_S2K_SIMPLE, MHASH_SHA1, 0, key->key_256_sha, 32,
 		      NULL, 0, (unsigned char *) pwd, real_pwd_len);
 
+	GRG_PROBE1 (key__gen__end, real_pwd_len);
+
 	return key;
 }
 
 GRG_KEY
 grg_key_clone (const GRG_KEY src)
 {
-	GRG_KEY clone = (GRG_KEY) malloc (sizeof (struct _grg_key));
+	GRG_KEY clone = (GRG_KEY) grg_secure_alloc (sizeof (struct _grg_key));
 
 	if (clone)
 		memcpy (clone, src, sizeof (struct _grg_key));
@@ -253,5 +607,5 @@ grg_key_compare (const GRG_KEY k1, const GRG_KEY k2)
 void
 grg_key_free (const GRG_CTX gctx, GRG_KEY key)
 {
-	grg_free (gctx, key, sizeof (struct _grg_key));
+	grg_secure_free (gctx, key, sizeof (struct _grg_key));
 }
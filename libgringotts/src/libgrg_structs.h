@@ -24,10 +24,29 @@
 
 #include "libgringotts.h"
 #include <stdio.h>
+#include <pthread.h>
 #include <mcrypt.h>
+#include <mhash.h>
+#include <zlib.h>
+#include <bzlib.h>
+
+#include "libgrg_rng.h"
+#include "libgrg_cipher.h"
+#include "libgrg_crc.h"
 
 #define HEADER_LEN	3
 
+//the length of the pattern of GRG_WIPE_PATTERN
+#define GRG_WIPE_PATTERN_LEN	4096
+
+//what the snapshots of a context share with it
+struct _grg_counters
+{
+	struct grg_stats stats;
+	pthread_mutex_t lock;	//of the settings of the context
+	int refs;		//the context, and its asynchronous writes
+};
+
 struct _grg_context
 {
 	int rnd;
@@ -36,7 +55,17 @@ struct _grg_context
 	grg_hash_algo hash_algo;
 	grg_comp_algo comp_algo;
 	grg_comp_ratio comp_lvl;
+	int comp_level;		//of zstd or lz4; 0 means the one of comp_lvl
 	grg_security_lvl sec_lvl;
+	long chunk_size;	//0 means the monolithic (version 4) format
+	int threads;		//to work on the chunks
+	GRG_RNG rng;		//shared by the snapshots of the context; each
+				//thread uses its own, if it can
+	grg_wipe_mode wipe_mode;
+	unsigned char *wipe_pattern;
+	struct _grg_counters *counters;
+	GRG_TRACE_CALLBACK trace;	//NULL if nobody is listening
+	void *trace_data;
 };
 
 struct _grg_key
@@ -50,15 +79,83 @@ struct _grg_key
 struct _grg_tmpfile
 {
 	int tmpfd;
+	int in_memory;		//a memfd, that's never synced
 
-	int dKey;
-	unsigned char *key;
-	int dIV;
-	unsigned char *IV;
+	unsigned char *key;	//of the keystream, GRG_CHACHA20_KEY_LEN bytes
+	long long size;
 
-	MCRYPT crypt;
+	unsigned long long *gens;	//of each LIBGRG_TMP_BLOCK, or NULL
+	long long ngens;	//how many blocks gens has room for
 
 	unsigned int rwmode;
 };
 
+struct _grg_stream
+{
+	GRG_CTX gctx;
+	struct _grg_context params;	//snapshot of the parameters in use
+	GRG_KEY key;
+	int encrypting;
+	int err;		//deferred error, returned by *_final ()
+
+	GRG_STREAM_SINK sink;
+	void *user_data;
+
+	GRG_CIPHER crypt;
+	int dIV;
+
+	z_stream zs;
+	bz_stream bzs;
+	int comp_open;
+	int comp_done;
+
+	unsigned char *buf;	//the whole output, or the decryption work area
+	long buf_len;
+	long buf_used;
+	unsigned char *out;	//decompression output block
+
+	long uncDim;		//plain data bytes seen so far
+	long dataDim;		//the DATA_LEN field, when decrypting
+
+	unsigned char head[64];	//HEADER ... IV, when decrypting; HEADER ... KCV
+				//and the IV of the current chunk if chunked
+	long head_used;
+	int head_done;
+	unsigned char inner[8];	//encrypted CRC32 and DATA_LEN
+	long inner_used;
+	uint32_t crc_outer;	//CRC32 registers, see libgrg_crc.h
+	uint32_t crc_inner;
+
+	unsigned char *table;	//the chunk table, when decrypting chunks
+	long count;		//its entries
+	long chunkSize;
+	long chunk;		//the chunk being decrypted
+	long long chunkRem;	//its bytes still to come, after the IV
+	long long pos;		//the offset of the next byte in the data
+};
+
+//reports a stage to the trace callback of the context; without one, it
+//costs a test of a pointer that's (almost) always NULL
+#define GRG_TRACE(gctx, stage, event, bytes)				\
+	do								\
+	{								\
+		if (__builtin_expect ((gctx)->trace != NULL, 0))	\
+			(gctx)->trace ((gctx)->trace_data, (stage),	\
+				       (event), (long long) (bytes));	\
+	}								\
+	while (0)
+
+//adds to a counter of the statistics of a context, or of anything else
+//holding them as GRG_TRACE () wants the callback
+#define GRG_COUNT(gctx, counter, n)					\
+	__sync_fetch_and_add (&(gctx)->counters->stats.counter,		\
+			      (long long) (n))
+
+void grg_ctx_lock (const GRG_CTX gctx);
+void grg_ctx_unlock (const GRG_CTX gctx);
+void grg_ctx_snapshot (const GRG_CTX gctx, struct _grg_context *snap);
+struct _grg_counters *grg_counters_ref (struct _grg_counters *counters);
+void grg_counters_unref (struct _grg_counters *counters);
+void grg_count_alloc (const GRG_CTX gctx, const long dim);
+
 #endif
@@ -0,0 +1,156 @@
+/*  libGringotts - generic data encoding (crypto+compression) library
+ *  (c) 2002, Germano Rizzo <mano@pluto.linux.it>
+ *
+ *  libgrg_threads.c - a minimal worker pool, to spread jobs on many cores
+ *  Author: Germano Rizzo
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libgrg_crypt.h"
+#include "libgrg_threads.h"
+#include "libgringotts.h"
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	long next;
+	long count;
+	int err;		//the first error met; it stops the others
+
+	GRG_JOB job;
+	void *arg;
+}
+GRG_POOL;
+
+/**
+ * grg_online_cpus:
+ *
+ * Tells how many processors can run our threads.
+ *
+ * Returns: the number of processors, at least 1
+ */
+int
+grg_online_cpus (void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long ret = sysconf (_SC_NPROCESSORS_ONLN);
+
+	if (ret > 0)
+		return (int) ret;
+#endif
+	return 1;
+}
+
+static void *
+worker (void *data)
+{
+	GRG_POOL *pool = (GRG_POOL *) data;
+	long index;
+	int err;
+
+	while (TRUE)
+	{
+		pthread_mutex_lock (&pool->lock);
+		if (pool->err < 0 || pool->next >= pool->count)
+		{
+			pthread_mutex_unlock (&pool->lock);
+			break;
+		}
+		index = pool->next++;
+		pthread_mutex_unlock (&pool->lock);
+
+		err = pool->job (pool->arg, index);
+
+		if (err < 0)
+		{
+			pthread_mutex_lock (&pool->lock);
+			if (pool->err == GRG_OK)
+				pool->err = err;
+			pthread_mutex_unlock (&pool->lock);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * grg_parallel_for:
+ * @threads: how many threads to use at most, the calling one included
+ * @count: the number of items
+ * @job: the function to call on each item
+ * @arg: the first argument of @job
+ *
+ * Calls @job on the items 0 ... @count - 1, spreading them among at most
+ * @threads threads; the items are handed out in order, one at a time, so
+ * that uneven jobs are balanced. When a job fails no more of them are
+ * started. If threads can't be created, the calling one does all the
+ * work.
+ *
+ * Returns: GRG_OK or the error code of the failed job
+ */
+int
+grg_parallel_for (const int threads, const long count, GRG_JOB job,
+		  void *arg)
+{
+	GRG_POOL pool;
+	pthread_t *tids;
+	long nthreads, started, i;
+
+	nthreads = (threads < count) ? threads : count;
+
+	pool.next = 0;
+	pool.count = count;
+	pool.err = GRG_OK;
+	pool.job = job;
+	pool.arg = arg;
+
+	if (nthreads < 2)
+	{
+		for (i = 0; i < count; i++)
+		{
+			pool.err = job (arg, i);
+			if (pool.err < 0)
+				break;
+		}
+
+		return (pool.err < 0) ? pool.err : GRG_OK;
+	}
+
+	tids = (pthread_t *) malloc ((nthreads - 1) * sizeof (pthread_t));
+	if (!tids)
+		return grg_parallel_for (1, count, job, arg);
+
+	pthread_mutex_init (&pool.lock, NULL);
+
+	for (started = 0; started < nthreads - 1; started++)
+		if (pthread_create (&tids[started], NULL, worker, &pool))
+			break;
+
+	//the calling thread works too
+	worker (&pool);
+
+	for (i = 0; i < started; i++)
+		pthread_join (tids[i], NULL);
+
+	pthread_mutex_destroy (&pool.lock);
+	free (tids);
+
+	return pool.err;
+}
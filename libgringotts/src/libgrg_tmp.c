@@ -19,11 +19,29 @@
  *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+// A temp file lives on a memfd, so only in memory (or in the swap), where
+// the kernel has them; else it's an O_TMPFILE, or a file unlinked as soon
+// as it's made. Its data are XORed with the ChaCha20 keystream of a random
+// key of its own, indexed by their offset, so that any range can be read
+// or rewritten without touching the rest. A keystream must never encrypt
+// twice, though, as the backing file can be on the disk, or in the swap:
+// each LIBGRG_TMP_BLOCK has a generation, the nonce of its keystream, that
+// goes up at each rewrite, and the rest of the blocks rewritten only in
+// part is encrypted again with the new one.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		//O_TMPFILE
+#endif
+
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 #include "libgrg_structs.h"
+#include "libgrg_probes.h"
 #include "libgrg_crypt.h"
 #include "libgrg_utils.h"
 #include "libgringotts.h"
@@ -31,12 +49,54 @@
 #define	WRITEABLE	1
 #define READABLE	0
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC	0x0001U
+#endif
+
+/**
+ * open_backing:
+ * @gctx: the context, whose header names the file if it has a name
+ * @in_memory: set to TRUE if the file is a memfd
+ *
+ * Opens an anonymous file to hold the data.
+ *
+ * Returns: the file descriptor, or -1
+ */
+static int
+open_backing (const GRG_CTX gctx, int *in_memory)
+{
+	char tmpname[] = "/tmp/___-XXXXXX";
+	int fd;
+
+	*in_memory = FALSE;
+
+#ifdef SYS_memfd_create
+	fd = syscall (SYS_memfd_create, "libgringotts", MFD_CLOEXEC);
+	if (fd >= 0)
+	{
+		*in_memory = TRUE;
+		return fd;
+	}
+#endif
+
+#ifdef O_TMPFILE
+	fd = open ("/tmp", O_TMPFILE | O_RDWR | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd >= 0)
+		return fd;
+#endif
+
+	memcpy (tmpname + 5, gctx->header, HEADER_LEN);
+	fd = mkstemp (tmpname);
+	if (fd >= 0)
+		unlink (tmpname);
+
+	return fd;
+}
+
 GRG_TMPFILE
 grg_tmpfile_gen (const GRG_CTX gctx)
 {
 	GRG_TMPFILE tf;
-	char tmpname[] = "/tmp/___-XXXXXX";
-	grg_crypt_algo ca;
 
 	if (!gctx)
 		return NULL;
@@ -45,49 +105,226 @@ grg_tmpfile_gen (const GRG_CTX gctx)
 	if (!tf)
 		return NULL;
 
-	ca = grg_ctx_get_crypt_algo (gctx);
-
-	memcpy (tmpname + 5, gctx->header, HEADER_LEN);
-	tf->tmpfd = mkstemp (tmpname);
-	unlink (tmpname);
-	memcpy (tmpname, "/tmp/___-XXXXXX", 15);
-
+	tf->tmpfd = open_backing (gctx, &tf->in_memory);
 	if (tf->tmpfd < 0)
 	{
 		free (tf);
 		return NULL;
 	}
 
-	tf->crypt =
-		mcrypt_module_open (grg2mcrypt (ca), NULL, MCRYPT_CFB, NULL);
-	if (tf->crypt == MCRYPT_FAILED)
+	tf->key = (unsigned char *) grg_secure_alloc (GRG_CHACHA20_KEY_LEN);
+	if (!tf->key)
 	{
 		close (tf->tmpfd);
 		free (tf);
 		return NULL;
 	}
 
-	tf->dKey = grg_get_key_size_static (ca);
-	tf->key = grg_rnd_seq (gctx, tf->dKey);
-	if(!tf->key)
+	grg_rnd_seq_direct (gctx, tf->key, GRG_CHACHA20_KEY_LEN);
+
+	tf->size = 0;
+	tf->gens = NULL;
+	tf->ngens = 0;
+	tf->rwmode = WRITEABLE;
+
+	return tf;
+}
+
+/**
+ * grow_gens:
+ * @tf: the temp file
+ * @end: the length the file is going to have
+ *
+ * Makes room for the generations of the blocks up to @end; the new ones
+ * start from 0.
+ *
+ * Returns: GRG_OK or GRG_MEM_ALLOCATION_ERR
+ */
+static int
+grow_gens (GRG_TMPFILE tf, const long long end)
+{
+	long long need = (end + LIBGRG_TMP_BLOCK - 1) / LIBGRG_TMP_BLOCK, room;
+	unsigned long long *gens;
+
+	if (need <= tf->ngens)
+		return GRG_OK;
+
+	room = (need > 2 * tf->ngens) ? need : 2 * tf->ngens;
+	gens = (unsigned long long *) realloc (tf->gens,
+					       room * sizeof (*gens));
+	if (!gens)
+		return GRG_MEM_ALLOCATION_ERR;
+
+	memset (gens + tf->ngens, 0, (room - tf->ngens) * sizeof (*gens));
+	tf->gens = gens;
+	tf->ngens = room;
+
+	return GRG_OK;
+}
+
+/**
+ * xor_range:
+ * @tf: the temp file
+ * @data: the data to encrypt or decrypt, in place
+ * @dim: their length
+ * @offset: their position in the file
+ *
+ * XORs some data with the keystream of the blocks they're in, each one
+ * with its generation as the nonce.
+ */
+static void
+xor_range (const GRG_TMPFILE tf, unsigned char *data, const long dim,
+	   const long long offset)
+{
+	long long pos = offset;
+	long done, step;
+
+	for (done = 0; done < dim; done += step, pos += step)
 	{
-		close (tf->tmpfd);
-		free (tf);
-		return NULL;
+		step = LIBGRG_TMP_BLOCK - pos % LIBGRG_TMP_BLOCK;
+		if (step > dim - done)
+			step = dim - done;
+
+		grg_chacha20_xor (tf->key, tf->gens[pos / LIBGRG_TMP_BLOCK],
+				  pos, data + done, step);
 	}
+}
+
+/**
+ * read_range:
+ * @gctx: the context
+ * @tf: the temp file
+ * @data: where to put the data
+ * @dim: how many bytes to read, all in the file
+ * @offset: where to read them
+ *
+ * Reads and decrypts some data.
+ *
+ * Returns: GRG_OK or GRG_READ_FILE_ERR
+ */
+static int
+read_range (const GRG_CTX gctx, const GRG_TMPFILE tf, unsigned char *data,
+	    const long dim, const long long offset)
+{
+	if (dim <= 0)
+		return GRG_OK;
+
+	if (grg_pread_full (&gctx->counters->stats, tf->tmpfd, data, dim,
+			    offset) < 0)
+		return GRG_READ_FILE_ERR;
 
-	tf->dIV = grg_get_block_size_static (ca);
-	tf->IV = grg_rnd_seq (gctx, tf->dIV);
-	if(!tf->IV)
+	xor_range (tf, data, dim, offset);
+	GRG_COUNT (gctx, bytes_decrypted, dim);
+
+	return GRG_OK;
+}
+
+/**
+ * write_range:
+ * @gctx: the context, to wipe the buffer
+ * @tf: the temp file
+ * @data: the data to write
+ * @dim: their length
+ * @offset: where to write them, at most at the end of the file
+ *
+ * Encrypts and writes some data, LIBGRG_PIPE_BLOCK bytes at a time. The
+ * blocks that held data already get a new generation, so the old bytes
+ * that share them with the new ones (at most one block at each side) are
+ * read first, and written again along with them.
+ *
+ * Returns: GRG_OK or an error code
+ */
+static int
+write_range (const GRG_CTX gctx, GRG_TMPFILE tf, const unsigned char *data,
+	     const long dim, const long long offset)
+{
+	unsigned char *buf, *head, *tail;
+	const unsigned char *src;
+	long long end = offset + dim, start = offset, stop = end, pos, at, blk;
+	long step, i, n;
+	int err;
+
+	if (offset < tf->size)
 	{
-		close (tf->tmpfd);
-		free (tf);
-		return NULL;
+		start = offset - offset % LIBGRG_TMP_BLOCK;
+		stop = end + (LIBGRG_TMP_BLOCK - end % LIBGRG_TMP_BLOCK) %
+			LIBGRG_TMP_BLOCK;
+		if (stop > tf->size)
+			stop = (end > tf->size) ? end : tf->size;
 	}
 
-	tf->rwmode = WRITEABLE;
+	err = grow_gens (tf, stop);
+	if (err < 0)
+		return err;
 
-	return tf;
+	buf = (unsigned char *) malloc (LIBGRG_PIPE_BLOCK +
+					2 * LIBGRG_TMP_BLOCK);
+	if (!buf)
+		return GRG_MEM_ALLOCATION_ERR;
+	head = buf + LIBGRG_PIPE_BLOCK;
+	tail = head + LIBGRG_TMP_BLOCK;
+
+	GRG_TRACE (gctx, GRG_STAGE_TMP_WRITE, GRG_TRACE_BEGIN, dim);
+
+	err = read_range (gctx, tf, head, offset - start, start);
+	if (err == GRG_OK)
+		err = read_range (gctx, tf, tail, stop - end, end);
+
+	for (pos = start; pos < stop && err == GRG_OK; pos += step)
+	{
+		step = (stop - pos < LIBGRG_PIPE_BLOCK) ?
+			stop - pos : LIBGRG_PIPE_BLOCK;
+
+		for (i = 0; i < step; i += n)
+		{
+			at = pos + i;
+			if (at < offset)
+			{
+				src = head + (at - start);
+				n = offset - at;
+			}
+			else if (at < end)
+			{
+				src = data + (at - offset);
+				n = end - at;
+			}
+			else
+			{
+				src = tail + (at - end);
+				n = stop - at;
+			}
+			if (n > step - i)
+				n = step - i;
+			memcpy (buf + i, src, n);
+		}
+
+		//start is aligned here, so the blocks are all in this step
+		if (start < tf->size)
+			for (blk = pos / LIBGRG_TMP_BLOCK;
+			     blk * LIBGRG_TMP_BLOCK < pos + step &&
+			     blk * LIBGRG_TMP_BLOCK < tf->size; blk++)
+				tf->gens[blk]++;
+
+		xor_range (tf, buf, step, pos);
+		err = grg_pwrite_full (&gctx->counters->stats, tf->tmpfd, buf,
+				       step, pos);
+	}
+
+	GRG_COUNT (gctx, bytes_encrypted, pos - start);
+
+	grg_free (gctx, buf, LIBGRG_PIPE_BLOCK + 2 * LIBGRG_TMP_BLOCK);
+
+	GRG_TRACE (gctx, GRG_STAGE_TMP_WRITE, GRG_TRACE_END,
+		   (err < 0) ? err : dim);
+
+	if (err < 0)
+		return err;
+
+	if (offset + dim > tf->size)
+		tf->size = offset + dim;
+	tf->rwmode = READABLE;
+
+	return GRG_OK;
 }
 
 int
@@ -95,7 +332,7 @@ grg_tmpfile_write (const GRG_CTX gctx, GRG_TMPFILE tf,
 		   const unsigned char *data, const long data_len)
 {
 	long dim;
-	unsigned char *tocrypt;
+	int err;
 
 	if (!gctx || !tf || !data)
 		return GRG_ARGUMENT_ERR;
@@ -103,83 +340,157 @@ grg_tmpfile_write (const GRG_CTX gctx, GRG_TMPFILE tf,
 	if (tf->rwmode == READABLE)
 		return GRG_TMP_NOT_WRITEABLE;
 
-	if (mcrypt_generic_init (tf->crypt, tf->key, tf->dKey, tf->IV) < 0)
-		return GRG_WRITE_ENC_INIT_ERR;
-
 	dim = (data_len < 0) ? strlen ((char *)data) : data_len;
 
-	tocrypt = grg_memconcat (2, gctx->header, HEADER_LEN, data, dim);
-	if (!tocrypt)
-		return GRG_MEM_ALLOCATION_ERR;
+	err = write_range (gctx, tf, data, dim, 0);
+	if (err < 0)
+		return err;
 
-	if (mcrypt_generic (tf->crypt, tocrypt, dim + HEADER_LEN))
+	if (!tf->in_memory)
 	{
-		mcrypt_generic_deinit (tf->crypt);
-		grg_free (gctx, tocrypt, dim + HEADER_LEN);
-		return GRG_WRITE_ENC_INIT_ERR;
+		GRG_TRACE (gctx, GRG_STAGE_SYNC, GRG_TRACE_BEGIN, dim);
+		GRG_PROBE1 (sync__begin, dim);
+		fsync (tf->tmpfd);
+		GRG_COUNT (gctx, syscalls, 1);
+		GRG_TRACE (gctx, GRG_STAGE_SYNC, GRG_TRACE_END, dim);
+		GRG_PROBE1 (sync__end, dim);
 	}
 
-	write (tf->tmpfd, &dim, sizeof (long));	//without considering endianity, since we
-	write (tf->tmpfd, tocrypt, dim + HEADER_LEN);	//read and write on the same system.
-
-	mcrypt_generic_deinit (tf->crypt);
-	grg_free (gctx, tocrypt, dim + HEADER_LEN);
-
-	fsync (tf->tmpfd);
-
-	tf->rwmode = READABLE;
 	return GRG_OK;
 }
 
+/**
+ * grg_tmpfile_append:
+ * @gctx: the context
+ * @tf: the temp file
+ * @data: the data to add
+ * @data_len: their length; if -1 they must be NULL-terminated
+ *
+ * Adds some data at the end of a temp file; it can be called many times.
+ *
+ * Returns: GRG_OK or an error code
+ */
 int
-grg_tmpfile_read (const GRG_CTX gctx, const GRG_TMPFILE tf,
-		  unsigned char **data, long *data_len)
+grg_tmpfile_append (const GRG_CTX gctx, GRG_TMPFILE tf,
+		    const unsigned char *data, const long data_len)
 {
-	long dim;
-	unsigned char *enc_data;
+	if (!gctx || !tf || !data)
+		return GRG_ARGUMENT_ERR;
+
+	return write_range (gctx, tf, data,
+			    (data_len < 0) ? strlen ((char *)data) : data_len,
+			    tf->size);
+}
 
-	if (!gctx || !tf)
+/**
+ * grg_tmpfile_pwrite:
+ * @gctx: the context
+ * @tf: the temp file
+ * @data: the data to write
+ * @data_len: their length
+ * @offset: where to write them; it can be the end of the file, not past it
+ *
+ * Overwrites a range of a temp file, extending it if needed.
+ *
+ * Returns: GRG_OK or an error code
+ */
+int
+grg_tmpfile_pwrite (const GRG_CTX gctx, GRG_TMPFILE tf,
+		    const unsigned char *data, const long data_len,
+		    const long long offset)
+{
+	if (!gctx || !tf || !data || data_len < 0 || offset < 0 ||
+	    offset > tf->size)
 		return GRG_ARGUMENT_ERR;
 
-	if (tf->rwmode != READABLE)
-		return GRG_TMP_NOT_YET_WRITTEN;
+	return write_range (gctx, tf, data, data_len, offset);
+}
 
-	if (mcrypt_generic_init (tf->crypt, tf->key, tf->dKey, tf->IV) < 0)
-		return GRG_READ_ENC_INIT_ERR;
+/**
+ * grg_tmpfile_pread:
+ * @gctx: the context
+ * @tf: the temp file
+ * @data: where to put the data
+ * @data_len: how many bytes to read at most
+ * @offset: where to read them
+ *
+ * Reads a range of a temp file, stopping at its end.
+ *
+ * Returns: the bytes read, 0 past the end, or an error code
+ */
+long
+grg_tmpfile_pread (const GRG_CTX gctx, const GRG_TMPFILE tf,
+		   unsigned char *data, const long data_len,
+		   const long long offset)
+{
+	long dim;
 
-	lseek (tf->tmpfd, 0, SEEK_SET);
+	if (!gctx || !tf || !data || data_len < 0 || offset < 0)
+		return GRG_ARGUMENT_ERR;
 
-	read (tf->tmpfd, &dim, sizeof (long));
+	if (offset >= tf->size)
+		return 0;
 
-	enc_data = (unsigned char *) malloc (dim + HEADER_LEN);
-	if (!enc_data)
-		return GRG_MEM_ALLOCATION_ERR;
+	dim = (tf->size - offset < data_len) ? tf->size - offset : data_len;
 
-	read (tf->tmpfd, enc_data, dim + HEADER_LEN);
+	GRG_TRACE (gctx, GRG_STAGE_TMP_READ, GRG_TRACE_BEGIN, dim);
 
-	if (mdecrypt_generic (tf->crypt, enc_data, dim + HEADER_LEN))
+	if (read_range (gctx, tf, data, dim, offset) < 0)
 	{
-		grg_unsafe_free (enc_data);
-		return GRG_READ_ENC_INIT_ERR;
+		GRG_TRACE (gctx, GRG_STAGE_TMP_READ, GRG_TRACE_END,
+			   GRG_READ_FILE_ERR);
+		return GRG_READ_FILE_ERR;
 	}
 
-	if (memcmp (enc_data, gctx->header, HEADER_LEN) != 0)
-	{
-		grg_unsafe_free (enc_data);
-		return GRG_READ_PWD_ERR;
-	}
+	GRG_TRACE (gctx, GRG_STAGE_TMP_READ, GRG_TRACE_END, dim);
 
-	*data = grg_memdup (enc_data + HEADER_LEN, dim);
-	if (!data)
-	{
-		grg_unsafe_free (enc_data);
+	return dim;
+}
+
+/**
+ * grg_tmpfile_size:
+ * @tf: the temp file
+ *
+ * Tells how long a temp file is.
+ *
+ * Returns: its length, or GRG_ARGUMENT_ERR
+ */
+long long
+grg_tmpfile_size (const GRG_TMPFILE tf)
+{
+	if (!tf)
+		return GRG_ARGUMENT_ERR;
+
+	return tf->size;
+}
+
+int
+grg_tmpfile_read (const GRG_CTX gctx, const GRG_TMPFILE tf,
+		  unsigned char **data, long *data_len)
+{
+	unsigned char *ret;
+	long got;
+
+	if (!gctx || !tf || !data)
+		return GRG_ARGUMENT_ERR;
+
+	if (tf->rwmode != READABLE)
+		return GRG_TMP_NOT_YET_WRITTEN;
+
+	ret = (unsigned char *) malloc (tf->size ? tf->size : 1);
+	if (!ret)
 		return GRG_MEM_ALLOCATION_ERR;
+
+	got = grg_tmpfile_pread (gctx, tf, ret, tf->size, 0);
+	if (got < 0)
+	{
+		grg_unsafe_free (ret);
+		return got;
 	}
 
+	*data = ret;
 	if (data_len)
-		*data_len = dim;
-
-	grg_unsafe_free (enc_data);
+		*data_len = got;
 
 	return GRG_OK;
 }
@@ -191,9 +502,7 @@ grg_tmpfile_close (const GRG_CTX gctx, GRG_TMPFILE tf)
 		return;
 
 	close (tf->tmpfd);
-	mcrypt_module_close (tf->crypt);
-	grg_free (gctx, tf->key, tf->dKey);
-	grg_unsafe_free (tf->IV);
+	grg_secure_free (gctx, tf->key, GRG_CHACHA20_KEY_LEN);
+	grg_unsafe_free (tf->gens);
 	grg_unsafe_free (tf);
-	tf = NULL;
 }
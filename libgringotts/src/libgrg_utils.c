@@ -23,17 +23,17 @@
 #include "libgringotts.h"
 #include "libgrg_crypt.h"
 #include "libgrg_structs.h"
+#include "libgrg_probes.h"
 
 #include <stdlib.h>
-#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <time.h>
 #include <math.h>
 #include <ctype.h>
 #include <limits.h>
 #include <fcntl.h>
-#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
@@ -49,6 +49,7 @@
 
 /**
  * grg_memdup
+ * @gctx: the context to count the allocation with, or NULL
  * @src: the source
  * @len: its length
  *
@@ -57,7 +58,7 @@
  * Returns: a newly allocated (to free() afterwards) byte sequence
  */
 unsigned char *
-grg_memdup (const unsigned char *src, long len)
+grg_memdup (const GRG_CTX gctx, const unsigned char *src, long len)
 {
 	unsigned char *ret;
 
@@ -67,57 +68,12 @@ grg_memdup (const unsigned char *src, long len)
 	ret = (unsigned char *) malloc (len);
 
 	if (ret)
-		memcpy (ret, src, len);
-
-	return ret;
-}
-
-/**
- * grg_memconcat:
- * @count: the number of byte sequences to concatenate
- * @src1: the first byte sequence to concatenate
- * @len1: the length of the first sequence
- * @...: the other sequences/lengths
- *
- * Concatenates some byte sequences
- *
- * Returns: a newly allocated (to free() afterwards) byte sequence
- */
-unsigned char *
-grg_memconcat (const int count, ...)
-{
-	va_list ap;
-	unsigned char *ret, *tmp, *strings[count];
-	int dim[count], i, dimtot = 0;
-
-	if (count < 1)
-		return NULL;
-
-	va_start (ap, count);
-
-	for (i = 0; i < count; i++)
-	{
-		strings[i] = va_arg (ap, unsigned char *);
-		dim[i] = va_arg (ap, int);
-		dimtot += dim[i];
-	}
-
-	if (!dimtot)
-		return NULL;
-
-	ret = (unsigned char *) malloc (dimtot);
-	if (!ret)
-		return NULL;
-
-	tmp = ret;
-	for (i = 0; i < count; i++)
 	{
-		memcpy (tmp, strings[i], dim[i]);
-		tmp += dim[i];
+		memcpy (ret, src, len);
+		if (gctx)
+			grg_count_alloc (gctx, len);
 	}
 
-	va_end (ap);
-
 	return ret;
 }
 
@@ -192,22 +148,78 @@ grg_long2char (const long seed)
 	return ret;
 }
 
+/**
+ * grg_long2char_direct:
+ * @seed: the long to convert
+ * @dest: where to write the four bytes
+ *
+ * As grg_long2char(), without allocating anything
+ */
+void
+grg_long2char_direct (const long seed, unsigned char *dest)
+{
+	long tmp = seed;
+	int i;
+
+	for (i = 3; i >= 0; i--, tmp >>= 8)
+		dest[i] = tmp & 0x0ff;
+}
+
 /**
  * grg_char2long:
  * @seed: the 4-char sequence to convert
  *
- * Reverts grg_long2char(), converting back into a long
+ * Reverts grg_long2char(), converting back into an unsigned long: the
+ * values from 2 Gb up must not turn negative
  *
- * Returns: a long
+ * Returns: an unsigned long
  */
-long
+unsigned long
 grg_char2long (const unsigned char *seed)
 {
-	long ret = 0;
+	unsigned long ret = 0;
 	int i;
 
 	for (i = 3; i >= 0; i--)
-		ret |= seed[i] << ((3 - i) * 8);
+		ret |= (unsigned long) seed[i] << ((3 - i) * 8);
+
+	return ret;
+}
+
+/**
+ * grg_llong2char:
+ * @seed: the long long to convert
+ * @dest: where to write the result
+ *
+ * Converts a long long into eight bytes, in the same (big endian)
+ * order as grg_long2char()
+ */
+void
+grg_llong2char (const long long seed, unsigned char *dest)
+{
+	unsigned long long tmp = seed;
+	int i;
+
+	for (i = 7; i >= 0; i--, tmp >>= 8)
+		dest[i] = tmp & 0x0ff;
+}
+
+/**
+ * grg_char2llong:
+ * @seed: the 8-char sequence to convert
+ *
+ * Reverts grg_llong2char(), converting back into a long long
+ *
+ * Returns: a long long
+ */
+long long
+grg_char2llong (const unsigned char *seed)
+{
+	unsigned long long ret = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		ret = (ret << 8) | seed[i];
 
 	return ret;
 }
@@ -224,8 +236,18 @@ grg_rnd_seq_direct (const GRG_CTX gctx, unsigned char *toOverwrite,
 	if (csize < 0)
 		csize = strlen ((char *)toOverwrite);
 
+	GRG_COUNT (gctx, bytes_random, csize);
+
+	//in paranoia mode, every byte comes straight from the kernel
+	if (gctx->rng && gctx->sec_lvl != GRG_SEC_PARANOIA)
+	{
+		grg_rng_read (gctx->rng, gctx->rnd, toOverwrite, csize);
+		return;
+	}
+
 #ifdef HAVE__DEV_RANDOM
 	read (gctx->rnd, toOverwrite, csize);
+	GRG_COUNT (gctx, syscalls, 1);
 #else
 	int step = sizeof (long int), i;
 	long int val;
@@ -280,20 +302,88 @@ grg_rnd_chr (const GRG_CTX gctx)
 	unsigned char rnd;
 	if (!gctx)
 		return 0;
+	GRG_COUNT (gctx, bytes_random, 1);
+	if (gctx->rng && gctx->sec_lvl != GRG_SEC_PARANOIA)
+	{
+		grg_rng_read (gctx->rng, gctx->rnd, &rnd, 1);
+		return rnd;
+	}
 #ifdef HAVE__DEV_RANDOM
 	read (gctx->rnd, &rnd, 1);
+	GRG_COUNT (gctx, syscalls, 1);
 #else
 	rnd = (random () / 256) % 256;
 #endif
 	return rnd;
 }
 
+/**
+ * grg_wipe:
+ * @data: pointer to the memory to wipe
+ * @dim: length of the sequence; if -1 it must be NULL-terminated
+ *
+ * Overwrites a sequence of bytes, as told by the wipe mode of the context,
+ * in a way the compiler can't optimize out even if the memory is freed
+ * right after.
+ */
+void
+grg_wipe (const GRG_CTX gctx, void *data, const long dim)
+{
+	unsigned char *pntr = (unsigned char *) data;
+	long len, done, step;
+
+	if (!gctx || !pntr)
+		return;
+
+	len = (dim >= 0) ? dim : (long) strlen ((char *) pntr);
+
+	GRG_TRACE (gctx, GRG_STAGE_WIPE, GRG_TRACE_BEGIN, len);
+	GRG_PROBE2 (wipe__begin, len, gctx->wipe_mode);
+
+	switch (gctx->wipe_mode)
+	{
+	case GRG_WIPE_ZERO:
+#ifdef __GNUC__
+		memset (pntr, 0, len);
+#else
+		{
+			volatile unsigned char *vp = pntr;
+
+			for (done = 0; done < len; done++)
+				vp[done] = 0;
+		}
+#endif
+		break;
+
+	case GRG_WIPE_PATTERN:
+		for (done = 0; done < len; done += step)
+		{
+			step = (len - done < GRG_WIPE_PATTERN_LEN) ?
+				len - done : GRG_WIPE_PATTERN_LEN;
+			memcpy (pntr + done, gctx->wipe_pattern, step);
+		}
+		break;
+
+	default:
+		grg_rnd_seq_direct (gctx, pntr, len);
+	}
+
+#ifdef __GNUC__
+	__asm__ __volatile__ ("" : : "r" (pntr) : "memory");
+#endif
+
+	GRG_COUNT (gctx, bytes_wiped, len);
+
+	GRG_TRACE (gctx, GRG_STAGE_WIPE, GRG_TRACE_END, len);
+	GRG_PROBE1 (wipe__end, len);
+}
+
 /**
  * grg_free:
  * @pntr: pointer to the memory to free
  * @dim: length of the sequence; if -1 it must be NULL-terminated
  *
- * Frees a sequence of bytes, overwriting it with random data
+ * Frees a sequence of bytes, wiping it with grg_wipe() first
  */
 void
 grg_free (const GRG_CTX gctx, void *alloc_data, const long dim)
@@ -304,7 +394,7 @@ grg_free (const GRG_CTX gctx, void *alloc_data, const long dim)
 		return;
 
 	if (gctx)
-		grg_rnd_seq_direct (gctx, (unsigned char *)pntr, (dim >= 0) ? dim : strlen (pntr));
+		grg_wipe (gctx, pntr, dim);
 
 	free (pntr);
 }
@@ -459,200 +549,149 @@ grg_file_pwd_quality (const char *pwd_path)
 }
 
 
-#define CHAR64(c) \
-	((c < 0 || c > 127) ? -1 : index_64[c])
-
-static const char basis_64[] =
-	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-static const char index_64[128] = {
-	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
-	52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
-	-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
-	15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
-	-1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
-	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1
-};
-
-unsigned char *
-grg_encode64 (const unsigned char *in, const int inlen,
-	      unsigned int *outlen)
+/**
+ * grg_write_full:
+ * @stats: the statistics to count the system calls in, or NULL
+ * @fd: the file descriptor to write to
+ * @data: the data
+ * @dim: their length
+ *
+ * Writes all the data, in as many write() as needed; a single one
+ * stops at 2 Gb.
+ *
+ * Returns: GRG_OK or GRG_WRITE_FILE_ERR
+ */
+int
+grg_write_full (struct grg_stats *stats, const int fd,
+		const unsigned char *data, const long dim)
 {
-	unsigned char *out, *ret;
-	unsigned char oval;
-	unsigned int olen, origlen;
-
-	if (!in)
-		return NULL;
+	long done = 0;
+	ssize_t ret;
 
-	origlen = (inlen >= 0) ? inlen : strlen ((char *)in);
-	olen = (origlen + 2) / 3 * 4 + 1;
-	out = (unsigned char *) malloc (olen);
-	if (!out)
-		return NULL;
+	while (done < dim)
+	{
+		ret = write (fd, data + done, dim - done);
+		if (stats)
+			__sync_fetch_and_add (&stats->syscalls, 1);
 
-	ret = out;
-	if (outlen)
-		*outlen = olen;
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return GRG_WRITE_FILE_ERR;
+		}
 
-	while (origlen >= 3)
-	{
-		*out++ = basis_64[in[0] >> 2];
-		*out++ = basis_64[((in[0] << 4) & 0x30) | (in[1] >> 4)];
-		*out++ = basis_64[((in[1] << 2) & 0x3c) | (in[2] >> 6)];
-		*out++ = basis_64[in[2] & 0x3f];
-		in += 3;
-		origlen -= 3;
-	}
-	if (origlen > 0)
-	{
-		*out++ = basis_64[in[0] >> 2];
-		oval = (in[0] << 4) & 0x30;
-		if (origlen > 1)
-			oval |= in[1] >> 4;
-		*out++ = basis_64[oval];
-		*out++ = (origlen < 2) ? '=' : basis_64[(in[1] << 2) & 0x3c];
-		*out++ = '=';
+		done += ret;
 	}
 
-	ret[olen - 1] = '\0';
-
-	return ret;
+	return GRG_OK;
 }
 
-unsigned char *
-grg_decode64 (const unsigned char *in, const int inlen,
-	      unsigned int *outlen)
+/**
+ * grg_read_full:
+ * @stats: the statistics to count the system calls in, or NULL
+ * @fd: the file descriptor to read from
+ * @data: where to put the data
+ * @dim: how many bytes to read
+ *
+ * Reads exactly @dim bytes, in as many read() as needed.
+ *
+ * Returns: GRG_OK or GRG_READ_FILE_ERR
+ */
+int
+grg_read_full (struct grg_stats *stats, const int fd, unsigned char *data,
+	       const long dim)
 {
-	unsigned olen, lup, tmpinlen;
-	int c1, c2, c3, c4;
-	char *out, *ret;
-
-	if (!in)
-		return NULL;
+	long done = 0;
+	ssize_t ret;
 
-	tmpinlen = (inlen >= 0) ? inlen : strlen ((char *)in);
-
-	olen = tmpinlen / 4 * 3;
-	if (in[tmpinlen - 1] == '=')
+	while (done < dim)
 	{
-		olen--;
-		if (in[tmpinlen - 2] == '=')
-			olen--;
-	}
-
-	out = (char *) malloc (olen+1);
-	if (!out)
-		return NULL;
-
-	ret = out;
+		ret = read (fd, data + done, dim - done);
+		if (stats)
+			__sync_fetch_and_add (&stats->syscalls, 1);
 
-	if (in[0] == '+' && in[1] == ' ')
-		in += 2;
-
-	if (*in == '\0')
-		return NULL;
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return GRG_READ_FILE_ERR;
 
-	for (lup = 0; lup < tmpinlen / 4; lup++)
-	{
-		c1 = in[0];
-		if (CHAR64 (c1) == -1)
-			return NULL;
-		c2 = in[1];
-		if (CHAR64 (c2) == -1)
-			return NULL;
-		c3 = in[2];
-		if (c3 != '=' && CHAR64 (c3) == -1)
-			return NULL;
-		c4 = in[3];
-		if (c4 != '=' && CHAR64 (c4) == -1)
-			return NULL;
-		in += 4;
-		*out++ = (CHAR64 (c1) << 2) | (CHAR64 (c2) >> 4);
-		if (c3 != '=')
-		{
-			*out++ = ((CHAR64 (c2) << 4) & 0xf0) | (CHAR64 (c3) >>
-								2);
-			if (c4 != '=')
-				*out++ = ((CHAR64 (c3) << 6) & 0xc0) |
-					CHAR64 (c4);
-		}
+		done += ret;
 	}
 
-	if (outlen)
-		*outlen = olen;
-
-	ret[olen] = '\0';
-
-	return (unsigned char *)ret;
+	return GRG_OK;
 }
 
+/**
+ * grg_pwrite_full:
+ * @stats: the statistics to count the system calls in, or NULL
+ * @fd: the file descriptor to write to
+ * @data: the data
+ * @dim: their length
+ * @pos: where to write them
+ *
+ * Writes all the data at @pos, in as many pwrite() as needed, without
+ * moving the offset of @fd.
+ *
+ * Returns: GRG_OK or GRG_WRITE_FILE_ERR
+ */
 int
-grg_file_shred (const char *path, const int npasses)
+grg_pwrite_full (struct grg_stats *stats, const int fd,
+		 const unsigned char *data, const long dim, const off_t pos)
 {
+	long done = 0;
+	ssize_t ret;
 
-#define SHRED_BLOCK_SIZE	65536
-
-	int fd, dim, tmpnpasses, i/* , j */;
-	struct stat buf;
-	char *mem;
-	GRG_CTX gctx;
-
-	fd = open (path, O_RDWR);
-
-	if (fd < 3)
+	while (done < dim)
 	{
-		close (fd);
-		return GRG_SHRED_CANT_OPEN_FILE;
-	}
-
-	tmpnpasses = (npasses > 0) ? npasses : 1;
+		ret = pwrite (fd, data + done, dim - done, pos + done);
+		if (stats)
+			__sync_fetch_and_add (&stats->syscalls, 1);
 
-	fstat (fd, &buf);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return GRG_WRITE_FILE_ERR;
 
-	if (buf.st_nlink > 1)
-	{
-		close (fd);
-		return GRG_SHRED_YET_LINKED;
+		done += ret;
 	}
 
-	dim = buf.st_size;
+	return GRG_OK;
+}
 
-	mem = mmap (NULL, dim, PROT_WRITE, MAP_SHARED, fd, 0);
+/**
+ * grg_pread_full:
+ * @stats: the statistics to count the system calls in, or NULL
+ * @fd: the file descriptor to read from
+ * @data: where to put the data
+ * @dim: how many bytes to read
+ * @pos: where to read them
+ *
+ * Reads exactly @dim bytes from @pos, in as many pread() as needed,
+ * without moving the offset of @fd.
+ *
+ * Returns: GRG_OK or GRG_READ_FILE_ERR
+ */
+int
+grg_pread_full (struct grg_stats *stats, const int fd, unsigned char *data,
+		const long dim, const off_t pos)
+{
+	long done = 0;
+	ssize_t ret;
 
-	if (mem == MAP_FAILED)
+	while (done < dim)
 	{
-		close (fd);
-		return GRG_SHRED_CANT_MMAP;
-	}
+		ret = pread (fd, data + done, dim - done, pos + done);
+		if (stats)
+			__sync_fetch_and_add (&stats->syscalls, 1);
 
-	gctx = grg_context_initialize_defaults ("GRG");
-	if (!gctx)
-	{
-		close (fd);
-		return GRG_MEM_ALLOCATION_ERR;
-	}
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return GRG_READ_FILE_ERR;
 
-	for (i = 0; i < tmpnpasses; i++)
-	{
-/*		int rem = dim % SHRED_BLOCK_SIZE;
-
-		for (j = SHRED_BLOCK_SIZE; j < dim; j += SHRED_BLOCK_SIZE)
-			grg_rnd_seq_direct (gctx, mem + j - SHRED_BLOCK_SIZE, SHRED_BLOCK_SIZE);
-		grg_rnd_seq_direct (gctx, mem + dim - rem, rem);
-*/
-		grg_rnd_seq_direct (gctx, (unsigned char *)mem, dim);
-		fsync (fd);
+		done += ret;
 	}
 
-	munmap (mem, dim);
-	close (fd);
-	unlink (path);
-	grg_context_free (gctx);
-
-	sync ();
-
-	return 0;
+	return GRG_OK;
 }
@@ -22,12 +22,28 @@
 #ifndef LIBGRG_UTILS_H
 #define LIBGRG_UTILS_H
 
+#include <sys/types.h>
+
+#include "libgringotts.h"
+
 unsigned char *grg_long2char (const long seed);
-long grg_char2long (const unsigned char *seed);
-unsigned char *grg_memdup (const unsigned char *src, const long len);
-unsigned char *grg_memconcat (const int count, ...);
+void grg_long2char_direct (const long seed, unsigned char *dest);
+unsigned long grg_char2long (const unsigned char *seed);
+void grg_llong2char (const long long seed, unsigned char *dest);
+long long grg_char2llong (const unsigned char *seed);
+unsigned char *grg_memdup (const GRG_CTX gctx, const unsigned char *src,
+			   const long len);
 void grg_XOR_mem (unsigned char *src, int src_len, unsigned char *mask,
 		  int mask_len);
 void grg_unsafe_free (void *alloc_data);
+int grg_write_full (struct grg_stats *stats, const int fd,
+		    const unsigned char *data, const long dim);
+int grg_read_full (struct grg_stats *stats, const int fd, unsigned char *data,
+		   const long dim);
+int grg_pwrite_full (struct grg_stats *stats, const int fd,
+		     const unsigned char *data, const long dim,
+		     const off_t pos);
+int grg_pread_full (struct grg_stats *stats, const int fd,
+		    unsigned char *data, const long dim, const off_t pos);
 
 #endif
@@ -22,6 +22,7 @@
 #define LIBGRG_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 // if you feel a wee bit confused please
 // read the manual, tipically found at
@@ -56,7 +57,9 @@ grg_hash_algo;
 typedef enum
 {
 	GRG_ZLIB = 0x00,	//00000000 (default)
-	GRG_BZIP = 0x04		//00000100
+	GRG_BZIP = 0x04,	//00000100
+	GRG_ZSTD = 0x100,	//beyond the ALGO byte: chunked formats only
+	GRG_LZ4 = 0x200
 }
 grg_comp_algo;
 
@@ -70,6 +73,13 @@ typedef enum
 }
 grg_comp_ratio;
 
+//to pick the algorithms above out of a byte holding them all, as in the
+//ALGO field of the file format; zstd and lz4 don't fit in it
+#define GRG_ENCRYPT_MASK	0x70	//01110000
+#define GRG_HASH_MASK		0x08	//00001000
+#define GRG_COMP_TYPE_MASK	0x04	//00000100
+#define GRG_COMP_LVL_MASK	0x03	//00000011
+
 //security level
 typedef enum
 {
@@ -78,6 +88,40 @@ typedef enum
 }
 grg_security_lvl;
 
+//how grg_free() and grg_wipe() overwrite the data
+typedef enum
+{
+	GRG_WIPE_RANDOM,	//fresh random data (default)
+	GRG_WIPE_PATTERN,	//a random pattern, fixed for the context
+	GRG_WIPE_ZERO		//zeroes
+}
+grg_wipe_mode;
+
+//the stages of the work reported to a trace callback
+typedef enum
+{
+	GRG_STAGE_ENCRYPT,	//a whole encryption
+	GRG_STAGE_DECRYPT,	//a whole decryption
+	GRG_STAGE_VALIDATE,	//the outer CRC32s, before decrypting
+	GRG_STAGE_COMPRESS,	//and the inner CRC32, of a block
+	GRG_STAGE_UNCOMPRESS,	//of a block
+	GRG_STAGE_CIPHER,	//encryption or decryption of a block
+	GRG_STAGE_CRC,		//the inner CRC32 of a block, when decrypting
+	GRG_STAGE_WIPE,		//grg_wipe () and grg_free ()
+	GRG_STAGE_SYNC,		//fsync () of a file written
+	GRG_STAGE_TMP_WRITE,
+	GRG_STAGE_TMP_READ,
+	GRG_STAGE_SHRED		//a whole grg_files_shred ()
+}
+grg_trace_stage;
+
+typedef enum
+{
+	GRG_TRACE_BEGIN,
+	GRG_TRACE_END
+}
+grg_trace_event;
+
 // ERROR CODES
 
 //I/O Ok
@@ -106,15 +150,98 @@ grg_security_lvl;
 //error codes in file shredding
 #define	GRG_SHRED_CANT_OPEN_FILE		-51
 #define GRG_SHRED_YET_LINKED			-52
-#define GRG_SHRED_CANT_MMAP				-53
+#define GRG_SHRED_CANT_MMAP				-53	//not returned anymore
+#define GRG_SHRED_CANCELLED				-54
 
 //generic error codes
 #define GRG_MEM_ALLOCATION_ERR			-71
 #define GRG_ARGUMENT_ERR				-72
+#define GRG_MEM_LOCK_ERR				-73
 
 typedef struct _grg_context *GRG_CTX;
 typedef struct _grg_key *GRG_KEY;
 typedef struct _grg_tmpfile *GRG_TMPFILE;
+typedef struct _grg_stream *GRG_STREAM;
+typedef struct _grg_aio *GRG_AIO;
+
+//receives the output of a GRG_STREAM, chunk by chunk; a negative
+//return value aborts the stream, and is passed back to the caller
+typedef int (*GRG_STREAM_SINK) (void *user_data, const unsigned char *data,
+				const long dim);
+
+//called, from another thread, when an asynchronous write is done; @ret
+//is GRG_OK or the error met
+typedef void (*GRG_AIO_CALLBACK) (void *user_data, const int ret);
+
+//called while files are wiped, with the bytes written so far out of
+//@total (all the passes on all the files); a non-zero return value
+//cancels the wiping
+typedef int (*GRG_SHRED_PROGRESS) (void *user_data, const long long done,
+				   const long long total);
+
+//called as each stage begins, with the bytes it's given, and as it ends,
+//with the bytes it made or a (negative) error code; the stages of the
+//chunks run in many threads at once, see grg_set_trace_callback ()
+typedef void (*GRG_TRACE_CALLBACK) (void *user_data,
+				    const grg_trace_stage stage,
+				    const grg_trace_event event,
+				    const long long bytes);
+
+//the functions libGringotts allocates and frees its sensitive memory with,
+//see grg_set_allocator (); @dim is always the real length
+struct grg_allocator
+{
+	void *(*alloc) (void *user_data, const long dim);
+	void (*free) (void *user_data, void *data, const long dim);
+	void *user_data;
+};
+
+//the state of an incremental base64 conversion, see grg_encode64_init ()
+//and grg_decode64_init ()
+struct grg_b64_state
+{
+	unsigned char carry[4];	//what's left over from the last piece
+	int carried;
+	int over;		//the padding was met, when decoding
+};
+
+//the parameters some data were written with, as given back by the
+//reentrant (_r) decryption functions instead of changing the context
+struct grg_params
+{
+	int version;		//of the file format
+	grg_crypt_algo crypt_algo;
+	grg_hash_algo hash_algo;
+	grg_comp_algo comp_algo;
+	grg_comp_ratio comp_lvl;
+	int comp_level;
+	long chunk_size;
+};
+
+//the outcome of each file of a batch, see grg_decrypt_files ()
+struct grg_file_result
+{
+	int ret;		//GRG_OK or an error code
+	unsigned char *data;	//the decrypted data, to free; NULL on error
+	long dim;
+	struct grg_params params;	//valid if version isn't 0
+};
+
+//what has been done with a context so far, see grg_get_stats ()
+struct grg_stats
+{
+	long long bytes_compressed;	//given to the compression
+	long long bytes_uncompressed;	//given back by the decompression
+	long long bytes_encrypted;
+	long long bytes_decrypted;
+	long long bytes_crc;		//checksummed with a CRC32
+	long long bytes_random;		//drawn from the random source
+	long long bytes_wiped;
+	long long allocs;		//buffers allocated for the data
+	long long alloc_bytes;		//their total length
+	long long alloc_max;		//the longest of them
+	long long syscalls;		//reading, writing and syncing the data
+};
 
 // General purpose functions
 
@@ -128,9 +255,20 @@ void grg_rnd_seq_direct (const GRG_CTX gctx, unsigned char *toOverwrite,
 	const unsigned int size);
 unsigned char grg_rnd_chr (const GRG_CTX gctx);
 void grg_free (const GRG_CTX gctx, void *alloc_data, const long dim);
+void grg_wipe (const GRG_CTX gctx, void *data, const long dim);
 double grg_ascii_pwd_quality (const char *pwd, const long pwd_len);
 double grg_file_pwd_quality (const char *pwd_path);
 
+// Sensitive memory allocation functions
+
+void grg_set_allocator (const struct grg_allocator *alloc);
+void *grg_secure_alloc (const long dim);
+void grg_secure_free (const GRG_CTX gctx, void *data, const long dim);
+int grg_secure_arena_init (const long dim);
+void grg_secure_arena_reset (void);
+void grg_secure_arena_free (void);
+long grg_secure_arena_used (void);
+
 // libGringotts context (GRG_CTX) related functions
 
 GRG_CTX grg_context_initialize (const char *header,
@@ -144,19 +282,33 @@ grg_crypt_algo grg_ctx_get_crypt_algo (const GRG_CTX gctx);
 grg_hash_algo grg_ctx_get_hash_algo (const GRG_CTX gctx);
 grg_comp_algo grg_ctx_get_comp_algo (const GRG_CTX gctx);
 grg_comp_ratio grg_ctx_get_comp_ratio (const GRG_CTX gctx);
+int grg_ctx_get_comp_level (const GRG_CTX gctx);
 grg_security_lvl grg_ctx_get_security_lvl (const GRG_CTX gctx);
+long grg_ctx_get_chunk_size (const GRG_CTX gctx);
+int grg_ctx_get_threads (const GRG_CTX gctx);
+grg_wipe_mode grg_ctx_get_wipe_mode (const GRG_CTX gctx);
+long long grg_ctx_get_wiped_bytes (const GRG_CTX gctx);
+int grg_get_stats (const GRG_CTX gctx, struct grg_stats *stats);
+void grg_set_trace_callback (GRG_CTX gctx, GRG_TRACE_CALLBACK callback,
+			     void *user_data);
 
 void grg_ctx_set_crypt_algo (GRG_CTX gctx, const grg_crypt_algo crypt_algo);
 void grg_ctx_set_hash_algo (GRG_CTX gctx, const grg_hash_algo hash_algo);
 void grg_ctx_set_comp_algo (GRG_CTX gctx, const grg_comp_algo comp_algo);
 void grg_ctx_set_comp_ratio (GRG_CTX gctx, const grg_comp_ratio comp_ratio);
+void grg_ctx_set_comp_level (GRG_CTX gctx, const int comp_level);
 void grg_ctx_set_security_lvl (GRG_CTX gctx,
 			       const grg_security_lvl sec_level);
+void grg_ctx_set_chunk_size (GRG_CTX gctx, const long chunk_size);
+void grg_ctx_set_threads (GRG_CTX gctx, const int threads);
+void grg_ctx_set_wipe_mode (GRG_CTX gctx, const grg_wipe_mode wipe_mode);
+void grg_ctx_set_params (GRG_CTX gctx, const struct grg_params *params);
 
 unsigned int grg_get_key_size_static (const grg_crypt_algo crypt_algo);
 unsigned int grg_get_key_size (const GRG_CTX gctx);
 unsigned int grg_get_block_size_static (const grg_crypt_algo crypt_algo);
 unsigned int grg_get_block_size (const GRG_CTX gctx);
+int grg_comp_algo_supported (const grg_comp_algo comp_algo);
 
 // libGringotts keyholder (GRG_KEY) related functions
 
@@ -174,6 +326,9 @@ int grg_decrypt_file (const GRG_CTX gctx, const GRG_KEY keystruct,
 int grg_encrypt_file (const GRG_CTX gctx, const GRG_KEY keystruct,
 		      const char *path,
 		      const unsigned char *origData, const long origDim);
+int grg_decrypt_file_r (const GRG_CTX gctx, const GRG_KEY keystruct,
+			const char *path, unsigned char **origData,
+			long *origDim, struct grg_params *params);
 
 // Their "direct" versions, requiring a file descriptor instead of a path
 int grg_validate_file_direct (const GRG_CTX gctx, const int fd);
@@ -184,6 +339,29 @@ int grg_decrypt_file_direct (const GRG_CTX gctx, const GRG_KEY keystruct,
 int grg_encrypt_file_direct (const GRG_CTX gctx, const GRG_KEY keystruct,
 			     const int fd, const unsigned char *origData,
 			     const long origDim);
+int grg_decrypt_file_direct_r (const GRG_CTX gctx, const GRG_KEY keystruct,
+			       const int fd, unsigned char **origData,
+			       long *origDim, struct grg_params *params);
+
+// Their batch versions, working on many files at once
+int grg_validate_files (const GRG_CTX gctx, const char **paths,
+			const long count, int *results);
+int grg_decrypt_files (const GRG_CTX gctx, const GRG_KEY keystruct,
+		       const char **paths, const long count,
+		       struct grg_file_result *results);
+int grg_validate_files_direct (const GRG_CTX gctx, const int *fds,
+			       const long count, int *results);
+int grg_decrypt_files_direct (const GRG_CTX gctx, const GRG_KEY keystruct,
+			      const int *fds, const long count,
+			      struct grg_file_result *results);
+
+// Asynchronous encryption, writing while still encrypting
+int grg_encrypt_file_async (const GRG_CTX gctx, const GRG_KEY keystruct,
+			    const int fd, const unsigned char *origData,
+			    const long origDim, GRG_AIO_CALLBACK callback,
+			    void *user_data, GRG_AIO * aio);
+int grg_aio_fd (const GRG_AIO aio);
+int grg_aio_wait (GRG_AIO aio);
 
 // Memory encryption/decryption functions
 int grg_validate_mem (const GRG_CTX gctx, const void *mem, const long memDim);
@@ -195,6 +373,56 @@ int grg_decrypt_mem (const GRG_CTX gctx, const GRG_KEY keystruct,
 int grg_encrypt_mem (const GRG_CTX gctx, const GRG_KEY keystruct, void **mem,
 		     long *memDim, const unsigned char *origData,
 		     const long origDim);
+int grg_decrypt_mem_r (const GRG_CTX gctx, const GRG_KEY keystruct,
+		       const void *mem, const long memDim,
+		       unsigned char **origData, long *origDim,
+		       struct grg_params *params);
+
+// Their copy-free versions, decrypting in place into a buffer of yours
+int grg_decrypted_size (const GRG_CTX gctx, const GRG_KEY keystruct,
+			const void *mem, const long memDim, long *origDim);
+int grg_decrypt_mem_into (const GRG_CTX gctx, const GRG_KEY keystruct,
+			  void *mem, const long memDim,
+			  unsigned char *origData, const long origSize,
+			  long *origDim);
+int grg_decrypt_mem_into_r (const GRG_CTX gctx, const GRG_KEY keystruct,
+			    void *mem, const long memDim,
+			    unsigned char *origData, const long origSize,
+			    long *origDim, struct grg_params *params);
+
+// Their scatter-gather versions, with the plain data in many pieces
+int grg_encrypt_iov (const GRG_CTX gctx, const GRG_KEY keystruct, void **mem,
+		     long *memDim, const struct iovec *iov, const int iovcnt);
+int grg_encrypt_file_iov (const GRG_CTX gctx, const GRG_KEY keystruct,
+			  const char *path, const struct iovec *iov,
+			  const int iovcnt);
+int grg_encrypt_file_iov_direct (const GRG_CTX gctx, const GRG_KEY keystruct,
+				 const int fd, const struct iovec *iov,
+				 const int iovcnt);
+int grg_decrypt_to_iov (const GRG_CTX gctx, const GRG_KEY keystruct,
+			void *mem, const long memDim,
+			const struct iovec *iov, const int iovcnt,
+			long *origDim);
+
+// Streaming (incremental) encryption/decryption functions
+GRG_STREAM grg_stream_encrypt_init (const GRG_CTX gctx,
+				    const GRG_KEY keystruct,
+				    GRG_STREAM_SINK sink, void *user_data);
+int grg_stream_encrypt_update (GRG_STREAM gs, const unsigned char *data,
+			       const long dim);
+int grg_stream_encrypt_final (GRG_STREAM gs);
+GRG_STREAM grg_stream_decrypt_init (const GRG_CTX gctx,
+				    const GRG_KEY keystruct,
+				    GRG_STREAM_SINK sink, void *user_data);
+int grg_stream_decrypt_update (GRG_STREAM gs, const void *mem,
+			       const long memDim);
+int grg_stream_decrypt_final (GRG_STREAM gs);
+void grg_stream_close (const GRG_CTX gctx, GRG_STREAM gs);
+
+int grg_stream_encrypt_fd (const GRG_CTX gctx, const GRG_KEY keystruct,
+			   const int in_fd, const int out_fd);
+int grg_stream_decrypt_fd (const GRG_CTX gctx, const GRG_KEY keystruct,
+			   const int in_fd, const int out_fd);
 
 // Encrypted temporary files functions
 GRG_TMPFILE grg_tmpfile_gen (const GRG_CTX gctx);
@@ -202,6 +430,15 @@ int grg_tmpfile_write (const GRG_CTX gctx, GRG_TMPFILE tf,
 		       const unsigned char *data, const long data_len);
 int grg_tmpfile_read (const GRG_CTX gctx, const GRG_TMPFILE tf,
 		      unsigned char **data, long *data_len);
+int grg_tmpfile_append (const GRG_CTX gctx, GRG_TMPFILE tf,
+			const unsigned char *data, const long data_len);
+int grg_tmpfile_pwrite (const GRG_CTX gctx, GRG_TMPFILE tf,
+			const unsigned char *data, const long data_len,
+			const long long offset);
+long grg_tmpfile_pread (const GRG_CTX gctx, const GRG_TMPFILE tf,
+			unsigned char *data, const long data_len,
+			const long long offset);
+long long grg_tmpfile_size (const GRG_TMPFILE tf);
 void grg_tmpfile_close (const GRG_CTX gctx, GRG_TMPFILE tf);
 
 // Miscellaneous file functions
@@ -210,6 +447,22 @@ unsigned char *grg_encode64 (const unsigned char *in,
 unsigned char *grg_decode64 (const unsigned char *in,
 			     const int inlen, unsigned int *outlen);
 
+// Their incremental versions, a piece at a time
+void grg_encode64_init (struct grg_b64_state *state);
+long grg_encode64_update (struct grg_b64_state *state,
+			  const unsigned char *in, const long inlen,
+			  unsigned char *out);
+long grg_encode64_final (struct grg_b64_state *state, unsigned char *out);
+void grg_decode64_init (struct grg_b64_state *state);
+long grg_decode64_update (struct grg_b64_state *state,
+			  const unsigned char *in, const long inlen,
+			  unsigned char *out);
+int grg_decode64_final (struct grg_b64_state *state);
+
 int grg_file_shred (const char *path, const int npasses);
+int grg_files_shred (const GRG_CTX gctx, const char **paths,
+		     const int npaths, const int npasses,
+		     GRG_SHRED_PROGRESS progress, void *user_data,
+		     int *results);
 
 #endif
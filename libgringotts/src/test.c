@@ -34,8 +34,14 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <poll.h>
 
 #include "libgringotts.h"
+#include "libgrg_cipher.h"
+#include "libgrg_crc.h"
+
+#include <mhash.h>
 
 #define BOH		2
 #define KO		1
@@ -165,6 +171,107 @@ static int test6()
 	return ret;
 }
 
+static void ref64 (const unsigned char *in, int len, char *out)
+{//plain base64, a bit at a time, to check the fast one against
+	static const char abc[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned long bits = 0;
+	int nbits = 0, i, o = 0;
+
+	for (i = 0; i < len; i++){
+		bits = (bits << 8) | in[i];
+		nbits += 8;
+		while (nbits >= 6){
+			nbits -= 6;
+			out[o++] = abc[(bits >> nbits) & 0x3f];
+		}
+	}
+	if (nbits)
+		out[o++] = abc[(bits << (6 - nbits)) & 0x3f];
+	while (o % 4)
+		out[o++] = '=';
+	out[o] = '\0';
+}
+
+static int testB64()
+{//base-64 against a plain coder, whole and a piece at a time, and bad input
+	unsigned char *orig, *based = NULL, *debased, *piece;
+	char *ref;
+	struct grg_b64_state st;
+	unsigned int olen;
+	long len, pos, step, n;
+	int ret = KO;
+
+	orig = grg_rnd_seq (gctx, TEST_DIM);
+	ref = (char *) malloc (TEST_DIM * 2);
+	piece = (unsigned char *) malloc (TEST_DIM * 2);
+
+	for (len = 0; len <= TEST_DIM; len = (len < 200) ? len + 1 : len * 3 + 1){
+		if (len > TEST_DIM)
+			len = TEST_DIM;
+		ref64 (orig, len, ref);
+
+		based = grg_encode64 (orig, len, &olen);
+		if (strcmp ((char *) based, ref) != 0 || olen != strlen (ref) + 1)
+			goto out;
+
+		//odd steps, so that pieces and groups never match
+		grg_encode64_init (&st);
+		for (pos = 0, n = 0, step = 1; pos < len; pos += step, step = step * 2 + 1){
+			if (step > len - pos)
+				step = len - pos;
+			n += grg_encode64_update (&st, orig + pos, step, piece + n);
+		}
+		n += grg_encode64_final (&st, piece + n);
+		if (n != (long) strlen (ref) || memcmp (piece, ref, n) != 0)
+			goto out;
+
+		if (len){
+			debased = grg_decode64 (based, -1, &olen);
+			n = (debased && olen == len && memcmp (debased, orig, len) == 0);
+			free (debased);
+			if (!n)
+				goto out;
+		}
+
+		grg_decode64_init (&st);
+		for (pos = 0, n = 0, step = 1; pos < (long) strlen (ref); pos += step, step = step * 2 + 1){
+			if (step > (long) strlen (ref) - pos)
+				step = strlen (ref) - pos;
+			n += grg_decode64_update (&st, (unsigned char *) ref + pos, step, piece + n);
+		}
+		if (grg_decode64_final (&st) != GRG_OK || n != len || memcmp (piece, orig, len) != 0)
+			goto out;
+
+		free (based);
+		based = NULL;
+		if (len == TEST_DIM)
+			break;
+	}
+
+	//a wrong character deep in a long string, where the vector code is
+	ref64 (orig, TEST_DIM, ref);
+	ref[5000] = '*';
+	if (grg_decode64 ((unsigned char *) ref, -1, NULL) != NULL)
+		goto out;
+	grg_decode64_init (&st);
+	if (grg_decode64_update (&st, (unsigned char *) ref, strlen (ref), piece) != GRG_ARGUMENT_ERR)
+		goto out;
+	//and data after the padding
+	grg_decode64_init (&st);
+	if (grg_decode64_update (&st, (unsigned char *) "QQ==QUFB", 8, piece) != GRG_ARGUMENT_ERR)
+		goto out;
+
+	ret = OK;
+
+out:
+	free (based);
+	free (orig);
+	free (ref);
+	free (piece);
+	return ret;
+}
+
 static int test7()
 {//random number generator functions
 	char r1, r2, r3;
@@ -201,6 +308,75 @@ static int test7()
 	return ret;
 }
 
+static int testR()
+{//buffered random generator: across refills, big requests, paranoia mode
+	unsigned char seen[256], *rs1, *rs2, small[16];
+	int i, distinct = 0, ret = OK;
+
+	memset (seen, 0, sizeof (seen));
+	for (i = 0; i < 4 * TEST_DIM; i++)
+		seen[grg_rnd_chr (gctx)] = 1;
+	for (i = 0; i < 256; i++)
+		distinct += seen[i];
+	if (distinct < 250)
+		return KO;
+
+	rs1 = grg_rnd_seq (gctx, 10 * TEST_DIM);
+	rs2 = grg_rnd_seq (gctx, 10 * TEST_DIM);
+	if (memcmp (rs1, rs2, 10 * TEST_DIM) == 0 ||
+		memcmp (rs1, rs1 + 5 * TEST_DIM, 5 * TEST_DIM) == 0)
+		ret = KO;
+	free (rs1);
+	free (rs2);
+
+	grg_ctx_set_security_lvl (gctx, GRG_SEC_PARANOIA);
+	memset (small, 0, sizeof (small));
+	grg_rnd_seq_direct (gctx, small, sizeof (small));
+	grg_ctx_set_security_lvl (gctx, GRG_SEC_NORMAL);
+	for (i = 0; i < (int) sizeof (small) && small[i] == 0; i++);
+	if (i == sizeof (small))
+		ret = KO;
+
+	return ret;
+}
+
+static int testU()
+{//built-in CRC32: the check value, and agreement with libmhash
+	static const unsigned char check[4] = { 0x18, 0x19, 0x89, 0xfc };
+	unsigned char *data, CRC[4], *CRC2;
+	long lens[] = { 0, 1, 15, 64, 255, 256, 1000, 3 * TEST_DIM + 5 };
+	uint32_t reg;
+	MHASH td;
+	int i, ret = OK;
+
+	grg_crc32 ((unsigned char *) "123456789", 9, CRC);
+	if (memcmp (CRC, check, 4) != 0)
+		return KO;
+
+	data = grg_rnd_seq (gctx, 3 * TEST_DIM + 5);
+
+	for (i = 0; i < (int) (sizeof (lens) / sizeof (long)); i++)
+	{
+		td = mhash_init (MHASH_CRC32);
+		mhash (td, data, lens[i]);
+		CRC2 = mhash_end (td);
+
+		//in two parts, at an odd place
+		reg = grg_crc32_update (GRG_CRC32_INIT, data, lens[i] / 3);
+		reg = grg_crc32_update (reg, data + lens[i] / 3,
+					lens[i] - lens[i] / 3);
+		grg_crc32_final (reg, CRC);
+
+		if (memcmp (CRC, CRC2, 4) != 0)
+			ret = KO;
+		free (CRC2);
+	}
+
+	free (data);
+
+	return ret;
+}
+
 static int test8()
 {//free-ers [not properly tested]
 	char *mem = (char *) malloc (TEST_DIM);
@@ -216,6 +392,115 @@ static int test8()
 	return OK;
 }
 
+static void *countAlloc (void *user_data, const long dim)
+{
+	((long *) user_data)[0]++;
+	return malloc (dim);
+}
+
+static void countFree (void *user_data, void *data, const long dim)
+{
+	((long *) user_data)[1]++;
+	free (data);
+}
+
+static int testY()
+{//allocator hooks, and the secure arena
+	long calls[2] = { 0, 0 }, used;
+	struct grg_allocator counting = { countAlloc, countFree, calls };
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2, *big;
+	void *mem;
+	long memDim, dim;
+	GRG_KEY k;
+	int ret;
+
+	grg_set_allocator (&counting);
+	k = grg_key_gen ("arena", -1);
+	ret = grg_encrypt_mem (gctx, k, &mem, &memDim, data, TEST_DIM);
+	grg_key_free (gctx, k);
+	grg_set_allocator (NULL);
+	if (ret < 0 || !calls[0] || calls[0] != calls[1])
+		return KO;
+	free (mem);
+
+	ret = grg_secure_arena_init (64 * 1024);
+	if (ret == GRG_MEM_LOCK_ERR){
+		free (data);
+		return BOH;
+	}
+	if (ret < 0 || grg_secure_arena_used ())
+		return KO;
+
+	k = grg_key_gen ("arena", -1);
+	used = grg_secure_arena_used ();
+	if (!used)
+		return KO;
+
+	//a freed block is reused, and too big ones go elsewhere
+	big = grg_secure_alloc (64 * 1024);
+	grg_key_free (gctx, k);
+	k = grg_key_gen ("arena", -1);
+	if (!big || grg_secure_arena_used () != used)
+		return KO;
+	grg_secure_free (gctx, big, 64 * 1024);
+
+	ret = grg_encrypt_mem (gctx, k, &mem, &memDim, data, TEST_DIM);
+	if (ret < 0)
+		return ret;
+	ret = grg_decrypt_mem (gctx, k, mem, memDim, &data2, &dim);
+	free (mem);
+	if (ret < 0)
+		return ret;
+	ret = (dim != TEST_DIM || memcmp (data, data2, TEST_DIM));
+	free (data);
+	free (data2);
+	grg_key_free (gctx, k);
+	if (ret)
+		return KO;
+
+	grg_secure_arena_reset ();
+	if (grg_secure_arena_used ())
+		return KO;
+	grg_secure_arena_free ();
+
+	return OK;
+}
+
+static int testS()
+{//wipe modes, and the counter of the wiped bytes
+	unsigned char mem[3 * TEST_DIM], orig[3 * TEST_DIM];
+	long long before = grg_ctx_get_wiped_bytes (gctx);
+	int i, ret = OK;
+
+	memset (orig, 'x', sizeof (orig));
+
+	memcpy (mem, orig, sizeof (mem));
+	grg_ctx_set_wipe_mode (gctx, GRG_WIPE_ZERO);
+	grg_wipe (gctx, mem, sizeof (mem));
+	for (i = 0; i < (int) sizeof (mem); i++)
+		if (mem[i] != 0)
+			ret = KO;
+
+	memcpy (mem, orig, sizeof (mem));
+	grg_ctx_set_wipe_mode (gctx, GRG_WIPE_PATTERN);
+	if (grg_ctx_get_wipe_mode (gctx) != GRG_WIPE_PATTERN)
+		ret = KO;
+	grg_wipe (gctx, mem, sizeof (mem));
+	if (memcmp (mem, orig, sizeof (mem)) == 0)
+		ret = KO;
+
+	memcpy (mem, orig, sizeof (mem));
+	grg_ctx_set_wipe_mode (gctx, GRG_WIPE_RANDOM);
+	grg_wipe (gctx, mem, sizeof (mem));
+	if (memcmp (mem, orig, sizeof (mem)) == 0)
+		ret = KO;
+
+	if (grg_ctx_get_wiped_bytes (gctx) - before != (long long) (3 * sizeof (mem)))
+		ret = KO;
+
+	return ret;
+}
+
 static int test9()
 {//file wiping utility [not properly tested]
 	char name[]="/tmp/libgrg-tmp-XXXXXX";
@@ -235,6 +520,77 @@ static int test9()
 	return KO;
 }
 
+static long long shred_done, shred_total;
+static int shred_calls;
+
+static int shred_progress (void *user_data, const long long done, const long long total)
+{
+	if (done < shred_done || done > total)
+		shred_calls = -1000;
+	shred_done = done;
+	shred_total = total;
+	shred_calls++;
+	return *((int *) user_data);
+}
+
+static int testShred()
+{//wiping of many files at once, progress and cancellation
+	char names[3][23];
+	const char *paths[3];
+	long dims[3] = {0, 5000, 3 * 1024 * 1024 + 7};
+	int results[3], stop = 0, ret = OK, i, fd;
+	unsigned char *data = malloc (dims[2]);
+
+	if (!data)
+		return KO;
+	memset (data, 'a', dims[2]);
+
+	for (i = 0; i < 3; i++)
+	{
+		strcpy (names[i], "/tmp/libgrg-tmp-XXXXXX");
+		fd = mkstemp (names[i]);
+		if (fd < 0)
+			return KO;
+		write (fd, data, dims[i]);
+		close (fd);
+		paths[i] = names[i];
+	}
+
+	shred_done = shred_calls = 0;
+	if (grg_files_shred (gctx, paths, 3, 2, shred_progress, &stop, results) != GRG_OK)
+		ret = KO;
+	for (i = 0; i < 3; i++)
+		if (results[i] != GRG_OK || access (names[i], F_OK) == 0)
+			ret = KO;
+	if (shred_calls < 1 || shred_total != 2 * (dims[1] + dims[2]) ||
+	    shred_done != shred_total)
+		ret = KO;
+
+	//a file that isn't there doesn't stop the others
+	strcpy (names[0], "/tmp/libgrg-tmp-XXXXXX");
+	fd = mkstemp (names[0]);
+	write (fd, data, dims[1]);
+	close (fd);
+	paths[1] = "/tmp/libgrg-does-not-exist";
+	if (grg_files_shred (gctx, paths, 2, 1, NULL, NULL, results) != GRG_SHRED_CANT_OPEN_FILE ||
+	    results[0] != GRG_OK || results[1] != GRG_SHRED_CANT_OPEN_FILE ||
+	    access (names[0], F_OK) == 0)
+		ret = KO;
+
+	//the callback is called at least at the end, so this is always cancelled
+	strcpy (names[0], "/tmp/libgrg-tmp-XXXXXX");
+	fd = mkstemp (names[0]);
+	write (fd, data, dims[2]);
+	close (fd);
+	stop = 1;
+	if (grg_files_shred (gctx, paths, 1, 8, shred_progress, &stop, NULL) != GRG_SHRED_CANCELLED)
+		ret = KO;
+	unlink (names[0]);
+
+	free (data);
+	return ret;
+}
+
 static int testA()
 {//password quality, string pwd
 	#define PWD1 "aaaaab"
@@ -331,6 +687,65 @@ static int testD()
 	return OK;
 }
 
+static int testTmp()
+{//appends, ranges rewritten and read at any offset
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *back;
+	GRG_TMPFILE tf = grg_tmpfile_gen (gctx);
+	long piece, pos, got;
+	int ret = OK;
+
+	if (!tf || !data)
+		return KO;
+
+	back = malloc (TEST_DIM);
+
+	//uneven pieces, so that they cross the blocks of the keystream
+	for (pos = 0, piece = 1; pos < TEST_DIM; pos += piece, piece = piece * 3 + 7)
+		if (grg_tmpfile_append (gctx, tf, data + pos,
+					(TEST_DIM - pos < piece) ? TEST_DIM - pos : piece) < 0)
+			ret = KO;
+	if (grg_tmpfile_size (tf) != TEST_DIM)
+		ret = KO;
+
+	memset (data + 1000, 'x', 5003);
+	if (grg_tmpfile_pwrite (gctx, tf, data + 1000, 5003, 1000) < 0 ||
+	    grg_tmpfile_pwrite (gctx, tf, data, 10, TEST_DIM + 1) != GRG_ARGUMENT_ERR)
+		ret = KO;
+
+	//a pwrite at the very end extends the file, and so does one that
+	//rewrites its last bytes and goes past them
+	if (grg_tmpfile_pwrite (gctx, tf, data, 10, TEST_DIM) < 0 ||
+	    grg_tmpfile_size (tf) != TEST_DIM + 10 ||
+	    grg_tmpfile_pwrite (gctx, tf, data, 12, TEST_DIM) < 0 ||
+	    grg_tmpfile_size (tf) != TEST_DIM + 12)
+		ret = KO;
+
+	//the same range, rewritten many times, across the blocks
+	for (piece = 0; piece < 5; piece++)
+	{
+		memset (data + 4000, 'a' + piece, 300);
+		if (grg_tmpfile_pwrite (gctx, tf, data + 4000, 300, 4000) < 0)
+			ret = KO;
+	}
+
+	got = grg_tmpfile_pread (gctx, tf, back, TEST_DIM, 0);
+	if (got != TEST_DIM || memcmp (back, data, TEST_DIM))
+		ret = KO;
+	got = grg_tmpfile_pread (gctx, tf, back, 100, 3333);
+	if (got != 100 || memcmp (back, data + 3333, 100))
+		ret = KO;
+	got = grg_tmpfile_pread (gctx, tf, back, 100, TEST_DIM + 5);
+	if (got != 7 || memcmp (back, data + 5, 7))
+		ret = KO;
+	if (grg_tmpfile_pread (gctx, tf, back, 100, TEST_DIM + 12) != 0)
+		ret = KO;
+
+	grg_tmpfile_close (gctx, tf);
+	free (data);
+	free (back);
+	return ret;
+}
+
 static int testE()
 {//data encoding and decoding in memory
 	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2;
@@ -421,6 +836,72 @@ static int testG()
 	return rval;
 }
 
+static void aioDone (void *user_data, const int ret)
+{
+	int *calls = (int *) user_data;
+
+	calls[0]++;
+	calls[1] = ret;
+}
+
+static int testW()
+{//asynchronous encryption to files, seekable and in append mode
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2;
+	char name[]="/tmp/libgrg-tmp-XXXXXX";
+	int fd, ret, pass, calls[2];
+	long ffdim;
+	struct pollfd pfd;
+	GRG_AIO aio;
+
+	for (pass = 0; pass < 2; pass++){
+		fd = mkstemp (name);
+		if (fd < 0)
+			return KO;
+		if (pass){
+			close (fd);
+			fd = open (name, O_WRONLY | O_APPEND);
+		}
+
+		calls[0] = 0;
+		ret=grg_encrypt_file_async(gctx, key, fd, data, TEST_DIM, aioDone, calls, &aio);
+		if (ret < 0){
+			free (data);
+			return ret;
+		}
+
+		pfd.fd = grg_aio_fd (aio);
+		pfd.events = POLLIN;
+		if (poll (&pfd, 1, 10000) != 1 || !(pfd.revents & POLLIN))
+			return KO;
+		ret = grg_aio_wait (aio);
+		if (ret < 0 || calls[0] != 1 || calls[1] != GRG_OK)
+			return KO;
+		//the offset is left after the data
+		if (lseek (fd, 0, SEEK_CUR) != lseek (fd, 0, SEEK_END))
+			return KO;
+		close (fd);
+
+		fd = open (name, O_RDONLY);
+		ret=grg_decrypt_file_direct(gctx, key, fd, &data2, &ffdim);
+		close (fd);
+		unlink (name);
+		strcpy (name, "/tmp/libgrg-tmp-XXXXXX");
+		if (ret < 0){
+			free (data);
+			return ret;
+		}
+		ret = (ffdim != TEST_DIM || memcmp (data, data2, TEST_DIM) != 0);
+		free (data2);
+		if (ret){
+			free (data);
+			return KO;
+		}
+	}
+
+	free (data);
+	return OK;
+}
+
 static int testH()
 {//data validating in files (direct variant)
 	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM);
@@ -506,6 +987,481 @@ static int testL()
 	return OK;
 }
 
+static int testP()
+{//copy-free decoding into a caller-supplied buffer
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2 = NULL;
+	void *stone = NULL;
+	GRG_KEY key2 = grg_key_gen ("wrong", -1);
+	int ret, rval = KO;
+	long fdim, ffdim, size;
+
+	ret = grg_encrypt_mem (gctx, key, &stone, &fdim, data, TEST_DIM);
+	if (ret < 0)
+		goto out;
+
+	ret = grg_decrypted_size (gctx, key, stone, fdim, &size);
+	if (ret < 0)
+		goto out;
+	if (size != TEST_DIM)
+		goto out;
+
+	data2 = (unsigned char *) malloc (size + 1);
+	//a wrong password isn't taken for a too small buffer
+	ret = grg_decrypted_size (gctx, key2, stone, fdim, &ffdim);
+	if (ret != GRG_READ_PWD_ERR)
+		goto out;
+	ret = grg_decrypt_mem_into (gctx, key2, stone, fdim, data2, size + 1, &ffdim);
+	if (ret != GRG_READ_PWD_ERR)
+		goto out;
+	//a too small buffer must be refused, without touching the data
+	ret = grg_decrypt_mem_into (gctx, key, stone, fdim, data2, size, &ffdim);
+	if (ret != GRG_ARGUMENT_ERR)
+		goto out;
+	ret = grg_decrypt_mem_into (gctx, key, stone, fdim, data2, size + 1, &ffdim);
+	if (ret < 0)
+		goto out;
+
+	if (ffdim == TEST_DIM && memcmp (data, data2, TEST_DIM) == 0 &&
+		data2[TEST_DIM] == '\0')
+		rval = OK;
+
+out:
+	grg_key_free (gctx, key2);
+	free (data);
+	free (data2);
+	free (stone);
+	return (ret < 0) ? ret : rval;
+}
+
+static int testZ()
+{//scatter-gather encoding and decoding, with pieces across the chunks
+	static const long in_cut[] = { 1, 0, 999, 3000, 17, TEST_DIM - 4017 };
+	static const long out_cut[] = { 7, 2500, 0, 1493, TEST_DIM - 4001, 1 };
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2 = NULL;
+	unsigned char *data3 = (unsigned char *) malloc (TEST_DIM);
+	char name[]="/tmp/libgrg-tmp-XXXXXX";
+	struct iovec in[6], out[6];
+	void *stone = NULL;
+	int ret, rval = KO, i, fd;
+	long fdim, ffdim, pos;
+
+	for (i = 0, pos = 0; i < 6; pos += in_cut[i++]){
+		in[i].iov_base = data + pos;
+		in[i].iov_len = in_cut[i];
+	}
+	for (i = 0, pos = 0; i < 6; pos += out_cut[i++]){
+		out[i].iov_base = data3 + pos;
+		out[i].iov_len = out_cut[i];
+	}
+
+	ret = grg_encrypt_iov (gctx, key, &stone, &fdim, in, 6);
+	if (ret < 0)
+		goto out;
+
+	ret = grg_decrypt_mem (gctx, key, stone, fdim, &data2, &ffdim);
+	if (ret < 0)
+		goto out;
+	if (ffdim != TEST_DIM || memcmp (data, data2, TEST_DIM) != 0)
+		goto out;
+
+	//pieces too small must be refused, without touching the data
+	ret = grg_decrypt_to_iov (gctx, key, stone, fdim, out, 5, &ffdim);
+	if (ret != GRG_ARGUMENT_ERR)
+		goto out;
+	ret = grg_decrypt_to_iov (gctx, key, stone, fdim, out, 6, &ffdim);
+	if (ret < 0)
+		goto out;
+	if (ffdim != TEST_DIM || memcmp (data, data3, TEST_DIM) != 0)
+		goto out;
+
+	//to a file, and back
+	fd = mkstemp (name);
+	close (fd);
+	ret = grg_encrypt_file_iov (gctx, key, name, in, 6);
+	if (ret < 0)
+		goto out;
+	free (data2);
+	ret = grg_decrypt_file (gctx, key, name, &data2, &ffdim);
+	unlink (name);
+	if (ret < 0)
+		goto out;
+
+	if (ffdim == TEST_DIM && memcmp (data, data2, TEST_DIM) == 0)
+		rval = OK;
+
+out:
+	free (data);
+	free (data2);
+	free (data3);
+	free (stone);
+	return (ret < 0) ? ret : rval;
+}
+
+static int testT()
+{//cipher backends: a NIST CFB8-AES256 vector, and agreement with libmcrypt
+	static const unsigned char kkey[32] = {
+		0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe,
+		0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+		0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7,
+		0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4 };
+	static const unsigned char kiv[16] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+	static const unsigned char kpt[18] = {
+		0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9,
+		0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a, 0xae, 0x2d };
+	static const unsigned char kct[18] = {
+		0xdc, 0x1f, 0x1a, 0x85, 0x20, 0xa6, 0x4d, 0xb5, 0x5f,
+		0xcc, 0x8a, 0xc5, 0x54, 0x84, 0x4e, 0x88, 0x97, 0x00 };
+	unsigned char kbuf[18], *plain, *ref, *buf;
+	long dim = 3 * TEST_DIM + 7;
+	GRG_CIPHER c;
+	int b, ret = OK;
+
+	plain = grg_rnd_seq (gctx, dim);
+	ref = (unsigned char *) malloc (dim);
+	buf = (unsigned char *) malloc (dim);
+
+	c = grg_cipher_open_backend (GRG_CIPHER_MCRYPT, GRG_RIJNDAEL_128,
+				     kkey, 32, kiv);
+	memcpy (ref, plain, dim);
+	grg_cipher_encrypt (c, ref, dim);
+	grg_cipher_close (c);
+
+	//the backends not supported by this CPU are skipped
+	for (b = GRG_CIPHER_MCRYPT; b <= GRG_CIPHER_VAES; b++)
+	{
+		c = grg_cipher_open_backend (b, GRG_RIJNDAEL_128, kkey, 32, kiv);
+		if (!c)
+			continue;
+		memcpy (kbuf, kpt, 18);
+		grg_cipher_encrypt (c, kbuf, 5);
+		grg_cipher_encrypt (c, kbuf + 5, 13);
+		grg_cipher_close (c);
+		if (memcmp (kbuf, kct, 18) != 0)
+			ret = KO;
+
+		c = grg_cipher_open_backend (b, GRG_RIJNDAEL_128, kkey, 32, kiv);
+		grg_cipher_decrypt (c, kbuf, 18);
+		grg_cipher_close (c);
+		if (memcmp (kbuf, kpt, 18) != 0)
+			ret = KO;
+
+		c = grg_cipher_open_backend (b, GRG_RIJNDAEL_128, kkey, 32, kiv);
+		memcpy (buf, plain, dim);
+		grg_cipher_encrypt (c, buf, dim);
+		grg_cipher_close (c);
+		if (memcmp (buf, ref, dim) != 0)
+			ret = KO;
+
+		c = grg_cipher_open_backend (b, GRG_RIJNDAEL_128, kkey, 32, kiv);
+		grg_cipher_decrypt (c, buf, 1000);
+		grg_cipher_decrypt (c, buf + 1000, 3);
+		grg_cipher_decrypt (c, buf + 1003, dim - 1003);
+		grg_cipher_close (c);
+		if (memcmp (buf, plain, dim) != 0)
+			ret = KO;
+	}
+
+	free (plain);
+	free (ref);
+	free (buf);
+
+	return ret;
+}
+
+static void to_version3 (unsigned char *stone, long *fdim)
+{//strips the key check value off version 4 data
+	memmove (stone + 9, stone + 13, *fdim - 13);
+	*fdim -= 4;
+	stone[3] = '3';
+	grg_crc32 (stone + 8, *fdim - 8, stone + 4);
+}
+
+static int testQ()
+{//chunked specifics: format, chunk size, corruption, wrong password
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2 = NULL;
+	void *stone = NULL;
+	GRG_KEY key2 = grg_key_gen ("wrong", -1);
+	struct grg_stats before, after;
+	int ret, rval = KO;
+	long fdim, ffdim;
+
+	ret = grg_encrypt_mem (gctx, key, &stone, &fdim, data, TEST_DIM);
+	if (ret < 0)
+		goto out;
+	if (((unsigned char *) stone)[3] != '5')
+		goto out;
+
+	//the chunk size is read back from the data
+	grg_ctx_set_chunk_size (gctx, 0);
+	ret = grg_update_gctx_from_mem (gctx, stone, fdim);
+	if (ret < 0)
+		goto out;
+	if (grg_ctx_get_chunk_size (gctx) != 1000)
+		goto out;
+
+	//a wrong password decrypts nothing but the key check value
+	grg_get_stats (gctx, &before);
+	ret = grg_decrypt_mem (gctx, key2, stone, fdim, &data2, &ffdim);
+	if (ret != GRG_READ_PWD_ERR)
+		goto out;
+	grg_get_stats (gctx, &after);
+	if (after.bytes_decrypted != before.bytes_decrypted)
+		goto out;
+
+	ret = grg_decrypted_size (gctx, key2, stone, fdim, &ffdim);
+	if (ret != GRG_READ_PWD_ERR)
+		goto out;
+	ret = grg_decrypt_mem (gctx, key, stone, fdim, &data2, &ffdim);
+	if (ret < 0)
+		goto out;
+	if (ffdim != TEST_DIM || memcmp (data, data2, TEST_DIM))
+		goto out;
+	free (data2);
+	data2 = NULL;
+
+	((unsigned char *) stone)[fdim - 1] ^= 0x01;
+	ret = grg_validate_mem (gctx, stone, fdim);
+	if (ret != GRG_READ_CRC_ERR)
+		goto out;
+	free (stone);
+	stone = NULL;
+
+	//no data at all still make one (empty) chunk
+	ret = grg_encrypt_mem (gctx, key, &stone, &fdim, data, 0);
+	if (ret < 0)
+		goto out;
+	ret = grg_decrypt_mem (gctx, key, stone, fdim, &data2, &ffdim);
+	if (ret < 0)
+		goto out;
+
+	if (ffdim == 0)
+		rval = OK;
+
+out:
+	grg_key_free (gctx, key2);
+	free (data);
+	free (data2);
+	free (stone);
+	return (ret < 0) ? ret : rval;
+}
+
+static int testKcv()
+{//version 4 specifics: the password is checked before decrypting
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2 = NULL;
+	void *stone = NULL;
+	GRG_KEY key2 = grg_key_gen ("wrong", -1);
+	struct grg_stats before, after;
+	int ret, rval = KO;
+	long fdim, ffdim;
+
+	ret = grg_encrypt_mem (gctx, key, &stone, &fdim, data, TEST_DIM);
+	if (ret < 0)
+		goto out;
+	if (((unsigned char *) stone)[3] != '4')
+		goto out;
+
+	//a wrong password decrypts nothing but the key check value
+	grg_get_stats (gctx, &before);
+	ret = grg_decrypt_mem (gctx, key2, stone, fdim, &data2, &ffdim);
+	if (ret != GRG_READ_PWD_ERR)
+		goto out;
+	ret = grg_decrypted_size (gctx, key2, stone, fdim, &ffdim);
+	if (ret != GRG_READ_PWD_ERR)
+		goto out;
+	grg_get_stats (gctx, &after);
+	if (after.bytes_decrypted != before.bytes_decrypted)
+		goto out;
+
+	ret = grg_decrypted_size (gctx, key, stone, fdim, &ffdim);
+	if (ret < 0 || ffdim != TEST_DIM)
+		goto out;
+	ret = grg_decrypt_mem (gctx, key, stone, fdim, &data2, &ffdim);
+	if (ret < 0 || ffdim != TEST_DIM || memcmp (data, data2, TEST_DIM))
+		goto out;
+
+	//the outer CRC32 covers the key check value
+	((unsigned char *) stone)[9] ^= 0x01;
+	ret = grg_validate_mem (gctx, stone, fdim);
+	if (ret == GRG_READ_CRC_ERR)
+		rval = OK;
+
+out:
+	grg_key_free (gctx, key2);
+	free (data);
+	free (data2);
+	free (stone);
+	return (ret < 0 && ret != GRG_READ_CRC_ERR) ? ret : rval;
+}
+
+static int testV3()
+{//version 3 data: a wrong password is told by DATA_LEN alone
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2 = NULL;
+	void *stone = NULL;
+	GRG_KEY key2 = grg_key_gen ("wrong", -1);
+	grg_comp_ratio ratio = grg_ctx_get_comp_ratio (gctx);
+	int ret, rval = KO;
+	long fdim, ffdim;
+
+	//without compression DATA_LEN must match the data, so that the
+	//odds of a wrong password passing are TEST_DIM in 4 billions
+	grg_ctx_set_comp_ratio (gctx, GRG_LVL_NONE);
+	ret = grg_encrypt_mem (gctx, key, &stone, &fdim, data, TEST_DIM);
+	grg_ctx_set_comp_ratio (gctx, ratio);
+	if (ret < 0)
+		goto out;
+	to_version3 (stone, &fdim);
+
+	ret = grg_validate_mem (gctx, stone, fdim);
+	if (ret < 0)
+		goto out;
+
+	data2 = (unsigned char *) malloc (TEST_DIM + 1);
+	ret = grg_decrypted_size (gctx, key2, stone, fdim, &ffdim);
+	if (ret != GRG_READ_PWD_ERR)
+		goto out;
+	ret = grg_decrypt_mem_into (gctx, key2, stone, fdim, data2,
+				    TEST_DIM + 1, &ffdim);
+	if (ret != GRG_READ_PWD_ERR)
+		goto out;
+
+	ret = grg_decrypt_mem_into (gctx, key, stone, fdim, data2,
+				    TEST_DIM + 1, &ffdim);
+	if (ret < 0)
+		goto out;
+	if (ffdim == TEST_DIM && memcmp (data, data2, TEST_DIM) == 0)
+		rval = OK;
+
+out:
+	grg_ctx_set_comp_ratio (gctx, ratio);
+	grg_key_free (gctx, key2);
+	free (data);
+	free (data2);
+	free (stone);
+	return (ret < 0) ? ret : rval;
+}
+
+#define TRACE_STAGES	(GRG_STAGE_SHRED + 1)
+
+static long trace_begins[TRACE_STAGES], trace_ends[TRACE_STAGES];
+static long long trace_last[TRACE_STAGES];
+
+static void trace_stage (void *user_data, const grg_trace_stage stage,
+			 const grg_trace_event event, const long long bytes)
+{//called by many threads, with the chunks
+	if (event == GRG_TRACE_BEGIN)
+		__sync_fetch_and_add (&trace_begins[stage], 1);
+	else {
+		__sync_fetch_and_add (&trace_ends[stage], 1);
+		trace_last[stage] = bytes;
+	}
+}
+
+static int testTrace()
+{//begin and end events of each stage, and no more once unset
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2 = NULL;
+	GRG_KEY key2 = grg_key_gen ("another one", -1);
+	GRG_TMPFILE tf;
+	void *stone = NULL;
+	long fdim, ffdim, total;
+	int i, ret = OK;
+
+	grg_ctx_set_chunk_size (gctx, 1000);
+	grg_ctx_set_threads (gctx, 4);
+	grg_set_trace_callback (gctx, trace_stage, NULL);
+
+	if (grg_encrypt_mem (gctx, key, &stone, &fdim, data, TEST_DIM) < 0 ||
+	    trace_last[GRG_STAGE_ENCRYPT] != fdim)
+		ret = KO;
+	if (grg_decrypt_mem (gctx, key, stone, fdim, &data2, &ffdim) < 0 ||
+	    trace_last[GRG_STAGE_DECRYPT] != TEST_DIM)
+		ret = KO;
+	//the errors come at the end of the stage
+	if (grg_decrypt_mem (gctx, key2, stone, fdim, &data2, &ffdim) != GRG_READ_PWD_ERR ||
+	    trace_last[GRG_STAGE_DECRYPT] != GRG_READ_PWD_ERR)
+		ret = KO;
+
+	tf = grg_tmpfile_gen (gctx);
+	if (!tf || grg_tmpfile_append (gctx, tf, data, TEST_DIM) < 0 ||
+	    grg_tmpfile_pread (gctx, tf, data, 100, 50) != 100 ||
+	    trace_last[GRG_STAGE_TMP_WRITE] != TEST_DIM ||
+	    trace_last[GRG_STAGE_TMP_READ] != 100)
+		ret = KO;
+	grg_tmpfile_close (gctx, tf);
+
+	//a compression, a block encryption... for each of the 11 chunks
+	if (trace_ends[GRG_STAGE_COMPRESS] != 11 || trace_ends[GRG_STAGE_CIPHER] < 22 ||
+	    trace_ends[GRG_STAGE_UNCOMPRESS] != 11 || trace_ends[GRG_STAGE_CRC] < 11 ||
+	    trace_ends[GRG_STAGE_VALIDATE] != 2 || !trace_ends[GRG_STAGE_WIPE])
+		ret = KO;
+	for (i = 0; i < TRACE_STAGES; i++)
+		if (trace_begins[i] != trace_ends[i])
+			ret = KO;
+
+	grg_set_trace_callback (gctx, NULL, NULL);
+	for (i = 0, total = 0; i < TRACE_STAGES; i++)
+		total += trace_ends[i];
+	free (stone);
+	stone = NULL;
+	if (grg_encrypt_mem (gctx, key, &stone, &fdim, data, TEST_DIM) < 0)
+		ret = KO;
+	for (i = 0; i < TRACE_STAGES; i++)
+		total -= trace_ends[i];
+	if (total)
+		ret = KO;
+
+	grg_ctx_set_threads (gctx, 1);
+	grg_ctx_set_chunk_size (gctx, 0);
+	grg_key_free (gctx, key2);
+	free (data);
+	free (data2);
+	free (stone);
+	return ret;
+}
+
+static int testStats()
+{//counters of the work done with the context
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2 = NULL;
+	struct grg_stats before, after;
+	GRG_TMPFILE tf;
+	void *stone = NULL;
+	long fdim, ffdim;
+	int ret = OK;
+
+	if (grg_get_stats (NULL, &before) != GRG_ARGUMENT_ERR ||
+	    grg_get_stats (gctx, NULL) != GRG_ARGUMENT_ERR ||
+	    grg_get_stats (gctx, &before) != GRG_OK)
+		ret = KO;
+
+	if (grg_encrypt_mem (gctx, key, &stone, &fdim, data, TEST_DIM) < 0 ||
+	    grg_decrypt_mem (gctx, key, stone, fdim, &data2, &ffdim) < 0)
+		ret = KO;
+	tf = grg_tmpfile_gen (gctx);
+	if (!tf || grg_tmpfile_append (gctx, tf, data, TEST_DIM) < 0 ||
+	    grg_tmpfile_pread (gctx, tf, data, 100, 50) != 100)
+		ret = KO;
+	grg_tmpfile_close (gctx, tf);
+
+	grg_get_stats (gctx, &after);
+	if (after.bytes_compressed - before.bytes_compressed != TEST_DIM ||
+	    after.bytes_uncompressed - before.bytes_uncompressed != TEST_DIM ||
+	    after.bytes_encrypted - before.bytes_encrypted < TEST_DIM ||
+	    after.bytes_decrypted - before.bytes_decrypted < TEST_DIM ||
+	    after.bytes_crc - before.bytes_crc < 2 * (long long) fdim ||
+	    after.bytes_random - before.bytes_random < grg_get_block_size (gctx) ||
+	    after.bytes_wiped == before.bytes_wiped ||
+	    after.allocs - before.allocs < 3 ||
+	    after.alloc_max < TEST_DIM + 1 ||
+	    after.syscalls - before.syscalls < 2)
+		ret = KO;
+
+	free (data);
+	free (data2);
+	free (stone);
+	return ret;
+}
+
 #define TEST_STRING "TEST_STRING"
 #define TEST_STRING_DIM 11
 #define ENC_STRING "VFNUM/Q2e5UfEC+5qi4MGcgHx6MYh8BLY0OjeYVq6sN8db1Hg15ZmxOUu5JN1yg2R7XBYRLvI1/eSTXUQ4dbLub+yIc2QU5TQ2TskJJHrg=="
@@ -535,6 +1491,628 @@ static int testM()
 	return rval;
 }
 
+typedef struct
+{
+	unsigned char *data;
+	long dim;
+}
+MEM_SINK;
+
+static int memSink (void *user_data, const unsigned char *data, const long dim)
+{//a GRG_STREAM_SINK that collects everything in memory
+	MEM_SINK *ms = (MEM_SINK *) user_data;
+	unsigned char *tmp = (unsigned char *) realloc (ms->data, ms->dim + dim);
+
+	if (!tmp)
+		return GRG_MEM_ALLOCATION_ERR;
+	memcpy (tmp + ms->dim, data, dim);
+	ms->data = tmp;
+	ms->dim += dim;
+	return GRG_OK;
+}
+
+#define STREAM_DIM	(TEST_DIM * 20)
+#define STREAM_STEP	1000
+
+static int testN()
+{//streaming encryption and decryption
+	unsigned char *data = grg_rnd_seq (gctx, STREAM_DIM), *data2 = NULL;
+	MEM_SINK enc = {NULL, 0}, dec = {NULL, 0};
+	GRG_STREAM gs;
+	GRG_KEY key2;
+	void *stone = NULL;
+	long i, fdim, ffdim;
+	int ret, rval = KO;
+
+	//encrypted by a stream, decrypted in memory
+	gs = grg_stream_encrypt_init (gctx, key, memSink, &enc);
+	if (!gs)
+		return KO;
+	for (i = 0, ret = GRG_OK; i < STREAM_DIM && ret == GRG_OK; i += STREAM_STEP)
+		ret = grg_stream_encrypt_update (gs, data + i,
+			(STREAM_DIM - i < STREAM_STEP) ? STREAM_DIM - i : STREAM_STEP);
+	if (ret == GRG_OK)
+		ret = grg_stream_encrypt_final (gs);
+	grg_stream_close (gctx, gs);
+	if (ret < 0)
+		goto out;
+
+	ret = grg_decrypt_mem (gctx, key, enc.data, enc.dim, &data2, &ffdim);
+	if (ret < 0)
+		goto out;
+	if (ffdim != STREAM_DIM || memcmp (data, data2, STREAM_DIM) != 0)
+		goto out;
+
+	//encrypted in memory, decrypted by a stream fed in small chunks
+	ret = grg_encrypt_mem (gctx, key, &stone, &fdim, data, STREAM_DIM);
+	if (ret < 0)
+		goto out;
+	gs = grg_stream_decrypt_init (gctx, key, memSink, &dec);
+	if (!gs)
+		goto out;
+	for (i = 0, ret = GRG_OK; i < fdim && ret == GRG_OK; i += STREAM_STEP)
+		ret = grg_stream_decrypt_update (gs, (char *) stone + i,
+			(fdim - i < STREAM_STEP) ? fdim - i : STREAM_STEP);
+	if (ret == GRG_OK)
+		ret = grg_stream_decrypt_final (gs);
+	grg_stream_close (gctx, gs);
+	if (ret < 0)
+		goto out;
+	if (dec.dim != STREAM_DIM || memcmp (data, dec.data, STREAM_DIM) != 0)
+		goto out;
+
+	//a wrong password must be detected
+	key2 = grg_key_gen ("wrong password", -1);
+	gs = grg_stream_decrypt_init (gctx, key2, memSink, &dec);
+	ret = grg_stream_decrypt_update (gs, stone, fdim);
+	if (ret == GRG_OK)
+		ret = grg_stream_decrypt_final (gs);
+	grg_stream_close (gctx, gs);
+	grg_key_free (gctx, key2);
+	if (ret == GRG_READ_PWD_ERR)
+		rval = OK;
+
+out:
+	free (data);
+	free (data2);
+	free (stone);
+	free (enc.data);
+	free (dec.data);
+	return (ret < 0 && ret != GRG_READ_PWD_ERR) ? ret : rval;
+}
+
+static int testO()
+{//streaming encryption and decryption between file descriptors
+	unsigned char *data = grg_rnd_seq (gctx, STREAM_DIM), *data2 = NULL;
+	char name1[]="/tmp/libgrg-tmp1-XXXXXX", name2[]="/tmp/libgrg-tmp2-XXXXXX",
+		name3[]="/tmp/libgrg-tmp3-XXXXXX";
+	int fd1 = mkstemp (name1), fd2 = mkstemp (name2), fd3 = mkstemp (name3);
+	int ret, rval = KO;
+	long ffdim;
+
+	if (fd1 < 0 || fd2 < 0 || fd3 < 0)
+		return KO;
+
+	write (fd1, data, STREAM_DIM);
+	lseek (fd1, 0, SEEK_SET);
+
+	ret = grg_stream_encrypt_fd (gctx, key, fd1, fd2);
+	if (ret == GRG_OK)
+	{
+		lseek (fd2, 0, SEEK_SET);
+		ret = grg_decrypt_file_direct (gctx, key, fd2, &data2, &ffdim);
+	}
+	if (ret == GRG_OK && ffdim == STREAM_DIM &&
+		memcmp (data, data2, STREAM_DIM) == 0)
+	{
+		lseek (fd2, 0, SEEK_SET);
+		ret = grg_stream_decrypt_fd (gctx, key, fd2, fd3);
+		free (data2);
+		data2 = NULL;
+		if (ret == GRG_OK && lseek (fd3, 0, SEEK_END) == STREAM_DIM)
+		{
+			data2 = (unsigned char *) malloc (STREAM_DIM);
+			lseek (fd3, 0, SEEK_SET);
+			if (read (fd3, data2, STREAM_DIM) == STREAM_DIM &&
+				memcmp (data, data2, STREAM_DIM) == 0)
+				rval = OK;
+		}
+	}
+
+	close (fd1); unlink (name1);
+	close (fd2); unlink (name2);
+	close (fd3); unlink (name3);
+	free (data);
+	free (data2);
+	return (ret < 0) ? ret : rval;
+}
+
+#define CHUNKED_STREAM_STEP	333
+
+static int testChunkedStream()
+{//stream decryption of a chunked file: between file descriptors, in uneven
+ //pieces, with a wrong password, a damaged chunk and a truncated one
+	unsigned char *data = grg_rnd_seq (gctx, STREAM_DIM), *data2 = NULL;
+	char name1[]="/tmp/libgrg-tmp1-XXXXXX", name2[]="/tmp/libgrg-tmp2-XXXXXX";
+	int fd1 = mkstemp (name1), fd2 = mkstemp (name2);
+	MEM_SINK dec = {NULL, 0};
+	GRG_STREAM gs;
+	GRG_KEY key2 = grg_key_gen ("wrong password", -1);
+	unsigned char *stone = NULL;
+	int ret, rval = KO;
+	long i, fdim;
+
+	if (fd1 < 0 || fd2 < 0)
+		return KO;
+
+	ret = grg_encrypt_file (gctx, key, name1, data, STREAM_DIM);
+	if (ret < 0)
+		goto out;
+
+	//many chunks, and none of them is a whole number of pieces
+	fdim = lseek (fd1, 0, SEEK_END);
+	stone = (unsigned char *) malloc (fdim);
+	lseek (fd1, 0, SEEK_SET);
+	if (!stone || read (fd1, stone, fdim) != fdim || stone[3] != '5' ||
+	    fdim < 10 * CHUNKED_STREAM_STEP)
+		goto out;
+
+	lseek (fd1, 0, SEEK_SET);
+	ret = grg_stream_decrypt_fd (gctx, key, fd1, fd2);
+	if (ret < 0)
+		goto out;
+	data2 = (unsigned char *) malloc (STREAM_DIM);
+	if (lseek (fd2, 0, SEEK_END) != STREAM_DIM)
+		goto out;
+	lseek (fd2, 0, SEEK_SET);
+	if (read (fd2, data2, STREAM_DIM) != STREAM_DIM ||
+	    memcmp (data, data2, STREAM_DIM))
+		goto out;
+
+	gs = grg_stream_decrypt_init (gctx, key, memSink, &dec);
+	if (!gs)
+		goto out;
+	for (i = 0, ret = GRG_OK; i < fdim && ret == GRG_OK;
+	     i += CHUNKED_STREAM_STEP)
+		ret = grg_stream_decrypt_update (gs, stone + i,
+			(fdim - i < CHUNKED_STREAM_STEP) ? fdim - i :
+			CHUNKED_STREAM_STEP);
+	if (ret == GRG_OK)
+		ret = grg_stream_decrypt_final (gs);
+	grg_stream_close (gctx, gs);
+	if (ret < 0)
+		goto out;
+	if (dec.dim != STREAM_DIM || memcmp (data, dec.data, STREAM_DIM))
+		goto out;
+
+	//the key check value tells a wrong password before any output
+	free (dec.data);
+	dec.data = NULL;
+	dec.dim = 0;
+	gs = grg_stream_decrypt_init (gctx, key2, memSink, &dec);
+	ret = grg_stream_decrypt_update (gs, stone, fdim);
+	grg_stream_close (gctx, gs);
+	if (ret != GRG_READ_PWD_ERR || dec.dim)
+		goto out;
+
+	//a damaged chunk is told as soon as it ends
+	stone[fdim - 1] ^= 1;
+	gs = grg_stream_decrypt_init (gctx, key, memSink, &dec);
+	ret = grg_stream_decrypt_update (gs, stone, fdim);
+	grg_stream_close (gctx, gs);
+	stone[fdim - 1] ^= 1;
+	if (ret != GRG_READ_CRC_ERR)
+		goto out;
+
+	//and a truncated one at the end
+	gs = grg_stream_decrypt_init (gctx, key, memSink, &dec);
+	ret = grg_stream_decrypt_update (gs, stone, fdim - 1);
+	if (ret == GRG_OK)
+		ret = grg_stream_decrypt_final (gs);
+	grg_stream_close (gctx, gs);
+	if (ret == GRG_READ_CRC_ERR)
+		rval = OK;
+	ret = GRG_OK;
+
+out:
+	close (fd1); unlink (name1);
+	close (fd2); unlink (name2);
+	grg_key_free (gctx, key2);
+	free (data);
+	free (data2);
+	free (stone);
+	free (dec.data);
+	return (ret < 0) ? ret : rval;
+}
+
+static int testV()
+{//zstd and lz4 specifics: format, algorithm and level, compression,
+ //wrong password, streams
+	unsigned char *data = grg_rnd_seq (gctx, TEST_DIM), *data2 = NULL;
+	void *stone = NULL;
+	grg_comp_algo algo = grg_ctx_get_comp_algo (gctx);
+	GRG_KEY key2 = grg_key_gen ("wrong", -1);
+	struct grg_stats before, after;
+	int ret, rval = KO, i;
+	long fdim, ffdim;
+
+	//well compressible data
+	for (i = 256; i < TEST_DIM; i++)
+		data[i] = data[i % 256];
+
+	grg_ctx_set_comp_level (gctx, 3);
+	ret = grg_encrypt_mem (gctx, key, &stone, &fdim, data, TEST_DIM);
+	if (ret < 0)
+		goto out;
+	if (((unsigned char *) stone)[3] != '5' || fdim > TEST_DIM / 2)
+		goto out;
+
+	//the algorithm and the level are read back from the data
+	grg_ctx_set_comp_algo (gctx, GRG_ZLIB);
+	grg_ctx_set_comp_level (gctx, 0);
+	ret = grg_update_gctx_from_mem (gctx, stone, fdim);
+	if (ret < 0)
+		goto out;
+	if (grg_ctx_get_comp_algo (gctx) != algo ||
+	    grg_ctx_get_comp_level (gctx) != 3 ||
+	    grg_ctx_get_chunk_size (gctx) != 0)
+		goto out;
+
+	ret = grg_decrypt_mem (gctx, key, stone, fdim, &data2, &ffdim);
+	if (ret < 0)
+		goto out;
+	if (ffdim != TEST_DIM || memcmp (data, data2, TEST_DIM))
+		goto out;
+	free (data2);
+	data2 = NULL;
+
+	//the whole data are a single chunk, but a wrong password is told
+	//without decrypting it
+	grg_get_stats (gctx, &before);
+	ret = grg_decrypt_mem (gctx, key2, stone, fdim, &data2, &ffdim);
+	if (ret != GRG_READ_PWD_ERR)
+		goto out;
+	ret = grg_decrypted_size (gctx, key2, stone, fdim, &ffdim);
+	if (ret != GRG_READ_PWD_ERR)
+		goto out;
+	grg_get_stats (gctx, &after);
+	if (after.bytes_decrypted != before.bytes_decrypted)
+		goto out;
+
+	//the streams write version 4 data, that have no room for it
+	if (grg_stream_encrypt_init (gctx, key, memSink, NULL))
+		goto out;
+
+	//levels out of the range of the algorithm are brought into it
+	grg_ctx_set_comp_level (gctx, 127);
+	free (stone);
+	ret = grg_encrypt_mem (gctx, key, &stone, &fdim, data, TEST_DIM);
+	if (ret < 0)
+		goto out;
+	ret = grg_decrypt_mem (gctx, key, stone, fdim, &data2, &ffdim);
+	if (ret < 0)
+		goto out;
+
+	if (ffdim == TEST_DIM && !memcmp (data, data2, TEST_DIM))
+		rval = OK;
+
+out:
+	grg_ctx_set_comp_level (gctx, 0);
+	grg_key_free (gctx, key2);
+	free (data);
+	free (data2);
+	free (stone);
+	return (ret < 0) ? ret : rval;
+}
+
+#define REENTRANT_THREADS	4
+
+struct reentrant_job
+{
+	void *stone;
+	long fdim;
+	unsigned char *data;
+	grg_crypt_algo algo;
+	long chunk_size;
+	int ret;
+};
+
+static void *reentrant_worker (void *arg)
+{
+	struct reentrant_job *job = (struct reentrant_job *) arg;
+	struct grg_params params;
+	unsigned char *data2;
+	long ffdim;
+	int i;
+
+	job->ret = KO;
+	for (i = 0; i < 20; i++){
+		data2 = NULL;
+		if (grg_decrypt_mem_r (gctx, key, job->stone, job->fdim, &data2,
+				       &ffdim, &params) < 0)
+			return NULL;
+		if (ffdim != TEST_DIM || memcmp (job->data, data2, TEST_DIM) ||
+		    params.crypt_algo != job->algo ||
+		    params.chunk_size != job->chunk_size){
+			free (data2);
+			return NULL;
+		}
+		free (data2);
+	}
+	job->ret = OK;
+	return NULL;
+}
+
+static int testK()
+{//one context and one key, shared by threads decrypting at once
+	static const grg_crypt_algo algos[REENTRANT_THREADS] =
+		{ GRG_AES, GRG_TWOFISH, GRG_3DES, GRG_RIJNDAEL_256 };
+	struct reentrant_job jobs[REENTRANT_THREADS];
+	pthread_t tids[REENTRANT_THREADS];
+	grg_crypt_algo algo = grg_ctx_get_crypt_algo (gctx);
+	unsigned char *data2 = NULL;
+	long ffdim;
+	int i, ret = GRG_OK, rval = OK;
+
+	memset (jobs, 0, sizeof (jobs));
+	for (i = 0; i < REENTRANT_THREADS; i++){
+		jobs[i].data = grg_rnd_seq (gctx, TEST_DIM);
+		jobs[i].algo = algos[i];
+		jobs[i].chunk_size = (i % 2) ? 1000 : 0;
+		grg_ctx_set_crypt_algo (gctx, algos[i]);
+		grg_ctx_set_chunk_size (gctx, jobs[i].chunk_size);
+		ret = grg_encrypt_mem (gctx, key, &jobs[i].stone, &jobs[i].fdim,
+				       jobs[i].data, TEST_DIM);
+		if (ret < 0)
+			goto out;
+	}
+	grg_ctx_set_crypt_algo (gctx, algo);
+	grg_ctx_set_chunk_size (gctx, 0);
+
+	for (i = 0; i < REENTRANT_THREADS; i++)
+		pthread_create (&tids[i], NULL, reentrant_worker, &jobs[i]);
+	//the settings can be changed meanwhile
+	for (i = 0; i < 1000; i++)
+		grg_ctx_set_comp_ratio (gctx, grg_ctx_get_comp_ratio (gctx));
+	for (i = 0; i < REENTRANT_THREADS; i++){
+		pthread_join (tids[i], NULL);
+		if (jobs[i].ret != OK)
+			rval = KO;
+	}
+
+	//the _r functions leave the context alone...
+	if (grg_ctx_get_crypt_algo (gctx) != algo)
+		rval = KO;
+
+	//...while the others still update it
+	ret = grg_decrypt_mem (gctx, key, jobs[1].stone, jobs[1].fdim, &data2,
+			       &ffdim);
+	if (ret < 0)
+		goto out;
+	if (grg_ctx_get_crypt_algo (gctx) != GRG_TWOFISH ||
+	    grg_ctx_get_chunk_size (gctx) != 1000)
+		rval = KO;
+
+out:
+	grg_ctx_set_crypt_algo (gctx, algo);
+	grg_ctx_set_chunk_size (gctx, 0);
+	for (i = 0; i < REENTRANT_THREADS; i++){
+		free (jobs[i].data);
+		free (jobs[i].stone);
+	}
+	free (data2);
+	return (ret < 0) ? ret : rval;
+}
+
+#define BATCH_FILES	6
+
+static int testJ()
+{//batch validation and decryption, one of the files being damaged
+	char names[BATCH_FILES][20];
+	const char *paths[BATCH_FILES];
+	unsigned char *data[BATCH_FILES];
+	struct grg_file_result results[BATCH_FILES];
+	int rets[BATCH_FILES], fds[BATCH_FILES];
+	int i, fd, ret = GRG_OK, rval = OK;
+
+	memset (data, 0, sizeof (data));
+	memset (results, 0, sizeof (results));
+	for (i = 0; i < BATCH_FILES; i++){
+		strcpy (names[i], "/tmp/___XXXXXX");
+		fd = mkstemp (names[i]);
+		close (fd);
+		paths[i] = names[i];
+		data[i] = grg_rnd_seq (gctx, TEST_DIM);
+		ret = grg_encrypt_file (gctx, key, paths[i], data[i], TEST_DIM);
+		if (ret < 0)
+			goto out;
+	}
+	//spoils the magic of the third file
+	fd = open (paths[2], O_WRONLY);
+	write (fd, "XXX", 3);
+	close (fd);
+
+	grg_ctx_set_threads (gctx, 4);
+	ret = grg_validate_files (gctx, paths, BATCH_FILES, rets);
+	if (ret != GRG_READ_MAGIC_ERR){
+		rval = KO;
+		goto out;
+	}
+	for (i = 0; i < BATCH_FILES; i++)
+		if (rets[i] != ((i == 2) ? GRG_READ_MAGIC_ERR : GRG_OK))
+			rval = KO;
+
+	ret = grg_decrypt_files (gctx, key, paths, BATCH_FILES, results);
+	if (ret != GRG_READ_MAGIC_ERR){
+		rval = KO;
+		goto out;
+	}
+	for (i = 0; i < BATCH_FILES; i++){
+		if (i == 2){
+			if (results[i].ret != GRG_READ_MAGIC_ERR || results[i].data)
+				rval = KO;
+			continue;
+		}
+		if (results[i].ret != GRG_OK || results[i].dim != TEST_DIM ||
+		    memcmp (results[i].data, data[i], TEST_DIM) ||
+		    results[i].params.crypt_algo != grg_ctx_get_crypt_algo (gctx))
+			rval = KO;
+	}
+
+	//the direct versions, on the good files only
+	for (i = 0; i < BATCH_FILES; i++)
+		fds[i] = open (paths[(i == 2) ? 0 : i], O_RDONLY);
+	ret = grg_validate_files_direct (gctx, fds, BATCH_FILES, rets);
+	for (i = 0; i < BATCH_FILES; i++){
+		free (results[i].data);
+		results[i].data = NULL;
+	}
+	if (ret == GRG_OK)
+		ret = grg_decrypt_files_direct (gctx, key, fds, BATCH_FILES,
+						results);
+	for (i = 0; i < BATCH_FILES; i++)
+		close (fds[i]);
+	if (ret == GRG_OK && memcmp (results[2].data, data[0], TEST_DIM))
+		rval = KO;
+
+out:
+	grg_ctx_set_threads (gctx, 1);
+	for (i = 0; i < BATCH_FILES; i++){
+		unlink (names[i]);
+		free (data[i]);
+		free (results[i].data);
+	}
+	return (ret < 0) ? ret : rval;
+}
+
+#define BIG_DIM		(0x100000000L + 65536)	//4 Gb + 64 Kb
+
+static int testX()
+{//data over 4 Gb, through a file: they're mostly zeroes, so that only the
+ //plain data take up memory
+	static const long marks[] = { 0, 0xffffffffL, 0x100000000L, BIG_DIM - 1 };
+	unsigned char *data = (unsigned char *) calloc (1, BIG_DIM), *data2 = NULL;
+	struct grg_params params;
+	char name[] = "/tmp/___XXXXXX";
+	void *stone = NULL;
+	long fdim, ffdim, i;
+	int fd, ret = GRG_MEM_ALLOCATION_ERR, rval = KO;
+
+	if (!data)
+		return ret;
+	for (i = 0; i < 4; i++)
+		data[marks[i]] = (unsigned char) (i + 1);
+
+	grg_ctx_set_comp_algo (gctx, GRG_ZLIB);
+	grg_ctx_set_comp_ratio (gctx, GRG_LVL_FAST);
+	ret = grg_encrypt_mem (gctx, key, &stone, &fdim, data, BIG_DIM);
+	free (data);
+	if (ret < 0)
+		goto out;
+	//too long for a single block: chunked, even if the context isn't
+	if (((unsigned char *) stone)[3] != '5')
+		goto out;
+
+	fd = mkstemp (name);
+	write (fd, stone, fdim);
+	lseek (fd, 0, SEEK_SET);
+	ret = grg_decrypt_file_direct_r (gctx, key, fd, &data2, &ffdim, &params);
+	close (fd);
+	unlink (name);
+	if (ret < 0)
+		goto out;
+
+	//the chunks of an unchunked context read back as no chunk size
+	if (ffdim != BIG_DIM || params.chunk_size != 0)
+		goto out;
+	for (i = 0; i < 4; i++){
+		if (data2[marks[i]] != i + 1)
+			goto out;
+		data2[marks[i]] = 0;
+	}
+	for (i = 0; i < BIG_DIM; i++)
+		if (data2[i])
+			goto out;
+	rval = OK;
+
+out:
+	grg_ctx_set_comp_algo (gctx, GRG_BZIP);
+	grg_ctx_set_comp_ratio (gctx, GRG_LVL_BEST);
+	free (data2);
+	free (stone);
+	return (ret < 0) ? ret : rval;
+}
+
+#define BIG_STREAM_DIM	0x88000000L	//2 Gb + 128 Mb
+#define BIG_STREAM_STEP	(1024 * 1024)
+
+static int checkSink (void *user_data, const unsigned char *data, const long dim)
+{//a GRG_STREAM_SINK that checks the pattern of testBigStream, without keeping it
+	long *pos = (long *) user_data, i;
+
+	for (i = 0; i < dim; i++, (*pos)++)
+		if (data[i] != (unsigned char) *pos)
+			return GRG_READ_COMP_ERR;
+	return GRG_OK;
+}
+
+static int testBigStream()
+{//a stream over 2 Gb, whose length doesn't fit in a signed 32 bits field
+	unsigned char *data = (unsigned char *) malloc (BIG_STREAM_STEP), *data2 = NULL;
+	MEM_SINK enc = {NULL, 0};
+	GRG_STREAM gs;
+	long i, got = 0, ffdim;
+	int ret = GRG_MEM_ALLOCATION_ERR, rval = KO;
+
+	if (!data)
+		return ret;
+	for (i = 0; i < BIG_STREAM_STEP; i++)
+		data[i] = (unsigned char) i;
+
+	grg_ctx_set_comp_algo (gctx, GRG_ZLIB);
+	grg_ctx_set_comp_ratio (gctx, GRG_LVL_FAST);
+	gs = grg_stream_encrypt_init (gctx, key, memSink, &enc);
+	if (!gs)
+		goto out;
+	for (i = 0, ret = GRG_OK; i < BIG_STREAM_DIM && ret == GRG_OK; i += BIG_STREAM_STEP)
+		ret = grg_stream_encrypt_update (gs, data, BIG_STREAM_STEP);
+	if (ret == GRG_OK)
+		ret = grg_stream_encrypt_final (gs);
+	grg_stream_close (gctx, gs);
+	if (ret < 0)
+		goto out;
+
+	ret = grg_decrypted_size (gctx, key, enc.data, enc.dim, &ffdim);
+	if (ret < 0 || ffdim != BIG_STREAM_DIM)
+		goto out;
+
+	gs = grg_stream_decrypt_init (gctx, key, checkSink, &got);
+	if (!gs)
+		goto out;
+	ret = grg_stream_decrypt_update (gs, enc.data, enc.dim);
+	if (ret == GRG_OK)
+		ret = grg_stream_decrypt_final (gs);
+	grg_stream_close (gctx, gs);
+	if (ret < 0 || got != BIG_STREAM_DIM)
+		goto out;
+
+	ret = grg_decrypt_mem (gctx, key, enc.data, enc.dim, &data2, &ffdim);
+	if (ret < 0 || ffdim != BIG_STREAM_DIM)
+		goto out;
+	got = 0;
+	if (checkSink (&got, data2, ffdim) < 0)
+		goto out;
+	rval = OK;
+
+out:
+	grg_ctx_set_comp_algo (gctx, GRG_BZIP);
+	grg_ctx_set_comp_ratio (gctx, GRG_LVL_BEST);
+	free (data);
+	free (data2);
+	free (enc.data);
+	return (ret < 0) ? ret : rval;
+}
+
 int main ()
 {
 	char *version = grg_get_version();
@@ -549,9 +2127,15 @@ int main ()
 
 	printf("  -= Utility functions =-\n\n");
 	doTest("Random number generators", test7);
+	doTest("Buffered random generator", testR);
+	doTest("CRC32 checksums", testU);
 	doTest("grg_free() function", test8);
+	doTest("Allocator hooks and secure arena", testY);
+	doTest("Wipe modes", testS);
 	doTest("Base64 conversions", test6);
+	doTest("Base64 against a plain coder, and incremental", testB64);
 	doTest("File shredding", test9);
+	doTest("Shredding of many files, with progress", testShred);
 	doTest("Password quality test (strings)", testA);
 	doTest("Password quality test (files)", testB);
 	printf("\n");
@@ -562,12 +2146,20 @@ int main ()
 	printf("\n");
 
 	printf("  -= Encryption/decryption =-\n\n");
+	doTest("Native ciphers against libmcrypt", testT);
 	doTest("Data encryption and decryption in memory", testE);
 	doTest("Data format validation in memory", testF);
+	doTest("Key check value, and wrong passwords", testKcv);
+	doTest("Wrong passwords on version 3 data", testV3);
+	doTest("Data decryption in memory, into a given buffer", testP);
+	doTest("Scatter-gather encryption and decryption", testZ);
 	doTest("Data encryption and decryption in files (using file descriptor)", testG);
 	doTest("Data format validation in files (using file descriptor)", testH);
 	doTest("Data encryption and decryption in files (using filename)", testI);
 	doTest("Data format validation in files (using filename)", testL);
+	doTest("Reentrant decryption, by many threads at once", testK);
+	doTest("Batch validation and decryption of files", testJ);
+	doTest("Asynchronous encryption to files", testW);
 	printf("\n");
 
 	printf("  -= Enc/decryption details =-\n\n");
@@ -603,14 +2195,90 @@ int main ()
 	doTest("BZip2 compression", testE);
 	grg_ctx_set_comp_ratio(gctx, GRG_LVL_NONE);
 	doTest("No compression", testE);
+	doTest("Scatter-gather data, no compression", testZ);
+	printf("\n");
+
+	printf("  -= Chunked (version 5) format =-\n\n");
+	grg_ctx_set_comp_ratio(gctx, GRG_LVL_BEST);
+	grg_ctx_set_chunk_size(gctx, 1000);
+	doTest("Chunked encryption and decryption in memory", testE);
+	doTest("Chunked format validation in memory", testF);
+	doTest("Chunked decryption into a given buffer", testP);
+	doTest("Chunked encryption and decryption in files", testG);
+	doTest("Chunked format details", testQ);
+	grg_ctx_set_threads(gctx, 4);
+	doTest("Chunked encryption and decryption in memory, 4 threads", testE);
+	doTest("Chunked decryption into a given buffer, 4 threads", testP);
+	doTest("Chunked scatter-gather data, 4 threads", testZ);
+	grg_ctx_set_comp_algo(gctx, GRG_ZLIB);
+	doTest("Chunked scatter-gather data, ZLib, 4 threads", testZ);
+	doTest("Chunked encryption and decryption in files, 4 threads", testG);
+	doTest("Asynchronous chunked encryption to files, 4 threads", testW);
+	grg_ctx_set_comp_algo(gctx, GRG_BZIP);
+	grg_ctx_set_threads(gctx, 1);
+	grg_ctx_set_chunk_size(gctx, 0);
+	printf("\n");
+
+	printf("  -= Zstd and lz4 (chunked format) =-\n\n");
+	if (grg_comp_algo_supported (GRG_ZSTD)){
+		grg_ctx_set_comp_algo(gctx, GRG_ZSTD);
+		doTest("Zstd compression", testE);
+		doTest("Zstd format details", testV);
+		grg_ctx_set_chunk_size(gctx, 1000);
+		grg_ctx_set_threads(gctx, 4);
+		doTest("Chunked zstd decryption into a given buffer, 4 threads", testP);
+		doTest("Chunked zstd scatter-gather data, 4 threads", testZ);
+		grg_ctx_set_threads(gctx, 1);
+		grg_ctx_set_chunk_size(gctx, 0);
+	} else
+		printf("(zstd not supported)\n");
+	if (grg_comp_algo_supported (GRG_LZ4)){
+		grg_ctx_set_comp_algo(gctx, GRG_LZ4);
+		doTest("Lz4 compression", testE);
+		doTest("Lz4 format details", testV);
+		grg_ctx_set_chunk_size(gctx, 1000);
+		doTest("Chunked lz4 encryption and decryption in files", testG);
+		doTest("Chunked lz4 scatter-gather data", testZ);
+		grg_ctx_set_chunk_size(gctx, 0);
+	} else
+		printf("(lz4 not supported)\n");
+	grg_ctx_set_comp_algo(gctx, GRG_BZIP);
+	printf("\n");
+
+	printf("  -= Large data =-\n\n");
+	//it takes some time, and 4.5 Gb of memory
+	if (getenv ("LIBGRG_TEST_BIG")){
+		doTest("Data over 4 Gb, in files", testX);
+		doTest("A stream over 2 Gb", testBigStream);
+	} else
+		printf("(set LIBGRG_TEST_BIG to test data over 2 and 4 Gb)\n");
+	printf("\n");
+
+	printf("  -= Streaming enc/decryption =-\n\n");
+	grg_ctx_set_comp_ratio(gctx, GRG_LVL_BEST);
+	doTest("Stream encryption and decryption, BZip2", testN);
+	grg_ctx_set_comp_algo(gctx, GRG_ZLIB);
+	doTest("Stream encryption and decryption, ZLib", testN);
+	grg_ctx_set_comp_ratio(gctx, GRG_LVL_NONE);
+	doTest("Stream encryption and decryption, no compression", testN);
+	grg_ctx_set_comp_ratio(gctx, GRG_LVL_FAST);
+	doTest("Stream encryption and decryption between file descriptors", testO);
+	grg_ctx_set_chunk_size(gctx, 1000);
+	doTest("Stream decryption of a chunked file, ZLib", testChunkedStream);
+	grg_ctx_set_comp_algo(gctx, GRG_BZIP);
+	doTest("Stream decryption of a chunked file, BZip2", testChunkedStream);
+	grg_ctx_set_chunk_size(gctx, 0);
 	printf("\n");
 
 	printf("  -= Encrypted Temp Files =-\n\n");
 	doTest("Tmpfile creation", testC);
 	doTest("Tmpfile reading and writing", testD);
+	doTest("Tmpfile appends and random access", testTmp);
 	printf("\n");
 
 	printf("  -= Other tests =-\n\n");
+	doTest("Tracing of the stages", testTrace);
+	doTest("Statistics of the work done", testStats);
 	doTest("Backwards compatibility", testM);
 	printf("\n");
 